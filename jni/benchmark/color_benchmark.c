@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the wprint_color kernels against the per-pixel formulas they replaced, over every RGB
+ * value and every tail length, and the transpose over every block size up to MAX_TRANSPOSE, then
+ * compares rows per second of the vector backend built for this machine with those formulas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "wprint_color.h"
+
+// Same as wprint_color.c, so that the reference cannot round differently
+#pragma STDC FP_CONTRACT OFF
+
+#define ALL_COLORS (1 << 24)
+#define CHUNK_PIXELS 65536
+#define MAX_TAIL 48 // tails of up to three vectors, plus the partial one
+#define ROW_PIXELS 2550 // US Letter at 300 dpi
+#define BENCH_ROWS 20000
+#define MAX_TRANSPOSE 40
+#define TILE_ROWS 32 // as wprint_image transposes rotated pages
+#define BENCH_TILES 2000
+
+#if defined(__ARM_NEON)
+#define BACKEND "neon"
+#elif defined(__SSSE3__)
+#define BACKEND "ssse3"
+#else
+#define BACKEND "scalar"
+#endif
+
+static long long _now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void _ref_sp_gray(const uint8 *src, uint8 *dst, int num_pixels) {
+    int i;
+    for (i = 0; i < num_pixels; i++) {
+        dst[i] = (uint8) SP_GRAY(src[i * 3], src[i * 3 + 1], src[i * 3 + 2]);
+    }
+}
+
+static void _ref_sp_gray_rgb(uint8 *pixels, int num_pixels) {
+    int i;
+    for (i = 0; i < num_pixels; i++) {
+        uint8 *p = pixels + i * 3;
+        p[0] = p[1] = p[2] = (uint8) SP_GRAY(p[0], p[1], p[2]);
+    }
+}
+
+static void _ref_gray(const uint8 *src, uint8 *dst, int num_pixels) {
+    int i;
+    for (i = 0; i < num_pixels; i++) {
+        dst[i] = (uint8) (0.299 * (double) src[i * 3] + 0.587 * (double) src[i * 3 + 1] +
+                0.114 * (double) src[i * 3 + 2]);
+    }
+}
+
+static void _ref_reverse(const uint8 *src, uint8 *dst, int num_pixels, int bytes_per_pixel) {
+    int i;
+    for (i = 0; i < num_pixels; i++) {
+        memcpy(dst + i * bytes_per_pixel, src + (num_pixels - 1 - i) * bytes_per_pixel,
+                bytes_per_pixel);
+    }
+}
+
+static void _ref_transpose(const uint8 *const *src_rows, int num_rows, uint8 *const *dst_rows,
+        int num_cols, bool reverse) {
+    int i, j;
+    for (i = 0; i < num_rows; i++) {
+        for (j = 0; j < num_cols; j++) {
+            memcpy(dst_rows[j] + (reverse ? num_rows - 1 - i : i) * 3, src_rows[i] + j * 3, 3);
+        }
+    }
+}
+
+/*
+ * Transposes every block of up to MAX_TRANSPOSE rows and pixels both ways round. The blocks end
+ * where their rows do, so that the sanitizers see anything read or written past them.
+ */
+static int _check_transpose(void) {
+    uint8 *src[MAX_TRANSPOSE], *out[MAX_TRANSPOSE], *ref[MAX_TRANSPOSE];
+    const uint8 *src_rows[MAX_TRANSPOSE];
+    uint8 *out_rows[MAX_TRANSPOSE], *ref_rows[MAX_TRANSPOSE];
+    int failures = 0, rows, cols, reverse, i;
+
+    for (i = 0; i < MAX_TRANSPOSE; i++) {
+        src[i] = malloc(MAX_TRANSPOSE * 3);
+        out[i] = malloc(MAX_TRANSPOSE * 3);
+        ref[i] = malloc(MAX_TRANSPOSE * 3);
+        if (!src[i] || !out[i] || !ref[i]) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (rows = 0; rows < MAX_TRANSPOSE * 3; rows++) {
+            src[i][rows] = (uint8) rand();
+        }
+    }
+
+    for (rows = 0; rows <= MAX_TRANSPOSE; rows++) {
+        for (cols = 0; cols <= MAX_TRANSPOSE; cols++) {
+            for (reverse = 0; reverse < 2; reverse++) {
+                for (i = 0; i < MAX_TRANSPOSE; i++) {
+                    memset(out[i], 0x5a, MAX_TRANSPOSE * 3);
+                    memset(ref[i], 0x5a, MAX_TRANSPOSE * 3);
+                    src_rows[i] = src[i] + (MAX_TRANSPOSE - cols) * 3;
+                    out_rows[i] = out[i] + (MAX_TRANSPOSE - rows) * 3;
+                    ref_rows[i] = ref[i] + (MAX_TRANSPOSE - rows) * 3;
+                }
+                wprint_transpose_rgb(src_rows, rows, out_rows, cols, reverse);
+                _ref_transpose(src_rows, rows, ref_rows, cols, reverse);
+                for (i = 0; i < MAX_TRANSPOSE; i++) {
+                    failures += (memcmp(out[i], ref[i], MAX_TRANSPOSE * 3) != 0);
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < MAX_TRANSPOSE; i++) {
+        free(src[i]);
+        free(out[i]);
+        free(ref[i]);
+    }
+    return failures;
+}
+
+/*
+ * Returns megabytes per second of transposing BENCH_TILES tiles of TILE_ROWS rows of ROW_PIXELS,
+ * with the kernel or else the reference
+ */
+static double _transpose_megabytes_per_second(bool vector, const uint8 *page, uint8 *out) {
+    const uint8 *src_rows[TILE_ROWS];
+    uint8 *dst_rows[ROW_PIXELS];
+    long long start;
+    int i, tile;
+
+    for (i = 0; i < TILE_ROWS; i++) {
+        src_rows[i] = page + i * ROW_PIXELS * 3;
+    }
+    for (i = 0; i < ROW_PIXELS; i++) {
+        dst_rows[i] = out + i * TILE_ROWS * 3;
+    }
+    start = _now_ns();
+    for (tile = 0; tile < BENCH_TILES; tile++) {
+        if (vector) {
+            wprint_transpose_rgb(src_rows, TILE_ROWS, dst_rows, ROW_PIXELS, tile & 1);
+        } else {
+            _ref_transpose(src_rows, TILE_ROWS, dst_rows, ROW_PIXELS, tile & 1);
+        }
+    }
+    return (double) BENCH_TILES * TILE_ROWS * ROW_PIXELS * 3 * 1e3 / (_now_ns() - start);
+}
+
+/*
+ * Compares every conversion of num_pixels pixels at src with the reference, returning the
+ * number of mismatches
+ */
+static int _check_pixels(const uint8 *src, int num_pixels, uint8 *out, uint8 *ref) {
+    int failures = 0, bpp;
+
+    wprint_rgb_to_sp_gray(src, out, num_pixels);
+    _ref_sp_gray(src, ref, num_pixels);
+    failures += (memcmp(out, ref, num_pixels) != 0);
+
+    memcpy(out, src, num_pixels * 3);
+    wprint_rgb_to_sp_gray(out, out, num_pixels);
+    failures += (memcmp(out, ref, num_pixels) != 0);
+
+    memcpy(out, src, num_pixels * 3);
+    memcpy(ref, src, num_pixels * 3);
+    wprint_rgb_to_sp_gray_rgb(out, num_pixels);
+    _ref_sp_gray_rgb(ref, num_pixels);
+    failures += (memcmp(out, ref, num_pixels * 3) != 0);
+
+    wprint_rgb_to_gray(src, out, num_pixels);
+    _ref_gray(src, ref, num_pixels);
+    failures += (memcmp(out, ref, num_pixels) != 0);
+
+    memcpy(out, src, num_pixels * 3);
+    wprint_rgb_to_gray(out, out, num_pixels);
+    failures += (memcmp(out, ref, num_pixels) != 0);
+
+    for (bpp = 1; bpp <= 4; bpp++) {
+        int count = num_pixels * 3 / bpp;
+        wprint_reverse_pixels(src, out, count, bpp);
+        _ref_reverse(src, ref, count, bpp);
+        failures += (memcmp(out, ref, count * bpp) != 0);
+    }
+    return failures;
+}
+
+/*
+ * Runs every RGB value through the kernels, then every length up to MAX_TAIL pixels
+ */
+static int _check(void) {
+    uint8 *src = malloc(CHUNK_PIXELS * 3), *out = malloc(CHUNK_PIXELS * 3);
+    uint8 *ref = malloc(CHUNK_PIXELS * 3);
+    int failures = 0, color = 0, i, length;
+
+    if (!src || !out || !ref) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    while (color < ALL_COLORS) {
+        for (i = 0; i < CHUNK_PIXELS; i++, color++) {
+            src[i * 3] = (uint8) (color >> 16);
+            src[i * 3 + 1] = (uint8) (color >> 8);
+            src[i * 3 + 2] = (uint8) color;
+        }
+        failures += _check_pixels(src, CHUNK_PIXELS, out, ref);
+    }
+
+    for (i = 0; i < MAX_TAIL * 3; i++) {
+        src[i] = (uint8) rand();
+    }
+    for (length = 0; length <= MAX_TAIL; length++) {
+        failures += _check_pixels(src, length, out, ref);
+    }
+    failures += _check_transpose();
+
+    free(src);
+    free(out);
+    free(ref);
+    return failures;
+}
+
+/*
+ * Returns rows per second of BENCH_ROWS rows through one of the conversions. 0-2 are the
+ * wprint_color kernels, 3-5 the reference formulas, in the order sp_gray, sp_gray_rgb, gray.
+ */
+static double _rows_per_second(int which, const uint8 *page, uint8 *out) {
+    long long start = _now_ns();
+    int row;
+
+    for (row = 0; row < BENCH_ROWS; row++) {
+        const uint8 *src = page + (row % 16) * ROW_PIXELS * 3;
+        switch (which) {
+            case 0:
+                wprint_rgb_to_sp_gray(src, out, ROW_PIXELS);
+                break;
+            case 1:
+                memcpy(out, src, ROW_PIXELS * 3);
+                wprint_rgb_to_sp_gray_rgb(out, ROW_PIXELS);
+                break;
+            case 2:
+                wprint_rgb_to_gray(src, out, ROW_PIXELS);
+                break;
+            case 3:
+                _ref_sp_gray(src, out, ROW_PIXELS);
+                break;
+            case 4:
+                memcpy(out, src, ROW_PIXELS * 3);
+                _ref_sp_gray_rgb(out, ROW_PIXELS);
+                break;
+            default:
+                _ref_gray(src, out, ROW_PIXELS);
+                break;
+        }
+    }
+    return BENCH_ROWS * 1e9 / (_now_ns() - start);
+}
+
+int main(void) {
+    static const char *names[] = {"rgb_to_sp_gray", "rgb_to_sp_gray_rgb", "rgb_to_gray"};
+    uint8 *page = malloc(TILE_ROWS * ROW_PIXELS * 3), *out = malloc(TILE_ROWS * ROW_PIXELS * 3);
+    int failures, i;
+
+    if (!page || !out) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    failures = _check();
+    printf("%s backend: %s\n", BACKEND, failures ? "MISMATCH" : "matches the reference exactly");
+
+    for (i = 0; i < TILE_ROWS * ROW_PIXELS * 3; i++) {
+        page[i] = (uint8) rand();
+    }
+    printf("%d pixel rows     %12s %12s\n", ROW_PIXELS, BACKEND " rows/s", "scalar rows/s");
+    for (i = 0; i < 3; i++) {
+        double vector = _rows_per_second(i, page, out);
+        double scalar = _rows_per_second(i + 3, page, out);
+        printf("%-20s %12.0f %12.0f\n", names[i], vector, scalar);
+    }
+    printf("%d row tiles          %12s %12s\n", TILE_ROWS, BACKEND " MB/s", "scalar MB/s");
+    printf("%-20s %12.0f %12.0f\n", "transpose_rgb", _transpose_megabytes_per_second(true, page, out),
+            _transpose_megabytes_per_second(false, page, out));
+
+    free(page);
+    free(out);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs jobs for several fake printers through lib_wprint's job threads while the first printer
+ * is stalled, once in each of the calls that can block on a real printer: connecting, starting
+ * the job, printing a page and ending the job. Each time, jobs for the other printers are started
+ * and sent pages only after the stall began, and must all finish before it ends. Checks that each
+ * printer prints its jobs one at a time and in the order they were started, and that a job
+ * cancelled while queued behind the stalled one never runs.
+ *
+ * The printers are the IPP port with a print interface that accepts everything and no status
+ * monitor. The print plugin only records when jobs start and end; its pages take a millisecond
+ * or so.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lib_wprint.h"
+#include "ifc_print_job.h"
+#include "ipp_print.h"
+#include "ippstatus_monitor.h"
+
+#define TAG "job_stress"
+
+#define NUM_PRINTERS 6 // printer 0 is the stalled one
+#define OTHER_JOBS 20 // for the other printers while printer 0 is stalled in each call
+#define DIR_JOB_EVERY 4 // every 4th job is a directory sent a page at a time
+#define PAGES_PER_DIR_JOB 3
+#define WAIT_SECONDS 30
+
+// Calls in which printer 0 stalls, one per round
+typedef enum {
+    STALL_INIT,
+    STALL_START_JOB,
+    STALL_PRINT_PAGE,
+    STALL_END_JOB,
+    NUM_STALLS
+} stall_t;
+
+static const char *_stall_names[NUM_STALLS] = {"print_ifc->init", "print_ifc->start_job",
+        "plugin->print_page", "print_ifc->end_job"};
+
+// A stalled job and the other printers' jobs for each round, and one job cancelled while queued
+#define MAX_JOBS (NUM_STALLS * (1 + OTHER_JOBS) + 1)
+
+typedef struct {
+    int printer;
+    wJob_t handle;
+    bool started;
+    bool done;
+    int result;
+} job_t;
+
+// The print interface of one job
+typedef struct {
+    ifc_print_job_t ifc;
+    int printer;
+} fake_print_ifc_t;
+
+static job_t _jobs[MAX_JOBS];
+static int _num_jobs;
+static int _last_started[NUM_PRINTERS];
+static int _running[NUM_PRINTERS];
+static int _printers_running;
+static int _most_printers_running;
+static int _errors;
+static stall_t _stall = NUM_STALLS;
+static bool _stalled;
+static bool _gate_open;
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _changed = PTHREAD_COND_INITIALIZER;
+
+static int _job_index(const wprint_job_params_t *job_params) {
+    int index = atoi(job_params->job_name);
+    return ((index >= 0) && (index < MAX_JOBS)) ? index : 0;
+}
+
+/*
+ * Blocks printer 0 in the call of this round until the gate opens
+ */
+static void _stall_in(int printer, stall_t call) {
+    pthread_mutex_lock(&_lock);
+    if ((printer == 0) && (call == _stall)) {
+        _stalled = true;
+        pthread_cond_broadcast(&_changed);
+        while (!_gate_open) {
+            pthread_cond_wait(&_changed, &_lock);
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+static const char **_get_mime_types(void) {
+    static const char *mime_types[] = {MIME_TYPE_PDF, NULL};
+    return mime_types;
+}
+
+static const char **_get_print_formats(void) {
+    static const char *print_formats[] = {PRINT_FORMAT_PCLM, NULL};
+    return print_formats;
+}
+
+static status_t _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc,
+        const ifc_print_job_t *job_ifc, wprint_job_params_t *job_params) {
+    job_t *job = &_jobs[_job_index(job_params)];
+
+    pthread_mutex_lock(&_lock);
+    job->handle = job_handle;
+    job->started = true;
+    if (_job_index(job_params) <= _last_started[job->printer]) {
+        fprintf(stderr, "job %d started after job %d of printer %d\n", _job_index(job_params),
+                _last_started[job->printer], job->printer);
+        _errors++;
+    }
+    _last_started[job->printer] = _job_index(job_params);
+    if (_running[job->printer]++ > 0) {
+        fprintf(stderr, "printer %d is running two jobs\n", job->printer);
+        _errors++;
+    } else {
+        _printers_running++;
+        _most_printers_running = MAX(_most_printers_running, _printers_running);
+    }
+    pthread_mutex_unlock(&_lock);
+    return OK;
+}
+
+static status_t _print_page(wprint_job_params_t *job_params, const char *mime_type,
+        const char *pathname) {
+    _stall_in(_jobs[_job_index(job_params)].printer, STALL_PRINT_PAGE);
+    usleep(500 + rand() % 1000);
+    return OK;
+}
+
+static status_t _end_job(wprint_job_params_t *job_params) {
+    job_t *job = &_jobs[_job_index(job_params)];
+
+    pthread_mutex_lock(&_lock);
+    if (--_running[job->printer] == 0) {
+        _printers_running--;
+    }
+    pthread_mutex_unlock(&_lock);
+    return OK;
+}
+
+wprint_plugin_t *libwprintplugin_pcl_reg(void) {
+    static const wprint_plugin_t _fake_plugin = {.version = WPRINT_PLUGIN_VERSION(0),
+            .priority = PRIORITY_LOCAL, .get_mime_types = _get_mime_types,
+            .get_print_formats = _get_print_formats, .start_job = _start_job,
+            .print_page = _print_page, .print_blank_page = NULL, .end_job = _end_job};
+    return (wprint_plugin_t *) &_fake_plugin;
+}
+
+wprint_plugin_t *libwprintplugin_pdf_reg(void) {
+    return NULL;
+}
+
+static status_t _fake_init(const ifc_print_job_t *this_p, const char *printer_address,
+        int port, const char *printer_uri, bool use_secure_uri) {
+    fake_print_ifc_t *fake = (fake_print_ifc_t *) this_p;
+    fake->printer = atoi(printer_address + strlen("printer"));
+    _stall_in(fake->printer, STALL_INIT);
+    return OK;
+}
+
+static status_t _fake_start_job(const ifc_print_job_t *this_p,
+        const wprint_job_params_t *job_params) {
+    _stall_in(((const fake_print_ifc_t *) this_p)->printer, STALL_START_JOB);
+    return OK;
+}
+
+static int _fake_send_data(const ifc_print_job_t *this_p, const char *buffer,
+        size_t bufferLength) {
+    return (int) bufferLength;
+}
+
+static status_t _fake_end_job(const ifc_print_job_t *this_p) {
+    _stall_in(((const fake_print_ifc_t *) this_p)->printer, STALL_END_JOB);
+    return OK;
+}
+
+static void _fake_destroy(const ifc_print_job_t *this_p) {
+    free((void *) this_p);
+}
+
+const ifc_print_job_t *ipp_get_print_ifc(const ifc_wprint_t *wprint_ifc) {
+    fake_print_ifc_t *fake = (fake_print_ifc_t *) calloc(1, sizeof(fake_print_ifc_t));
+    if (fake != NULL) {
+        fake->ifc.init = _fake_init;
+        fake->ifc.start_job = _fake_start_job;
+        fake->ifc.send_data = _fake_send_data;
+        fake->ifc.end_job = _fake_end_job;
+        fake->ifc.destroy = _fake_destroy;
+    }
+    return (const ifc_print_job_t *) fake;
+}
+
+const ifc_status_monitor_t *ipp_status_get_monitor_ifc(const ifc_wprint_t *wprint_ifc) {
+    return NULL;
+}
+
+static void _job_callback(wJob_t job_handle, void *param) {
+    wprint_job_callback_params_t *cb_param = (wprint_job_callback_params_t *) param;
+    int i;
+
+    if (cb_param->state != JOB_DONE) {
+        return;
+    }
+    pthread_mutex_lock(&_lock);
+    for (i = 0; i < _num_jobs; i++) {
+        if (_jobs[i].handle == job_handle) {
+            _jobs[i].done = true;
+            _jobs[i].result = cb_param->job_done_result;
+        }
+    }
+    pthread_cond_broadcast(&_changed);
+    pthread_mutex_unlock(&_lock);
+}
+
+/*
+ * Waits for the jobs of the printers from first_printer on to finish, or for the stall to begin
+ * if stall is set, returning false on timeout
+ */
+static bool _wait_for(int first_printer, bool stall) {
+    struct timespec deadline;
+    bool waiting = true;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += WAIT_SECONDS;
+
+    pthread_mutex_lock(&_lock);
+    while (waiting) {
+        waiting = stall && !_stalled;
+        for (i = 0; !stall && (i < _num_jobs); i++) {
+            waiting |= ((_jobs[i].printer >= first_printer) && !_jobs[i].done);
+        }
+        if (waiting && (pthread_cond_timedwait(&_changed, &_lock, &deadline) == ETIMEDOUT)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+    return !waiting;
+}
+
+/*
+ * Starts a job for printer, returning its index, or -1
+ */
+static int _start(int printer, const char *page, const char *dir) {
+    printer_capabilities_t printer_cap;
+    wprint_job_params_t job_params;
+    char printer_addr[32];
+    bool is_dir = ((_num_jobs % DIR_JOB_EVERY) == DIR_JOB_EVERY - 1);
+    int index = _num_jobs, p;
+    wJob_t handle;
+
+    memset(&printer_cap, 0, sizeof(printer_cap));
+    printer_cap.canPrintPCLm = true;
+    pthread_mutex_lock(&_lock);
+    _jobs[index].printer = printer;
+    _num_jobs++;
+    pthread_mutex_unlock(&_lock);
+
+    snprintf(printer_addr, sizeof(printer_addr), "printer%d", printer);
+    wprintGetDefaultJobParams(&job_params);
+    snprintf(job_params.job_name, sizeof(job_params.job_name), "%d", index);
+
+    // A job may finish before this returns, which is why start_job records the handle too
+    handle = wprintStartJob(printer_addr, 631, &job_params, &printer_cap, MIME_TYPE_PDF,
+            is_dir ? dir : page, _job_callback, NULL, "ipp://");
+    if (handle == WPRINT_BAD_JOB_HANDLE) {
+        fprintf(stderr, "job %d did not start\n", index);
+        return -1;
+    }
+    pthread_mutex_lock(&_lock);
+    _jobs[index].handle = handle;
+    pthread_mutex_unlock(&_lock);
+    for (p = 0; is_dir && (p < PAGES_PER_DIR_JOB); p++) {
+        if (wprintPage(handle, p + 1, page, p == PAGES_PER_DIR_JOB - 1, false, 0, 0, 0, 0) !=
+                OK) {
+            fprintf(stderr, "job %d did not take page %d\n", index, p + 1);
+            _errors++;
+        }
+    }
+    return index;
+}
+
+static void _timed_out(int sig) {
+    static const char message[] = "timed out: a call made while printer 0 was stalled waited "
+            "behind it\n";
+    write(STDERR_FILENO, message, sizeof(message) - 1);
+    _exit(1);
+}
+
+static double _now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(void) {
+    char dir[] = "/tmp/job_stressXXXXXX";
+    char page[sizeof(dir) + 8];
+    double start, slowest = 0.0;
+    int i, p, stalled_job, cancelled_job = -1;
+    stall_t stall;
+    FILE *file;
+
+    if ((mkdtemp(dir) == NULL) || (snprintf(page, sizeof(page), "%s/page", dir) < 0) ||
+            ((file = fopen(page, "w")) == NULL)) {
+        fprintf(stderr, "cannot create %s\n", dir);
+        return 1;
+    }
+    fputs("page", file);
+    fclose(file);
+
+    if (wprintInit() < 0) {
+        fprintf(stderr, "wprintInit failed\n");
+        return 1;
+    }
+    for (p = 0; p < NUM_PRINTERS; p++) {
+        _last_started[p] = -1;
+    }
+
+    // Calls that wait behind the stalled printer may never return, so give up on the process
+    signal(SIGALRM, _timed_out);
+
+    for (stall = 0; stall < NUM_STALLS; stall++) {
+        pthread_mutex_lock(&_lock);
+        _stall = stall;
+        _stalled = false;
+        _gate_open = false;
+        pthread_mutex_unlock(&_lock);
+
+        alarm(WAIT_SECONDS);
+        if (((stalled_job = _start(0, page, dir)) < 0) || !_wait_for(0, true)) {
+            fprintf(stderr, "printer 0 did not stall in %s\n", _stall_names[stall]);
+            return 1;
+        }
+        if ((stall == 0) && ((cancelled_job = _start(0, page, dir)) < 0)) {
+            return 1;
+        }
+
+        start = _now_seconds();
+        for (i = 0; i < OTHER_JOBS; i++) {
+            if (_start(1 + (i % (NUM_PRINTERS - 1)), page, dir) < 0) {
+                return 1;
+            }
+        }
+        if (stall == 0) {
+            wprintCancelJob(_jobs[cancelled_job].handle);
+        }
+        if (!_wait_for(1, false)) {
+            fprintf(stderr, "jobs for other printers waited behind printer 0 stalled in %s\n",
+                    _stall_names[stall]);
+            return 1;
+        }
+        slowest = MAX(slowest, _now_seconds() - start);
+
+        pthread_mutex_lock(&_lock);
+        if (_jobs[stalled_job].done) {
+            fprintf(stderr, "the job stalled in %s finished\n", _stall_names[stall]);
+            _errors++;
+        }
+        _gate_open = true;
+        pthread_cond_broadcast(&_changed);
+        pthread_mutex_unlock(&_lock);
+        if (!_wait_for(0, false)) {
+            fprintf(stderr, "the job stalled in %s did not finish\n", _stall_names[stall]);
+            return 1;
+        }
+        alarm(0);
+    }
+
+    for (i = 0; i < _num_jobs; i++) {
+        int expected = (i == cancelled_job) ? CANCELLED : OK;
+        if ((_jobs[i].result != expected) || (_jobs[i].started == (i == cancelled_job))) {
+            fprintf(stderr, "job %d ended with %d\n", i, _jobs[i].result);
+            _errors++;
+        }
+        wprintEndJob(_jobs[i].handle);
+    }
+    wprintExit();
+    unlink(page);
+    rmdir(dir);
+
+    printf("%d jobs for %d printers, one stalled in each of %d calls: %s\n", _num_jobs,
+            NUM_PRINTERS, NUM_STALLS, _errors ? "FAILED" : "ok");
+    printf("others finished within %.2f s while stalled, at most %d printers printing at once\n",
+            slowest, _most_printers_running);
+    return _errors ? 1 : 0;
+}
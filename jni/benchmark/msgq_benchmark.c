@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compares the locking and MSG_Q_SPSC message queues between two threads: how many messages a
+ * second get through a queue as deep as plugin_pcl's, and how long a receiver blocked on an empty
+ * queue takes to wake up once a message is sent.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "wprint_msgq.h"
+
+#define QUEUE_DEPTH 6
+#define MSG_LENGTH 96 // about the size of plugin_pcl's messages
+#define LATENCY_SAMPLES 2000
+#define LATENCY_GAP_US 200 // long enough for the receiver to go to sleep
+
+typedef struct {
+    long long sent_ns;
+    char payload[MSG_LENGTH - sizeof(long long)];
+} bench_msg_t;
+
+typedef struct {
+    msg_q_id msgQ;
+    long count;
+    long long *latency_ns;
+} receiver_args_t;
+
+static long long _now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void *_drain(void *param) {
+    receiver_args_t *args = (receiver_args_t *) param;
+    bench_msg_t msg;
+    long i;
+
+    for (i = 0; i < args->count; i++) {
+        if (msgQReceive(args->msgQ, (char *) &msg, sizeof(msg), WAIT_FOREVER) != OK) break;
+        if (args->latency_ns != NULL) {
+            args->latency_ns[i] = _now_ns() - msg.sent_ns;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Sends count messages as fast as the queue takes them, returning messages per second
+ */
+static double _throughput(int options, long count) {
+    receiver_args_t args = {msgQCreate(QUEUE_DEPTH, sizeof(bench_msg_t), options), count, NULL};
+    bench_msg_t msg;
+    pthread_t tid;
+    long long start;
+    long i;
+
+    memset(&msg, 0, sizeof(msg));
+    start = _now_ns();
+    pthread_create(&tid, NULL, _drain, &args);
+    for (i = 0; i < count; i++) {
+        msg.sent_ns = i;
+        msgQSend(args.msgQ, (const char *) &msg, sizeof(msg), WAIT_FOREVER, MSG_Q_FIFO);
+    }
+    pthread_join(tid, NULL);
+    start = _now_ns() - start;
+    msgQDelete(args.msgQ);
+    return count * 1e9 / start;
+}
+
+static int _compare(const void *a, const void *b) {
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Sends one message at a time to a sleeping receiver, storing the median and 99th percentile
+ * times from send to receive
+ */
+static void _latency(int options, double *median_us, double *p99_us) {
+    long long *latency_ns = calloc(LATENCY_SAMPLES, sizeof(long long));
+    receiver_args_t args = {msgQCreate(QUEUE_DEPTH, sizeof(bench_msg_t), options),
+            LATENCY_SAMPLES, latency_ns};
+    bench_msg_t msg;
+    pthread_t tid;
+    int i;
+
+    memset(&msg, 0, sizeof(msg));
+    pthread_create(&tid, NULL, _drain, &args);
+    for (i = 0; i < LATENCY_SAMPLES; i++) {
+        usleep(LATENCY_GAP_US);
+        msg.sent_ns = _now_ns();
+        msgQSend(args.msgQ, (const char *) &msg, sizeof(msg), NO_WAIT, MSG_Q_FIFO);
+    }
+    pthread_join(tid, NULL);
+    msgQDelete(args.msgQ);
+
+    qsort(latency_ns, LATENCY_SAMPLES, sizeof(long long), _compare);
+    *median_us = latency_ns[LATENCY_SAMPLES / 2] / 1000.0;
+    *p99_us = latency_ns[LATENCY_SAMPLES * 99 / 100] / 1000.0;
+    free(latency_ns);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        const char *name;
+        int options;
+    } kinds[] = {{"locked", MSG_Q_FIFO}, {"spsc", MSG_Q_SPSC}};
+    long count = (argc > 1) ? atol(argv[1]) : 2000000;
+    double median_us, p99_us;
+    unsigned int i;
+
+    if (count <= 0) {
+        fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%ld messages of %zu bytes through a queue of %d, %ld cpus\n", count,
+            sizeof(bench_msg_t), QUEUE_DEPTH, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %12s %14s %11s\n", "queue", "msgs/s", "wakeup median", "wakeup p99");
+    for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        double rate = _throughput(kinds[i].options, count);
+        _latency(kinds[i].options, &median_us, &p99_us);
+        printf("%-8s %12.0f %11.1f us %8.1f us\n", kinds[i].name, rate, median_us, p99_us);
+    }
+    return 0;
+}
@@ -0,0 +1,695 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Feeds synthetic RGB pages through the same decode, scale, rotate and encode steps that
+ * plugin_pcl uses, writing the job to a PORT_FILE sink, and reports throughput and peak memory
+ * for each output format and kind of page. Stages run one after another on one thread so their
+ * times can be told apart. With -L it compares landscape pages, which are rotated, with portrait
+ * ones at 300 and 600 dpi.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ifc_print_job.h"
+#include "lib_pcl.h"
+#include "wprint_image.h"
+#include "wprint_arena.h"
+#include "wprint_msgq.h"
+
+#define TAG "raster_benchmark"
+
+#define MEGABYTE (1024.0 * 1024.0)
+
+// The resolution the source size is given for; -L scales it to each resolution it compares
+#define SOURCE_DPI 300
+
+/*
+ * Kinds of synthetic page
+ */
+typedef enum {
+    PAGE_TEXT,
+    PAGE_PHOTO,
+    PAGE_BLANK,
+
+    PAGE_KIND_COUNT
+} page_kind_t;
+
+static const char *_page_kind_names[PAGE_KIND_COUNT] = {"text", "photo", "blank"};
+
+/*
+ * Time spent in each stage, in milliseconds
+ */
+typedef struct {
+    double decode_ms;
+    double scale_ms; // scaling and rotation, excluding decode
+    double encode_ms;
+} stage_times_t;
+
+/*
+ * Benchmark settings
+ */
+typedef struct {
+    const char *output_path;
+    int num_pages;
+    int source_width;
+    int source_height;
+    int resolution;
+    wprint_rotation_t rotation;
+    scaler_filter_t scale_filter;
+    int memory_budget;
+    int compression_threads;
+    bool use_arena;
+    bool compare_orientations;
+} bench_params_t;
+
+static struct {
+    page_kind_t kind;
+    int width;
+    int height;
+    unsigned char *row;
+    unsigned char *page; // the whole page, once a rotated page has been rendered
+    unsigned long bytes_decoded;
+    double decode_ms;
+    int rows_cached;
+} _source;
+
+static unsigned long _bytes_sent;
+static const ifc_print_job_t *_sink;
+
+static double _now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/*
+ * Returns a repeatable pseudo-random value for a position on the page
+ */
+static unsigned int _hash(unsigned int x, unsigned int y) {
+    unsigned int h = x * 0x9e3779b1u ^ y * 0x85ebca77u;
+    h ^= h >> 15;
+    h *= 0xc2b2ae3du;
+    return h ^ (h >> 13);
+}
+
+/*
+ * Fills row with columns first_col to end_col - 1 of lines of black glyph-sized runs on white,
+ * like a page of text
+ */
+static void _text_row(unsigned char *row, int width, int y, int first_col, int end_col) {
+    int line = y / 50, line_row = y % 50;
+    int x;
+
+    memset(row, 0xff, (end_col - first_col) * 3);
+    if ((line_row < 10) || (line_row >= 34) || (y < 150) || (y >= _source.height - 150)) {
+        return;
+    }
+    for (x = 150 + MAX(first_col - 170, 0) / 20 * 20; (x < width - 150) && (x < end_col);
+            x += 20) {
+        unsigned int glyph = _hash(x / 20, line);
+        // a word gap now and then, and a few strokes per glyph
+        if ((glyph & 7) == 0) {
+            continue;
+        }
+        int stroke = (glyph >> 3) % 14, length = 2 + (glyph >> 8) % 4;
+        int start = MAX(x + stroke, first_col), end = MIN(x + stroke + length, end_col);
+        if ((((line_row + (glyph >> 12)) % 6) < 3) && (start < end)) {
+            memset(row + (start - first_col) * 3, 0, (end - start) * 3);
+        }
+    }
+}
+
+/*
+ * Fills row with columns first_col to end_col - 1 of smooth colour gradients and grain, like a
+ * photo
+ */
+static void _photo_row(unsigned char *row, int width, int y, int first_col, int end_col) {
+    int x;
+    for (x = first_col; x < end_col; x++, row += 3) {
+        unsigned int grain = _hash(x, y) & 15;
+        row[0] = (unsigned char) ((x * 255 / width + grain) & 0xff);
+        row[1] = (unsigned char) ((y * 255 / _source.height + grain) & 0xff);
+        row[2] = (unsigned char) (((x + y) * 127 / (width + _source.height) + 64 + grain)
+                & 0xff);
+    }
+}
+
+static void _synthetic_init(wprint_image_info_t *image_info) {
+}
+
+static status_t _synthetic_get_hdr(wprint_image_info_t *image_info) {
+    image_info->width = _source.width;
+    image_info->height = _source.height;
+    image_info->num_components = 3;
+    return OK;
+}
+
+/*
+ * Fills row with num_cols columns of source row y of the current kind of page, from first_col
+ */
+static void _synthetic_fill_cols(unsigned char *row, int y, int first_col, int num_cols) {
+    double start = _now_ms();
+
+    if (_source.kind == PAGE_TEXT) {
+        _text_row(row, _source.width, y, first_col, first_col + num_cols);
+    } else if (_source.kind == PAGE_PHOTO) {
+        _photo_row(row, _source.width, y, first_col, first_col + num_cols);
+    } else {
+        memset(row, 0xff, num_cols * 3);
+    }
+    _source.decode_ms += _now_ms() - start;
+    _source.bytes_decoded += BYTES_PER_PIXEL(num_cols);
+}
+
+static unsigned char *_synthetic_decode_row(wprint_image_info_t *image_info, int row) {
+    if ((row < 0) || (row >= _source.height)) {
+        return NULL;
+    }
+    // like the real decoders, size the row caches on the first row
+    if ((image_info->swath_start == -1) && (wprint_image_compute_rows_to_cache(image_info) < 0)) {
+        return NULL;
+    }
+    image_info->swath_start = row;
+
+    _synthetic_fill_cols(_source.row, row, 0, _source.width);
+    return _source.row;
+}
+
+/*
+ * Renders a rotated page whole on first use, as wprint_mupdf does when the page fits the memory
+ * budget, so that its rows are made once rather than once for every swath
+ */
+static unsigned char *_synthetic_peek_row(wprint_image_info_t *image_info, int row) {
+    size_t row_bytes = BYTES_PER_PIXEL(_source.width);
+    int y;
+
+    if ((row < 0) || (row >= _source.height) ||
+            (row_bytes * _source.height > (size_t) image_info->memory_budget)) {
+        return NULL;
+    }
+    if (_source.page == NULL) {
+        _source.page = wprint_arena_alloc(image_info->arena, row_bytes * _source.height);
+        if (_source.page == NULL) {
+            return NULL;
+        }
+        for (y = 0; y < _source.height; y++) {
+            _synthetic_fill_cols(_source.page + row_bytes * y, y, 0, _source.width);
+        }
+    }
+    return _source.page + row_bytes * row;
+}
+
+/*
+ * Makes only the columns asked for, as wprint_mupdf renders only a swath's columns of a rotated
+ * page too large for the memory budget
+ */
+static unsigned char *_synthetic_decode_cols(wprint_image_info_t *image_info, int row,
+        int first_col, int num_cols) {
+    if ((row < 0) || (row >= _source.height) || (first_col < 0) ||
+            (first_col + num_cols > _source.width)) {
+        return NULL;
+    }
+    _synthetic_fill_cols(_source.row, row, first_col, num_cols);
+    return _source.row;
+}
+
+static status_t _synthetic_cleanup(wprint_image_info_t *image_info) {
+    wprint_arena_free(image_info->arena, _source.page);
+    _source.page = NULL;
+    return OK;
+}
+
+static status_t _synthetic_supports_subsampling(wprint_image_info_t *image_info) {
+    return ERROR;
+}
+
+static int _synthetic_native_units(wprint_image_info_t *image_info) {
+    return image_info->pdf_render_resolution;
+}
+
+static const image_decode_ifc_t _synthetic_decode_ifc = {&_synthetic_init, &_synthetic_get_hdr,
+        &_synthetic_decode_row, &_synthetic_cleanup, &_synthetic_supports_subsampling,
+        &_synthetic_native_units, &_synthetic_peek_row, &_synthetic_decode_cols,};
+
+static const ifc_wprint_debug_stream_t *_get_debug_stream_ifc(wJob_t id) {
+    return NULL;
+}
+
+static const ifc_wprint_t _wprint_ifc = {.msgQCreate = msgQCreate, .msgQDelete = msgQDelete,
+        .msgQSend = msgQSend, .msgQReceive = msgQReceive, .msgQNumMsgs = msgQNumMsgs,
+        .get_debug_stream_ifc = _get_debug_stream_ifc,};
+
+/*
+ * Counts what the encoders write before passing it to the file sink
+ */
+static int _counting_send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
+    _bytes_sent += length;
+    return _sink->send_data(_sink, buffer, length);
+}
+
+static int _counting_send_datav(const ifc_print_job_t *this_p, const struct iovec *iov,
+        int iovcnt) {
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        _bytes_sent += iov[i].iov_len;
+    }
+    return _sink->send_datav(_sink, iov, iovcnt);
+}
+
+static ifc_print_job_t _counting_ifc;
+
+/*
+ * Resets the peak resident set size so the next run reports its own. Returns false where the
+ * kernel does not support it.
+ */
+static bool _reset_peak_rss(void) {
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+    bool reset;
+
+    if (clear_refs == NULL) {
+        return false;
+    }
+    reset = (fputs("5", clear_refs) >= 0);
+    return (fclose(clear_refs) == 0) && reset;
+}
+
+/*
+ * Returns the peak resident set size in kB, or 0 if unknown
+ */
+static long _peak_rss_kb(void) {
+    char line[128];
+    long peak = 0;
+    FILE *status = fopen("/proc/self/status", "r");
+
+    if (status == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &peak) == 1) {
+            break;
+        }
+    }
+    fclose(status);
+    return peak;
+}
+
+/*
+ * Sends one synthetic page of the current kind through the pipeline
+ */
+static status_t _print_page(const bench_params_t *params, const ifc_pcl_t *pcl_ifc,
+        pcl_job_info_t *job_info, wprint_arena_t *arena, int num_buffs, int page_num,
+        stage_times_t *times, unsigned long *raster_bytes) {
+    wprint_image_info_t image_info;
+    unsigned char *buff_pool[MAX_STRIPE_BUFFERS];
+    int i, buff_size, bytes_per_row, num_rows, image_row = 0, buff_index = 0;
+    int printable_width = (int) (8.5 * params->resolution);
+    int printable_height = 11 * params->resolution;
+    status_t result = OK;
+    double start;
+
+    wprint_arena_next_page(arena);
+    wprint_image_setup(&image_info, MIME_TYPE_PDF, &_wprint_ifc, params->resolution,
+            params->resolution, params->scale_filter, params->memory_budget, arena);
+    image_info.decode_ifc = &_synthetic_decode_ifc;
+    if (wprint_image_get_info(NULL, &image_info) != OK) {
+        return ERROR;
+    }
+    wprint_image_set_output_properties(&image_info, params->rotation, printable_width,
+            printable_height, 0, 0, 0, 0, AUTO_FIT_RENDER_FLAGS, job_info->strip_height,
+            num_buffs, PAD_ALL);
+
+    buff_size = wprint_image_get_output_buff_size(&image_info);
+    for (i = 0; i < num_buffs; i++) {
+        buff_pool[i] = wprint_arena_alloc(arena, buff_size);
+        if (buff_pool[i] == NULL) {
+            result = ERROR;
+        }
+    }
+
+    bytes_per_row = BYTES_PER_PIXEL(wprint_image_get_width(&image_info));
+    num_rows = wprint_image_get_height(&image_info);
+    job_info->num_components = image_info.num_components;
+
+    start = _now_ms();
+    pcl_ifc->start_page(job_info, wprint_image_get_width(&image_info), num_rows);
+    times->encode_ms += _now_ms() - start;
+
+    while ((result == OK) && (num_rows > 0)) {
+        unsigned char *buff = buff_pool[buff_index];
+        int height = MIN(num_rows, job_info->strip_height);
+        int nbytes;
+
+        buff_index = (buff_index + 1) % num_buffs;
+        if (wprint_image_is_blank_stripe(&image_info, image_row, height)) {
+            nbytes = height * bytes_per_row;
+            buff = NULL;
+        } else {
+            _source.decode_ms = 0;
+            start = _now_ms();
+            nbytes = wprint_image_decode_stripe(&image_info, image_row, &height, buff);
+            times->scale_ms += _now_ms() - start - _source.decode_ms;
+            times->decode_ms += _source.decode_ms;
+        }
+        if (nbytes <= 0) {
+            result = ERROR;
+            break;
+        }
+
+        start = _now_ms();
+        pcl_ifc->print_swath(job_info, (char *) buff, image_row, height, bytes_per_row);
+        times->encode_ms += _now_ms() - start;
+
+        *raster_bytes += height * bytes_per_row;
+        image_row += height;
+        num_rows -= height;
+    }
+
+    start = _now_ms();
+    pcl_ifc->end_page(job_info, page_num);
+    times->encode_ms += _now_ms() - start;
+
+    if (image_info.rows_cached > _source.rows_cached) {
+        _source.rows_cached = image_info.rows_cached;
+    }
+    wprint_image_cleanup(&image_info);
+    for (i = 0; i < num_buffs; i++) {
+        wprint_arena_free(arena, buff_pool[i]);
+    }
+    return result;
+}
+
+/*
+ * Prints a job of num_pages pages of one kind in one format and reports how it went, returning
+ * the pages printed per second in pages_per_second
+ */
+static status_t _run(const bench_params_t *params, pcl_t pcl_type, page_kind_t kind,
+        double *pages_per_second) {
+    ifc_pcl_t *pcl_ifc = (pcl_type == PCLm) ? pclm_connect() : pwg_connect();
+    pcl_job_info_t job_info;
+    wprint_arena_t *arena = NULL;
+    stage_times_t times = {0};
+    unsigned long raster_bytes = 0;
+    unsigned int strip_height = STRIPE_HEIGHT;
+    int num_buffs;
+    double start, total_ms, raster_mb;
+    bool rss_reset;
+    status_t result = OK;
+    int page;
+
+    *pages_per_second = 0.0;
+    if (pcl_ifc == NULL) {
+        fprintf(stderr, "no %s encoder\n", (pcl_type == PCLm) ? "PCLm" : "PWG");
+        return ERROR;
+    }
+    _sink = printer_connect(PORT_FILE);
+    if ((_sink == NULL) ||
+            (_sink->init(_sink, params->output_path, PORT_FILE, NULL, false) != OK)) {
+        fprintf(stderr, "cannot open %s\n", params->output_path);
+        if (_sink != NULL) {
+            _sink->destroy(_sink);
+        }
+        return ERROR;
+    }
+    memcpy(&_counting_ifc, _sink, sizeof(ifc_print_job_t));
+    _counting_ifc.send_data = _counting_send_data;
+    _counting_ifc.send_datav = _counting_send_datav;
+    _bytes_sent = 0;
+
+    _source.kind = kind;
+    _source.width = params->source_width;
+    _source.height = params->source_height;
+    _source.bytes_decoded = 0;
+    _source.rows_cached = 0;
+    _source.row = malloc(BYTES_PER_PIXEL(_source.width));
+    if (_source.row == NULL) {
+        _sink->destroy(_sink);
+        return ERROR;
+    }
+
+    memset(&job_info, 0, sizeof(job_info));
+    job_info.job_handle = 1;
+    job_info.print_ifc = &_counting_ifc;
+    job_info.wprint_ifc = &_wprint_ifc;
+    // sized as plugin_pcl does, keeping PCLm at the usual printer strip height
+    wprint_image_plan_stripes(params->memory_budget,
+            BYTES_PER_PIXEL((int) (8.5 * params->resolution)), (pcl_type == PCLm),
+            &strip_height, &num_buffs);
+    job_info.strip_height = (int) strip_height;
+    job_info.memory_budget = params->memory_budget;
+    job_info.compression_threads = params->compression_threads;
+    job_info.useragent = TAG;
+
+    rss_reset = _reset_peak_rss();
+    start = _now_ms();
+    if (params->use_arena) {
+        arena = wprint_arena_create();
+    }
+    pcl_ifc->start_job(job_info.job_handle, &job_info, US_LETTER, MEDIA_PLAIN, params->resolution,
+            DUPLEX_MODE_NONE, DUPLEX_DRY_TIME_NORMAL, COLOR_SPACE_COLOR, TRAY_SRC_AUTO_SELECT, 0,
+            0);
+    for (page = 1; (page <= params->num_pages) && (result == OK); page++) {
+        result = _print_page(params, pcl_ifc, &job_info, arena, num_buffs, page, &times,
+                &raster_bytes);
+    }
+    pcl_ifc->end_job(&job_info);
+    wprint_arena_destroy(arena);
+    total_ms = _now_ms() - start;
+
+    _sink->end_job(_sink);
+    _sink->destroy(_sink);
+    free(_source.row);
+
+    raster_mb = raster_bytes / MEGABYTE;
+    *pages_per_second = (page - 1) * 1000.0 / total_ms;
+    printf("%-5s %-5s %5d %4ux%-2d %5d %8.2f %10.1f %10.1f %10.1f %10.1f %8.1f ",
+            (pcl_type == PCLm) ? "pclm" : "pwg", _page_kind_names[kind], page - 1, strip_height,
+            num_buffs, _source.rows_cached, *pages_per_second,
+            raster_mb * 1000.0 / total_ms,
+            (times.decode_ms > 0) ? _source.bytes_decoded / MEGABYTE * 1000.0 / times.decode_ms
+                    : 0.0,
+            (times.scale_ms > 0) ? raster_mb * 1000.0 / times.scale_ms : 0.0,
+            (times.encode_ms > 0) ? raster_mb * 1000.0 / times.encode_ms : 0.0,
+            _bytes_sent / MEGABYTE);
+    if (rss_reset) {
+        printf("%9.1f\n", _peak_rss_kb() / 1024.0);
+    } else {
+        printf("%9s\n", "-");
+    }
+    return result;
+}
+
+/*
+ * Prints the settings of a table of runs and its column headings
+ */
+static void _print_header(const bench_params_t *params) {
+    int degrees = (params->rotation == ROT_90) ? 90 : (params->rotation == ROT_180) ? 180 :
+            (params->rotation == ROT_270) ? 270 : 0;
+
+    printf("%dx%d pages fitted to US Letter at %d dpi, rotation %d, scale quality %d, "
+            "memory budget %d kB, page buffers from the %s\n", params->source_width,
+            params->source_height, params->resolution, degrees, params->scale_filter,
+            params->memory_budget / 1024, params->use_arena ? "arena" : "heap");
+    printf("%-5s %-5s %5s %7s %5s %8s %10s %10s %10s %10s %8s %9s\n", "fmt", "kind", "pages",
+            "stripes", "cache", "pages/s", "total MB/s", "decode", "scale+rot", "encode", "out MB", "peak RSS");
+}
+
+/*
+ * Runs each format from first_format to last_format with each kind of page from first_kind to
+ * last_kind, storing the pages printed per second in rates
+ */
+static status_t _run_all(const bench_params_t *params, int first_format, int last_format,
+        int first_kind, int last_kind, double rates[PCL_NUM_TYPES][PAGE_KIND_COUNT]) {
+    status_t result = OK;
+    int format, kind;
+
+    for (format = first_format; format <= last_format; format++) {
+        if ((format != PCLm) && (format != PCLPWG)) {
+            continue;
+        }
+        for (kind = first_kind; kind <= last_kind; kind++) {
+            if (_run(params, (pcl_t) format, (page_kind_t) kind, &rates[format][kind]) != OK) {
+                result = ERROR;
+            }
+        }
+    }
+    return result;
+}
+
+/*
+ * Runs the formats and kinds of page portrait and then landscape at 300 and 600 dpi, and
+ * summarises pages per second for each orientation side by side. Runs that fail count as 0.
+ */
+static status_t _compare_orientations(const bench_params_t *params, int first_format,
+        int last_format, int first_kind, int last_kind) {
+    static const int resolutions[] = {300, 600};
+    static const wprint_rotation_t rotations[] = {ROT_0, ROT_90, ROT_270};
+    double rates[2][3][PCL_NUM_TYPES][PAGE_KIND_COUNT];
+    bench_params_t run_params = *params;
+    status_t result = OK;
+    int r, o, format, kind;
+
+    for (r = 0; r < 2; r++) {
+        int width = params->source_width * resolutions[r] / SOURCE_DPI;
+        int height = params->source_height * resolutions[r] / SOURCE_DPI;
+        for (o = 0; o < 3; o++) {
+            // a landscape page is the portrait one turned on its side, so it has the same pixels
+            run_params.resolution = resolutions[r];
+            run_params.rotation = rotations[o];
+            run_params.source_width = (rotations[o] == ROT_0) ? width : height;
+            run_params.source_height = (rotations[o] == ROT_0) ? height : width;
+            _print_header(&run_params);
+            if (_run_all(&run_params, first_format, last_format, first_kind, last_kind,
+                    rates[r][o]) != OK) {
+                result = ERROR;
+            }
+            printf("\n");
+        }
+    }
+
+    printf("pages/s of portrait and landscape pages, and how much slower the slower landscape "
+            "one is\n");
+    printf("%-5s %-5s %-5s %10s %10s %10s %9s\n", "dpi", "fmt", "kind", "portrait", "rot 90",
+            "rot 270", "slowdown");
+    for (r = 0; r < 2; r++) {
+        for (format = first_format; format <= last_format; format++) {
+            if ((format != PCLm) && (format != PCLPWG)) {
+                continue;
+            }
+            for (kind = first_kind; kind <= last_kind; kind++) {
+                double portrait = rates[r][0][format][kind];
+                double landscape = MIN(rates[r][1][format][kind], rates[r][2][format][kind]);
+                printf("%-5d %-5s %-5s %10.2f %10.2f %10.2f %8.2fx\n", resolutions[r],
+                        (format == PCLm) ? "pclm" : "pwg", _page_kind_names[kind], portrait,
+                        rates[r][1][format][kind], rates[r][2][format][kind],
+                        (landscape > 0) ? portrait / landscape : 0.0);
+            }
+        }
+    }
+    return result;
+}
+
+static void _usage(const char *name) {
+    fprintf(stderr, "usage: %s [-f pclm|pwg|all] [-k text|photo|blank|all] [-n pages]\n"
+            "        [-s WIDTHxHEIGHT] [-d dpi] [-r 0|90|180|270] [-q 0-4] [-m kB] [-c threads]\n"
+            "        [-H] [-L] [-o output]\n"
+            "  -s  size of the synthetic pages in pixels (default 2480x3508, A4 at 300 dpi)\n"
+            "  -d  print resolution; pages are fitted to US Letter (default 300)\n"
+            "  -q  scale quality: default, box, bilinear, bicubic, lanczos3 (default 0)\n"
+            "  -m  memory budget for stripes, row caching and scaling (default %d)\n"
+            "  -c  PCLm compression workers, 1 for none (default 0, chosen from cores and budget)\n"
+            "  -H  allocate page buffers from the heap for every page instead of recycling them\n"
+            "  -L  compare portrait pages with landscape ones, the source turned on its side and\n"
+            "      printed at 90 and 270 degrees, at 300 and 600 dpi; -s is for 300 dpi and -d\n"
+            "      and -r are ignored\n"
+            "  -o  where the job is written (default /dev/null)\n", name,
+            DEFAULT_MEMORY_BUDGET / 1024);
+}
+
+int main(int argc, char *argv[]) {
+    bench_params_t params = {.output_path = "/dev/null", .num_pages = 10, .source_width = 2480,
+            .source_height = 3508, .resolution = 300, .rotation = ROT_0,
+            .scale_filter = SCALER_FILTER_DEFAULT, .memory_budget = DEFAULT_MEMORY_BUDGET,
+            .use_arena = true};
+    int first_format = PCLm, last_format = PCLPWG;
+    int first_kind = 0, last_kind = PAGE_KIND_COUNT - 1;
+    double rates[PCL_NUM_TYPES][PAGE_KIND_COUNT];
+    int kind, opt, degrees = 0;
+    status_t result;
+
+    while ((opt = getopt(argc, argv, "f:k:n:s:d:r:q:m:c:HLo:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "pclm") == 0) {
+                    first_format = last_format = PCLm;
+                } else if (strcmp(optarg, "pwg") == 0) {
+                    first_format = last_format = PCLPWG;
+                } else if (strcmp(optarg, "all") != 0) {
+                    _usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'k':
+                for (kind = 0; kind < PAGE_KIND_COUNT; kind++) {
+                    if (strcmp(optarg, _page_kind_names[kind]) == 0) {
+                        first_kind = last_kind = kind;
+                    }
+                }
+                if ((first_kind != last_kind) && (strcmp(optarg, "all") != 0)) {
+                    _usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                params.num_pages = atoi(optarg);
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &params.source_width, &params.source_height) != 2) {
+                    _usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'd':
+                params.resolution = atoi(optarg);
+                break;
+            case 'r':
+                degrees = atoi(optarg);
+                degrees = (degrees == 90 || degrees == 180 || degrees == 270) ? degrees : 0;
+                params.rotation = (degrees == 90) ? ROT_90 : (degrees == 180) ? ROT_180 :
+                        (degrees == 270) ? ROT_270 : ROT_0;
+                break;
+            case 'q':
+                params.scale_filter = (scaler_filter_t) atoi(optarg);
+                break;
+            case 'm':
+                params.memory_budget = atoi(optarg) * 1024;
+                break;
+            case 'c':
+                params.compression_threads = atoi(optarg);
+                break;
+            case 'H':
+                params.use_arena = false;
+                break;
+            case 'L':
+                params.compare_orientations = true;
+                break;
+            case 'o':
+                params.output_path = optarg;
+                break;
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+    if ((params.num_pages <= 0) || (params.source_width <= 1) || (params.source_height <= 1) ||
+            (params.resolution <= 0) || (params.memory_budget <= 0) || (params.scale_filter < SCALER_FILTER_DEFAULT) ||
+            (params.scale_filter > SCALER_FILTER_LANCZOS3)) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    printf("stage rates are MB/s of printed raster, except decode which is of source pixels\n");
+    if (params.compare_orientations) {
+        result = _compare_orientations(&params, first_format, last_format, first_kind, last_kind);
+    } else {
+        _print_header(&params);
+        result = _run_all(&params, first_format, last_format, first_kind, last_kind, rates);
+    }
+    return (result == OK) ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks PCLmGenerator::RLEEncodeImage against the byte-at-a-time encoder it replaced and
+ * decodes its output back to the input, over random rows, every length up to MAX_LENGTH at every
+ * word alignment, and runs that end on either side of the 128 byte block limit. Then compares
+ * the two encoders' throughput on rows like those of text, photo and blank pages.
+ *
+ * The old encoder dropped the last byte of a literal run that ended the input, so where its
+ * output does not decode the two may differ in their final block only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "PCLmGenerator.h"
+
+#define MAX_LENGTH 300
+#define RANDOM_ROWS 20000
+#define ROW_BYTES (2550 * 3) // US Letter at 300 dpi, RGB
+#define BENCH_ROWS 4000
+
+// The room compressStrip allows for expansion, plus the end of data marker
+#define ENCODED_SIZE(length) ((length) * 2 + 1)
+
+// PCLmGenerator lets this class reach its private encoder
+class RLEEncoderTest {
+public:
+    static int encode(ubyte *in, ubyte *out, int inLength) {
+        return PCLmGenerator::RLEEncodeImage(in, out, inLength);
+    }
+};
+
+static long long _now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * The encoder before it compared words. It reads the byte at in + inLength, so callers must
+ * leave one there that differs from the last byte of input.
+ */
+static int _old_encode(ubyte *in, ubyte *out, int inLength) {
+    ubyte *imgPtr = in;
+    ubyte *endPtr = in + inLength;
+    ubyte *origOut = out;
+    ubyte c;
+    sint32 cnt = 0;
+
+    while (imgPtr < endPtr) {
+        c = *imgPtr++;
+        cnt = 1;
+
+        while (*imgPtr == c && cnt < inLength) {
+            if (imgPtr > endPtr) {
+                break;
+            }
+            cnt++;
+            imgPtr++;
+        }
+
+        if (cnt > 1) {
+            while (cnt > 128) {
+                *out++ = 129;
+                *out++ = c;
+                cnt -= 128;
+            }
+            if (cnt) {
+                *out++ = (257 - cnt);
+                *out++ = c;
+            }
+        } else {
+            ubyte *start, *p;
+            sint32 i;
+            start = (imgPtr - 1);
+
+            for (cnt = 1, p = start; *p != *imgPtr; p++, imgPtr++, cnt++) {
+                if (imgPtr >= endPtr) break;
+            }
+            if (!(imgPtr == endPtr)) {
+                imgPtr--;
+            }
+            cnt--;
+            while (cnt > 128) {
+                *out++ = 127;
+                for (i = 0; i < 128; i++) {
+                    *out++ = *start++;
+                }
+                cnt -= 128;
+            }
+            *out++ = cnt - 1;
+            for (i = 0; i < cnt; i++) {
+                *out++ = *start++;
+            }
+        }
+    }
+    *out++ = 128;
+    return ((int) (out - origOut));
+}
+
+/*
+ * Decodes length bytes of PackBits from in, which must end with the end of data marker and
+ * nothing after it. Returns the number of bytes written to out, or -1 if the data is malformed.
+ */
+static int _decode(const ubyte *in, int length, ubyte *out, int outSize) {
+    const ubyte *end = in + length;
+    int written = 0, count;
+
+    while (in < end) {
+        ubyte header = *in++;
+        if (header == 128) {
+            return (in == end) ? written : -1;
+        } else if (header < 128) {
+            count = header + 1;
+            if (end - in < count || written + count > outSize) return -1;
+            memcpy(out + written, in, count);
+            in += count;
+        } else {
+            count = 257 - header;
+            if (in == end || written + count > outSize) return -1;
+            memset(out + written, *in++, count);
+        }
+        written += count;
+    }
+    return -1;
+}
+
+/*
+ * Returns the offset of the last block before the end of data marker in an encoded stream
+ */
+static int _last_block(const ubyte *encoded, int size) {
+    int offset = 0, last = 0;
+    while (offset < size - 1) {
+        last = offset;
+        offset += (encoded[offset] < 128) ? encoded[offset] + 2 : 2;
+    }
+    return last;
+}
+
+// Rows where the old encoder lost its trailing literal byte
+static int oldTruncated = 0;
+
+/*
+ * Encodes length bytes at in with both encoders and decodes the result, returning 1 if anything
+ * differs. in must have room for the byte after the input.
+ */
+static int _check_row(ubyte *in, int length, ubyte *newOut, ubyte *oldOut, ubyte *decoded) {
+    int newSize, oldSize, same;
+
+    if (length > 0) {
+        in[length] = (ubyte) ~in[length - 1];
+    }
+    newSize = RLEEncoderTest::encode(in, newOut, length);
+    if (newSize > ENCODED_SIZE(length) ||
+            _decode(newOut, newSize, decoded, length) != length ||
+            memcmp(decoded, in, length) != 0) {
+        fprintf(stderr, "length %d: does not decode to its input\n", length);
+        return 1;
+    }
+
+    oldSize = _old_encode(in, oldOut, length);
+    if (_decode(oldOut, oldSize, decoded, length) == length && memcmp(decoded, in, length) == 0) {
+        same = (newSize == oldSize && memcmp(newOut, oldOut, newSize) == 0);
+    } else {
+        same = (memcmp(newOut, oldOut, _last_block(newOut, newSize)) == 0);
+        oldTruncated++;
+    }
+    if (!same) {
+        fprintf(stderr, "length %d: encoders differ\n", length);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Fills length bytes with values from an alphabet of the given size, so that smaller alphabets
+ * give more and longer runs
+ */
+static void _fill_random(ubyte *p, int length, int alphabet, unsigned int *seed) {
+    for (int i = 0; i < length; i++) {
+        p[i] = (ubyte) (rand_r(seed) % alphabet);
+    }
+}
+
+/*
+ * Appends a run of count bytes at p + *length, a repeat if repeat is set and otherwise a literal
+ * with no two equal neighbours
+ */
+static void _append_run(ubyte *p, int *length, int count, bool repeat) {
+    ubyte c = (ubyte) (*length ? p[*length - 1] + 1 : 0);
+    for (int i = 0; i < count; i++) {
+        p[(*length)++] = repeat ? c : (ubyte) (c + i);
+    }
+}
+
+static int _check() {
+    static const int edges[] = {1, 2, 127, 128, 129, 255, 256, 257, 384, 385};
+    static const int alphabets[] = {2, 3, 4, 16, 256};
+    const int maxLength = 4 * 385 + 8;
+    ubyte *buffer = (ubyte *) malloc(maxLength + 8 + 1);
+    ubyte *newOut = (ubyte *) malloc(ENCODED_SIZE(maxLength));
+    ubyte *oldOut = (ubyte *) malloc(ENCODED_SIZE(maxLength));
+    ubyte *decoded = (ubyte *) malloc(maxLength);
+    unsigned int seed = 1;
+    int failures = 0;
+
+    if (!buffer || !newOut || !oldOut || !decoded) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    // Every length at every offset from word alignment
+    for (int offset = 0; offset < 8; offset++) {
+        for (int length = 0; length <= MAX_LENGTH; length++) {
+            for (int alphabet : alphabets) {
+                _fill_random(buffer + offset, length, alphabet, &seed);
+                failures += _check_row(buffer + offset, length, newOut, oldOut, decoded);
+            }
+        }
+    }
+
+    // Pairs of runs either side of the block limit, in every order
+    for (int offset = 0; offset < 8; offset++) {
+        for (int first : edges) {
+            for (int second : edges) {
+                for (int kinds = 0; kinds < 4; kinds++) {
+                    int length = 0;
+                    _append_run(buffer + offset, &length, first, kinds & 1);
+                    _append_run(buffer + offset, &length, second, kinds & 2);
+                    failures += _check_row(buffer + offset, length, newOut, oldOut, decoded);
+                }
+            }
+        }
+    }
+
+    // Longer random rows
+    for (int row = 0; row < RANDOM_ROWS; row++) {
+        int length = rand_r(&seed) % maxLength;
+        _fill_random(buffer, length, alphabets[row % 5], &seed);
+        failures += _check_row(buffer, length, newOut, oldOut, decoded);
+    }
+
+    free(buffer);
+    free(newOut);
+    free(oldOut);
+    free(decoded);
+    return failures;
+}
+
+/*
+ * Returns megabytes per second of one encoder over BENCH_ROWS rows of ROW_BYTES
+ */
+static double _megabytes_per_second(bool useNew, ubyte *row, ubyte *out) {
+    long long start = _now_ns();
+    for (int i = 0; i < BENCH_ROWS; i++) {
+        if (useNew) {
+            RLEEncoderTest::encode(row, out, ROW_BYTES);
+        } else {
+            _old_encode(row, out, ROW_BYTES);
+        }
+    }
+    return (double) BENCH_ROWS * ROW_BYTES * 1e3 / (_now_ns() - start);
+}
+
+int main() {
+    static const char *names[] = {"text", "photo", "blank"};
+    ubyte *row = (ubyte *) malloc(ROW_BYTES + 1);
+    ubyte *out = (ubyte *) malloc(ENCODED_SIZE(ROW_BYTES));
+    unsigned int seed = 2;
+    int failures;
+
+    if (!row || !out) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    failures = _check();
+    printf("RLEEncodeImage: %s\n", failures ? "MISMATCH" : "matches the old encoder and decodes");
+    printf("(%d rows where the old encoder dropped its last byte)\n", oldTruncated);
+
+    printf("%d byte rows  %10s %10s\n", ROW_BYTES, "new MB/s", "old MB/s");
+    for (int kind = 0; kind < 3; kind++) {
+        for (int i = 0; i < ROW_BYTES; i++) {
+            if (kind == 0) {
+                // Mostly white, with short dark strokes
+                row[i] = (i / 3) % 40 < 4 ? 0 : 255;
+            } else if (kind == 1) {
+                row[i] = (ubyte) rand_r(&seed);
+            } else {
+                row[i] = 255;
+            }
+        }
+        row[ROW_BYTES] = (ubyte) ~row[ROW_BYTES - 1];
+        double newRate = _megabytes_per_second(true, row, out);
+        double oldRate = _megabytes_per_second(false, row, out);
+        printf("%-16s %10.0f %10.0f\n", names[kind], newRate, oldRate);
+    }
+
+    free(row);
+    free(out);
+    return failures ? 1 : 0;
+}
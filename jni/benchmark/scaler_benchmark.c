@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Scales random images at the ratios of fitting common page and photo sizes to a page, in
+ * stripes of STRIPE_ROWS output rows as wprint_image does. Checks that the default scaler's row
+ * passes, which combine input rows with NEON or SSE2, give exactly the output of the per-pixel
+ * loops they replaced, and that scaling each stripe in NUM_SLICES column slices on as many
+ * threads gives exactly the full-width output. Compares the time each takes.
+ *
+ * Then does the same for each polyphase filter, checking that its output is within 1 of scaling
+ * with the same coefficient tables in double precision, here and for small random sizes. The
+ * tables of random sizes must have windows that stay in the image and never move backwards, and
+ * weights that sum to one.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "wprint_scaler.h"
+
+#define STRIPE_ROWS 16 // as wprint_image decodes pages
+#define NUM_SLICES 4 // as wprint_image splits stripes with its most threads
+#define BENCH_RUNS 3 // the best of which is reported
+#define RANDOM_TABLES 1000 // size pairs per filter whose coefficient tables are checked
+#define RANDOM_IMAGES 300 // size pairs per filter of small images checked against the reference
+#define MAX_TABLE_SIZE 8000
+#define MAX_IMAGE_SIZE 64
+// The fixed-point factors, which are set up for every filter, divide by zero when scaling up from
+// a single pixel
+#define MIN_SIZE 2
+#define ONE_WEIGHT (1 << 14) // what the weights of each output pixel sum to
+
+#if defined(__ARM_NEON)
+#define BACKEND "neon"
+#elif defined(__SSE2__)
+#define BACKEND "sse2"
+#else
+#define BACKEND "scalar"
+#endif
+
+typedef struct {
+    const char *name;
+    uint16 in_width, in_height;
+    uint16 out_width, out_height;
+} scale_case_t;
+
+// Printable areas are those of a 300 dpi printer with 1/8 inch margins, or borderless for photos
+static const scale_case_t _cases[] = {
+        {"Letter to printable area", 2550, 3300, 2480, 3230},
+        {"Letter at 600 dpi", 5100, 6600, 2480, 3230},
+        {"A4 to printable area", 2481, 3508, 2405, 3433},
+        {"12 MP photo to Letter", 4032, 3024, 2480, 1860},
+        {"12 MP photo to 4x6", 4032, 3024, 1800, 1200},
+        {"Screenshot to Letter", 1080, 1920, 1816, 3230},
+        {"VGA photo to Letter", 640, 480, 2480, 1860},
+        {"Panorama to Letter", 4000, 1000, 2480, 3230}, // mixed, rows up first
+        {"Receipt to Letter", 600, 4000, 2480, 3230}, // mixed, columns up first
+};
+
+static const struct {
+    scaler_filter_t filter;
+    const char *name;
+} _filters[] = {
+        {SCALER_FILTER_BOX, "box"},
+        {SCALER_FILTER_BILINEAR, "bilinear"},
+        {SCALER_FILTER_BICUBIC, "bicubic"},
+        {SCALER_FILTER_LANCZOS3, "lanczos3"},
+};
+
+#define NUM_FILTERS ((int) (sizeof(_filters) / sizeof(_filters[0])))
+
+static long long _now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+typedef struct scale_job_s scale_job_t;
+
+typedef struct {
+    scale_job_t *job;
+    uint16 first_column, num_columns;
+    uint8 *temp;
+} slice_t;
+
+/*
+ * An image being scaled. The calling thread sets up each stripe; then every slice is scaled,
+ * each after the first on its own thread, and the calling thread moves the rows into place.
+ */
+struct scale_job_s {
+    scaler_config_t *config;
+    const scale_case_t *c;
+    uint8 *src, *dst, *stripe;
+    uint16 start_row, input_start; // of the current stripe, start_row past the end to exit
+    pthread_barrier_t stripe_ready, stripe_done;
+    slice_t slices[NUM_SLICES];
+};
+
+static void _scale_slice(slice_t *slice) {
+    scale_job_t *job = slice->job;
+    scaler_scale_image_columns(job->src + (size_t) job->input_start * job->c->in_width * 3,
+            job->config, job->stripe, slice->temp, slice->first_column, slice->num_columns);
+}
+
+static void *_slice_thread(void *param) {
+    slice_t *slice = (slice_t *) param;
+    scale_job_t *job = slice->job;
+
+    for (;;) {
+        pthread_barrier_wait(&job->stripe_ready);
+        if (job->start_row >= job->c->out_height) {
+            return NULL;
+        }
+        _scale_slice(slice);
+        pthread_barrier_wait(&job->stripe_done);
+    }
+}
+
+/*
+ * Scales src into dst with config, which must be set up for the case, splitting the columns of
+ * each stripe into num_slices slices as wprint_image does. Returns the time taken in nanoseconds,
+ * or -1 if out of memory.
+ */
+static long long _scale(scaler_config_t *config, const scale_case_t *c, uint8 *src, uint8 *dst,
+        int num_slices) {
+    scale_job_t job;
+    pthread_t threads[NUM_SLICES];
+    uint16 start_row, end_row, input_start, input_end, num_rows, offset, max_rows = 0;
+    uint32 temp_size, max_temp_size = 0, out_bytes = c->out_width * 3;
+    long long start = -1;
+    int i;
+
+    for (start_row = 0; start_row < c->out_height; start_row += STRIPE_ROWS) {
+        end_row = MIN(start_row + STRIPE_ROWS, c->out_height) - 1;
+        scaler_calculate_scaling_rows(start_row, end_row, config, &input_start, &input_end,
+                &num_rows, &offset, &temp_size);
+        max_rows = MAX(max_rows, num_rows);
+        max_temp_size = MAX(max_temp_size, temp_size);
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.config = config;
+    job.c = c;
+    job.src = src;
+    job.dst = dst;
+    job.stripe = (uint8 *) malloc((size_t) max_rows * out_bytes);
+    for (i = 0; i < num_slices; i++) {
+        job.slices[i].job = &job;
+        job.slices[i].first_column = (c->out_width * i) / num_slices;
+        job.slices[i].num_columns = (c->out_width * (i + 1)) / num_slices -
+                job.slices[i].first_column;
+        job.slices[i].temp = (uint8 *) malloc(MAX(max_temp_size, 1));
+        if (job.slices[i].temp == NULL) {
+            break;
+        }
+    }
+
+    if ((job.stripe != NULL) && (i == num_slices)) {
+        pthread_barrier_init(&job.stripe_ready, NULL, num_slices);
+        pthread_barrier_init(&job.stripe_done, NULL, num_slices);
+        for (i = 1; i < num_slices; i++) {
+            if (pthread_create(&threads[i], NULL, _slice_thread, &job.slices[i]) != 0) {
+                fprintf(stderr, "cannot start threads\n");
+                exit(1);
+            }
+        }
+
+        start = _now_ns();
+        for (job.start_row = 0; job.start_row < c->out_height; job.start_row += STRIPE_ROWS) {
+            end_row = MIN(job.start_row + STRIPE_ROWS, c->out_height) - 1;
+            scaler_calculate_scaling_rows(job.start_row, end_row, config, &job.input_start,
+                    &input_end, &num_rows, &offset, &temp_size);
+            pthread_barrier_wait(&job.stripe_ready);
+            _scale_slice(&job.slices[0]);
+            pthread_barrier_wait(&job.stripe_done);
+            memcpy(dst + (size_t) job.start_row * out_bytes, job.stripe + (size_t) offset *
+                    out_bytes, (size_t) (end_row - job.start_row + 1) * out_bytes);
+        }
+        start = _now_ns() - start;
+
+        pthread_barrier_wait(&job.stripe_ready);
+        for (i = 1; i < num_slices; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_barrier_destroy(&job.stripe_ready);
+        pthread_barrier_destroy(&job.stripe_done);
+    }
+
+    free(job.stripe);
+    for (i = 0; i < num_slices; i++) {
+        free(job.slices[i].temp);
+    }
+    return start;
+}
+
+/*
+ * Returns the shortest of BENCH_RUNS times to scale src into dst with filter in num_slices
+ * slices, or -1 if out of memory. With use_pixel_loops, the default scaler runs its per-pixel
+ * fallback.
+ */
+static long long _best_time(const scale_case_t *c, scaler_filter_t filter, bool_t use_pixel_loops,
+        uint8 *src, uint8 *dst, int num_slices) {
+    scaler_config_t config;
+    long long best = -1, time;
+    int run;
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        memset(&config, 0, sizeof(config));
+        if (scaler_make_image_resampler_tables(c->in_width, c->in_width * 3, c->out_width,
+                c->out_width * 3, c->in_height, c->out_height, filter, &config) != OK) {
+            return -1;
+        }
+        config.usePixelLoops = use_pixel_loops;
+        time = _scale(&config, c, src, dst, num_slices);
+        scaler_free_tables(&config);
+        if (time < 0) {
+            return -1;
+        }
+        best = ((best < 0) || (time < best)) ? time : best;
+    }
+    return best;
+}
+
+/*
+ * Scales src into dst with the coefficient tables of filter in double precision, rounding only
+ * the result. Returns -1 if out of memory.
+ */
+static int _ref_resample(const scale_case_t *c, scaler_filter_t filter, const uint8 *src,
+        uint8 *dst) {
+    scaler_config_t config;
+    const scaler_taps_t *x_taps, *y_taps;
+    double *row, sum;
+    int x, y, i, k;
+
+    memset(&config, 0, sizeof(config));
+    if (scaler_make_image_resampler_tables(c->in_width, c->in_width * 3, c->out_width,
+            c->out_width * 3, c->in_height, c->out_height, filter, &config) != OK) {
+        return -1;
+    }
+    if ((row = (double *) malloc(c->in_width * 3 * sizeof(double))) == NULL) {
+        scaler_free_tables(&config);
+        return -1;
+    }
+    x_taps = config.pXTaps;
+    y_taps = config.pYTaps;
+
+    for (y = 0; y < c->out_height; y++) {
+        const sint16 *weights = y_taps->weights + y * y_taps->num_taps;
+        const uint8 *in = src + (size_t) y_taps->start[y] * c->in_width * 3;
+        for (i = 0; i < c->in_width * 3; i++) {
+            for (sum = 0.0, k = 0; k < y_taps->num_taps; k++) {
+                sum += in[(size_t) k * c->in_width * 3 + i] * (double) weights[k] / ONE_WEIGHT;
+            }
+            row[i] = sum;
+        }
+        for (x = 0; x < c->out_width; x++) {
+            weights = x_taps->weights + x * x_taps->num_taps;
+            for (i = 0; i < 3; i++) {
+                for (sum = 0.0, k = 0; k < x_taps->num_taps; k++) {
+                    sum += row[(x_taps->start[x] + k) * 3 + i] * weights[k] / ONE_WEIGHT;
+                }
+                dst[((size_t) y * c->out_width + x) * 3 + i] =
+                        (uint8) MAX(0, MIN(255, lround(sum)));
+            }
+        }
+    }
+
+    free(row);
+    scaler_free_tables(&config);
+    return 0;
+}
+
+static int _max_diff(const uint8 *a, const uint8 *b, size_t size) {
+    int max_diff = 0;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        max_diff = MAX(max_diff, abs(a[i] - b[i]));
+    }
+    return max_diff;
+}
+
+/*
+ * Returns whether the windows of taps stay within in_size pixels and never move backwards, and
+ * the weights of each output pixel sum to one
+ */
+static bool_t _taps_ok(const scaler_taps_t *taps, uint16 in_size, uint16 out_size) {
+    int i, k, sum;
+
+    for (i = 0; i < out_size; i++) {
+        if ((taps->start[i] + taps->num_taps > in_size) ||
+                ((i > 0) && (taps->start[i] < taps->start[i - 1]))) {
+            return 0;
+        }
+        for (sum = 0, k = 0; k < taps->num_taps; k++) {
+            sum += taps->weights[i * taps->num_taps + k];
+        }
+        if (sum != ONE_WEIGHT) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Checks the tables of every filter for random sizes up to MAX_TABLE_SIZE, and the output for
+ * small random images against _ref_resample. Returns the number of failures.
+ */
+static int _check_filters(void) {
+    scaler_config_t config;
+    scale_case_t c = {"random", 0, 0, 0, 0};
+    uint8 src[(MAX_IMAGE_SIZE + 2) * MAX_IMAGE_SIZE * 3];
+    uint8 out[MAX_IMAGE_SIZE * MAX_IMAGE_SIZE * 3], ref[sizeof(out)];
+    int failures = 0, f, n;
+    size_t i;
+
+    for (f = 0; f < NUM_FILTERS; f++) {
+        for (n = 0; n < RANDOM_TABLES; n++) {
+            uint16 in_size = MIN_SIZE + rand() % (MAX_TABLE_SIZE - MIN_SIZE + 1);
+            uint16 out_size = MIN_SIZE + rand() % (MAX_TABLE_SIZE - MIN_SIZE + 1);
+            memset(&config, 0, sizeof(config));
+            if (scaler_make_image_resampler_tables(in_size, in_size * 3, out_size, out_size * 3,
+                    MIN_SIZE, MIN_SIZE, _filters[f].filter, &config) != OK) {
+                fprintf(stderr, "out of memory\n");
+                return failures + 1;
+            }
+            if (!_taps_ok(config.pXTaps, in_size, out_size)) {
+                fprintf(stderr, "%s tables from %d to %d are wrong\n", _filters[f].name,
+                        in_size, out_size);
+                failures++;
+            }
+            scaler_free_tables(&config);
+        }
+
+        for (n = 0; n < RANDOM_IMAGES; n++) {
+            c.in_width = MIN_SIZE + rand() % (MAX_IMAGE_SIZE - MIN_SIZE + 1);
+            c.in_height = MIN_SIZE + rand() % (MAX_IMAGE_SIZE - MIN_SIZE + 1);
+            c.out_width = MIN_SIZE + rand() % (MAX_IMAGE_SIZE - MIN_SIZE + 1);
+            c.out_height = MIN_SIZE + rand() % (MAX_IMAGE_SIZE - MIN_SIZE + 1);
+            for (i = 0; i < sizeof(src); i++) {
+                src[i] = (uint8) rand();
+            }
+            if ((_best_time(&c, _filters[f].filter, 0, src, out, 1) < 0) ||
+                    (_ref_resample(&c, _filters[f].filter, src, ref) < 0)) {
+                fprintf(stderr, "out of memory\n");
+                return failures + 1;
+            }
+            if (_max_diff(out, ref, (size_t) c.out_width * c.out_height * 3) > 1) {
+                fprintf(stderr, "%s from %dx%d to %dx%d is off by more than 1\n",
+                        _filters[f].name, c.in_width, c.in_height, c.out_width, c.out_height);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+static size_t _count_diffs(const uint8 *a, const uint8 *b, size_t size) {
+    size_t diffs = 0, i;
+    for (i = 0; i < size; i++) {
+        diffs += (a[i] != b[i]);
+    }
+    return diffs;
+}
+
+/*
+ * Returns a random image for case n of _cases, with room for the rows past the last input row
+ * that the scaler may read
+ */
+static uint8 *_make_source(int n) {
+    size_t size = ((size_t) _cases[n].in_height + 2) * _cases[n].in_width * 3, i;
+    uint8 *src = (uint8 *) malloc(size);
+
+    srand(n + 1);
+    for (i = 0; (src != NULL) && (i < size); i++) {
+        src[i] = (uint8) rand();
+    }
+    return src;
+}
+
+int main(void) {
+    size_t out_size, pass_diffs, slice_diffs;
+    long long loops_ns, passes_ns, slices_ns;
+    uint8 *src, *loops, *passes, *slices;
+    int pass_failures = 0, slice_failures = 0, filter_failures, max_error, n, f;
+
+    printf("%-26s %-26s %10s %10s %10s %8s %8s\n", "", "", "loops ms", BACKEND " ms",
+            "sliced ms", "diffs", "sliced");
+    for (n = 0; n < (int) (sizeof(_cases) / sizeof(_cases[0])); n++) {
+        const scale_case_t *c = &_cases[n];
+
+        out_size = (size_t) c->out_height * c->out_width * 3;
+        src = _make_source(n);
+        loops = (uint8 *) malloc(out_size);
+        passes = (uint8 *) malloc(out_size);
+        slices = (uint8 *) malloc(out_size);
+        if ((src == NULL) || (loops == NULL) || (passes == NULL) || (slices == NULL)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        loops_ns = _best_time(c, SCALER_FILTER_DEFAULT, 1, src, loops, 1);
+        passes_ns = _best_time(c, SCALER_FILTER_DEFAULT, 0, src, passes, 1);
+        slices_ns = _best_time(c, SCALER_FILTER_DEFAULT, 0, src, slices, NUM_SLICES);
+        if ((loops_ns < 0) || (passes_ns < 0) || (slices_ns < 0)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        pass_diffs = _count_diffs(loops, passes, out_size);
+        slice_diffs = _count_diffs(passes, slices, out_size);
+        pass_failures += (pass_diffs != 0);
+        slice_failures += (slice_diffs != 0);
+        printf("%-26s %5dx%-5d -> %5dx%-5d %10.1f %10.1f %10.1f %8zu %8zu\n", c->name,
+                c->in_width, c->in_height, c->out_width, c->out_height, loops_ns / 1e6,
+                passes_ns / 1e6, slices_ns / 1e6, pass_diffs, slice_diffs);
+
+        free(src);
+        free(loops);
+        free(passes);
+        free(slices);
+    }
+
+    printf("\n%-26s %-26s %10s %10s %10s %8s %8s\n", "", "", "filter", "ms", "sliced ms",
+            "error", "sliced");
+    filter_failures = _check_filters();
+    for (n = 0; n < (int) (sizeof(_cases) / sizeof(_cases[0])); n++) {
+        const scale_case_t *c = &_cases[n];
+
+        out_size = (size_t) c->out_height * c->out_width * 3;
+        src = _make_source(n);
+        loops = (uint8 *) malloc(out_size); // the double precision reference
+        passes = (uint8 *) malloc(out_size);
+        slices = (uint8 *) malloc(out_size);
+        if ((src == NULL) || (loops == NULL) || (passes == NULL) || (slices == NULL)) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        for (f = 0; f < NUM_FILTERS; f++) {
+            passes_ns = _best_time(c, _filters[f].filter, 0, src, passes, 1);
+            slices_ns = _best_time(c, _filters[f].filter, 0, src, slices, NUM_SLICES);
+            if ((passes_ns < 0) || (slices_ns < 0) ||
+                    (_ref_resample(c, _filters[f].filter, src, loops) < 0)) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+
+            max_error = _max_diff(loops, passes, out_size);
+            slice_diffs = _count_diffs(passes, slices, out_size);
+            filter_failures += (max_error > 1);
+            slice_failures += (slice_diffs != 0);
+            printf("%-26s %5dx%-5d -> %5dx%-5d %10s %10.1f %10.1f %8d %8zu\n",
+                    (f == 0) ? c->name : "", c->in_width, c->in_height, c->out_width,
+                    c->out_height, _filters[f].name, passes_ns / 1e6, slices_ns / 1e6,
+                    max_error, slice_diffs);
+        }
+
+        free(src);
+        free(loops);
+        free(passes);
+        free(slices);
+    }
+
+    printf("%s row passes: %s\n", BACKEND,
+            pass_failures ? "MISMATCH" : "match the per-pixel loops exactly");
+    printf("%d column slices: %s\n", NUM_SLICES,
+            slice_failures ? "MISMATCH" : "match the full-width output exactly");
+    printf("filters: %s\n", filter_failures ? "MISMATCH" :
+            "within 1 of double precision, with sound tables");
+    return (pass_failures || slice_failures || filter_failures) ? 1 : 0;
+}
@@ -18,6 +18,7 @@
 #ifndef __IFC_PRINT_JOB_H__
 #define __IFC_PRINT_JOB_H__
 
+#include <sys/uio.h>
 #include "lib_wprint.h"
 #include "ifc_wprint.h"
 
@@ -50,6 +51,13 @@ typedef struct ifc_print_job_st {
     int (*send_data)(const struct ifc_print_job_st *this_p, const char *buffer,
             size_t bufferLength);
 
+    /*
+     * Optional. Sends the iovcnt buffers of iov in order, as send_data would their
+     * concatenation, returning the total amount of data written or -1 for an error.
+     */
+    int (*send_datav)(const struct ifc_print_job_st *this_p, const struct iovec *iov,
+            int iovcnt);
+
     /*
      * Returns print job status
      */
@@ -54,6 +54,12 @@ typedef struct ifc_status_monitor_st {
      */
     void (*stop)(const struct ifc_status_monitor_st *this_p);
 
+    /*
+     * Asks a running monitor to poll again promptly, such as when the job is expected to change
+     * state. May be NULL.
+     */
+    void (*poll_soon)(const struct ifc_status_monitor_st *this_p);
+
     /*
      * Destroy printer status monitor
      */
@@ -48,9 +48,10 @@ typedef struct {
  */
 typedef struct {
     /*
-     * Create a FIFO message queue
+     * Create a FIFO message queue. options is MSG_Q_FIFO, or MSG_Q_SPSC for a queue with a single
+     * sending and a single receiving thread.
      */
-    msg_q_id (*msgQCreate)(int max_mesgs, int max_msg_length);
+    msg_q_id (*msgQCreate)(int max_mesgs, int max_msg_length, int options);
 
     /*
      * Delete a previously created message queue. Returns OK or ERROR.
@@ -58,13 +59,15 @@ typedef struct {
     status_t (*msgQDelete)(msg_q_id msgQ);
 
     /**
-     * Sends a message to a message queue. Returns OK or ERROR.
+     * Sends a message to a message queue, waiting for room as long as timeout allows: WAIT_FOREVER,
+     * NO_WAIT or a number of milliseconds. Returns OK or ERROR.
      */
     status_t (*msgQSend)(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int timeout,
             int priority);
 
     /**
-     * Collects a message, returning 0 if successful. timeout may be WAIT_FOREVER or NO_WAIT.
+     * Collects a message, returning 0 if successful. timeout may be WAIT_FOREVER, NO_WAIT or a
+     * number of milliseconds.
      */
     status_t (*msgQReceive)(msg_q_id msgQ, char *buffer, unsigned long max_nbytes, int timeout);
 
@@ -27,7 +27,9 @@
 #include "ifc_wprint.h"
 #include <dlfcn.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define WPRINT_BAD_JOB_HANDLE ((wJob_t) ERROR)
 
@@ -44,7 +46,9 @@
 #define minor_version(X) ((X >> 0) & 0xffff)
 
 #define STRIPE_HEIGHT           (16)
-#define BUFFERED_ROWS           (STRIPE_HEIGHT * 8)
+
+// Memory a page may use for stripe buffers, row caching and scaling unless a job sets its own
+#define DEFAULT_MEMORY_BUDGET   (4 * 1024 * 1024)
 
 #define MAX_MIME_LENGTH         (64)
 #define MAX_PRINTER_ADDR_LENGTH (64)
@@ -119,8 +123,47 @@ typedef enum {
                                           RENDER_FLAG_LANDSCAPE_MODE | \
                                           RENDER_FLAG_CENTER_ON_ORIENTATION)
 
+/*
+ * How pages are resampled when they are resized to the printable area, from the fixed-point
+ * scaler through filters that are slower but keep text and edges sharper
+ */
+typedef enum {
+    SCALE_QUALITY_DEFAULT,
+    SCALE_QUALITY_BOX,
+    SCALE_QUALITY_BILINEAR,
+    SCALE_QUALITY_BICUBIC,
+    SCALE_QUALITY_LANCZOS3,
+} scale_quality_t;
+
 typedef void (*wprint_status_cb_t)(wJob_t job_id, void *parm);
 
+/*
+ * Where the time of a job went, summed over the pages processed so far, and how its stripes were
+ * sized. Pages are rendered ahead and encoded and sent on their own thread, so stages overlap and
+ * their times can add up to more than the job took. Times are in milliseconds.
+ */
+typedef struct {
+    int pages;
+    long render_ms; // rendering PDF pages, including pages rendered ahead
+    long decode_ms; // decoding, scaling and rotating stripes, excluding rendering
+    long compress_ms; // encoding stripes in the print format, excluding sending
+    long buffer_wait_ms; // waiting for the encoder to hand back a stripe buffer
+    long send_ms; // sending data to the printer
+    int64_t bytes_sent;
+    int strip_height; // rows per stripe, chosen for the job's memory budget
+    int stripe_buffers; // stripes that may be in flight at once
+    int rows_cached; // most rows cached for decoding or rotating a page
+} wprint_job_stats_t;
+
+/*
+ * Returns the time of a monotonic clock in microseconds, for measuring how long things take
+ */
+static inline int64_t wprint_get_usecs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 /*
  * Parameters describing a job request
  */
@@ -197,6 +240,24 @@ typedef struct {
     char job_name[MAX_ID_STRING_LENGTH + 1];
     char job_originating_user_name[MAX_NAME_LENGTH + 1];
     int pdf_render_resolution;
+
+    // How many queued pages may be rendered ahead of the page printing, and the memory they may hold
+    int render_ahead_pages;
+    int render_ahead_bytes;
+
+    // Bytes a page may hold in stripe buffers, row caches and scaling buffers. The strip height
+    // and number of stripes in flight are chosen to fit. 0 means DEFAULT_MEMORY_BUDGET.
+    int memory_budget;
+
+    // Strip compression workers a PCLm job may keep busy, from a pool shared by every job. 0 picks
+    // a default from the number of cores and memory_budget; 1 compresses on the job's thread.
+    int compression_threads;
+
+    // Resampling used when pages have to be resized
+    scale_quality_t scale_quality;
+
+    // Kept up to date by the plugin as the job runs
+    wprint_job_stats_t stats;
     bool accepts_app_name;
     bool accepts_app_version;
     bool accepts_os_name;
@@ -238,6 +299,8 @@ typedef struct {
     // Certificate received from printer, if any
     uint8 *certificate;
     int certificate_len;
+    // Where the job's time went, when state is JOB_DONE; zero otherwise
+    wprint_job_stats_t stats;
 } wprint_job_callback_params_t;
 
 typedef enum {
@@ -269,6 +332,13 @@ typedef struct {
             wprint_job_params_t *job_params);
 
     status_t (*end_job)(wprint_job_params_t *job_params);
+
+    /*
+     * Optional. Starts rendering page_num of pathname in the background so that a later
+     * print_page of it finds the work done.
+     */
+    status_t (*prepare_page)(wprint_job_params_t *job_params, const char *mime_type,
+            const char *pathname, int page_num);
 } wprint_plugin_t;
 
 /*
@@ -288,6 +358,13 @@ bool wprintIsRunning();
 status_t wprintGetCapabilities(const wprint_connect_info_t *connect_info,
         printer_capabilities_t *printer_cap);
 
+/*
+ * Forgets cached capabilities of the printer at printer_addr, or of all printers if NULL.
+ * Capabilities are cached for a few minutes and revalidated against the printer's
+ * printer-config-change-time before reuse.
+ */
+void wprintInvalidateCapabilities(const char *printer_addr);
+
 /*
  * Fills in the job params structure with default values.
  */
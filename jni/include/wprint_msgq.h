@@ -20,11 +20,22 @@
 
 #include "wtypes.h"
 
+/*
+ * msgQSend and msgQReceive timeouts. Any other positive timeout is a number of milliseconds to wait
+ * for room in, or a message from, the queue before returning ERROR.
+ */
 #define WAIT_FOREVER -1
 #define NO_WAIT 0
 
 #define MSG_Q_FIFO 0
 
+/*
+ * msgQCreate option for a queue used by exactly one sending thread and one receiving thread at a
+ * time. Such a queue takes no locks. msgQPeek and msgQReceive must then be called from the
+ * receiving thread only.
+ */
+#define MSG_Q_SPSC 1
+
 typedef void *msg_q_id;
 
 #define MSG_Q_INVALID_ID ((msg_q_id)NULL)
@@ -33,15 +44,29 @@ typedef void *msg_q_id;
  * Definitions corresponding to ifc_wprint_t interfaces
  */
 
-msg_q_id msgQCreate(int max_msgs, int max_msg_length);
+msg_q_id msgQCreate(int max_msgs, int max_msg_length, int options);
 
 status_t msgQDelete(msg_q_id msgQ);
 
+/*
+ * Copies nbytes of buffer to the tail of the queue, waiting up to timeout for room if it is full.
+ * priority must be MSG_Q_FIFO.
+ */
 status_t msgQSend(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int timeout,
         int priority);
 
+/*
+ * Removes the message at the head of the queue into buffer, waiting up to timeout for one if the
+ * queue is empty
+ */
 status_t msgQReceive(msg_q_id msgQ, char *buffer, unsigned long max_nbytes, int timeout);
 
+/*
+ * Copies the message index places from the head of the queue into buffer without removing it.
+ * Returns ERROR if the queue holds no such message.
+ */
+status_t msgQPeek(msg_q_id msgQ, int index, char *buffer, unsigned long max_nbytes);
+
 int msgQNumMsgs(msg_q_id msgQ);
 
 #endif // __WPRINT_MSGQ_H__
\ No newline at end of file
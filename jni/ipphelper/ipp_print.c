@@ -25,6 +25,9 @@
 
 #define TAG "ipp_print"
 
+/* Consecutive buffers smaller than this are gathered into one write to the printer */
+#define COALESCE_BUFFER_SIZE 4096
+
 static status_t _init(const ifc_print_job_t *this_p, const char *printer_address, int port,
         const char *printer_uri, bool use_secure_uri);
 
@@ -34,13 +37,16 @@ static status_t _start_job(const ifc_print_job_t *this_p, const wprint_job_param
 
 static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length);
 
+static int _send_datav(const ifc_print_job_t *this_p, const struct iovec *iov, int iovcnt);
+
 static status_t _end_job(const ifc_print_job_t *this_p);
 
 static void _destroy(const ifc_print_job_t *this_p);
 
 static const ifc_print_job_t _print_job_ifc = {
         .init = _init, .validate_job = _validate_job, .start_job = _start_job,
-        .send_data = _send_data, .end_job = _end_job, .destroy = _destroy, .enable_timeout = NULL,
+        .send_data = _send_data, .send_datav = _send_datav, .end_job = _end_job,
+        .destroy = _destroy, .enable_timeout = NULL,
 };
 
 /*
@@ -86,7 +92,7 @@ static status_t _init(const ifc_print_job_t *this_p, const char *printer_address
 
     ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
     if (ipp_job->http != NULL) {
-        httpClose(ipp_job->http);
+        ipp_http_release(ipp_job->http);
     }
 
     if ((printer_uri == NULL) || (strlen(printer_uri) == 0)) {
@@ -101,14 +107,17 @@ static status_t _init(const ifc_print_job_t *this_p, const char *printer_address
             ipp_scheme, NULL, printer_address, ippPortNumber, printer_uri);
     getResourceFromURI(ipp_job->printer_uri, ipp_job->http_resource, 1024);
     if (use_secure_uri) {
-        ipp_job->http = httpConnectEncrypt(printer_address, ippPortNumber, HTTP_ENCRYPTION_ALWAYS);
+        ipp_job->http = ipp_http_connect(printer_address, ippPortNumber, HTTP_ENCRYPTION_ALWAYS,
+                NULL);
 
         // If ALWAYS doesn't work, fall back to REQUIRED
         if (ipp_job->http == NULL) {
-            ipp_job->http = httpConnectEncrypt(printer_address, ippPortNumber, HTTP_ENCRYPT_REQUIRED);
+            ipp_job->http = ipp_http_connect(printer_address, ippPortNumber,
+                    HTTP_ENCRYPT_REQUIRED, NULL);
         }
     } else {
-        ipp_job->http = httpConnectEncrypt(printer_address, ippPortNumber, HTTP_ENCRYPTION_IF_REQUESTED);
+        ipp_job->http = ipp_http_connect(printer_address, ippPortNumber,
+                HTTP_ENCRYPTION_IF_REQUESTED, NULL);
     }
 
     httpSetTimeout(ipp_job->http, DEFAULT_IPP_TIMEOUT, NULL, 0);
@@ -125,7 +134,7 @@ static void _destroy(const ifc_print_job_t *this_p) {
 
     ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
     if (ipp_job->http != NULL) {
-        httpClose(ipp_job->http);
+        ipp_http_release(ipp_job->http);
     }
 
     free(ipp_job);
@@ -551,6 +560,41 @@ static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t
     return ((ipp_job->status == HTTP_CONTINUE) ? length : (int) ERROR);
 }
 
+/*
+ * Small buffers, such as the PDF grammar between PCLm strips, are copied together so that each
+ * cupsWriteRequestData() call carries a useful amount of data. Larger buffers go out as they are.
+ */
+static int _send_datav(const ifc_print_job_t *this_p, const struct iovec *iov, int iovcnt) {
+    char pending[COALESCE_BUFFER_SIZE];
+    size_t used = 0, total = 0;
+    int i;
+
+    if (iov == NULL) {
+        return ERROR;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > sizeof(pending) - used) {
+            if ((used > 0) && (_send_data(this_p, pending, used) == ERROR)) {
+                return ERROR;
+            }
+            used = 0;
+        }
+        if (iov[i].iov_len <= sizeof(pending) - used) {
+            memcpy(pending + used, iov[i].iov_base, iov[i].iov_len);
+            used += iov[i].iov_len;
+        } else if (_send_data(this_p, iov[i].iov_base, iov[i].iov_len) == ERROR) {
+            return ERROR;
+        }
+        total += iov[i].iov_len;
+    }
+
+    if ((used > 0) && (_send_data(this_p, pending, used) == ERROR)) {
+        return ERROR;
+    }
+    return (int) total;
+}
+
 static status_t _end_job(const ifc_print_job_t *this_p) {
     LOGD("_end_job: Enter");
     status_t result = ERROR;
@@ -16,6 +16,9 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
+#include <time.h>
+
 #include "lib_wprint.h"
 #include "cups.h"
 #include "http-private.h"
@@ -27,6 +30,43 @@
 
 #define TAG "ipphelper"
 
+/* Number of idle printer connections kept for reuse */
+#define HTTP_POOL_SIZE 8
+
+/* Idle connections older than this, in seconds, are closed rather than reused */
+#define HTTP_POOL_MAX_IDLE 30
+
+/*
+ * An idle connection, kept for reuse by later requests to the same printer
+ */
+typedef struct {
+    http_t *http;
+    char host[HTTP_MAX_HOST];
+    int port;
+    http_encryption_t encryption;
+    time_t idle_since;
+} http_pool_entry_t;
+
+static http_pool_entry_t _http_pool[HTTP_POOL_SIZE];
+static pthread_mutex_t _http_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of printers whose negotiated IPP version is remembered */
+#define IPP_VERSIONS_SIZE 8
+
+/*
+ * The IPP version used for requests to a printer
+ */
+typedef struct {
+    char printer_uri[MAX_URI_LENGTH + 1];
+    int major;
+    int minor;
+    unsigned int last_used;
+} ipp_version_entry_t;
+
+static ipp_version_entry_t _ipp_versions[IPP_VERSIONS_SIZE];
+static unsigned int _ipp_versions_used = 0;
+static pthread_mutex_t _ipp_versions_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Get the IPP version of the given printer
  */
@@ -47,40 +87,6 @@ static void parse_IPPVersions(ipp_t *response, ipp_version_supported_t *ippVersi
  */
 static void parse_printerUris(ipp_t *response, printer_capabilities_t *capabilities);
 
-/*
- * Known media sizes.
- *
- * A note on rounding: In some cases the Android-specified width (in mils) is rounded down.
- * This causes artifacts in libjpeg-turbo when rendering to the correct width, so in these
- * cases we override with a rounded-up value.
- */
-struct MediaSizeTableElement SupportedMediaSizes[SUPPORTED_MEDIA_SIZE_COUNT] = {
-        { US_LETTER, "LETTER", 8500, 11000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_letter_8.5x11in" },
-        { US_LEGAL, "LEGAL", 8500, 14000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_legal_8.5x14in" },
-        { LEDGER, "LEDGER", 11000, 17000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_ledger_11x17in" },
-        { INDEX_CARD_5X7, "5X7", 5000, 7000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_5x7_5x7in" },
-
-        // Android system uses width of 11690
-        { ISO_A3, "A3", 11694, 16540, 297, 420, "iso_a3_297x420mm" },
-
-        // Android system uses width of 8267
-        { ISO_A4, "A4", 8268, 11692, 210, 297, "iso_a4_210x297mm" },
-        { ISO_A5, "A5", 5830, 8270, 148, 210, "iso_a5_148x210mm" },
-
-        // Android system uses width of 10118
-        { JIS_B4, "JIS B4", 10119, 14331, 257, 364, "jis_b4_257x364mm" },
-
-        // Android system uses width of 7165
-        { JIS_B5, "JIS B5", 7167, 10118, 182, 257, "jis_b5_182x257mm" },
-        { US_GOVERNMENT_LETTER, "8x10", 8000, 10000, UNKNOWN_VALUE, UNKNOWN_VALUE,
-        "na_govt-letter_8x10in" },
-        { INDEX_CARD_4X6, "4x6", 4000, 6000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_index-4x6_4x6in" },
-        { JPN_HAGAKI_PC, "JPOST", 3940, 5830, 100, 148, "jpn_hagaki_100x148mm" },
-        { PHOTO_89X119, "89X119", 3504, 4685, 89, 119, "om_dsc-photo_89x119mm" },
-        { CARD_54X86, "54X86", 2126, 3386, 54, 86, "om_card_54x86mm" },
-        { OE_PHOTO_L, "L", 3500, 5000, UNKNOWN_VALUE, UNKNOWN_VALUE, "oe_photo-l_3.5x5in" }
-};
-
 typedef struct {
     double Lower;
     double Upper;
@@ -88,19 +94,61 @@ typedef struct {
 
 static const char *__request_ipp_version[] = {"ipp-versions-supported"};
 
-static int __ipp_version_major = 2;
-static int __ipp_version_minor = 0;
+/*
+ * Returns the IPP version entry of printer_uri, starting it at 2.0 in the least recently used
+ * entry if there is none. Must be called with _ipp_versions_lock held.
+ */
+static ipp_version_entry_t *_ipp_version_entry(const char *printer_uri) {
+    ipp_version_entry_t *entry = &_ipp_versions[0];
+    int i;
+
+    if (printer_uri == NULL) {
+        printer_uri = "";
+    }
+    for (i = 0; i < IPP_VERSIONS_SIZE; i++) {
+        if (strcmp(_ipp_versions[i].printer_uri, printer_uri) == 0) {
+            entry = &_ipp_versions[i];
+            break;
+        }
+        if (_ipp_versions[i].last_used < entry->last_used) {
+            entry = &_ipp_versions[i];
+        }
+    }
+
+    if (i == IPP_VERSIONS_SIZE) {
+        strlcpy(entry->printer_uri, printer_uri, sizeof(entry->printer_uri));
+        entry->major = 2;
+        entry->minor = 0;
+    }
+    entry->last_used = ++_ipp_versions_used;
+    return entry;
+}
+
+/*
+ * Records the IPP version to use for requests to printer_uri
+ */
+static void _set_printer_ipp_version(const char *printer_uri, int major, int minor) {
+    ipp_version_entry_t *entry;
+
+    pthread_mutex_lock(&_ipp_versions_lock);
+    entry = _ipp_version_entry(printer_uri);
+    entry->major = major;
+    entry->minor = minor;
+    pthread_mutex_unlock(&_ipp_versions_lock);
+}
 
 status_t set_ipp_version(ipp_t *op_to_set, char *printer_uri, http_t *http,
         ipp_version_state use_existing_version) {
+    ipp_version_entry_t *entry;
+    int major, minor;
+
     LOGD("set_ipp_version(): Enter %d", use_existing_version);
     if (op_to_set == NULL) {
         return ERROR;
     }
     switch (use_existing_version) {
         case NEW_REQUEST_SEQUENCE:
-            __ipp_version_major = 2;
-            __ipp_version_minor = 0;
+            _set_printer_ipp_version(printer_uri, 2, 0);
             break;
         case IPP_VERSION_RESOLVED:
             break;
@@ -110,7 +158,15 @@ status_t set_ipp_version(ipp_t *op_to_set, char *printer_uri, http_t *http,
             }
             break;
     }
-    ippSetVersion(op_to_set, __ipp_version_major, __ipp_version_minor);
+
+    // Each printer keeps its own version, so concurrent jobs cannot change each other's
+    pthread_mutex_lock(&_ipp_versions_lock);
+    entry = _ipp_version_entry(printer_uri);
+    major = entry->major;
+    minor = entry->minor;
+    pthread_mutex_unlock(&_ipp_versions_lock);
+
+    ippSetVersion(op_to_set, major, minor);
     LOGD("set_ipp_version(): Done");
     return OK;
 }
@@ -196,23 +252,17 @@ static status_t test_and_set_ipp_version(char *printer_uri, http_t *http, int ma
 
             parse_IPPVersions(response, &ippVersions);
             if (ippVersions.supportsIpp20) {
-                __ipp_version_major = 2;
-                __ipp_version_minor = 0;
+                _set_printer_ipp_version(printer_uri, 2, 0);
                 return_value = OK;
-                LOGD("test_and_set_ipp_version(): ipp version set to %d,%d",
-                        __ipp_version_major, __ipp_version_minor);
+                LOGD("test_and_set_ipp_version(): ipp version set to 2,0");
             } else if (ippVersions.supportsIpp11) {
-                __ipp_version_major = 1;
-                __ipp_version_minor = 1;
+                _set_printer_ipp_version(printer_uri, 1, 1);
                 return_value = OK;
-                LOGD("test_and_set_ipp_version(): ipp version set to %d,%d",
-                        __ipp_version_major, __ipp_version_minor);
+                LOGD("test_and_set_ipp_version(): ipp version set to 1,1");
             } else if (ippVersions.supportsIpp10) {
-                __ipp_version_major = 1;
-                __ipp_version_minor = 0;
+                _set_printer_ipp_version(printer_uri, 1, 0);
                 return_value = OK;
-                LOGD("test_and_set_ipp_version(): ipp version set to %d,%d",
-                        __ipp_version_major, __ipp_version_minor);
+                LOGD("test_and_set_ipp_version(): ipp version set to 1,0");
             } else {
                 LOGD("test_and_set_ipp_version: ipp version not found");
                 return_value = ERROR;
@@ -1194,6 +1244,128 @@ static int ipp_server_cert_cb(http_t *http, void *tls, cups_array_t *certs, void
     return error;
 }
 
+/*
+ * Closes pooled connections that have been idle too long. Must be called with _http_pool_lock
+ * held.
+ */
+static void _http_pool_evict(time_t now) {
+    int i;
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        if ((_http_pool[i].http != NULL) &&
+                (now - _http_pool[i].idle_since >= HTTP_POOL_MAX_IDLE)) {
+            httpClose(_http_pool[i].http);
+            _http_pool[i].http = NULL;
+        }
+    }
+}
+
+/*
+ * Returns true if a secure connection's certificate is accepted by connect_info, the same as it
+ * would be for a new connection
+ */
+static bool _http_pool_cert_allowed(http_t *http, const wprint_connect_info_t *connect_info) {
+    cups_array_t *certs = NULL;
+    bool allowed = false;
+
+    if ((connect_info == NULL) || (connect_info->validate_certificate == NULL) ||
+            (http->tls == NULL)) {
+        return true;
+    }
+
+    if (httpCopyCredentials(http, &certs) == 0) {
+        allowed = (ipp_server_cert_cb(http, NULL, certs, (void *) connect_info) == 0);
+        httpFreeCredentials(certs);
+    }
+    return allowed;
+}
+
+http_t *ipp_http_connect(const char *host, int port, http_encryption_t encryption,
+        const wprint_connect_info_t *connect_info) {
+    http_t *http = NULL;
+    time_t now = time(NULL);
+    int i;
+
+    pthread_mutex_lock(&_http_pool_lock);
+    _http_pool_evict(now);
+    for (i = 0; (i < HTTP_POOL_SIZE) && (http == NULL); i++) {
+        if ((_http_pool[i].http != NULL) && (_http_pool[i].port == port) &&
+                (_http_pool[i].encryption == encryption) &&
+                (strcmp(_http_pool[i].host, host) == 0)) {
+            http = _http_pool[i].http;
+            _http_pool[i].http = NULL;
+        }
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+
+    if (http != NULL) {
+        // An idle connection has nothing to read unless the printer closed it
+        if ((http->fd < 0) || httpWait(http, 0) || !_http_pool_cert_allowed(http, connect_info)) {
+            LOGD("ipp_http_connect: discarding stale connection to %s:%d", host, port);
+            httpClose(http);
+            http = NULL;
+        } else {
+            LOGD("ipp_http_connect: reusing connection to %s:%d", host, port);
+            return http;
+        }
+    }
+
+    return httpConnectEncrypt(host, port, encryption);
+}
+
+void ipp_http_release(http_t *http) {
+    http_pool_entry_t *entry = NULL;
+    time_t now = time(NULL);
+    int i;
+
+    if (http == NULL) {
+        return;
+    }
+
+    // Only a connection with no request in progress can be handed to another user
+    if ((http->fd < 0) || (http->state != HTTP_STATE_WAITING) || http->error ||
+            (http->keep_alive == HTTP_KEEPALIVE_OFF)) {
+        httpClose(http);
+        return;
+    }
+
+    pthread_mutex_lock(&_http_pool_lock);
+    _http_pool_evict(now);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (_http_pool[i].http == NULL) {
+            entry = &_http_pool[i];
+            break;
+        }
+        if ((entry == NULL) || (_http_pool[i].idle_since < entry->idle_since)) {
+            entry = &_http_pool[i];
+        }
+    }
+
+    // Make room by closing the longest idle connection
+    if (entry->http != NULL) {
+        httpClose(entry->http);
+    }
+
+    entry->http = http;
+    strlcpy(entry->host, http->hostname, sizeof(entry->host));
+    entry->port = httpAddrPort(http->hostaddr);
+    entry->encryption = http->encryption;
+    entry->idle_since = now;
+    pthread_mutex_unlock(&_http_pool_lock);
+}
+
+void ipp_http_pool_flush(void) {
+    int i;
+
+    pthread_mutex_lock(&_http_pool_lock);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (_http_pool[i].http != NULL) {
+            httpClose(_http_pool[i].http);
+            _http_pool[i].http = NULL;
+        }
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+}
+
 http_t *ipp_cups_connect(const wprint_connect_info_t *connect_info, char *printer_uri,
         unsigned int uriLength) {
     const char *uri_path;
@@ -1210,14 +1382,17 @@ http_t *ipp_cups_connect(const wprint_connect_info_t *connect_info, char *printe
     int ippPortNumber = ((connect_info->port_num == IPP_PORT) ? ippPort() : connect_info->port_num);
 
     if (strstr(connect_info->uri_scheme,IPPS_PREFIX) != NULL) {
-        curl_http = httpConnectEncrypt(connect_info->printer_addr, ippPortNumber, HTTP_ENCRYPTION_ALWAYS);
+        curl_http = ipp_http_connect(connect_info->printer_addr, ippPortNumber,
+                HTTP_ENCRYPTION_ALWAYS, connect_info);
 
         // If ALWAYS doesn't work, fall back to REQUIRED
         if (curl_http == NULL) {
-            curl_http = httpConnectEncrypt(connect_info->printer_addr, ippPortNumber, HTTP_ENCRYPT_REQUIRED);
+            curl_http = ipp_http_connect(connect_info->printer_addr, ippPortNumber,
+                    HTTP_ENCRYPT_REQUIRED, connect_info);
         }
     } else {
-        curl_http = httpConnectEncrypt(connect_info->printer_addr, ippPortNumber, HTTP_ENCRYPTION_IF_REQUESTED);
+        curl_http = ipp_http_connect(connect_info->printer_addr, ippPortNumber,
+                HTTP_ENCRYPTION_IF_REQUESTED, connect_info);
     }
 
     httpSetTimeout(curl_http, (double)connect_info->timeout / 1000, NULL, 0);
@@ -90,7 +90,7 @@ extern void get_PrinterStateReason(ipp_t *response, ipp_pstate_t *printer_state,
 extern void parse_printerAttributes(ipp_t *response, printer_capabilities_t *capabilities);
 
 /*
- * Sets IPP version
+ * Sets the IPP version of a request to the one negotiated with the printer at printer_uri
  */
 extern status_t set_ipp_version(ipp_t *, char *, http_t *, ipp_version_state);
 
@@ -138,6 +138,24 @@ extern void getResourceFromURI(const char *uri, char *resource, int resourcelen)
 http_t *ipp_cups_connect(const wprint_connect_info_t *info, char *printer_uri,
         unsigned int uriLength);
 
+/*
+ * Returns a connection to host:port with the given encryption, reusing an idle pooled
+ * connection when a healthy one exists. connect_info, if not NULL, is used to check the
+ * certificate of a reused secure connection. Return the connection with ipp_http_release().
+ */
+http_t *ipp_http_connect(const char *host, int port, http_encryption_t encryption,
+        const wprint_connect_info_t *connect_info);
+
+/*
+ * Returns a connection to the pool if it can be reused, or closes it
+ */
+void ipp_http_release(http_t *http);
+
+/*
+ * Closes all pooled connections
+ */
+void ipp_http_pool_flush(void);
+
 /*
  * Executes a CUPS request with the given ipp request structure
  */
@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
 #include "lib_wprint.h"
 #include "ippstatus_capabilities.h"   // move these to above the calls to cups files
 #include "ipphelper.h"
@@ -28,6 +30,19 @@
 
 #define TAG "ippstatus_capabilities"
 
+/* Number of printers whose capabilities are remembered */
+#define CAPS_CACHE_SIZE 4
+
+/* Cached capabilities validated less than this many seconds ago are used as-is */
+#define CAPS_CACHE_FRESH 30
+
+/* Cached capabilities validated this many seconds ago or more are fetched again in full */
+#define CAPS_CACHE_MAX_AGE (10 * 60)
+
+/* Attributes that change when cached capabilities may no longer be accurate */
+#define CONFIG_CHANGE_TIME "printer-config-change-time"
+#define STATE_CHANGE_TIME "printer-state-change-time"
+
 /*
  * Requested printer attributes
  */
@@ -64,9 +79,33 @@ static const char *pattrs[] = {
         "pclm-strip-height-preferred",
         "pclm-compression-method-preferred",
         "pclm-source-resolution-supported",
-        "document-format-details-supported"
+        "document-format-details-supported",
+        CONFIG_CHANGE_TIME,
+        STATE_CHANGE_TIME
+};
+
+static const char *change_time_attrs[] = {
+        CONFIG_CHANGE_TIME,
+        STATE_CHANGE_TIME
 };
 
+/*
+ * Parsed capabilities of a printer, with what is needed to check they are still current
+ */
+typedef struct {
+    bool valid;
+    char printer_addr[HTTP_MAX_HOST];
+    char printer_uri[MAX_URI_LENGTH + 1];
+    printer_capabilities_t caps;
+    int config_change_time; // -1 if not reported
+    int state_change_time; // -1 if not reported
+    time_t validated;
+    time_t last_used;
+} caps_cache_entry_t;
+
+static caps_cache_entry_t _caps_cache[CAPS_CACHE_SIZE];
+static pthread_mutex_t _caps_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void _init(const ifc_printer_capabilities_t *this_p,
         const wprint_connect_info_t *info);
 
@@ -82,6 +121,7 @@ static ifc_printer_capabilities_t _capabilities_ifc = {
 
 typedef struct {
     http_t *http;
+    char printer_addr[HTTP_MAX_HOST];
     printer_capabilities_t printer_caps;
     ifc_printer_capabilities_t ifc;
 } ipp_capabilities_t;
@@ -112,9 +152,10 @@ static void _init(const ifc_printer_capabilities_t *this_p,
 
         if (caps->http != NULL) {
             LOGD("_init(): http != NULL closing HTTP");
-            httpClose(caps->http);
+            ipp_http_release(caps->http);
         }
 
+        strlcpy(caps->printer_addr, connect_info->printer_addr, sizeof(caps->printer_addr));
         caps->http = ipp_cups_connect(connect_info, caps->printer_caps.printerUri,
                 sizeof(caps->printer_caps.printerUri));
         getResourceFromURI(caps->printer_caps.printerUri, caps->printer_caps.httpResource, 1024);
@@ -124,6 +165,157 @@ static void _init(const ifc_printer_capabilities_t *this_p,
     } while (0);
 }
 
+/*
+ * Returns the value of an integer attribute in response, or -1 if it is missing
+ */
+static int _get_change_time(ipp_t *response, const char *name) {
+    ipp_attribute_t *attrptr = ippFindAttribute(response, name, IPP_TAG_INTEGER);
+    return (attrptr == NULL) ? -1 : ippGetInteger(attrptr, 0);
+}
+
+/*
+ * Returns the cache entry for printer_uri, or NULL. Must be called with _caps_cache_lock held.
+ */
+static caps_cache_entry_t *_caps_cache_find(const char *printer_uri) {
+    int i;
+    for (i = 0; i < CAPS_CACHE_SIZE; i++) {
+        if (_caps_cache[i].valid && (strcmp(_caps_cache[i].printer_uri, printer_uri) == 0)) {
+            return &_caps_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Asks the printer only for its change times and returns true if they match the given ones
+ */
+static bool _caps_unchanged(ipp_capabilities_t *caps, int config_change_time,
+        int state_change_time) {
+    ipp_t *request;
+    ipp_t *response;
+    bool unchanged = false;
+
+    // Without a change time there is nothing cheaper than a full fetch
+    if ((config_change_time < 0) && (state_change_time < 0)) {
+        return false;
+    }
+
+    request = ippNewRequest(IPP_GET_PRINTER_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
+            caps->printer_caps.printerUri);
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes",
+            sizeof(change_time_attrs) / sizeof(change_time_attrs[0]), NULL, change_time_attrs);
+
+    response = ipp_doCupsRequest(caps->http, request, caps->printer_caps.httpResource,
+            caps->printer_caps.printerUri);
+    if ((response != NULL) && (cupsLastError() < IPP_REDIRECTION_OTHER_SITE)) {
+        // State changes with every job, so prefer the config change time when there is one
+        if (config_change_time >= 0) {
+            unchanged = (_get_change_time(response, CONFIG_CHANGE_TIME) == config_change_time);
+        } else {
+            unchanged = (_get_change_time(response, STATE_CHANGE_TIME) == state_change_time);
+        }
+    }
+
+    ippDelete(response);
+    ippDelete(request);
+    return unchanged;
+}
+
+/*
+ * Copies cached capabilities for this printer into capabilities and returns true if they are
+ * still current, checking with the printer if they have not been validated recently
+ */
+static bool _get_cached_capabilities(ipp_capabilities_t *caps,
+        printer_capabilities_t *capabilities) {
+    caps_cache_entry_t *entry;
+    time_t now = time(NULL);
+    int config_change_time, state_change_time;
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    entry = _caps_cache_find(caps->printer_caps.printerUri);
+    if ((entry == NULL) || (now - entry->validated >= CAPS_CACHE_MAX_AGE)) {
+        pthread_mutex_unlock(&_caps_cache_lock);
+        return false;
+    }
+
+    if (now - entry->validated >= CAPS_CACHE_FRESH) {
+        config_change_time = entry->config_change_time;
+        state_change_time = entry->state_change_time;
+        pthread_mutex_unlock(&_caps_cache_lock);
+
+        if (!_caps_unchanged(caps, config_change_time, state_change_time)) {
+            LOGD("_get_cached_capabilities: %s changed", caps->printer_caps.printerUri);
+            return false;
+        }
+
+        pthread_mutex_lock(&_caps_cache_lock);
+        entry = _caps_cache_find(caps->printer_caps.printerUri);
+        if (entry == NULL) {
+            pthread_mutex_unlock(&_caps_cache_lock);
+            return false;
+        }
+        entry->validated = now;
+    }
+
+    memcpy(capabilities, &entry->caps, sizeof(printer_capabilities_t));
+    entry->last_used = now;
+    pthread_mutex_unlock(&_caps_cache_lock);
+
+    LOGD("_get_cached_capabilities: using cached %s", caps->printer_caps.printerUri);
+    return true;
+}
+
+/*
+ * Stores freshly fetched capabilities, replacing the least recently used entry if needed
+ */
+static void _cache_capabilities(ipp_capabilities_t *caps,
+        const printer_capabilities_t *capabilities, ipp_t *response) {
+    caps_cache_entry_t *entry;
+    time_t now = time(NULL);
+    int i;
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    entry = _caps_cache_find(caps->printer_caps.printerUri);
+    for (i = 0; (entry == NULL) && (i < CAPS_CACHE_SIZE); i++) {
+        if (!_caps_cache[i].valid) {
+            entry = &_caps_cache[i];
+        }
+    }
+
+    if (entry == NULL) {
+        entry = &_caps_cache[0];
+        for (i = 1; i < CAPS_CACHE_SIZE; i++) {
+            if (_caps_cache[i].last_used < entry->last_used) {
+                entry = &_caps_cache[i];
+            }
+        }
+    }
+
+    entry->valid = true;
+    strlcpy(entry->printer_addr, caps->printer_addr, sizeof(entry->printer_addr));
+    strlcpy(entry->printer_uri, caps->printer_caps.printerUri, sizeof(entry->printer_uri));
+    memcpy(&entry->caps, capabilities, sizeof(printer_capabilities_t));
+    entry->config_change_time = _get_change_time(response, CONFIG_CHANGE_TIME);
+    entry->state_change_time = _get_change_time(response, STATE_CHANGE_TIME);
+    entry->validated = now;
+    entry->last_used = now;
+    pthread_mutex_unlock(&_caps_cache_lock);
+}
+
+void ipp_capabilities_invalidate(const char *printer_addr) {
+    int i;
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    for (i = 0; i < CAPS_CACHE_SIZE; i++) {
+        if ((printer_addr == NULL) ||
+                (strcmp(_caps_cache[i].printer_addr, printer_addr) == 0)) {
+            _caps_cache[i].valid = false;
+        }
+    }
+    pthread_mutex_unlock(&_caps_cache_lock);
+}
+
 static status_t _get_capabilities(const ifc_printer_capabilities_t *this_p,
         printer_capabilities_t *capabilities) {
     LOGD("_get_capabilities: Enter");
@@ -151,6 +343,11 @@ static status_t _get_capabilities(const ifc_printer_capabilities_t *this_p,
             break;
         }
 
+        if ((capabilities != NULL) && _get_cached_capabilities(caps, capabilities)) {
+            result = OK;
+            break;
+        }
+
         request = ippNewRequest(op);
 
         ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
@@ -196,14 +393,17 @@ static status_t _get_capabilities(const ifc_printer_capabilities_t *this_p,
         }
     } while (0);
 
-    ippDelete(response);
-    ippDelete(request);
-
     if ((caps != NULL) && (capabilities != NULL)) {
         memcpy(capabilities->httpResource, caps->printer_caps.httpResource,
                 sizeof(capabilities->httpResource));
+        if ((result == OK) && (response != NULL)) {
+            _cache_capabilities(caps, capabilities, response);
+        }
     }
 
+    ippDelete(response);
+    ippDelete(request);
+
     LOGI(" ippstatus_capabilities: _get_capabilities: returning %d:", result);
     return result;
 }
@@ -218,7 +418,7 @@ static void _destroy(const ifc_printer_capabilities_t *this_p) {
 
         caps = IMPL(ipp_capabilities_t, ifc, this_p);
         if (caps->http != NULL) {
-            httpClose(caps->http);
+            ipp_http_release(caps->http);
         }
         free(caps);
     } while (0);
@@ -32,6 +32,12 @@ extern "C" {
 extern const ifc_printer_capabilities_t
         *ipp_status_get_capabilities_ifc(const ifc_wprint_t *wprint_ifc);
 
+/*
+ * Drops cached capabilities of the printer at printer_addr, or of all printers if NULL, so they
+ * are fetched again in full on next use
+ */
+extern void ipp_capabilities_invalidate(const char *printer_addr);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
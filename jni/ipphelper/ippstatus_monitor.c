@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <semaphore.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #include "lib_wprint.h"
 #include "ippstatus_monitor.h"
@@ -36,6 +38,13 @@
 
 #define TAG "ippstatus_monitor"
 
+/*
+ * Bounds on the status polling interval, in milliseconds. Polling is fast while the printer state
+ * is changing, such as around the start and end of a job, and backs off while it holds steady.
+ */
+#define MIN_POLL_INTERVAL_MS 250
+#define MAX_POLL_INTERVAL_MS 2000
+
 static void _init(const ifc_status_monitor_t *this_p, const wprint_connect_info_t *);
 
 static void _get_status(const ifc_status_monitor_t *this_p, printer_state_dyn_t *printer_state_dyn);
@@ -46,12 +55,15 @@ static void _start(const ifc_status_monitor_t *this_p, void (*status_cb)(
 
 static void _stop(const ifc_status_monitor_t *this_p);
 
+static void _poll_soon(const ifc_status_monitor_t *this_p);
+
 static status_t _cancel(const ifc_status_monitor_t *this_p, const char *requesting_user);
 
 static void _destroy(const ifc_status_monitor_t *this_p);
 
 static const ifc_status_monitor_t _status_ifc = {.init = _init, .get_status = _get_status,
-        .cancel = _cancel, .start = _start, .stop = _stop, .destroy = _destroy,};
+        .cancel = _cancel, .start = _start, .stop = _stop, .poll_soon = _poll_soon,
+        .destroy = _destroy,};
 
 typedef struct {
     unsigned char initialized;
@@ -94,7 +106,7 @@ static void _init(const ifc_status_monitor_t *this_p, const wprint_connect_info_
         }
 
         if (monitor->http != NULL) {
-            httpClose(monitor->http);
+            ipp_http_release(monitor->http);
         }
 
         monitor->http = ipp_cups_connect(connect_info, monitor->printer_uri,
@@ -132,7 +144,7 @@ static void _destroy(const ifc_status_monitor_t *this_p) {
         }
 
         if (monitor->http != NULL) {
-            httpClose(monitor->http);
+            ipp_http_release(monitor->http);
         }
 
         free(monitor);
@@ -183,6 +195,27 @@ static void _get_status(const ifc_status_monitor_t *this_p,
     } while (0);
 }
 
+/*
+ * Waits up to timeout_ms for the monitor to be stopped or poked. Returns true if it was.
+ */
+static bool _wait_for_wakeup(ipp_monitor_t *monitor, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (sem_timedwait(&monitor->monitor_sem, &deadline) != 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void _start(const ifc_status_monitor_t *this_p,
         void (*status_cb)(const printer_state_dyn_t *new_status,
                 const printer_state_dyn_t *old_status, void *status_param),
@@ -232,7 +265,9 @@ static void _start(const ifc_status_monitor_t *this_p,
             if (status_cb != NULL) {
                 (*status_cb)(&curr_status, &last_status, param);
             }
-            sem_wait(&monitor->monitor_sem);
+            while (!monitor->stop_monitor) {
+                sem_wait(&monitor->monitor_sem);
+            }
 
             last_status.printer_status = PRINT_STATUS_UNKNOWN;
             last_status.printer_reasons[0] = PRINT_STATUS_SHUTTING_DOWN;
@@ -240,16 +275,24 @@ static void _start(const ifc_status_monitor_t *this_p,
             curr_status.printer_status = PRINT_STATUS_UNKNOWN;
             curr_status.printer_reasons[0] = PRINT_STATUS_SHUTTING_DOWN;
         } else {
+            int poll_interval = MIN_POLL_INTERVAL_MS;
             while (!monitor->stop_monitor) {
                 pthread_mutex_lock(&monitor->mutex);
                 _get_status(this_p, &curr_status);
                 pthread_mutex_unlock(&monitor->mutex);
-                if ((status_cb != NULL) &&
-                        (memcmp(&curr_status, &last_status, sizeof(printer_state_dyn_t)) != 0)) {
-                    (*status_cb)(&curr_status, &last_status, param);
+                if (memcmp(&curr_status, &last_status, sizeof(printer_state_dyn_t)) != 0) {
+                    if (status_cb != NULL) {
+                        (*status_cb)(&curr_status, &last_status, param);
+                    }
                     memcpy(&last_status, &curr_status, sizeof(printer_state_dyn_t));
+                    poll_interval = MIN_POLL_INTERVAL_MS;
+                } else if (poll_interval < MAX_POLL_INTERVAL_MS) {
+                    poll_interval *= 2;
+                }
+
+                if (_wait_for_wakeup(monitor, poll_interval)) {
+                    poll_interval = MIN_POLL_INTERVAL_MS;
                 }
-                sleep(1);
             }
         }
         monitor->monitor_running = 0;
@@ -274,8 +317,32 @@ static void _stop(const ifc_status_monitor_t *this_p) {
             continue;
         }
 
-        sem_post(&monitor->monitor_sem);
+        // set the flag first so the woken monitor sees it
         monitor->stop_monitor = 1;
+        sem_post(&monitor->monitor_sem);
+    } while (0);
+}
+
+static void _poll_soon(const ifc_status_monitor_t *this_p) {
+    ipp_monitor_t *monitor;
+    int pending;
+    LOGD("_poll_soon(): enter");
+    do {
+        if (this_p == NULL) {
+            continue;
+        }
+
+        monitor = IMPL(ipp_monitor_t, ifc, this_p);
+        if (!monitor->initialized || !monitor->monitor_running) {
+            continue;
+        }
+
+        // One pending wakeup is enough however many callers ask. monitor->mutex is held across
+        // status requests, so the semaphore's count is checked instead of a flag under it.
+        if ((sem_getvalue(&monitor->monitor_sem, &pending) == 0) && (pending > 0)) {
+            continue;
+        }
+        sem_post(&monitor->monitor_sem);
     } while (0);
 }
 
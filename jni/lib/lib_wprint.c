@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -63,13 +65,26 @@
 #define _DEFAULT_PCL_TYPE      PCLm
 #endif // (USE_PWG_OVER_PCLM != 0)
 
+// Pages rendered ahead of the one printing, and the memory they may hold
+#define _DEFAULT_RENDER_AHEAD_PAGES  1
+#define _DEFAULT_RENDER_AHEAD_BYTES  (64 * 1024 * 1024)
+
 #define _MAX_SPOOLED_JOBS     100
 #define _MAX_MSGS             (_MAX_SPOOLED_JOBS * 5)
 
 #define _MAX_PAGES_PER_JOB   1000
 
+// Longest wprintPage waits for room in a full pageQ before checking the job is still live
+#define _PAGE_SEND_WAIT_MS   100
+
+// Jobs for different printers run in parallel on up to this many threads
+#define _MAX_JOB_THREADS     4
+
 #define MAX_IDLE_WAIT        (5 * 60)
 
+// Longest pause, in seconds, between status checks while waiting for a busy printer
+#define MAX_IDLE_POLL_INTERVAL (4)
+
 #define DEFAULT_RESOLUTION   (300)
 
 // When searching for a supported resolution this is the max resolution we will consider.
@@ -158,6 +173,19 @@ typedef struct {
     /* A buffer of bytes containing the certificate received while setting up this job, if any. */
     uint8 *certificate;
     int certificate_len;
+
+    /* Order in which the job was started, used to run jobs for one printer in order */
+    unsigned long sequence;
+
+    /* True while a job thread is running this job */
+    bool claimed;
+
+    /* wprintPage() calls waiting without the lock for room in pageQ */
+    int page_senders;
+
+    pthread_t status_tid;
+    sem_t start_wait_sem;
+    sem_t end_wait_sem;
 } _job_queue_t;
 
 /*
@@ -186,14 +214,20 @@ typedef struct {
 static _job_queue_t _job_queue[_MAX_SPOOLED_JOBS];
 static msg_q_id _msgQ;
 
-static pthread_t _job_status_tid;
-static pthread_t _job_tid;
+static pthread_t _job_tids[_MAX_JOB_THREADS];
+static int _num_job_threads;
 
 static pthread_mutex_t _q_lock;
 static pthread_mutexattr_t _q_lock_attr;
 
-static sem_t _job_end_wait_sem;
-static sem_t _job_start_wait_sem;
+// Signalled, with _q_lock held, when a running job is cancelled
+static pthread_cond_t _job_cancelled;
+
+// Signalled, with _q_lock held, when a job thread lets go of a job or its last page sender returns
+static pthread_cond_t _job_released;
+
+// Set by wprintExit so job threads drop jobs they have yet to start
+static bool _stopping;
 
 static _io_plugin_t _io_plugins[2];
 
@@ -418,6 +452,46 @@ static void _unlock(void) {
     pthread_mutex_unlock(&_q_lock);
 }
 
+/*
+ * Sets deadline to timeout_ms from now on CLOCK_REALTIME
+ */
+static void _get_deadline(int timeout_ms, struct timespec *deadline) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * Waits up to timeout_ms for sem to be posted. Returns OK if it was, else ERROR.
+ */
+static int _wait_for_sem(sem_t *sem, int timeout_ms) {
+    struct timespec deadline;
+    _get_deadline(timeout_ms, &deadline);
+
+    while (sem_timedwait(sem, &deadline) != 0) {
+        if (errno != EINTR) {
+            return ERROR;
+        }
+    }
+    return OK;
+}
+
+/*
+ * Waits up to timeout_ms for jq to be cancelled. Must be called holding the lock exactly once.
+ */
+static void _wait_for_cancel(_job_queue_t *jq, int timeout_ms) {
+    struct timespec deadline;
+    _get_deadline(timeout_ms, &deadline);
+
+    while (!jq->job_params.cancelled &&
+            (pthread_cond_timedwait(&_job_cancelled, &_q_lock, &deadline) != ETIMEDOUT)) {
+    }
+}
+
 static wJob_t _get_handle(void) {
     static unsigned long _running_number = 0;
     wJob_t job_handle = WPRINT_BAD_JOB_HANDLE;
@@ -445,6 +519,10 @@ static wJob_t _get_handle(void) {
 
                 _job_queue[index].job_state = JOB_STATE_QUEUED;
                 _job_queue[index].job_handle = _ENCODE_HANDLE(index);
+                _job_queue[index].sequence = _running_number;
+                _job_queue[index].status_tid = pthread_self();
+                sem_init(&_job_queue[index].start_wait_sem, 0, 0);
+                sem_init(&_job_queue[index].end_wait_sem, 0, 0);
 
                 job_handle = _job_queue[index].job_handle;
             }
@@ -474,6 +552,8 @@ static int _recycle_handle(wJob_t job_handle) {
             free((void *) jq->job_params.useragent);
         }
         free(jq->printer_addr);
+        sem_destroy(&jq->start_wait_sem);
+        sem_destroy(&jq->end_wait_sem);
         jq->job_state = JOB_STATE_FREE;
         if (jq->job_debug_fd != -1) {
             close(jq->job_debug_fd);
@@ -498,25 +578,58 @@ static int _recycle_handle(wJob_t job_handle) {
  * Stops the job status thread if it exists
  */
 static int _stop_status_thread(_job_queue_t *jq) {
-    if (!pthread_equal(_job_status_tid, pthread_self()) && (jq && jq->status_ifc)) {
+    if (jq && !pthread_equal(jq->status_tid, pthread_self()) && jq->status_ifc) {
         (jq->status_ifc->stop)(jq->status_ifc);
         _unlock();
-        pthread_join(_job_status_tid, 0);
+        pthread_join(jq->status_tid, 0);
         _lock();
-        _job_status_tid = pthread_self();
+        jq->status_tid = pthread_self();
         return OK;
     } else {
         return ERROR;
     }
 }
 
+/*
+ * Returns true if a job for the same printer that was started before jq has yet to finish
+ */
+static bool _printer_busy(const _job_queue_t *jq) {
+    int i;
+    for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
+        const _job_queue_t *other = &_job_queue[i];
+        if ((other != jq) && (other->claimed || (other->job_state == JOB_STATE_QUEUED)) &&
+                (other->sequence < jq->sequence) &&
+                (strcmp(other->printer_addr, jq->printer_addr) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns the oldest queued job whose printer is not busy with an earlier job, or NULL. Must be
+ * called with the lock held.
+ */
+static _job_queue_t *_next_runnable_job(void) {
+    _job_queue_t *next = NULL;
+    int i;
+    for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
+        _job_queue_t *jq = &_job_queue[i];
+        if ((jq->job_state == JOB_STATE_QUEUED) && !jq->claimed &&
+                ((next == NULL) || (jq->sequence < next->sequence)) && !_printer_busy(jq)) {
+            next = jq;
+        }
+    }
+    return next;
+}
+
 /*
  * Handles a new status message from the printer. Based on the status of wprint and the printer,
  * this function will start/end a job, send another page, or return blocking errors.
  */
 static void _job_status_callback(const printer_state_dyn_t *new_status,
         const printer_state_dyn_t *old_status, void *param) {
-    wprint_job_callback_params_t cb_param;
+    wprint_job_callback_params_t cb_param = { 0 };
     _job_queue_t *jq = (_job_queue_t *) param;
     unsigned int i, blocked_reasons;
     print_status_t statusnew, statusold;
@@ -540,8 +653,8 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
         case PRINT_STATUS_UNKNOWN:
             if ((new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE)
                     || (new_status->printer_reasons[0] == PRINT_STATUS_UNKNOWN)) {
-                sem_post(&_job_start_wait_sem);
-                sem_post(&_job_end_wait_sem);
+                sem_post(&jq->start_wait_sem);
+                sem_post(&jq->end_wait_sem);
                 _lock();
                 if ((new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE)
                         && ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL))) {
@@ -557,20 +670,20 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                 if (jq->is_dir && !jq->last_page_seen) {
                     wprintPage(jq->job_handle, jq->num_pages + 1, NULL, true, false, 0, 0, 0, 0);
                 }
-                sem_post(&_job_end_wait_sem);
+                sem_post(&jq->end_wait_sem);
             }
             break;
 
         case PRINT_STATUS_CANCELLED:
-            sem_post(&_job_start_wait_sem);
+            sem_post(&jq->start_wait_sem);
             if ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL)) {
                 jq->print_ifc->enable_timeout(jq->print_ifc, 1);
             }
             if (statusold != PRINT_STATUS_CANCELLED) {
                 LOGI("status requested job cancel");
                 if (new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE) {
-                    sem_post(&_job_start_wait_sem);
-                    sem_post(&_job_end_wait_sem);
+                    sem_post(&jq->start_wait_sem);
+                    sem_post(&jq->end_wait_sem);
                     if ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL)) {
                         jq->print_ifc->enable_timeout(jq->print_ifc, 1);
                     }
@@ -580,13 +693,13 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                 _unlock();
             }
             if (new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE) {
-                sem_post(&_job_start_wait_sem);
-                sem_post(&_job_end_wait_sem);
+                sem_post(&jq->start_wait_sem);
+                sem_post(&jq->end_wait_sem);
             }
             break;
 
         case PRINT_STATUS_PRINTING:
-            sem_post(&_job_start_wait_sem);
+            sem_post(&jq->start_wait_sem);
             _lock();
             if ((jq->job_state != JOB_STATE_RUNNING) || (jq->blocked_reasons != blocked_reasons)) {
                 jq->job_state = JOB_STATE_RUNNING;
@@ -603,7 +716,7 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
             break;
 
         case PRINT_STATUS_UNABLE_TO_CONNECT:
-            sem_post(&_job_start_wait_sem);
+            sem_post(&jq->start_wait_sem);
             _lock();
             _stop_status_thread(jq);
 
@@ -618,23 +731,14 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                 jq->cb_fn(jq->job_handle, (void *) &cb_param);
             }
 
-            if (jq->print_ifc != NULL) {
-                jq->print_ifc->destroy(jq->print_ifc);
-                jq->print_ifc = NULL;
-            }
-
-            if (jq->status_ifc != NULL) {
-                jq->status_ifc->destroy(jq->status_ifc);
-                jq->status_ifc = NULL;
-            }
-
+            // The job thread may be using the interfaces, so it destroys them when it is done
             _unlock();
-            sem_post(&_job_end_wait_sem);
+            sem_post(&jq->end_wait_sem);
             break;
 
         default:
             // an error has occurred, report it back to the client
-            sem_post(&_job_start_wait_sem);
+            sem_post(&jq->start_wait_sem);
             _lock();
 
             if ((jq->job_state != JOB_STATE_BLOCKED) || (jq->blocked_reasons != blocked_reasons)) {
@@ -675,14 +779,14 @@ static int _start_status_thread(_job_queue_t *jq) {
     pthread_sigmask(SIG_SETMASK, &allsig, &oldsig);
 #endif // CHECK_PTHREAD_SIGMASK_STATUS
     if (result == OK) {
-        result = pthread_create(&_job_status_tid, 0, _job_status_thread, jq);
-        if ((result == ERROR) && (_job_status_tid != pthread_self())) {
+        result = pthread_create(&jq->status_tid, 0, _job_status_thread, jq);
+        if ((result == ERROR) && (jq->status_tid != pthread_self())) {
 #if USE_PTHREAD_CANCEL
-            pthread_cancel(_job_status_tid);
+            pthread_cancel(jq->status_tid);
 #else // else USE_PTHREAD_CANCEL
-            pthread_kill(_job_status_tid, SIGKILL);
+            pthread_kill(jq->status_tid, SIGKILL);
 #endif // USE_PTHREAD_CANCEL
-            _job_status_tid = pthread_self();
+            jq->status_tid = pthread_self();
         }
     }
 
@@ -773,6 +877,37 @@ static void _initialize_status_ifc(_job_queue_t *jq) {
     jq->status_ifc->init(jq->status_ifc, &connect_info);
 }
 
+/*
+ * Lets the plugin start rendering the pages queued behind the one about to print, so the next
+ * page is ready as soon as the current one has been sent
+ */
+static void _render_ahead(_job_queue_t *jq) {
+    _page_t next;
+    int i;
+
+    if (jq->plugin->prepare_page == NULL) return;
+
+    for (i = 0; i < jq->job_params.render_ahead_pages; i++) {
+        if (msgQPeek(jq->pageQ, i, (char *) &next, sizeof(next)) != OK) break;
+        if (next.pdf_page && !next.corrupted && (strlen(next.filename) > 0)) {
+            jq->plugin->prepare_page(&(jq->job_params), jq->mime_type, next.filename,
+                    next.page_num);
+        }
+    }
+}
+
+/*
+ * Logs where the time of a finished job went
+ */
+static void _log_job_stats(const wprint_job_stats_t *stats) {
+    LOGI("Job stats: %d pages, %lld bytes sent; render %ld ms, decode %ld ms, compress %ld ms, "
+            "buffer wait %ld ms, send %ld ms", stats->pages, (long long) stats->bytes_sent,
+            stats->render_ms, stats->decode_ms, stats->compress_ms, stats->buffer_wait_ms,
+            stats->send_ms);
+    LOGI("Job stats: %d stripes of %d rows in flight, up to %d rows cached",
+            stats->stripe_buffers, stats->strip_height, stats->rows_cached);
+}
+
 /*
  * Runs a print job. Contains logic for what to do given different printer statuses.
  */
@@ -781,6 +916,9 @@ static void *_job_thread(void *param) {
     _msg_t msg;
     wJob_t job_handle;
     _job_queue_t *jq;
+    const ifc_print_job_t *print_ifc;
+    const ifc_status_monitor_t *status_ifc;
+    const wprint_plugin_t *plugin;
     _page_t page;
     int i;
     status_t job_result;
@@ -797,41 +935,48 @@ static void *_job_thread(void *param) {
             break;
         }
 
-        job_handle = msg.job_id;
-
-        //  check if this is a valid job_handle that is still active
         _lock();
 
-        jq = _get_job_desc(job_handle);
-
-        //  set state to running and invoke the plugin, there is one
-        if (jq) {
-            if (jq->job_state != JOB_STATE_QUEUED) {
-                _unlock();
-                continue;
-            }
+        // Each message only says there may be work. Jobs for one printer run one at a time, in
+        // the order they were started, so rather than wait for the printer of the job it was
+        // posted for, a thread runs whichever job can start. A job left queued behind its
+        // printer is picked up by the thread that finishes that printer's current job.
+        while (!_stopping && ((jq = _next_runnable_job()) != NULL)) {
+            job_handle = jq->job_handle;
             corrupted = 0;
             job_result = OK;
             jq->job_params.plugin_data = NULL;
 
-            // clear out the semaphore just in case
-            while (sem_trywait(&_job_start_wait_sem) == OK) {
-            }
-            while (sem_trywait(&_job_end_wait_sem) == OK) {
-            }
+            jq->claimed = true;
+
+            /*
+             * Talking to the printer can take as long as its timeouts, so every call into the
+             * interfaces and the plugin is made without the lock, which other printers' jobs and
+             * the API calls need meanwhile. The interfaces and plugin stay the job's own until
+             * claimed is cleared; page senders, cancels and status callbacks only take the lock to
+             * change its state.
+             */
+            print_ifc = jq->print_ifc;
+            status_ifc = jq->status_ifc;
+            plugin = jq->plugin;
 
             // initialize the status ifc
-            if (jq->status_ifc != NULL) {
+            if (status_ifc != NULL) {
+                _unlock();
                 _initialize_status_ifc(jq);
+                _lock();
             }
             // wait for the printer to be idle
-            if ((jq->status_ifc != NULL) && (jq->status_ifc->get_status != NULL)) {
+            if ((status_ifc != NULL) && (status_ifc->get_status != NULL)) {
                 int retry = 0;
                 int loop = 1;
+                int poll_interval = 1;
                 printer_state_dyn_t printer_state;
                 do {
                     print_status_t status;
-                    jq->status_ifc->get_status(jq->status_ifc, &printer_state);
+                    _unlock();
+                    status_ifc->get_status(status_ifc, &printer_state);
+                    _lock();
                     status = printer_state.printer_status & ~PRINTER_IDLE_BIT;
 
                     // Pass along any certificate received in future callbacks
@@ -892,6 +1037,7 @@ static void *_job_thread(void *param) {
                                         (jq->blocked_reasons != blocked_reasons)) {
                                     jq->job_state = JOB_STATE_BLOCKED;
                                     jq->blocked_reasons = blocked_reasons;
+                                    poll_interval = 1;
                                     if (jq->cb_fn) {
                                         cb_param.state = JOB_BLOCKED;
                                         cb_param.blocked_reasons = blocked_reasons;
@@ -900,10 +1046,10 @@ static void *_job_thread(void *param) {
                                         jq->cb_fn(jq->job_handle, (void *) &cb_param);
                                     }
                                 }
-                                _unlock();
-                                sleep(1);
-                                _lock();
-                                retry++;
+                                // back off while the printer stays busy for the same reasons
+                                _wait_for_cancel(jq, poll_interval * 1000);
+                                retry += poll_interval;
+                                poll_interval = MIN(poll_interval * 2, MAX_IDLE_POLL_INTERVAL);
                             }
                             break;
                     }
@@ -920,11 +1066,13 @@ static void *_job_thread(void *param) {
                 }
             }
 
-            _job_status_tid = pthread_self();
+            jq->status_tid = pthread_self();
             if (job_result == OK) {
-                if (jq->print_ifc) {
-                    job_result = jq->print_ifc->init(jq->print_ifc, jq->printer_addr,
-                            jq->port_num, jq->printer_uri, jq->use_secure_uri);
+                if (print_ifc) {
+                    _unlock();
+                    job_result = print_ifc->init(print_ifc, jq->printer_addr, jq->port_num,
+                            jq->printer_uri, jq->use_secure_uri);
+                    _lock();
                     if (job_result == ERROR) {
                         jq->blocked_reasons = BLOCKED_REASON_UNABLE_TO_CONNECT;
                     }
@@ -946,11 +1094,13 @@ static void *_job_thread(void *param) {
             }
 
             jq->job_params.page_num = -1;
+            memset(&jq->job_params.stats, 0, sizeof(jq->job_params.stats));
             if (job_result == OK) {
-                if (jq->print_ifc != NULL) {
+                _unlock();
+                if (print_ifc != NULL) {
                     LOGD("_job_thread: Calling validate_job");
-                    if (jq->print_ifc->validate_job != NULL) {
-                        job_result = jq->print_ifc->validate_job(jq->print_ifc, &jq->job_params);
+                    if (print_ifc->validate_job != NULL) {
+                        job_result = print_ifc->validate_job(print_ifc, &jq->job_params);
                     }
 
                     /* PDF format plugin's start_job and end_job are to be called for each copy,
@@ -958,17 +1108,18 @@ static void *_job_thread(void *param) {
                      */
 
                     // Do not call start_job unless validate_job returned OK
-                    if ((job_result == OK) && (jq->print_ifc->start_job != NULL) &&
+                    if ((job_result == OK) && (print_ifc->start_job != NULL) &&
                             (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0)) {
-                        jq->print_ifc->start_job(jq->print_ifc, &jq->job_params);
+                        print_ifc->start_job(print_ifc, &jq->job_params);
                     }
                 }
 
                 // Do not call start_job unless validate_job returned OK
-                if (job_result == OK && jq->plugin->start_job != NULL) {
-                    job_result = jq->plugin->start_job(job_handle, (void *) &_wprint_ifc,
-                            (void *) jq->print_ifc, &(jq->job_params));
+                if (job_result == OK && plugin->start_job != NULL) {
+                    job_result = plugin->start_job(job_handle, (void *) &_wprint_ifc,
+                            (void *) print_ifc, &(jq->job_params));
                 }
+                _lock();
             }
 
             if (job_result == OK) {
@@ -988,9 +1139,11 @@ static void *_job_thread(void *param) {
                         break;
                     }
                     bool pdf_printed = false;
-                    if (jq->print_ifc->start_job != NULL &&
+                    if (print_ifc->start_job != NULL &&
                             (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
-                        jq->print_ifc->start_job(jq->print_ifc, &jq->job_params);
+                        _unlock();
+                        print_ifc->start_job(print_ifc, &jq->job_params);
+                        _lock();
                     }
 
                     per_copy_page_num = 0;
@@ -1001,15 +1154,15 @@ static void *_job_thread(void *param) {
 
                     while (OK == msgQReceive(jq->pageQ, (char *) &page, sizeof(page),
                             WAIT_FOREVER)) {
-                        _lock();
-
                         // check for any printing problems so far
-                        if (jq->print_ifc->check_status) {
-                            if (jq->print_ifc->check_status(jq->print_ifc) == ERROR) {
+                        if (print_ifc->check_status) {
+                            if (print_ifc->check_status(print_ifc) == ERROR) {
+                                _lock();
                                 job_result = ERROR;
                                 break;
                             }
                         }
+                        _lock();
 
                         /* take empty filename as cue to break out of the loop
                          * but we have to do last_page processing
@@ -1053,13 +1206,14 @@ static void *_job_thread(void *param) {
                                 LOGD("_job_thread(): page not corrupt, calling plugin's print_page"
                                         " function for page #%d", page.page_num);
                                 if (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0) {
-                                    job_result = jq->plugin->print_page(&(jq->job_params),
+                                    _render_ahead(jq);
+                                    job_result = plugin->print_page(&(jq->job_params),
                                             jq->mime_type,
                                             page.filename);
                                 } else if (!pdf_printed) {
                                     // for PDF plugin, print_page prints entire document,
                                     // so need to be called only once
-                                    job_result = jq->plugin->print_page(&(jq->job_params),
+                                    job_result = plugin->print_page(&(jq->job_params),
                                             jq->mime_type,
                                             page.filename);
                                     pdf_printed = true;
@@ -1069,8 +1223,8 @@ static void *_job_thread(void *param) {
                                         "page #%d", page.page_num);
                                 job_result = CORRUPT;
                                 if ((jq->job_params.duplex != DUPLEX_MODE_NONE) &&
-                                        (jq->plugin->print_blank_page != NULL)) {
-                                    jq->plugin->print_blank_page(job_handle, &(jq->job_params));
+                                        (plugin->print_blank_page != NULL)) {
+                                    plugin->print_blank_page(job_handle, &(jq->job_params));
                                 }
                             }
                             _lock();
@@ -1091,9 +1245,9 @@ static void *_job_thread(void *param) {
                         // make sure we always print an even number of pages in duplex jobs
                         if (page.last_page && (jq->job_params.duplex != DUPLEX_MODE_NONE)
                                 && (jq->job_params.page_backside)
-                                && (jq->plugin->print_blank_page != NULL)) {
+                                && (plugin->print_blank_page != NULL)) {
                             _unlock();
-                            jq->plugin->print_blank_page(job_handle, &(jq->job_params));
+                            plugin->print_blank_page(job_handle, &(jq->job_params));
                             _lock();
                         }
 
@@ -1127,8 +1281,11 @@ static void *_job_thread(void *param) {
                     } // while there is another page
 
                     if ((strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0) &&
-                            (jq->print_ifc->end_job)) {
-                        int end_job_result = jq->print_ifc->end_job(jq->print_ifc);
+                            (print_ifc->end_job)) {
+                        int end_job_result;
+                        _unlock();
+                        end_job_result = print_ifc->end_job(print_ifc);
+                        _lock();
                         if (job_result == OK) {
                             if (end_job_result == ERROR) {
                                 job_result = ERROR;
@@ -1148,8 +1305,11 @@ static void *_job_thread(void *param) {
                     }
 
                     // check for any printing problems so far
-                    if ((jq->print_ifc != NULL) && (jq->print_ifc->check_status)) {
-                        if (jq->print_ifc->check_status(jq->print_ifc) == ERROR) {
+                    if ((print_ifc != NULL) && (print_ifc->check_status)) {
+                        _unlock();
+                        status_t check_result = print_ifc->check_status(print_ifc);
+                        _lock();
+                        if (check_result == ERROR) {
                             job_result = ERROR;
                             break;
                         }
@@ -1164,12 +1324,12 @@ static void *_job_thread(void *param) {
                     jq->job_params.page_printing = true;
 
                     _unlock();
-                    job_result = jq->plugin->print_page(&(jq->job_params), jq->mime_type,
+                    job_result = plugin->print_page(&(jq->job_params), jq->mime_type,
                             jq->pathname);
 
                     if ((jq->job_params.duplex != DUPLEX_MODE_NONE)
-                            && (jq->plugin->print_blank_page != NULL)) {
-                        jq->plugin->print_blank_page(job_handle,
+                            && (plugin->print_blank_page != NULL)) {
+                        plugin->print_blank_page(job_handle,
                                 &(jq->job_params));
                     }
 
@@ -1182,40 +1342,43 @@ static void *_job_thread(void *param) {
 
             // if we started the job end it
             if (jq->job_params.page_num >= 0) {
+                int end_job_result = OK;
+
+                _unlock();
                 // if the job was cancelled without sending anything through, print a blank sheet
                 if ((jq->job_params.page_num == 0)
-                        && (jq->plugin->print_blank_page != NULL)) {
-                    jq->plugin->print_blank_page(job_handle, &(jq->job_params));
+                        && (plugin->print_blank_page != NULL)) {
+                    plugin->print_blank_page(job_handle, &(jq->job_params));
                 }
-                if (jq->plugin->end_job != NULL) {
-                    jq->plugin->end_job(&(jq->job_params));
+                if (plugin->end_job != NULL) {
+                    plugin->end_job(&(jq->job_params));
                 }
-                if ((jq->print_ifc != NULL) && (jq->print_ifc->end_job) &&
+                if ((print_ifc != NULL) && (print_ifc->end_job) &&
                         (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0)) {
-                    int end_job_result = jq->print_ifc->end_job(jq->print_ifc);
-                    if (job_result == OK) {
-                        if (end_job_result == ERROR) {
-                            job_result = ERROR;
-                        } else if (end_job_result == CANCELLED) {
-                            job_result = CANCELLED;
-                        }
+                    end_job_result = print_ifc->end_job(print_ifc);
+                }
+                _lock();
+                if (job_result == OK) {
+                    if (end_job_result == ERROR) {
+                        job_result = ERROR;
+                    } else if (end_job_result == CANCELLED) {
+                        job_result = CANCELLED;
                     }
                 }
             }
 
             // if we started to print, wait for idle
-            if ((jq->job_params.page_num > 0) && (jq->status_ifc != NULL)) {
+            if ((jq->job_params.page_num > 0) && (status_ifc != NULL)) {
                 int retry, result;
-                _unlock();
 
-                for (retry = 0, result = ERROR; ((result == ERROR) && (retry <= MAX_START_WAIT));
-                        retry++) {
-                    if (retry != 0) {
-                        sleep(1);
-                    }
-                    result = sem_trywait(&_job_start_wait_sem);
+                _unlock();
+                // the printer has all the data, so its state is about to change
+                if (status_ifc->poll_soon != NULL) {
+                    status_ifc->poll_soon(status_ifc);
                 }
 
+                result = _wait_for_sem(&jq->start_wait_sem, MAX_START_WAIT * 1000);
+
                 if (result == OK) {
                     for (retry = 0, result = ERROR; ((result == ERROR) && (retry <= MAX_DONE_WAIT));
                             retry++) {
@@ -1230,8 +1393,8 @@ static void *_job_thread(void *param) {
                                 retry = (MAX_DONE_WAIT + 1);
                             }
                             _unlock();
-                            sleep(1);
-                            if (retry == MAX_DONE_WAIT) {
+                            result = _wait_for_sem(&jq->end_wait_sem, 1000);
+                            if ((result == ERROR) && (retry == MAX_DONE_WAIT)) {
                                 _lock();
                                 if (!jq->job_params.cancelled &&
                                         (jq->blocked_reasons
@@ -1242,8 +1405,9 @@ static void *_job_thread(void *param) {
                                 }
                                 _unlock();
                             }
+                        } else {
+                            result = sem_trywait(&jq->end_wait_sem);
                         }
-                        result = sem_trywait(&_job_end_wait_sem);
                     }
                 } else {
                     LOGD("_job_thread(): the job never started");
@@ -1293,48 +1457,57 @@ static void *_job_thread(void *param) {
                                 jq->mime_type, jq->job_params.print_format);
                         job_result = ERROR;
                         jq->job_state = JOB_STATE_ERROR;
+
+                        // the failure may be due to capabilities that have since changed
+                        wprintInvalidateCapabilities(jq->printer_addr);
                         break;
                 } // job_result
 
+                _log_job_stats(&jq->job_params.stats);
+
                 // end of job callback
                 if (jq->cb_fn) {
                     cb_param.state = JOB_DONE;
                     cb_param.blocked_reasons = jq->blocked_reasons;
                     cb_param.job_done_result = job_result;
+                    cb_param.stats = jq->job_params.stats;
 
                     jq->cb_fn(job_handle, (void *) &cb_param);
+                    memset(&cb_param.stats, 0, sizeof(cb_param.stats));
                 }
+            }
 
-                if (jq->print_ifc != NULL) {
-                    jq->print_ifc->destroy(jq->print_ifc);
-                    jq->print_ifc = NULL;
-                }
-
-                if (jq->status_ifc != NULL) {
-                    jq->status_ifc->destroy(jq->status_ifc);
-                    jq->status_ifc = NULL;
-                }
+            // The interfaces are destroyed here even if a status callback finished the job early
+            jq->print_ifc = NULL;
+            jq->status_ifc = NULL;
+            _unlock();
+            if (print_ifc != NULL) {
+                print_ifc->destroy(print_ifc);
             }
-        } else {
-            LOGI("_job_thread(): job %ld not in queue .. maybe cancelled", job_handle);
+            if (status_ifc != NULL) {
+                status_ifc->destroy(status_ifc);
+            }
+            _lock();
+
+            jq->claimed = false;
+            pthread_cond_broadcast(&_job_released);
+            LOGI("_job_thread(): job finished: %ld", job_handle);
         }
 
         _unlock();
-        LOGI("_job_thread(): job finished: %ld", job_handle);
     }
 
-    sem_post(&_job_end_wait_sem);
     return NULL;
 }
 
 /*
- * Starts the wprint background job thread
+ * Starts the wprint background job threads
  */
 static int _start_thread(void) {
     sigset_t allsig, oldsig;
     int result;
 
-    _job_tid = pthread_self();
+    _num_job_threads = 0;
 
     result = OK;
     sigfillset(&allsig);
@@ -1344,14 +1517,13 @@ static int _start_thread(void) {
     pthread_sigmask(SIG_SETMASK, &allsig, &oldsig);
 #endif // CHECK_PTHREAD_SIGMASK_STATUS
     if (result == OK) {
-        result = pthread_create(&_job_tid, 0, _job_thread, NULL);
-        if ((result == ERROR) && (_job_tid != pthread_self())) {
-#if USE_PTHREAD_CANCEL
-            pthread_cancel(_job_tid);
-#else // else USE_PTHREAD_CANCEL
-            pthread_kill(_job_tid, SIGKILL);
-#endif // USE_PTHREAD_CANCEL
-            _job_tid = pthread_self();
+        // A thread that fails to start only limits how many printers are served at once
+        while ((_num_job_threads < _MAX_JOB_THREADS) &&
+                (pthread_create(&_job_tids[_num_job_threads], 0, _job_thread, NULL) == 0)) {
+            _num_job_threads++;
+        }
+        if (_num_job_threads == 0) {
+            result = ERROR;
         }
     }
 
@@ -1368,16 +1540,17 @@ static int _start_thread(void) {
 }
 
 /*
- * Waits for the job thread to reach a stopped state
+ * Waits for the job threads to reach a stopped state
  */
 static int _stop_thread(void) {
-    if (!pthread_equal(_job_tid, pthread_self())) {
-        pthread_join(_job_tid, 0);
-        _job_tid = pthread_self();
-        return OK;
-    } else {
+    if (_num_job_threads == 0) {
         return ERROR;
     }
+
+    while (_num_job_threads > 0) {
+        pthread_join(_job_tids[--_num_job_threads], 0);
+    }
+    return OK;
 }
 
 static const wprint_io_plugin_t _file_io_plugin = {
@@ -1418,19 +1591,19 @@ int wprintInit(void) {
     _setup_print_plugins();
     _setup_io_plugins();
 
-    _msgQ = msgQCreate(_MAX_MSGS, sizeof(_msg_t));
+    _msgQ = msgQCreate(_MAX_MSGS, sizeof(_msg_t), MSG_Q_FIFO);
 
     if (!_msgQ) {
         LOGE("ERROR: cannot create msgQ");
         return ERROR;
     }
 
-    sem_init(&_job_end_wait_sem, 0, 0);
-    sem_init(&_job_start_wait_sem, 0, 0);
-
     signal(SIGPIPE, SIG_IGN); // avoid broken pipe process shutdowns
     pthread_mutexattr_settype(&_q_lock_attr, PTHREAD_MUTEX_RECURSIVE_NP);
     pthread_mutex_init(&_q_lock, &_q_lock_attr);
+    pthread_cond_init(&_job_cancelled, NULL);
+    pthread_cond_init(&_job_released, NULL);
+    _stopping = false;
 
     if (_start_thread() != OK) {
         LOGE("could not start job thread");
@@ -1618,6 +1791,10 @@ status_t wprintGetCapabilities(const wprint_connect_info_t *connect_info,
     return result;
 }
 
+void wprintInvalidateCapabilities(const char *printer_addr) {
+    ipp_capabilities_invalidate(printer_addr);
+}
+
 /*
  * Returns a preferred print format supported by the printer
  */
@@ -1668,7 +1845,9 @@ status_t wprintGetDefaultJobParams(wprint_job_params_t *job_params) {
             .borderless = false, .cancelled = false, .renderInReverseOrder = false,
             .ipp_1_0_supported = false, .ipp_2_0_supported = false, .epcl_ipp_supported = false,
             .strip_height = STRIPE_HEIGHT, .docCategory = {0},
-            .copies_supported = false};
+            .copies_supported = false, .render_ahead_pages = _DEFAULT_RENDER_AHEAD_PAGES,
+            .render_ahead_bytes = _DEFAULT_RENDER_AHEAD_BYTES,
+            .memory_budget = DEFAULT_MEMORY_BUDGET, .compression_threads = 0};
 
     if (job_params == NULL) return result;
 
@@ -1948,11 +2127,11 @@ wJob_t wprintStartJob(const char *printer_addr, port_t port_num,
             jq->num_pages = 0;
 
             // create a pageQ for queuing page information
-            jq->pageQ = msgQCreate(_MAX_PAGES_PER_JOB, sizeof(_page_t));
+            jq->pageQ = msgQCreate(_MAX_PAGES_PER_JOB, sizeof(_page_t), MSG_Q_FIFO);
 
             // create a secondary page Q for subsequently saving page data for copies #2 to n
             if (jq->job_params.num_copies > 1) {
-                jq->saveQ = msgQCreate(_MAX_PAGES_PER_JOB, sizeof(_page_t));
+                jq->saveQ = msgQCreate(_MAX_PAGES_PER_JOB, sizeof(_page_t), MSG_Q_FIFO);
             }
         } else {
             jq->num_pages = 1;
@@ -1999,6 +2178,16 @@ status_t wprintEndJob(wJob_t job_handle) {
         // if the job is done and is to be freed, do it
         if ((jq->job_state == JOB_STATE_CANCELLED) || (jq->job_state == JOB_STATE_ERROR) ||
                 (jq->job_state == JOB_STATE_CORRUPTED) || (jq->job_state == JOB_STATE_COMPLETED)) {
+            // A status callback can finish a job while its thread is still winding it up
+            while (jq->claimed) {
+                pthread_cond_wait(&_job_released, &_q_lock);
+            }
+
+            // A finished job takes no more pages, so senders give up within _PAGE_SEND_WAIT_MS
+            while (jq->page_senders > 0) {
+                pthread_cond_wait(&_job_released, &_q_lock);
+            }
+
             result = OK;
             if (jq->pageQ) {
                 while ((msgQNumMsgs(jq->pageQ) > 0)
@@ -2075,11 +2264,42 @@ status_t wprintPage(wJob_t job_handle, int page_num, const char *filename, bool
             snprintf(page.filename, MAX_PATHNAME_LENGTH, "%s/%s", jq->pathname, filename);
         }
 
+        // Claim the last page now, so that no other caller queues a page behind it
         if (last_page) {
             jq->last_page_seen = true;
         }
 
-        result = msgQSend(jq->pageQ, (char *) &page, sizeof(page), NO_WAIT, MSG_Q_FIFO);
+        if (jq->job_params.cancelled) {
+            // Only the page that wakes the job thread; it must not wait
+            result = msgQSend(jq->pageQ, (char *) &page, sizeof(page), NO_WAIT, MSG_Q_FIFO);
+        } else {
+            // Rather than drop the page, wait for the job thread to take one from a full pageQ.
+            // The wait is made without the lock; page_senders keeps wprintEndJob() from deleting
+            // the queue meanwhile. A cancelled or finished job takes no more.
+            msg_q_id pageQ = jq->pageQ;
+            jq->page_senders++;
+            do {
+                _unlock();
+                result = msgQSend(pageQ, (char *) &page, sizeof(page), _PAGE_SEND_WAIT_MS,
+                        MSG_Q_FIFO);
+                _lock();
+            } while ((result != OK) && !jq->job_params.cancelled &&
+                    ((jq->job_state == JOB_STATE_QUEUED) || (jq->job_state == JOB_STATE_RUNNING) ||
+                    (jq->job_state == JOB_STATE_BLOCKED)));
+            if (--jq->page_senders == 0) {
+                pthread_cond_broadcast(&_job_released);
+            }
+
+            if (_get_job_desc(job_handle) != jq) {
+                LOGE("wprintPage(%ld): job went away while queuing a page", job_handle);
+                jq = NULL;
+                result = ERROR;
+            }
+        }
+
+        if ((result != OK) && last_page && (jq != NULL)) {
+            jq->last_page_seen = false;
+        }
     }
 
     if (result == OK) {
@@ -2106,12 +2326,16 @@ status_t wprintCancelJob(wJob_t job_handle) {
     if (jq) {
         LOGI("received cancel request");
         // send a dummy page in case we're waiting on the msgQ page receive
-        if ((jq->job_state == JOB_STATE_RUNNING) || (jq->job_state == JOB_STATE_BLOCKED)) {
+        // A claimed job is being started by a job thread, so it is cancelled like a running one
+        if ((jq->job_state == JOB_STATE_RUNNING) || (jq->job_state == JOB_STATE_BLOCKED) ||
+                ((jq->job_state == JOB_STATE_QUEUED) && jq->claimed)) {
             bool enableTimeout = true;
             jq->cancel_ok = true;
             jq->job_params.cancelled = true;
+            pthread_cond_broadcast(&_job_cancelled);
             wprintPage(job_handle, jq->num_pages + 1, NULL, true, false, 0, 0, 0, 0);
-            if (jq->status_ifc) {
+            // a queued job has yet to reach the printer
+            if (jq->status_ifc && (jq->job_state != JOB_STATE_QUEUED)) {
                 // are we blocked waiting for the job to start
                 if ((jq->job_state != JOB_STATE_BLOCKED) || (jq->job_params.page_num != 0)) {
                     errno = OK;
@@ -2143,7 +2367,7 @@ status_t wprintCancelJob(wJob_t job_handle) {
             jq->job_state = JOB_STATE_CANCELLED;
 
             if (jq->cb_fn) {
-                wprint_job_callback_params_t cb_param;
+                wprint_job_callback_params_t cb_param = { 0 };
                 cb_param.state = JOB_DONE;
                 cb_param.blocked_reasons = BLOCKED_REASONS_CANCELLED;
                 cb_param.job_done_result = CANCELLED;
@@ -2175,21 +2399,26 @@ status_t wprintExit(void) {
     _msg_t msg;
 
     if (_msgQ) {
+        int i;
+
         //  toss the remaining messages in the msgQ
         while ((msgQNumMsgs(_msgQ) > 0) &&
                 (OK == msgQReceive(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT))) {}
 
-        // send a quit message
+        // keep job threads from starting any more jobs
+        _lock();
+        _stopping = true;
+        _unlock();
+
+        // send a quit message to each job thread
         msg.id = MSG_QUIT;
-        msgQSend(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT, MSG_Q_FIFO);
+        for (i = 0; i < _num_job_threads; i++) {
+            msgQSend(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT, MSG_Q_FIFO);
+        }
 
-        // stop the job thread
+        // stop the job threads
         _stop_thread();
 
-        // empty out the semaphore
-        while (sem_trywait(&_job_end_wait_sem) == OK);
-        while (sem_trywait(&_job_start_wait_sem) == OK);
-
         // receive any messages just in case
         while ((msgQNumMsgs(_msgQ) > 0)
                 && (OK == msgQReceive(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT))) {}
@@ -2198,11 +2427,15 @@ status_t wprintExit(void) {
         msgQDelete(_msgQ);
         _msgQ = NULL;
 
-        sem_destroy(&_job_end_wait_sem);
-        sem_destroy(&_job_start_wait_sem);
+        pthread_cond_destroy(&_job_cancelled);
+        pthread_cond_destroy(&_job_released);
         pthread_mutex_destroy(&_q_lock);
     }
 
+    // close idle printer connections and forget what they reported
+    ipp_http_pool_flush();
+    wprintInvalidateCapabilities(NULL);
+
     return OK;
 }
 
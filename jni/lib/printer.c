@@ -25,6 +25,8 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <string.h>
+#include <sys/uio.h>
 
 #include "ifc_print_job.h"
 #include "wprint_debug.h"
@@ -33,6 +35,9 @@
 
 #define DEFAULT_TIMEOUT (5000)
 
+/* Most buffers handed to writev() at once */
+#define MAX_SEND_IOV 64
+
 typedef struct {
     ifc_print_job_t ifc;
     int port_num;
@@ -87,65 +92,101 @@ static int _start_job(const ifc_print_job_t *this_p, const wprint_job_params_t *
     }
 }
 
-static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
+/*
+ * Drops the first bytes_written bytes from the count entries of iov
+ */
+static void _consume_iov(struct iovec *iov, int *count, size_t bytes_written) {
+    int done = 0;
+
+    while ((done < *count) && (bytes_written >= iov[done].iov_len)) {
+        bytes_written -= iov[done].iov_len;
+        done++;
+    }
+    if (done < *count) {
+        iov[done].iov_base = (char *) iov[done].iov_base + bytes_written;
+        iov[done].iov_len -= bytes_written;
+    }
+    *count -= done;
+    memmove(iov, iov + done, *count * sizeof(struct iovec));
+}
+
+static int _send_datav(const ifc_print_job_t *this_p, const struct iovec *iov, int iovcnt) {
     status_t retval = OK;
-    size_t length_in = length;
+    size_t length_in = 0;
     ssize_t bytes_written;
+    struct iovec pending[MAX_SEND_IOV];
+    int i, count = 0, next = 0;
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
 
-    if (this_p && buffer && (print_job->job_status == OK)) {
-        if (print_job->port_num == PORT_FILE) {
-            while ((length > 0) && (retval != -1)) {
-                bytes_written = write(print_job->psock, buffer, length);
-                if (bytes_written < 0) {
-                    retval = ERROR;
-                } else {
-                    length -= bytes_written;
-                    buffer += bytes_written;
-                }
+    if (!this_p || !iov || (iovcnt < 0) || (print_job->job_status != OK)) {
+        return ERROR;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        length_in += iov[i].iov_len;
+    }
+
+    while (retval == OK) {
+        // iov is left alone, so it is written from a window of up to MAX_SEND_IOV entries
+        while ((count < MAX_SEND_IOV) && (next < iovcnt)) {
+            if (iov[next].iov_len > 0) {
+                pending[count++] = iov[next];
             }
-        } else {
+            next++;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        if (print_job->port_num != PORT_FILE) {
             fd_set w_fds;
             int selreturn;
             struct timeval timeout;
 
-            while ((length > 0) && (retval == OK)) {
-                FD_ZERO(&w_fds);
-                FD_SET(print_job->psock, &w_fds);
-                timeout.tv_sec = 20;
-                timeout.tv_usec = 0;
-                selreturn = select(print_job->psock + 1, NULL, &w_fds, NULL, &timeout);
-                if (selreturn < 0) {
-                    LOGE("select returned an errnor (%d)", errno);
-                    retval = ERROR;
-                } else if (selreturn > 0) {
-                    if (FD_ISSET(print_job->psock, &w_fds)) {
-                        bytes_written = write(print_job->psock, buffer, length);
-                        if (bytes_written < 0) {
-                            LOGE("unable to transmit %d bytes of data (errno %d)", length, errno);
-                            retval = ERROR;
-                        } else {
-                            length -= bytes_written;
-                            buffer += bytes_written;
-                        }
-                    } else {
-                        LOGE("select returned OK, but fd is not set");
-                        retval = ERROR;
-                    }
-                } else {
-                    retval = (print_job->timeout_enabled ? ERROR : OK);
-                    if (retval == ERROR) {
-                        LOGE("select timed out");
-                    }
+            FD_ZERO(&w_fds);
+            FD_SET(print_job->psock, &w_fds);
+            timeout.tv_sec = 20;
+            timeout.tv_usec = 0;
+            selreturn = select(print_job->psock + 1, NULL, &w_fds, NULL, &timeout);
+            if (selreturn < 0) {
+                LOGE("select returned an errnor (%d)", errno);
+                retval = ERROR;
+                continue;
+            } else if (selreturn == 0) {
+                retval = (print_job->timeout_enabled ? ERROR : OK);
+                if (retval == ERROR) {
+                    LOGE("select timed out");
                 }
+                continue;
+            } else if (!FD_ISSET(print_job->psock, &w_fds)) {
+                LOGE("select returned OK, but fd is not set");
+                retval = ERROR;
+                continue;
             }
         }
 
-        print_job->job_status = retval;
-    } else {
-        retval = ERROR;
+        bytes_written = writev(print_job->psock, pending, count);
+        if (bytes_written < 0) {
+            LOGE("unable to transmit %zu bytes of data (errno %d)", length_in, errno);
+            retval = ERROR;
+        } else {
+            _consume_iov(pending, &count, (size_t) bytes_written);
+        }
+    }
+
+    print_job->job_status = retval;
+    return ((retval == OK) ? (int) length_in : (int) ERROR);
+}
+
+static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
+    struct iovec iov;
+
+    if (!buffer) {
+        return ERROR;
     }
-    return ((retval == OK) ? length_in : (int)ERROR);
+    iov.iov_base = (void *) buffer;
+    iov.iov_len = length;
+    return _send_datav(this_p, &iov, 1);
 }
 
 static int _end_job(const ifc_print_job_t *this_p) {
@@ -245,8 +286,9 @@ int wConnect(const char *printer_addr, int port_num, long int timeout_msec) {
 }
 
 static const ifc_print_job_t _print_job_ifc = {.init = _init, .validate_job = NULL,
-        .start_job = _start_job, .send_data = _send_data, .end_job = _end_job, .destroy = _destroy,
-        .enable_timeout = _enable_timeout, .check_status = _check_status,};
+        .start_job = _start_job, .send_data = _send_data, .send_datav = _send_datav,
+        .end_job = _end_job, .destroy = _destroy, .enable_timeout = _enable_timeout,
+        .check_status = _check_status,};
 
 const ifc_print_job_t *printer_connect(int port_num) {
     _print_job_t *print_job;
@@ -88,6 +88,16 @@ static jfieldID _JobCallbackParamsField__jobState;
 static jfieldID _JobCallbackParamsField__jobDoneResult;
 static jfieldID _JobCallbackParamsField__blockedReasons;
 static jfieldID _JobCallbackParamsField__certificate;
+static jfieldID _JobCallbackParamsField__pages;
+static jfieldID _JobCallbackParamsField__renderMs;
+static jfieldID _JobCallbackParamsField__decodeMs;
+static jfieldID _JobCallbackParamsField__compressMs;
+static jfieldID _JobCallbackParamsField__bufferWaitMs;
+static jfieldID _JobCallbackParamsField__sendMs;
+static jfieldID _JobCallbackParamsField__bytesSent;
+static jfieldID _JobCallbackParamsField__stripHeight;
+static jfieldID _JobCallbackParamsField__stripeBuffers;
+static jfieldID _JobCallbackParamsField__rowsCached;
 
 static jclass _PrintServiceStringsClass;
 static jfieldID _PrintServiceStringsField__JOB_STATE_QUEUED;
@@ -168,9 +178,7 @@ static bool _get_pdf_page_count(const char *mime_type, int *page_count, const ch
         return false;
     }
 
-    pdf_render_ifc_t *pdf_render_ifc = create_pdf_render_ifc();
-    *page_count = pdf_render_ifc->openDocument(pdf_render_ifc, pathname);
-    pdf_render_ifc->destroy(pdf_render_ifc);
+    *page_count = wprint_mupdf_page_count(pathname);
 
     LOGI("pdf page count for %s: %d", pathname, *page_count);
     if (*page_count < 0) {
@@ -502,6 +510,26 @@ static void _initJNI(JNIEnv *env, jobject callbackReceiver, jstring fakeDir) {
             env, _JobCallbackParamsClass, "blockedReasons", "[Ljava/lang/String;");
     _JobCallbackParamsField__certificate = (*env)->GetFieldID(
             env, _JobCallbackParamsClass, "certificate", "[B");
+    _JobCallbackParamsField__pages = (*env)->GetFieldID(env, _JobCallbackParamsClass, "pages",
+            "I");
+    _JobCallbackParamsField__renderMs = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "renderMs", "J");
+    _JobCallbackParamsField__decodeMs = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "decodeMs", "J");
+    _JobCallbackParamsField__compressMs = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "compressMs", "J");
+    _JobCallbackParamsField__bufferWaitMs = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "bufferWaitMs", "J");
+    _JobCallbackParamsField__sendMs = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "sendMs", "J");
+    _JobCallbackParamsField__bytesSent = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "bytesSent", "J");
+    _JobCallbackParamsField__stripHeight = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "stripHeight", "I");
+    _JobCallbackParamsField__stripeBuffers = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "stripeBuffers", "I");
+    _JobCallbackParamsField__rowsCached = (*env)->GetFieldID(env, _JobCallbackParamsClass,
+            "rowsCached", "I");
 
     if (callbackReceiver) {
         _callbackReceiver = (jobject) (*env)->NewGlobalRef(env, callbackReceiver);
@@ -1109,6 +1137,27 @@ static void _wprint_callback_fn(wJob_t job_handle, void *param) {
         (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__jobId,
                 (jint) job_handle);
 
+        (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__pages,
+                (jint) cb_param->stats.pages);
+        (*env)->SetLongField(env, callbackParams, _JobCallbackParamsField__renderMs,
+                (jlong) cb_param->stats.render_ms);
+        (*env)->SetLongField(env, callbackParams, _JobCallbackParamsField__decodeMs,
+                (jlong) cb_param->stats.decode_ms);
+        (*env)->SetLongField(env, callbackParams, _JobCallbackParamsField__compressMs,
+                (jlong) cb_param->stats.compress_ms);
+        (*env)->SetLongField(env, callbackParams, _JobCallbackParamsField__bufferWaitMs,
+                (jlong) cb_param->stats.buffer_wait_ms);
+        (*env)->SetLongField(env, callbackParams, _JobCallbackParamsField__sendMs,
+                (jlong) cb_param->stats.send_ms);
+        (*env)->SetLongField(env, callbackParams, _JobCallbackParamsField__bytesSent,
+                (jlong) cb_param->stats.bytes_sent);
+        (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__stripHeight,
+                (jint) cb_param->stats.strip_height);
+        (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__stripeBuffers,
+                (jint) cb_param->stats.stripe_buffers);
+        (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__rowsCached,
+                (jint) cb_param->stats.rows_cached);
+
         if (cb_param->certificate) {
             LOGI("_wprint_callback_fn: copying certificate len=%d", cb_param->certificate_len);
             jbyteArray certificate = (*env)->NewByteArray(env, cb_param->certificate_len);
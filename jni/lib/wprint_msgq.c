@@ -22,8 +22,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "wprint_msgq.h"
 #include "wprint_debug.h"
@@ -32,34 +39,239 @@
 
 #define _SEM_NAME_LENGTH    16
 
+/* Keeps the counters of an MSG_Q_SPSC queue's two threads on separate cache lines */
+#define _CACHE_LINE_SIZE    64
+
+/* Fields at the start of every kind of queue */
 typedef struct {
     msg_q_id msgq_id;
+    int options;
+} _msgq_base_t;
+
+typedef struct {
+    _msgq_base_t base;
     char name[_SEM_NAME_LENGTH];
     int max_msgs;
     int max_msg_length;
     int num_msgs;
     sem_t sem_count;
     sem_t *sem_ptr;
+    sem_t sem_space; // free slots, so that a sender can wait for one
     pthread_mutex_t mutex;
     pthread_mutexattr_t mutexattr;
     unsigned long read_offset;
     unsigned long write_offset;
 } _msgq_hdr_t;
 
-msg_q_id msgQCreate(int max_msgs, int max_msg_length) {
+/*
+ * An MSG_Q_SPSC queue. Messages are numbered by two free-running counters, each written by only
+ * one of the threads, so neither side takes a lock. The receiver sleeps on a futex while the queue
+ * is empty, and the sender on another while it is full.
+ */
+typedef struct {
+    _msgq_base_t base;
+    int max_msgs;
+    int max_msg_length;
+    unsigned int slot_mask; // max_msgs rounded up to a power of two, less one
+    char *slots;
+
+    // written by the receiving thread; also the futex the sender waits on
+    char pad_read[_CACHE_LINE_SIZE];
+    atomic_uint read_count;
+    atomic_int receiver_waiting;
+
+    // written by the sending thread; also the futex the receiver waits on
+    char pad_write[_CACHE_LINE_SIZE];
+    atomic_uint write_count;
+    atomic_int sender_waiting;
+    char pad_end[_CACHE_LINE_SIZE];
+} _spsc_hdr_t;
+
+static bool _is_spsc(msg_q_id msgQ) {
+    return (((_msgq_base_t *) msgQ)->options & MSG_Q_SPSC) != 0;
+}
+
+/*
+ * Sets deadline to timeout milliseconds from now on clock
+ */
+static void _get_deadline(clockid_t clock, int timeout, struct timespec *deadline) {
+    clock_gettime(clock, deadline);
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * Waits for sem to be posted, giving up after timeout milliseconds unless timeout is WAIT_FOREVER.
+ * Returns 0 if it was posted.
+ */
+static int _sem_wait(sem_t *sem, int timeout) {
+    struct timespec deadline;
+    int result;
+
+    if (timeout == NO_WAIT) {
+        return sem_trywait(sem);
+    } else if (timeout != WAIT_FOREVER) {
+        _get_deadline(CLOCK_REALTIME, timeout, &deadline);
+    }
+
+    do {
+        result = (timeout == WAIT_FOREVER) ? sem_wait(sem) : sem_timedwait(sem, &deadline);
+    } while ((result != 0) && (errno == EINTR));
+    return result;
+}
+
+/*
+ * Sleeps while word holds expected, or until a CLOCK_MONOTONIC deadline unless that is NULL. May
+ * return early. Returns false once the deadline has passed.
+ */
+static bool _futex_wait(atomic_uint *word, unsigned int expected,
+        const struct timespec *deadline) {
+    struct timespec remaining;
+
+    if (deadline != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &remaining);
+        remaining.tv_sec = deadline->tv_sec - remaining.tv_sec;
+        remaining.tv_nsec = deadline->tv_nsec - remaining.tv_nsec;
+        if (remaining.tv_nsec < 0) {
+            remaining.tv_sec--;
+            remaining.tv_nsec += 1000000000L;
+        }
+        if (remaining.tv_sec < 0) return false;
+    }
+    syscall(__NR_futex, word, FUTEX_WAIT_PRIVATE, expected, (deadline != NULL) ? &remaining : NULL,
+            NULL, 0);
+    return true;
+}
+
+static void _futex_wake(atomic_uint *word) {
+    syscall(__NR_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static msg_q_id _spsc_create(int max_msgs, int max_msg_length) {
+    _spsc_hdr_t *msgq;
+    unsigned int slots = 1;
+
+    if ((max_msgs <= 0) || (max_msg_length <= 0)) return MSG_Q_INVALID_ID;
+
+    while (slots < (unsigned int) max_msgs) {
+        slots <<= 1;
+    }
+
+    msgq = (_spsc_hdr_t *) calloc(1, sizeof(_spsc_hdr_t) + (size_t) slots * max_msg_length);
+    if (msgq) {
+        msgq->base.msgq_id = (msg_q_id) msgq;
+        msgq->base.options = MSG_Q_SPSC;
+        msgq->max_msgs = max_msgs;
+        msgq->max_msg_length = max_msg_length;
+        msgq->slot_mask = slots - 1;
+        msgq->slots = (char *) (msgq + 1);
+        atomic_init(&msgq->read_count, 0);
+        atomic_init(&msgq->receiver_waiting, 0);
+        atomic_init(&msgq->write_count, 0);
+        atomic_init(&msgq->sender_waiting, 0);
+    }
+    return ((msg_q_id) msgq);
+}
+
+static status_t _spsc_send(_spsc_hdr_t *msgq, const char *buffer, unsigned long nbytes,
+        int timeout) {
+    unsigned int write_count = atomic_load_explicit(&msgq->write_count, memory_order_relaxed);
+    unsigned int read_count = atomic_load_explicit(&msgq->read_count, memory_order_acquire);
+    struct timespec deadline;
+
+    if (nbytes > msgq->max_msg_length) return ERROR;
+    if (timeout > 0) {
+        _get_deadline(CLOCK_MONOTONIC, timeout, &deadline);
+    }
+
+    while ((write_count - read_count) >= msgq->max_msgs) {
+        bool waited = true;
+        if (timeout == NO_WAIT) return ERROR;
+
+        // Same handshake as the receiver's, on read_count
+        atomic_store(&msgq->sender_waiting, 1);
+        if ((write_count - atomic_load(&msgq->read_count)) >= msgq->max_msgs) {
+            waited = _futex_wait(&msgq->read_count, read_count,
+                    (timeout == WAIT_FOREVER) ? NULL : &deadline);
+        }
+        atomic_store(&msgq->sender_waiting, 0);
+        if (!waited) return ERROR;
+        read_count = atomic_load_explicit(&msgq->read_count, memory_order_acquire);
+    }
+
+    memcpy(msgq->slots + (size_t) (write_count & msgq->slot_mask) * msgq->max_msg_length, buffer,
+            nbytes);
+
+    // Sequentially consistent, so that either the receiver sees this message before it sleeps or
+    // this thread sees that it is asleep
+    atomic_store(&msgq->write_count, write_count + 1);
+    if (atomic_load(&msgq->receiver_waiting)) {
+        _futex_wake(&msgq->write_count);
+    }
+    return OK;
+}
+
+static status_t _spsc_receive(_spsc_hdr_t *msgq, char *buffer, unsigned long max_nbytes,
+        int timeout) {
+    unsigned int read_count = atomic_load_explicit(&msgq->read_count, memory_order_relaxed);
+    struct timespec deadline;
+
+    if (timeout > 0) {
+        _get_deadline(CLOCK_MONOTONIC, timeout, &deadline);
+    }
+
+    while (atomic_load_explicit(&msgq->write_count, memory_order_acquire) == read_count) {
+        bool waited = true;
+        if (timeout == NO_WAIT) return ERROR;
+
+        atomic_store(&msgq->receiver_waiting, 1);
+        if (atomic_load(&msgq->write_count) == read_count) {
+            waited = _futex_wait(&msgq->write_count, read_count,
+                    (timeout == WAIT_FOREVER) ? NULL : &deadline);
+        }
+        atomic_store(&msgq->receiver_waiting, 0);
+        if (!waited) return ERROR;
+    }
+
+    memcpy(buffer, msgq->slots + (size_t) (read_count & msgq->slot_mask) * msgq->max_msg_length,
+            MIN(max_nbytes, (unsigned long) msgq->max_msg_length));
+
+    // Hand the slot back to the sender only once it has been copied, and wake the sender if it is
+    // waiting for one
+    atomic_store(&msgq->read_count, read_count + 1);
+    if (atomic_load(&msgq->sender_waiting)) {
+        _futex_wake(&msgq->read_count);
+    }
+    return OK;
+}
+
+static int _spsc_num_msgs(_spsc_hdr_t *msgq) {
+    unsigned int read_count = atomic_load_explicit(&msgq->read_count, memory_order_acquire);
+    return (int) (atomic_load_explicit(&msgq->write_count, memory_order_acquire) - read_count);
+}
+
+msg_q_id msgQCreate(int max_msgs, int max_msg_length, int options) {
     _msgq_hdr_t *msgq;
     int msgq_size;
 
+    if (options & MSG_Q_SPSC) {
+        return _spsc_create(max_msgs, max_msg_length);
+    }
+
     msgq_size = sizeof(_msgq_hdr_t) + max_msgs * max_msg_length;
     msgq = (_msgq_hdr_t *) malloc((size_t)msgq_size);
 
     if (msgq) {
         memset((char *) msgq, 0, (size_t)msgq_size);
-        msgq->msgq_id = (msg_q_id) msgq;
+        msgq->base.msgq_id = (msg_q_id) msgq;
+        msgq->base.options = options;
         msgq->max_msgs = max_msgs;
         msgq->max_msg_length = max_msg_length;
         msgq->num_msgs = 0;
-
         // create a mutex to protect access to this structure
         pthread_mutexattr_init(&(msgq->mutexattr));
         pthread_mutexattr_settype(&(msgq->mutexattr), PTHREAD_MUTEX_RECURSIVE_NP);
@@ -68,6 +280,7 @@ msg_q_id msgQCreate(int max_msgs, int max_msg_length) {
         // create a counting semaphore
         msgq->sem_ptr = &msgq->sem_count;
         sem_init(msgq->sem_ptr, 0, 0); // PRIVATE, EMPTY
+        sem_init(&msgq->sem_space, 0, (unsigned int) max_msgs);
 
         msgq->read_offset = 0;
         msgq->write_offset = 0;
@@ -78,13 +291,20 @@ msg_q_id msgQCreate(int max_msgs, int max_msg_length) {
 status_t msgQDelete(msg_q_id msgQ) {
     _msgq_hdr_t *msgq = (msg_q_id) msgQ;
 
-    if (msgq) {
+    if (msgq && _is_spsc(msgQ)) {
+        int num_msgs = _spsc_num_msgs((_spsc_hdr_t *) msgQ);
+        if (num_msgs) {
+            LOGE("Warning msgQDelete() called on queue with %d messages", num_msgs);
+        }
+        free(msgQ);
+    } else if (msgq) {
         pthread_mutex_lock(&(msgq->mutex));
         if (msgq->num_msgs) {
             LOGE("Warning msgQDelete() called on queue with %d messages", msgq->num_msgs);
         }
 
         sem_destroy(&(msgq->sem_count));
+        sem_destroy(&(msgq->sem_space));
         pthread_mutex_unlock(&(msgq->mutex));
         pthread_mutex_destroy(&(msgq->mutex));
         free((void *) msgq);
@@ -99,11 +319,14 @@ status_t msgQSend(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int t
     status_t result = ERROR;
 
     // validate function arguments
-    if (msgq && (timeout == NO_WAIT) && (priority == MSG_Q_FIFO)) {
-        pthread_mutex_lock(&(msgq->mutex));
+    if (msgq && (timeout >= WAIT_FOREVER) && (priority == MSG_Q_FIFO) && _is_spsc(msgQ)) {
+        result = _spsc_send((_spsc_hdr_t *) msgQ, buffer, nbytes, timeout);
+    } else if (msgq && (timeout >= WAIT_FOREVER) && (priority == MSG_Q_FIFO) &&
+            (nbytes <= msgq->max_msg_length)) {
+        // wait for room in the msgQ
+        if (_sem_wait(&msgq->sem_space, timeout) == 0) {
+            pthread_mutex_lock(&(msgq->mutex));
 
-        // ensure the message conforms to size limits and there is room in the msgQ
-        if ((nbytes <= msgq->max_msg_length) && (msgq->num_msgs < msgq->max_msgs)) {
             msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
                     (msgq->write_offset * msgq->max_msg_length);
             memcpy(msg_loc, buffer, nbytes);
@@ -111,9 +334,9 @@ status_t msgQSend(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int t
             msgq->num_msgs++;
             sem_post(msgq->sem_ptr);
             result = OK;
-        }
 
-        pthread_mutex_unlock(&(msgq->mutex));
+            pthread_mutex_unlock(&(msgq->mutex));
+        }
     }
     return result;
 }
@@ -123,24 +346,49 @@ status_t msgQReceive(msg_q_id msgQ, char *buffer, unsigned long max_nbytes, int
     char *msg_loc;
     status_t result = ERROR;
 
-    if (msgq && buffer && ((timeout == WAIT_FOREVER) || (timeout == NO_WAIT))) {
-        if (timeout == WAIT_FOREVER) {
-            result = (status_t) sem_wait(msgq->sem_ptr);
-        } else {
-            /* timeout is NO_WAIT */
-            result = (status_t) sem_trywait(msgq->sem_ptr);
-        }
+    if (msgq && buffer && (timeout >= WAIT_FOREVER) && _is_spsc(msgQ)) {
+        result = _spsc_receive((_spsc_hdr_t *) msgQ, buffer, max_nbytes, timeout);
+    } else if (msgq && buffer && (timeout >= WAIT_FOREVER)) {
+        result = (status_t) _sem_wait(msgq->sem_ptr, timeout);
 
         if (result == 0) {
             pthread_mutex_lock(&(msgq->mutex));
 
             msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
                     (msgq->read_offset * msgq->max_msg_length);
-            memcpy(buffer, msg_loc, max_nbytes);
+            memcpy(buffer, msg_loc, MIN(max_nbytes, (unsigned long) msgq->max_msg_length));
             msgq->read_offset = (msgq->read_offset + 1) % msgq->max_msgs;
             msgq->num_msgs--;
             pthread_mutex_unlock(&(msgq->mutex));
+            sem_post(&msgq->sem_space);
+        }
+    }
+    return result;
+}
+
+status_t msgQPeek(msg_q_id msgQ, int index, char *buffer, unsigned long max_nbytes) {
+    _msgq_hdr_t *msgq = (msg_q_id) msgQ;
+    char *msg_loc;
+    status_t result = ERROR;
+
+    if (msgq && buffer && (index >= 0) && _is_spsc(msgQ)) {
+        _spsc_hdr_t *spsc = (_spsc_hdr_t *) msgQ;
+        if (index < _spsc_num_msgs(spsc)) {
+            unsigned int slot = (atomic_load_explicit(&spsc->read_count, memory_order_relaxed) +
+                    index) & spsc->slot_mask;
+            memcpy(buffer, spsc->slots + (size_t) slot * spsc->max_msg_length,
+                    MIN(max_nbytes, (unsigned long) spsc->max_msg_length));
+            result = OK;
         }
+    } else if (msgq && buffer && (index >= 0)) {
+        pthread_mutex_lock(&(msgq->mutex));
+        if (index < msgq->num_msgs) {
+            msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
+                    (((msgq->read_offset + index) % msgq->max_msgs) * msgq->max_msg_length);
+            memcpy(buffer, msg_loc, MIN(max_nbytes, (unsigned long) msgq->max_msg_length));
+            result = OK;
+        }
+        pthread_mutex_unlock(&(msgq->mutex));
     }
     return result;
 }
@@ -149,7 +397,9 @@ int msgQNumMsgs(msg_q_id msgQ) {
     _msgq_hdr_t *msgq = (msg_q_id) msgQ;
     int num_msgs = -1;
 
-    if (msgq) {
+    if (msgq && _is_spsc(msgQ)) {
+        num_msgs = _spsc_num_msgs((_spsc_hdr_t *) msgQ);
+    } else if (msgq) {
         pthread_mutex_lock(&(msgq->mutex));
         num_msgs = msgq->num_msgs;
         pthread_mutex_unlock(&(msgq->mutex));
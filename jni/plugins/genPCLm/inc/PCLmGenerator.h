@@ -20,8 +20,76 @@
 #define _PCLM_GENERATOR
 #define SUPPORT_WHITE_STRIPS
 
+#include <pthread.h>
+#include <sys/uio.h>
 #include "common_defines.h"
 
+/*
+ * Upper bound on the number of strip compression workers, which all generators share
+ */
+#define MAX_COMPRESSION_THREADS 4
+
+/*
+ * Strip buffers kept for reuse once their strips have been compressed or injected
+ */
+#define MAX_SPARE_STRIP_BUFFERS (MAX_COMPRESSION_THREADS * 4)
+
+class PCLmGenerator;
+
+/*
+ * A strip handed to the compression workers. Strips are injected into the output in the order
+ * they were queued, regardless of the order in which their compression completes.
+ */
+typedef struct PCLmCompressionTask {
+    PCLmGenerator *owner;
+    ubyte *inBuffer;
+    int inBufferSize;
+    ubyte *outBuffer;
+    int outBufferSize;
+    int numCompBytes;
+    int imageWidth;
+    int imageHeight;
+    compressionDisposition compression;
+    colorSpaceDisposition colorSpace;
+    bool whiteStrip;
+    bool claimed;
+    bool done;
+    struct PCLmCompressionTask *next;
+
+    // Next strip waiting for a worker, across all generators
+    struct PCLmCompressionTask *nextQueued;
+} PCLmCompressionTask;
+
+/*
+ * A piece of the output of one call: either bytes of the output buffer, which may move as it
+ * grows, or a compressed strip held until the next call
+ */
+typedef struct {
+    const ubyte *data; // NULL for the output buffer bytes from offset
+    sint32 offset;
+    sint32 length;
+} PCLmOutputSegment;
+
+/*
+ * Number of compressed white strips kept for reuse across pages and jobs
+ */
+#define WHITE_STRIP_CACHE_SIZE 8
+
+/*
+ * A compressed all-white strip. White strips of the same geometry compress identically, so the
+ * cache is shared by every generator in the process.
+ */
+typedef struct {
+    compressionDisposition compression;
+    colorSpaceDisposition colorSpace;
+    int imageWidth;
+    int imageHeight;
+    int resolution;
+    ubyte *data;
+    int numBytes;
+    unsigned int lastUsed;
+} PCLmWhiteStripCacheEntry;
+
 /*
  * Generates a stream of PCLm output.
  *
@@ -51,16 +119,38 @@ public:
     int StartPage(PCLmPageSetup *PCLmPageContent, void **pOutBuffer, int *iOutBufferSize);
 
     /*
-     * Ends rendering a page. Frees scratch buffer.
+     * Ends rendering a page. Flushes any strips still being compressed. The page buffers are kept
+     * for the next page.
      */
     int EndPage(void **pOutBuffer, int *iOutBufferSize);
 
     /*
-     * Compresses output buffer in Flate, RLE, or JPEG compression
+     * Compresses output buffer in Flate, RLE, or JPEG compression. When compression workers are
+     * running, the strip is queued and the output holds whichever earlier strips have completed.
      */
     int Encapsulate(void *pInBuffer, int inBufferSize, int numLines, void **pOutBuffer,
             int *iOutBufferSize);
 
+    /*
+     * Same as Encapsulate, but consumes the caller's rows in place at the given stride. Rows may
+     * be converted or mirrored in place.
+     */
+    int EncapsulateStrip(const PCLmStripDescriptor *strip, void **pOutBuffer,
+            int *iOutBufferSize);
+
+    /*
+     * Same as EncapsulateStrip, but the output is a list of buffers to be sent in order. The
+     * compressed strips are referenced where they are rather than copied after their headers.
+     * The buffers stay valid until the next call to the generator.
+     */
+    int EncapsulateStripV(const PCLmStripDescriptor *strip, const struct iovec **pOutVector,
+            int *iOutVectorCount);
+
+    /*
+     * Same as EndPage, with the output as for EncapsulateStripV
+     */
+    int EndPageV(const struct iovec **pOutVector, int *iOutVectorCount);
+
     /*
      * Returns index of matched media size, else returns index for letter
      */
@@ -72,12 +162,25 @@ public:
     void FreeBuffer(void *pBuffer);
 
 private:
+    // benchmark/rle_benchmark.cpp checks RLEEncodeImage through this
+    friend class RLEEncoderTest;
+
+    /*
+     * compress input by identifying repeating bytes (not sequences)
+     * Compression ratio good for grayscale images, not great on RGB
+     * Output:
+     *     1-127:   literal run
+     *     128:     end of compression block
+     *     129-256: repeating byte sequence
+     */
+    static int RLEEncodeImage(ubyte *in, ubyte *out, int inLength);
+
     /*
      * Convert an image from one color space to another.
      * Currently, only supports RGB->GRAY
      */
     bool colorConvertSource(colorSpaceDisposition srcCS, colorSpaceDisposition dstCS, ubyte *strip,
-            sint32 stripWidth, sint32 stripHeight);
+            sint32 stripWidth, sint32 stripHeight, sint32 stride);
 
     /*
      * Generates the PDF page construct(s), which includes the image information. The /Length
@@ -111,7 +214,8 @@ private:
             colorSpaceDisposition destColorSpace, bool);
 
     /*
-     * Initializes the output buffer with buff and size
+     * Initializes the output buffer with buff and size, and releases the strips held by the
+     * previous output
      */
     void initOutBuff(char *buff, sint32 size);
 
@@ -125,6 +229,29 @@ private:
      */
     void write2Buff(ubyte *buff, int buffSize);
 
+    /*
+     * Writes a compressed strip to the output. When the output is a vector and buff is the
+     * heldPayload passed to injectStrip, buff is referenced instead of copied.
+     */
+    void writePayload2Buff(ubyte *buff, int buffSize);
+
+    /*
+     * Ends the current run of output buffer bytes, if any, and appends the segment after it.
+     * Returns false on allocation failure.
+     */
+    bool addOutSegment(const ubyte *data, sint32 offset, sint32 length);
+
+    /*
+     * Keeps buffer, of size bytes, until the output referencing it has been sent. Returns false
+     * on allocation failure.
+     */
+    bool holdStripBuffer(ubyte *buffer, int size);
+
+    /*
+     * Turns the segments of the current output into pOutVector
+     */
+    int finishOutVector(const struct iovec **pOutVector, int *iOutVectorCount);
+
     /*
      * Adds totalBytesWrittenToPCLmFile to the xRefTable for output
      */
@@ -167,11 +294,21 @@ private:
     int errorOutAndCleanUp();
 
     /*
-     * Cleans up allocatedOutputBuffer, leftoverScanlineBuffer, scratchBuffer, xRefTable, and
-     * KidsArray
+     * Cleans up allocatedOutputBuffer, the page buffers, xRefTable, and KidsArray
      */
     void Cleanup(void);
 
+    /*
+     * Frees leftoverScanlineBuffer, scratchBuffer and the row buffers allocated by StartPage
+     */
+    void freePageBuffers(void);
+
+    /*
+     * Allocates the page buffers for rows of rowBytes, keeping those of the previous page when
+     * its rows and strips were the same size. Returns false on allocation failure.
+     */
+    bool allocPageBuffers(sint32 rowBytes, bool needMarginStrip);
+
     /*
      * Writes job information to the output buffer
      */
@@ -182,14 +319,10 @@ private:
      */
     void injectImageTransform();
 
-#ifdef SUPPORT_WHITE_STRIPS
-
     /*
-     * Checks if the given buffer is a white strip
+     * Checks if numRows rows of rowBytes, stride bytes apart, are all white
      */
-    bool isWhiteStrip(void *, int);
-
-#endif
+    bool isWhiteStrip(ubyte *data, sint32 stride, sint32 rowBytes, sint32 numRows);
 
     /*
      * Outputs the string associated with the given bin into returnStr
@@ -202,14 +335,94 @@ private:
     bool getOutputBin(jobOutputBin bin, char *);
 
     /*
-     * compress input by identifying repeating bytes (not sequences)
-     * Compression ratio good for grayscale images, not great on RGB
-     * Output:
-     *     1-127:   literal run
-     *     128:     end of compression block
-     *     129-256: repeating byte sequence
+     * Fills stripRowPtrs with numRows output rows for the numSourceRows rows at data. Rows are
+     * used in place when they already span the media, otherwise they are copied into marginStrip
+     * at the left margin. Missing rows, and all rows if data is NULL, point at whiteRow.
+     */
+    ubyte **stripRows(ubyte *data, sint32 stride, sint32 numSourceRows, sint32 numComponents,
+            sint32 numRows);
+
+    /*
+     * Compresses numRows rows of rowBytes into out, returning the compressed size. Rows that are
+     * not contiguous are gathered into gatherBuffer first for RLE.
+     */
+    int compressRows(ubyte **rows, int numRows, int imageWidth, int rowBytes,
+            compressionDisposition compression, colorSpaceDisposition colorSpace, ubyte *out,
+            int outSize, ubyte *gatherBuffer);
+
+    /*
+     * Injects a compressed strip using the grammar for the given compression. A non-zero
+     * buffSize passes ownership of buff, a takeStripBuffer buffer of that size, so that it can
+     * be referenced by vectored output rather than copied.
+     */
+    void injectStrip(ubyte *buff, int buffSize, int numBytes, int imageHeight,
+            compressionDisposition compression, colorSpaceDisposition colorSpace, bool whiteStrip);
+
+    /*
+     * Compresses and injects the given rows, or queues a copy of them when compression workers
+     * are running. Returns false on allocation failure.
+     */
+    bool encodeStrip(ubyte **rows, sint32 numRows, sint32 rowBytes, bool whiteStrip);
+
+    /*
+     * Same as encodeStrip for numRows rows of white, taking the compressed strip from the white
+     * strip cache when possible. Returns false on allocation failure.
+     */
+    bool encodeWhiteStrip(sint32 numRows, sint32 rowBytes, bool whiteStrip);
+
+    /*
+     * Starts handing strips to the shared compression workers, growing the pool to numThreads
+     * workers if needed. Does nothing if already joined or numThreads is below 2.
+     */
+    void joinCompressionPool(int numThreads);
+
+    /*
+     * Stops using the shared compression workers, waiting for the strips they are compressing
+     * for this generator and discarding the rest
+     */
+    void leaveCompressionPool();
+
+    /*
+     * Worker thread entry point; compresses strips queued by any generator until the pool has
+     * more workers than its generators asked for
+     */
+    static void *compressionThread(void *param);
+
+    /*
+     * Compresses a single task's strip into its output buffer
+     */
+    void compressStrip(PCLmCompressionTask *task);
+
+    /*
+     * Returns a buffer of size bytes, reusing a spare one of that size if there is one
      */
-    int RLEEncodeImage(ubyte *in, ubyte *out, int inLength);
+    ubyte *takeStripBuffer(int size);
+
+    /*
+     * Keeps buffer, of size bytes, as a spare for a later strip, freeing the oldest spare if
+     * there are already MAX_SPARE_STRIP_BUFFERS
+     */
+    void releaseStripBuffer(ubyte *buffer, int size);
+
+    /*
+     * Takes ownership of strip, which must come from takeStripBuffer, and queues it for
+     * compression, or straight for injection if it is already compressed. Returns false on
+     * allocation failure.
+     */
+    bool queueStrip(ubyte *strip, int numBytes, int imageHeight, bool whiteStrip,
+            bool compressed);
+
+    /*
+     * Injects completed strips, in queued order, into the output buffer. Blocks until every
+     * queued strip is injected if waitForAll is set, otherwise only while more than maxPending
+     * strips remain in flight.
+     */
+    void injectCompletedStrips(bool waitForAll, int maxPending);
+
+    /*
+     * Grows the output buffer, if needed, so that numBytes more can be written
+     */
+    bool growOutBuff(int numBytes);
 
     sint32 currStripHeight;
     char currMediaName[256];
@@ -235,6 +448,31 @@ private:
     int dstNumComponents;
     int numLeftoverScanlines;
     ubyte *scratchBuffer;
+    sint32 scratchBufferSize;
+    ubyte *whiteRow;
+    ubyte *mirrorRow; // holds a row while prepImageForBacksideDuplex swaps rows
+    ubyte *marginStrip;
+    ubyte *gatherBuffer;
+    ubyte **stripRowPtrs;
+
+    // Vectored output of the current call, and the strip buffers it references
+    bool vectorOutput;
+    sint32 segmentStart;
+    PCLmOutputSegment *outSegments;
+    int numOutSegments;
+    int maxOutSegments;
+    struct iovec *outVector;
+    int maxOutVector;
+    ubyte *heldPayload;
+    int heldPayloadSize;
+    ubyte **heldStripBuffers;
+    int *heldStripBufferSizes;
+    int numHeldStripBuffers;
+    int maxHeldStripBuffers;
+
+    // Row size and strip height the page buffers were allocated for
+    sint32 pageBufferRowBytes;
+    sint32 pageBufferStripHeight;
     int pageCount;
     bool reverseOrder;
     int outBuffSize;
@@ -255,6 +493,9 @@ private:
     sint32 *xRefTable;
     sint32 xRefIndex;
     sint32 xRefStart;
+    // Range of xRefTable entries for the current page's strips, reordered by fixXRef
+    sint32 startXRef;
+    sint32 endXRef;
     char pOutStr[256];
     bool adobeRGBCS_firstTime;
     bool mirrorBackside;
@@ -266,6 +507,17 @@ private:
     sint32 numPartialScanlinesToInject;
 
     PCLmSUserSettingsType *m_pPCLmSSettings;
+
+    // Workers of the shared pool this generator asked for, 0 to compress on the calling thread
+    int numCompressionThreads;
+    pthread_mutex_t compressionLock;
+    pthread_cond_t compressionDone;
+    PCLmCompressionTask *pendingHead;
+    PCLmCompressionTask *pendingTail;
+    int numPendingStrips;
+    ubyte *spareStripBuffers[MAX_SPARE_STRIP_BUFFERS];
+    int spareStripBufferSizes[MAX_SPARE_STRIP_BUFFERS];
+    int numSpareStripBuffers;
 };
 
 #endif // _PCLM_PARSER_
\ No newline at end of file
@@ -178,8 +178,19 @@ typedef struct {
     int mediaHeightInPixels;
     int SourceWidthPixels;
     int SourceHeightPixels;
+    int numCompressionThreads; // 0 or 1 compresses strips serially on the calling thread
 } PCLmPageSetup;
 
+/*
+ * A strip of caller-owned raster rows, consumed in place. Rows start stride bytes apart; NULL data
+ * describes numRows rows of white.
+ */
+typedef struct {
+    ubyte *data;
+    int stride;
+    int numRows;
+} PCLmStripDescriptor;
+
 typedef enum {
     success = 0,
     genericFailure = -1,
@@ -22,9 +22,9 @@
 #include <jpeglib.h>
 
 /*
- * Encode JPEG data from imageBuffer into to an output buffer
+ * Encode JPEG data from the image_height rows into to an output buffer
  */
 extern void write_JPEG_Buff(ubyte *outBuff, int quality, int image_width, int image_height,
-        JSAMPLE *imageBuffer, int resolution, colorSpaceDisposition, int *numCompBytes);
+        JSAMPROW *rows, int resolution, colorSpaceDisposition, int *numCompBytes);
 
 #endif // _GEN_PCLM_H
\ No newline at end of file
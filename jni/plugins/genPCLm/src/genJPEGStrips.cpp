@@ -49,7 +49,7 @@ static void term_buffer(jpeg_compress_struct *) {
 
 GLOBAL(void)
 write_JPEG_Buff(ubyte *buffPtr, int quality, int image_width, int image_height,
-        JSAMPLE *imageBuffer, int resolution, colorSpaceDisposition destCS, int *numCompBytes) {
+        JSAMPROW *rows, int resolution, colorSpaceDisposition destCS, int *numCompBytes) {
     struct jpeg_error_mgr jerr;
 
     // Step 1: allocate and initialize JPEG compression object
@@ -102,15 +102,11 @@ write_JPEG_Buff(ubyte *buffPtr, int quality, int image_width, int image_height,
     // Step 4: Start compressor
     jpeg_start_compress(&cinfo, TRUE);
 
-    // Step 5: Write scanlines
+    // Step 5: Write scanlines straight from the caller's rows
 
-    int row_stride; // physical row width in image buffer
-    row_stride = image_width * cinfo.input_components; // JSAMPLEs per row in imageBuffer
-
-    JSAMPROW row_pointer[1]; // pointer to JSAMPLE row[s]
     while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &imageBuffer[cinfo.next_scanline * row_stride];
-        (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        (void) jpeg_write_scanlines(&cinfo, &rows[cinfo.next_scanline],
+                cinfo.image_height - cinfo.next_scanline);
     }
 
     // Step 6: Finish compression
@@ -17,6 +17,7 @@
  */
 
 #include "../../media.h"
+#include "../../wprint_color.h"
 #include <PCLmGenerator.h>
 
 #include <assert.h>
@@ -25,7 +26,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <genPCLm.h>
+#include <wprint_debug.h>
 
 #define TAG "genPCLm"
 
@@ -39,89 +42,162 @@
 #define PAGES_OBJ_NUMBER   2
 #define ADOBE_RGB_SIZE 284
 
-#define rgb_2_gray(r, g, b) (ubyte)(0.299*(double)r+0.587*(double)g+0.114*(double)b)
-
 static PCLmSUserSettingsType PCLmSSettings;
 
-/*
- * Shift the strip image right in the strip buffer by leftMargin pixels.
- *
- * Assumptions: The strip buffer was allocated large enough to handle the shift; if not
- * then the image data on the right will get clipped.
- *
- * We allocate a full strip (height and width), but then only copy numLinesThisCall from
- * the original buffer to the newly allocated buffer.  This pads the strips for JPEG processing.
- */
-static ubyte *shiftStripByLeftMargin(ubyte *ptrToStrip, sint32 currSourceWidth,
-        sint32 currStripHeight, sint32 numLinesThisCall, sint32 currMediaWidth, sint32 leftMargin,
-        colorSpaceDisposition destColorSpace) {
-    ubyte *fromPtr, *toPtr, *newStrip;
-    sint32 scanLineWidth;
+static PCLmWhiteStripCacheEntry whiteStripCache[WHITE_STRIP_CACHE_SIZE];
+static unsigned int whiteStripCacheUses = 0;
+static pthread_mutex_t whiteStripCacheLock = PTHREAD_MUTEX_INITIALIZER;
 
-    if (destColorSpace == grayScale) {
-        scanLineWidth = currMediaWidth;
+// Compression workers shared by every generator in the process, and the strips waiting for them
+static pthread_mutex_t compressionPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compressionPoolWork = PTHREAD_COND_INITIALIZER;
+static PCLmCompressionTask *poolQueueHead = NULL;
+static PCLmCompressionTask *poolQueueTail = NULL;
+static int poolThreads = 0;
 
-        // Allocate a full strip
-        newStrip = (ubyte *) malloc(scanLineWidth * currStripHeight);
-        memset(newStrip, 0xff, scanLineWidth * currStripHeight);
-        for (int i = 0; i < numLinesThisCall; i++) {
-            toPtr = newStrip + leftMargin + (i * currMediaWidth);
-            fromPtr = ptrToStrip + (i * currSourceWidth);
-            memcpy(toPtr, fromPtr, currSourceWidth);
-        }
-    } else {
-        scanLineWidth = currMediaWidth * 3;
-        sint32 srcScanlineWidth = currSourceWidth * 3;
-        sint32 shiftAmount = leftMargin * 3;
-        newStrip = (ubyte *) malloc(scanLineWidth * currStripHeight);
-        memset(newStrip, 0xff, scanLineWidth * currStripHeight);
-        for (int i = 0; i < numLinesThisCall; i++) {
-            toPtr = newStrip + shiftAmount + (i * scanLineWidth);
-            fromPtr = ptrToStrip + (i * srcScanlineWidth);
-            memcpy(toPtr, fromPtr, srcScanlineWidth);
+// Number of generators in the pool that asked for each number of workers
+static int poolRequests[MAX_COMPRESSION_THREADS + 1];
+
+/*
+ * Returns the most workers any generator in the pool asked for. Called with the pool locked.
+ */
+static int poolWantedThreads(void) {
+    for (int i = MAX_COMPRESSION_THREADS; i > 0; i--) {
+        if (poolRequests[i]) {
+            return i;
         }
     }
-
-    return newStrip;
+    return 0;
 }
 
-#ifdef SUPPORT_WHITE_STRIPS
-
-bool PCLmGenerator::isWhiteStrip(void *pInBuffer, int inBufferSize) {
-    uint32 *ptr = (uint32 *) pInBuffer;
-    for (int i = 0; i < inBufferSize / 4; i++, ptr++) {
-        if (*ptr != 0xffffffff) {
+bool PCLmGenerator::isWhiteStrip(ubyte *data, sint32 stride, sint32 rowBytes, sint32 numRows) {
+    for (sint32 i = 0; data && i < numRows; i++) {
+        if (memcmp(data + i * stride, whiteRow, rowBytes)) {
             return false;
         }
     }
     return true;
 }
 
-#endif
-
 void PCLmGenerator::Cleanup(void) {
+    leaveCompressionPool();
+
+    // No worker holds our strips any more, so the strip buffers can be freed without the lock
+    while (numHeldStripBuffers) {
+        free(heldStripBuffers[--numHeldStripBuffers]);
+    }
+    while (numSpareStripBuffers) {
+        free(spareStripBuffers[--numSpareStripBuffers]);
+    }
+    free(heldStripBuffers);
+    free(heldStripBufferSizes);
+    heldStripBuffers = NULL;
+    heldStripBufferSizes = NULL;
+    maxHeldStripBuffers = 0;
+    free(outSegments);
+    outSegments = NULL;
+    numOutSegments = maxOutSegments = 0;
+    free(outVector);
+    outVector = NULL;
+    maxOutVector = 0;
+
     if (allocatedOutputBuffer) {
         free(allocatedOutputBuffer);
         allocatedOutputBuffer = NULL;
         currOutBuffSize = 0;
     }
 
+    freePageBuffers();
+    if (xRefTable) {
+        free(xRefTable);
+        xRefTable = NULL;
+    }
+    if (KidsArray) {
+        free(KidsArray);
+        KidsArray = NULL;
+    }
+}
+
+void PCLmGenerator::freePageBuffers(void) {
     if (leftoverScanlineBuffer) {
         free(leftoverScanlineBuffer);
         leftoverScanlineBuffer = NULL;
     }
+    numLeftoverScanlines = 0;
     if (scratchBuffer) {
         free(scratchBuffer);
         scratchBuffer = NULL;
     }
-    if (xRefTable) {
-        free(xRefTable);
-        xRefTable = NULL;
+    if (whiteRow) {
+        free(whiteRow);
+        whiteRow = NULL;
     }
-    if (KidsArray) {
-        free(KidsArray);
-        KidsArray = NULL;
+    if (mirrorRow) {
+        free(mirrorRow);
+        mirrorRow = NULL;
+    }
+    if (marginStrip) {
+        free(marginStrip);
+        marginStrip = NULL;
+    }
+    if (gatherBuffer) {
+        free(gatherBuffer);
+        gatherBuffer = NULL;
+    }
+    if (stripRowPtrs) {
+        free(stripRowPtrs);
+        stripRowPtrs = NULL;
+    }
+    pageBufferRowBytes = 0;
+    pageBufferStripHeight = 0;
+}
+
+bool PCLmGenerator::allocPageBuffers(sint32 rowBytes, bool needMarginStrip) {
+    // We need to pad the scratchBuffer size to allow for compression expansion (RLE can create
+    // compressed segments that are slightly larger than the source.
+    sint32 newScratchBufferSize = currStripHeight * mediaWidthInPixels * srcNumComponents * 2;
+
+    if (leftoverScanlineBuffer) {
+        free(leftoverScanlineBuffer);
+        leftoverScanlineBuffer = NULL;
     }
+    numLeftoverScanlines = 0;
+
+    if (rowBytes != pageBufferRowBytes || currStripHeight != pageBufferStripHeight ||
+            newScratchBufferSize != scratchBufferSize) {
+        freePageBuffers();
+        scratchBufferSize = newScratchBufferSize;
+        scratchBuffer = (ubyte *) malloc(scratchBufferSize);
+        whiteRow = (ubyte *) malloc(rowBytes);
+        mirrorRow = (ubyte *) malloc(rowBytes);
+        gatherBuffer = (ubyte *) malloc(rowBytes * currStripHeight);
+        stripRowPtrs = (ubyte **) malloc(currStripHeight * sizeof(ubyte *));
+        if (!scratchBuffer || !whiteRow || !mirrorRow || !gatherBuffer || !stripRowPtrs) {
+            return false;
+        }
+        memset(whiteRow, 0xff, rowBytes);
+        pageBufferRowBytes = rowBytes;
+        pageBufferStripHeight = currStripHeight;
+    }
+
+    // Rows that do not span the media are shifted into a white strip, otherwise they are
+    // encoded straight from the caller's buffer. The margins may move between pages, so the
+    // strip is whitened again even when it is reused.
+    if (!needMarginStrip) {
+        if (marginStrip) {
+            free(marginStrip);
+            marginStrip = NULL;
+        }
+    } else {
+        if (!marginStrip) {
+            marginStrip = (ubyte *) malloc(rowBytes * currStripHeight);
+            if (!marginStrip) {
+                return false;
+            }
+        }
+        memset(marginStrip, 0xff, rowBytes * currStripHeight);
+    }
+    return true;
 }
 
 int PCLmGenerator::errorOutAndCleanUp() {
@@ -130,9 +206,6 @@ int PCLmGenerator::errorOutAndCleanUp() {
     return genericFailure;
 }
 
-static sint32 startXRef = 0;
-static sint32 endXRef = 0;
-
 /*
  * DO NOT EDIT UNTIL YOU READ THE HEADER FILE DESCRIPTION.
  */
@@ -224,6 +297,14 @@ void PCLmGenerator::initOutBuff(char *buff, sint32 size) {
     outBuffSize = size;
     totalBytesWrittenToCurrBuff = 0;
     memset(buff, 0, size);
+
+    // The caller has sent the previous output, so the strips it referenced can be reused
+    for (int i = 0; i < numHeldStripBuffers; i++) {
+        releaseStripBuffer(heldStripBuffers[i], heldStripBufferSizes[i]);
+    }
+    numHeldStripBuffers = 0;
+    numOutSegments = 0;
+    segmentStart = 0;
 }
 
 void PCLmGenerator::writeStr2OutBuff(char *str) {
@@ -248,6 +329,118 @@ void PCLmGenerator::write2Buff(ubyte *buff, int buffSize) {
     totalBytesWrittenToPCLmFile += buffSize;
 }
 
+void PCLmGenerator::writePayload2Buff(ubyte *buff, int buffSize) {
+    if (vectorOutput && buff && buff == heldPayload &&
+            holdStripBuffer(heldPayload, heldPayloadSize)) {
+        heldPayload = NULL;
+        if (addOutSegment(buff, 0, buffSize)) {
+            totalBytesWrittenToPCLmFile += buffSize;
+            return;
+        }
+    }
+    write2Buff(buff, buffSize);
+}
+
+bool PCLmGenerator::addOutSegment(const ubyte *data, sint32 offset, sint32 length) {
+    if (numOutSegments + 2 > maxOutSegments) {
+        int newMax = maxOutSegments ? maxOutSegments * 2 : 16;
+        PCLmOutputSegment *newSegments = (PCLmOutputSegment *) realloc(outSegments,
+                newMax * sizeof(PCLmOutputSegment));
+        if (!newSegments) {
+            return false;
+        }
+        outSegments = newSegments;
+        maxOutSegments = newMax;
+    }
+
+    sint32 used = currBuffPtr - outBuffPtr;
+    if (used > segmentStart) {
+        outSegments[numOutSegments].data = NULL;
+        outSegments[numOutSegments].offset = segmentStart;
+        outSegments[numOutSegments].length = used - segmentStart;
+        numOutSegments++;
+    }
+    segmentStart = used;
+
+    if (length > 0) {
+        outSegments[numOutSegments].data = data;
+        outSegments[numOutSegments].offset = offset;
+        outSegments[numOutSegments].length = length;
+        numOutSegments++;
+    }
+    return true;
+}
+
+bool PCLmGenerator::holdStripBuffer(ubyte *buffer, int size) {
+    if (numHeldStripBuffers == maxHeldStripBuffers) {
+        int newMax = maxHeldStripBuffers ? maxHeldStripBuffers * 2 : 8;
+        ubyte **newBuffers = (ubyte **) realloc(heldStripBuffers, newMax * sizeof(ubyte *));
+        if (!newBuffers) {
+            return false;
+        }
+        heldStripBuffers = newBuffers;
+        int *newSizes = (int *) realloc(heldStripBufferSizes, newMax * sizeof(int));
+        if (!newSizes) {
+            return false;
+        }
+        heldStripBufferSizes = newSizes;
+        maxHeldStripBuffers = newMax;
+    }
+
+    heldStripBuffers[numHeldStripBuffers] = buffer;
+    heldStripBufferSizes[numHeldStripBuffers] = size;
+    numHeldStripBuffers++;
+    return true;
+}
+
+int PCLmGenerator::finishOutVector(const struct iovec **pOutVector, int *iOutVectorCount) {
+    // Close the last run of output buffer bytes
+    if (!addOutSegment(NULL, 0, 0)) {
+        return errorOutAndCleanUp();
+    }
+
+    if (numOutSegments > maxOutVector) {
+        struct iovec *newVector = (struct iovec *) realloc(outVector,
+                numOutSegments * sizeof(struct iovec));
+        if (!newVector) {
+            return errorOutAndCleanUp();
+        }
+        outVector = newVector;
+        maxOutVector = numOutSegments;
+    }
+
+    // The output buffer only stops moving once the call is done, so its pieces are placed now
+    for (int i = 0; i < numOutSegments; i++) {
+        const PCLmOutputSegment *segment = &outSegments[i];
+        outVector[i].iov_base = (void *) (segment->data ? segment->data :
+                (const ubyte *) outBuffPtr + segment->offset);
+        outVector[i].iov_len = segment->length;
+    }
+    *pOutVector = outVector;
+    *iOutVectorCount = numOutSegments;
+    return success;
+}
+
+bool PCLmGenerator::growOutBuff(int numBytes) {
+    sint32 used = currBuffPtr - outBuffPtr;
+    if (used + numBytes < outBuffSize) {
+        return true;
+    }
+
+    sint32 newSize = used + numBytes + DEFAULT_OUTBUFF_SIZE / 10;
+    char *newBuff = (char *) realloc(allocatedOutputBuffer, newSize);
+    if (newBuff == NULL) {
+        return false;
+    }
+
+    allocatedOutputBuffer = newBuff;
+    outBuffPtr = newBuff;
+    currBuffPtr = newBuff + used;
+    memset(currBuffPtr, 0, newSize - used);
+    outBuffSize = currOutBuffSize = newSize;
+    return true;
+}
+
 int PCLmGenerator::statOutputFileSize() {
     addXRef(totalBytesWrittenToPCLmFile);
     return (1);
@@ -417,15 +610,11 @@ bool PCLmGenerator::injectAdobeRGBCS() {
 }
 
 bool PCLmGenerator::colorConvertSource(colorSpaceDisposition srcCS, colorSpaceDisposition dstCS,
-        ubyte *strip, sint32 stripWidth, sint32 stripHeight) {
+        ubyte *strip, sint32 stripWidth, sint32 stripHeight, sint32 stride) {
     if (srcCS == deviceRGB && dstCS == grayScale) {
-        // Do an inplace conversion from RGB -> 8 bpp gray
-        ubyte *srcPtr = strip;
-        ubyte *dstPtr = strip;
+        // Do an inplace conversion from RGB -> 8 bpp gray, leaving each row where it started
         for (int h = 0; h < stripHeight; h++) {
-            for (int w = 0; w < stripWidth; w++, dstPtr++, srcPtr += 3) {
-                *dstPtr = (ubyte) rgb_2_gray(*srcPtr, *(srcPtr + 1), *(srcPtr + 2));
-            }
+            wprint_rgb_to_gray(strip + h * stride, strip + h * stride, stripWidth);
         }
         dstNumComponents = 1;
     } else {
@@ -509,7 +698,7 @@ int PCLmGenerator::injectRLEStrip(ubyte *RLEBuffer, int numBytes, int imageWidth
     writeStr2OutBuff(pOutStr);
 
     // Write the zlib compressed strip to the PDF output file
-    write2Buff(RLEBuffer, numBytes);
+    writePayload2Buff(RLEBuffer, numBytes);
     sprintf(pOutStr, "\nendstream\n");
     writeStr2OutBuff(pOutStr);
     sprintf(pOutStr, "endobj\n");
@@ -598,7 +787,7 @@ int PCLmGenerator::injectLZStrip(ubyte *LZBuffer, int numBytes, int imageWidth,
     writeStr2OutBuff(pOutStr);
 
     // Write the zlib compressed strip to the PDF output file
-    write2Buff(LZBuffer, numBytes);
+    writePayload2Buff(LZBuffer, numBytes);
     sprintf(pOutStr, "\nendstream\n");
     writeStr2OutBuff(pOutStr);
     sprintf(pOutStr, "endobj\n");
@@ -722,7 +911,7 @@ int PCLmGenerator::injectJPEG(char *jpeg_Buff, int imageWidth, int imageHeight,
     sprintf(pOutStr, "stream\n");
     writeStr2OutBuff(pOutStr);
 
-    write2Buff((ubyte *) jpeg_Buff, numCompBytes);
+    writePayload2Buff((ubyte *) jpeg_Buff, numCompBytes);
     sprintf(pOutStr, "\nendstream\n");
     writeStr2OutBuff(pOutStr);
     sprintf(pOutStr, "endobj\n");
@@ -987,40 +1176,24 @@ void PCLmGenerator::writePDFGrammarPage(int imageWidth, int imageHeight, int num
 }
 
 /*
- * Mirrors the source image in preparation for backside duplex support
+ * Mirrors the source image in preparation for backside duplex support, using temp to hold one row
  */
-static bool prepImageForBacksideDuplex(ubyte *imagePtr, sint32 imageHeight, sint32 imageWidth,
-        sint32 numComponents) {
-    sint32 numBytes = imageHeight * imageWidth * numComponents;
-    ubyte *head, *tail, t0, t1, t2;
-
-    if (numComponents == 3) {
-        for (head = imagePtr, tail = imagePtr + numBytes - 1; tail > head;) {
-            t0 = *head;
-            t1 = *(head + 1);
-            t2 = *(head + 2);
-
-            *head = *(tail - 2);
-            *(head + 1) = *(tail - 1);
-            *(head + 2) = *(tail - 0);
-            *tail = t2;
-            *(tail - 1) = t1;
-            *(tail - 2) = t0;
-
-            head += 3;
-            tail -= 3;
-        }
-    } else {
-        for (head = imagePtr, tail = imagePtr + numBytes; tail > head;) {
-            t0 = *head;
-            *head = *tail;
-            *tail = t0;
-            head++;
-            tail--;
+static void prepImageForBacksideDuplex(ubyte *imagePtr, sint32 imageHeight, sint32 imageWidth,
+        sint32 numComponents, sint32 stride, ubyte *temp) {
+    ubyte *head, *tail;
+    sint32 top, bottom;
+    sint32 rowBytes = imageWidth * numComponents;
+
+    // Swap rows from the outside in, reversing the pixel order of each as we go
+    for (top = 0, bottom = imageHeight - 1; top <= bottom; top++, bottom--) {
+        head = imagePtr + top * stride;
+        tail = imagePtr + bottom * stride;
+        wprint_reverse_pixels(head, temp, imageWidth, numComponents);
+        if (top != bottom) {
+            wprint_reverse_pixels(tail, head, imageWidth, numComponents);
         }
+        memcpy(tail, temp, rowBytes);
     }
-//origTail++;
-    return true;
 }
 
 bool PCLmGenerator::getInputBinString(jobInputBin bin, char *returnStr) {
@@ -1269,75 +1442,117 @@ void PCLmGenerator::writePDFGrammarHeader() {
     writeStr2OutBuff(pOutStr);
 }
 
+/*
+ * Reads the eight bytes at p as a little-endian word, so that the byte at p + i is bits 8i to
+ * 8i + 7 whatever the byte order of the machine
+ */
+static inline uint64_t loadWordLE(const ubyte *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/*
+ * Index of the lowest byte of a loadWordLE word that has any bit set in mask
+ */
+static inline sint32 firstSetByte(uint64_t mask) {
+    return __builtin_ctzll(mask) >> 3;
+}
+
+/*
+ * Number of bytes from in equal to *in, comparing a word at a time
+ */
+static sint32 repeatRunLength(const ubyte *in, const ubyte *endPtr) {
+    const ubyte *p = in + 1;
+    uint64_t pattern = 0x0101010101010101ULL * *in;
+    uint64_t word;
+
+    for (; p + sizeof(word) <= endPtr; p += sizeof(word)) {
+        word = loadWordLE(p);
+        if (word ^ pattern) {
+            return (sint32) (p - in) + firstSetByte(word ^ pattern);
+        }
+    }
+    while (p < endPtr && *p == *in) {
+        p++;
+    }
+    return (sint32) (p - in);
+}
+
+/*
+ * Number of bytes from in up to the next pair of equal bytes, or to endPtr if there is none.
+ * Adjacent bytes are compared a word at a time by looking for a zero byte in their XOR.
+ */
+static sint32 literalRunLength(const ubyte *in, const ubyte *endPtr) {
+    const ubyte *p = in;
+    uint64_t word, next, diff, zero;
+
+    for (; p + sizeof(word) + 1 <= endPtr; p += sizeof(word)) {
+        word = loadWordLE(p);
+        next = loadWordLE(p + 1);
+        diff = word ^ next;
+        // The lowest flagged byte is exact; borrows only carry into higher bytes, which
+        // loadWordLE makes the ones later in memory
+        zero = (diff - 0x0101010101010101ULL) & ~diff & 0x8080808080808080ULL;
+        if (zero) {
+            return (sint32) (p - in) + firstSetByte(zero);
+        }
+    }
+    while (p + 1 < endPtr && p[0] != p[1]) {
+        p++;
+    }
+    return (p + 1 < endPtr) ? (sint32) (p - in) : (sint32) (endPtr - in);
+}
+
 int PCLmGenerator::RLEEncodeImage(ubyte *in, ubyte *out, int inLength) {
     ubyte *imgPtr = in;
     ubyte *endPtr = in + inLength;
     ubyte *origOut = out;
     ubyte c;
-    sint32 cnt = 0;
+    sint32 cnt;
 
     while (imgPtr < endPtr) {
-        c = *imgPtr++;
-        cnt = 1;
-
-        // Figure out how many repeating bytes are in the image
-        while (*imgPtr == c && cnt < inLength) {
-            if (imgPtr > endPtr) {
-                break;
-            }
-            cnt++;
-            imgPtr++;
-        }
-
-        if (cnt > 1) {
-            /* If cnt > 1, then output repeating byte specification
+        if (imgPtr + 1 < endPtr && imgPtr[0] == imgPtr[1]) {
+            /* Output the repeating byte specification
              * The syntax is "byte-count repeateByte", where byte-count is 257-byte-count.
              * Since the cnt value is a byte, if the repeateCnt is > 128 then we need to put
              * out multiple repeat-blocks (Referred to as method 1) range is 128-256
              */
+            c = *imgPtr;
+            cnt = repeatRunLength(imgPtr, endPtr);
+            imgPtr += cnt;
             while (cnt > 128) {
                 *out++ = 129; // i.e. 257-129==128
                 *out++ = c;
                 cnt -= 128;
             }
-            // Now handle the repeats that are < 128
-            if (cnt) {
-                *out++ = (257 - cnt); // i.e. cnt==2: 257-255=2
-                *out++ = c;
-            }
+            // Now handle the repeats that are <= 128
+            *out++ = (ubyte) (257 - cnt); // i.e. cnt==2: 257-255=2
+            *out++ = c;
         } else {
-            /* If cnt==1, then this is a literal run - no repeating bytes found.
+            /* This is a literal run - no repeating bytes found.
              * The syntax is "byte-count literal-run", where byte-count is < 128 and
              * literal-run is the non-repeating bytes of the input stream.
              * Referred to as method 2, range is 0-127
              */
-            ubyte *start, *p;
-            sint32 i;
-            start = (imgPtr - 1);  // The first byte of the literal run
-
-            // Now find the end of the literal run
-            for (cnt = 1, p = start; *p != *imgPtr; p++, imgPtr++, cnt++) {
-                if (imgPtr >= endPtr) break;
-            }
-            if (!(imgPtr == endPtr)) {
-                imgPtr--;
-                // imgPtr incremented 1 too many
-            }
-            cnt--;
+            cnt = literalRunLength(imgPtr, endPtr);
             // Blocks of literal bytes can't exceed 128 bytes, so output multiple
             //    literal-run blocks if > 128
             while (cnt > 128) {
                 *out++ = 127;
-                for (i = 0; i < 128; i++) {
-                    *out++ = *start++;
-                }
+                memcpy(out, imgPtr, 128);
+                out += 128;
+                imgPtr += 128;
                 cnt -= 128;
             }
             // Now output the leftover literal run
-            *out++ = cnt - 1;
-            for (i = 0; i < cnt; i++) {
-                *out++ = *start++;
-            }
+            *out++ = (ubyte) (cnt - 1);
+            memcpy(out, imgPtr, cnt);
+            out += cnt;
+            imgPtr += cnt;
         }
     }
     // Now, write the end-of-compression marker (byte 128) into the output stream
@@ -1346,6 +1561,440 @@ int PCLmGenerator::RLEEncodeImage(ubyte *in, ubyte *out, int inLength) {
     return ((int) (out - origOut));
 }
 
+ubyte **PCLmGenerator::stripRows(ubyte *data, sint32 stride, sint32 numSourceRows,
+        sint32 numComponents, sint32 numRows) {
+    sint32 scanlineWidth = mediaWidthInPixels * numComponents;
+    sint32 marginBytes = leftMarginInPix * numComponents;
+    sint32 copyBytes = MAX(0, MIN(currSourceWidth * numComponents, scanlineWidth - marginBytes));
+
+    for (sint32 i = 0; i < numRows; i++) {
+        if (!data || i >= numSourceRows) {
+            stripRowPtrs[i] = whiteRow;
+        } else if (!marginStrip) {
+            stripRowPtrs[i] = data + i * stride;
+        } else {
+            // The rest of the row was whitened in StartPage and is never written
+            stripRowPtrs[i] = marginStrip + i * scanlineWidth;
+            memcpy(stripRowPtrs[i] + marginBytes, data + i * stride, copyBytes);
+        }
+    }
+    return stripRowPtrs;
+}
+
+int PCLmGenerator::compressRows(ubyte **rows, int numRows, int imageWidth, int rowBytes,
+        compressionDisposition compression, colorSpaceDisposition colorSpace, ubyte *out,
+        int outSize, ubyte *gatherBuffer) {
+    int numCompBytes = 0;
+
+    if (compression == compressDCT) {
+        write_JPEG_Buff(out, JPEG_QUALITY, imageWidth, numRows, (JSAMPROW *) rows,
+                currRenderResolutionInteger, colorSpace, &numCompBytes);
+    } else if (compression == compressFlate) {
+        // Stream the rows through zlib; this produces the same output as compress()
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            return 0;
+        }
+        zs.next_out = out;
+        zs.avail_out = (uInt) outSize;
+        for (int i = 0; i < numRows; i++) {
+            zs.next_in = rows[i];
+            zs.avail_in = (uInt) rowBytes;
+            deflate(&zs, (i == numRows - 1) ? Z_FINISH : Z_NO_FLUSH);
+        }
+        numCompBytes = (int) zs.total_out;
+        deflateEnd(&zs);
+    } else if (compression == compressRLE) {
+        ubyte *in = rows[0];
+        for (int i = 1; i < numRows; i++) {
+            if (rows[i] != rows[0] + i * rowBytes) {
+                if (!gatherBuffer) {
+                    return 0;
+                }
+                for (int j = 0; j < numRows; j++) {
+                    memcpy(gatherBuffer + j * rowBytes, rows[j], rowBytes);
+                }
+                in = gatherBuffer;
+                break;
+            }
+        }
+        numCompBytes = RLEEncodeImage(in, out, rowBytes * numRows);
+    } else {
+        assert(0);
+    }
+    return numCompBytes;
+}
+
+void PCLmGenerator::injectStrip(ubyte *buff, int buffSize, int numBytes, int imageHeight,
+        compressionDisposition compression, colorSpaceDisposition colorSpace, bool whiteStrip) {
+    heldPayload = buffSize ? buff : NULL;
+    heldPayloadSize = buffSize;
+
+    if (compression == compressDCT) {
+        injectJPEG((char *) buff, mediaWidthInPixels, imageHeight, numBytes, colorSpace,
+                whiteStrip);
+    } else if (compression == compressFlate) {
+        injectLZStrip(buff, numBytes, mediaWidthInPixels, imageHeight, colorSpace, whiteStrip);
+    } else {
+        injectRLEStrip(buff, numBytes, mediaWidthInPixels, imageHeight, colorSpace, whiteStrip);
+    }
+
+    // The strip was copied rather than referenced, so its buffer is done with
+    if (heldPayload) {
+        releaseStripBuffer(heldPayload, heldPayloadSize);
+        heldPayload = NULL;
+    }
+}
+
+bool PCLmGenerator::encodeStrip(ubyte **rows, sint32 numRows, sint32 rowBytes, bool whiteStrip) {
+    if (numCompressionThreads) {
+        // The workers outlive the caller's buffer, so they get a copy of the rows
+        ubyte *strip = takeStripBuffer(rowBytes * numRows);
+        if (!strip) {
+            return false;
+        }
+        for (sint32 i = 0; i < numRows; i++) {
+            memcpy(strip + i * rowBytes, rows[i], rowBytes);
+        }
+        return queueStrip(strip, rowBytes * numRows, numRows, whiteStrip, false);
+    }
+
+    // Vectored output references the strip until the next call, so scratchBuffer cannot be used
+    ubyte *out = vectorOutput ? takeStripBuffer(scratchBufferSize) : NULL;
+    int numCompBytes = compressRows(rows, numRows, mediaWidthInPixels, rowBytes,
+            currCompressionDisposition, destColorSpace, out ? out : scratchBuffer,
+            scratchBufferSize, gatherBuffer);
+    injectStrip(out ? out : scratchBuffer, out ? scratchBufferSize : 0, numCompBytes, numRows,
+            currCompressionDisposition, destColorSpace, whiteStrip);
+    return true;
+}
+
+bool PCLmGenerator::encodeWhiteStrip(sint32 numRows, sint32 rowBytes, bool whiteStrip) {
+    PCLmWhiteStripCacheEntry *entry;
+    int numCompBytes = -1;
+
+    pthread_mutex_lock(&whiteStripCacheLock);
+    for (entry = whiteStripCache; entry < whiteStripCache + WHITE_STRIP_CACHE_SIZE; entry++) {
+        if (entry->data && entry->compression == currCompressionDisposition &&
+                entry->colorSpace == destColorSpace && entry->imageWidth == mediaWidthInPixels &&
+                entry->imageHeight == numRows &&
+                entry->resolution == currRenderResolutionInteger &&
+                entry->numBytes <= scratchBufferSize) {
+            entry->lastUsed = ++whiteStripCacheUses;
+            numCompBytes = entry->numBytes;
+            memcpy(scratchBuffer, entry->data, numCompBytes);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&whiteStripCacheLock);
+
+    if (numCompBytes < 0) {
+        ubyte **rows = stripRows(NULL, 0, 0, 0, numRows);
+        numCompBytes = compressRows(rows, numRows, mediaWidthInPixels, rowBytes,
+                currCompressionDisposition, destColorSpace, scratchBuffer, scratchBufferSize,
+                gatherBuffer);
+
+        // Failing to cache the strip only costs compressing it again next time
+        ubyte *data = (ubyte *) malloc(numCompBytes);
+        if (data) {
+            memcpy(data, scratchBuffer, numCompBytes);
+            pthread_mutex_lock(&whiteStripCacheLock);
+            PCLmWhiteStripCacheEntry *oldest = whiteStripCache;
+            for (entry = whiteStripCache; entry < whiteStripCache + WHITE_STRIP_CACHE_SIZE;
+                    entry++) {
+                if (entry->lastUsed < oldest->lastUsed) {
+                    oldest = entry;
+                }
+            }
+            free(oldest->data);
+            oldest->compression = currCompressionDisposition;
+            oldest->colorSpace = destColorSpace;
+            oldest->imageWidth = mediaWidthInPixels;
+            oldest->imageHeight = numRows;
+            oldest->resolution = currRenderResolutionInteger;
+            oldest->data = data;
+            oldest->numBytes = numCompBytes;
+            oldest->lastUsed = ++whiteStripCacheUses;
+            pthread_mutex_unlock(&whiteStripCacheLock);
+        }
+    }
+
+    if (numCompressionThreads) {
+        // Queued behind any strips still being compressed, to keep the output in order
+        ubyte *strip = takeStripBuffer(numCompBytes);
+        if (!strip) {
+            return false;
+        }
+        memcpy(strip, scratchBuffer, numCompBytes);
+        return queueStrip(strip, numCompBytes, numRows, whiteStrip, true);
+    }
+
+    injectStrip(scratchBuffer, 0, numCompBytes, numRows, currCompressionDisposition,
+            destColorSpace, whiteStrip);
+    return true;
+}
+
+void PCLmGenerator::compressStrip(PCLmCompressionTask *task) {
+    // Same padding as scratchBuffer, to allow for RLE expansion
+    int outSize = task->imageWidth * task->imageHeight * srcNumComponents * 2;
+    int rowBytes = task->inBufferSize / task->imageHeight;
+    ubyte **rows = (ubyte **) malloc(task->imageHeight * sizeof(ubyte *));
+    task->outBuffer = takeStripBuffer(outSize);
+    task->outBufferSize = outSize;
+    task->numCompBytes = 0;
+    if (task->outBuffer == NULL || rows == NULL) {
+        releaseStripBuffer(task->outBuffer, outSize);
+        task->outBuffer = NULL;
+        free(rows);
+        return;
+    }
+
+    for (int i = 0; i < task->imageHeight; i++) {
+        rows[i] = task->inBuffer + i * rowBytes;
+    }
+    task->numCompBytes = compressRows(rows, task->imageHeight, task->imageWidth, rowBytes,
+            task->compression, task->colorSpace, task->outBuffer, outSize, NULL);
+    free(rows);
+}
+
+void *PCLmGenerator::compressionThread(void *param) {
+    PCLmCompressionTask *task;
+
+    pthread_mutex_lock(&compressionPoolLock);
+    while (true) {
+        task = poolQueueHead;
+        if (task == NULL) {
+            // Idle workers beyond what the generators in the pool asked for go away
+            if (poolThreads > poolWantedThreads()) {
+                break;
+            }
+            pthread_cond_wait(&compressionPoolWork, &compressionPoolLock);
+            continue;
+        }
+        poolQueueHead = task->nextQueued;
+        if (poolQueueHead == NULL) {
+            poolQueueTail = NULL;
+        }
+        task->claimed = true;
+        pthread_mutex_unlock(&compressionPoolLock);
+
+        PCLmGenerator *gen = task->owner;
+        gen->compressStrip(task);
+        gen->releaseStripBuffer(task->inBuffer, task->inBufferSize);
+        task->inBuffer = NULL;
+
+        // The generator may go away as soon as it sees the strip done
+        pthread_mutex_lock(&gen->compressionLock);
+        task->done = true;
+        pthread_cond_broadcast(&gen->compressionDone);
+        pthread_mutex_unlock(&gen->compressionLock);
+
+        pthread_mutex_lock(&compressionPoolLock);
+    }
+    poolThreads--;
+    pthread_mutex_unlock(&compressionPoolLock);
+    return NULL;
+}
+
+void PCLmGenerator::joinCompressionPool(int numThreads) {
+    if (numCompressionThreads || numThreads <= 1) {
+        return;
+    }
+    if (numThreads > MAX_COMPRESSION_THREADS) {
+        numThreads = MAX_COMPRESSION_THREADS;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_mutex_lock(&compressionPoolLock);
+    while (poolThreads < numThreads) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, compressionThread, NULL) != 0) {
+            break;
+        }
+        poolThreads++;
+    }
+    // Without a single worker, strips are compressed on the calling thread
+    if (poolThreads > 0) {
+        poolRequests[numThreads]++;
+        numCompressionThreads = numThreads;
+    }
+    LOGD("joinCompressionPool: asked for %d workers, the pool has %d", numThreads, poolThreads);
+    pthread_mutex_unlock(&compressionPoolLock);
+    pthread_attr_destroy(&attr);
+}
+
+void PCLmGenerator::leaveCompressionPool() {
+    if (!numCompressionThreads) {
+        return;
+    }
+
+    // Take back the strips no worker has started on
+    pthread_mutex_lock(&compressionPoolLock);
+    PCLmCompressionTask **link = &poolQueueHead;
+    poolQueueTail = NULL;
+    while (*link) {
+        if ((*link)->owner == this) {
+            *link = (*link)->nextQueued;
+        } else {
+            poolQueueTail = *link;
+            link = &(*link)->nextQueued;
+        }
+    }
+    poolRequests[numCompressionThreads]--;
+    pthread_cond_broadcast(&compressionPoolWork);
+    pthread_mutex_unlock(&compressionPoolLock);
+    numCompressionThreads = 0;
+
+    // Wait for the rest, which nobody claims any more
+    pthread_mutex_lock(&compressionLock);
+    PCLmCompressionTask *task = pendingHead;
+    while (task) {
+        if (task->claimed && !task->done) {
+            pthread_cond_wait(&compressionDone, &compressionLock);
+            task = pendingHead;
+        } else {
+            task = task->next;
+        }
+    }
+    pthread_mutex_unlock(&compressionLock);
+
+    while (pendingHead) {
+        task = pendingHead;
+        pendingHead = task->next;
+        free(task->inBuffer);
+        free(task->outBuffer);
+        free(task);
+    }
+    pendingTail = NULL;
+    numPendingStrips = 0;
+}
+
+ubyte *PCLmGenerator::takeStripBuffer(int size) {
+    pthread_mutex_lock(&compressionLock);
+    for (int i = 0; i < numSpareStripBuffers; i++) {
+        if (spareStripBufferSizes[i] == size) {
+            ubyte *buffer = spareStripBuffers[i];
+            numSpareStripBuffers--;
+            memmove(spareStripBuffers + i, spareStripBuffers + i + 1,
+                    (numSpareStripBuffers - i) * sizeof(ubyte *));
+            memmove(spareStripBufferSizes + i, spareStripBufferSizes + i + 1,
+                    (numSpareStripBuffers - i) * sizeof(int));
+            pthread_mutex_unlock(&compressionLock);
+            return buffer;
+        }
+    }
+    pthread_mutex_unlock(&compressionLock);
+    return (ubyte *) malloc(size);
+}
+
+void PCLmGenerator::releaseStripBuffer(ubyte *buffer, int size) {
+    if (!buffer) {
+        return;
+    }
+
+    // Make room by dropping the oldest spare, likely of a size no longer asked for
+    ubyte *oldest = NULL;
+    pthread_mutex_lock(&compressionLock);
+    if (numSpareStripBuffers == MAX_SPARE_STRIP_BUFFERS) {
+        oldest = spareStripBuffers[0];
+        numSpareStripBuffers--;
+        memmove(spareStripBuffers, spareStripBuffers + 1, numSpareStripBuffers * sizeof(ubyte *));
+        memmove(spareStripBufferSizes, spareStripBufferSizes + 1,
+                numSpareStripBuffers * sizeof(int));
+    }
+    spareStripBuffers[numSpareStripBuffers] = buffer;
+    spareStripBufferSizes[numSpareStripBuffers] = size;
+    numSpareStripBuffers++;
+    pthread_mutex_unlock(&compressionLock);
+    free(oldest);
+}
+
+bool PCLmGenerator::queueStrip(ubyte *strip, int numBytes, int imageHeight, bool whiteStrip,
+        bool compressed) {
+    PCLmCompressionTask *task = (PCLmCompressionTask *) calloc(1, sizeof(PCLmCompressionTask));
+    if (task == NULL) {
+        releaseStripBuffer(strip, numBytes);
+        return false;
+    }
+
+    if (compressed) {
+        task->outBuffer = strip;
+        task->outBufferSize = numBytes;
+        task->numCompBytes = numBytes;
+        task->claimed = true;
+        task->done = true;
+    } else {
+        task->inBuffer = strip;
+        task->inBufferSize = numBytes;
+    }
+    task->owner = this;
+    task->imageWidth = mediaWidthInPixels;
+    task->imageHeight = imageHeight;
+    task->compression = currCompressionDisposition;
+    task->colorSpace = destColorSpace;
+    task->whiteStrip = whiteStrip;
+
+    pthread_mutex_lock(&compressionLock);
+    if (pendingTail) {
+        pendingTail->next = task;
+    } else {
+        pendingHead = task;
+    }
+    pendingTail = task;
+    numPendingStrips++;
+    pthread_mutex_unlock(&compressionLock);
+
+    if (!compressed) {
+        pthread_mutex_lock(&compressionPoolLock);
+        if (poolQueueTail) {
+            poolQueueTail->nextQueued = task;
+        } else {
+            poolQueueHead = task;
+        }
+        poolQueueTail = task;
+        pthread_cond_signal(&compressionPoolWork);
+        pthread_mutex_unlock(&compressionPoolLock);
+    }
+    return true;
+}
+
+void PCLmGenerator::injectCompletedStrips(bool waitForAll, int maxPending) {
+    pthread_mutex_lock(&compressionLock);
+    while (pendingHead) {
+        PCLmCompressionTask *task = pendingHead;
+        if (!task->done) {
+            if (!waitForAll && numPendingStrips <= maxPending) {
+                break;
+            }
+            pthread_cond_wait(&compressionDone, &compressionLock);
+            continue;
+        }
+
+        pendingHead = task->next;
+        if (pendingHead == NULL) {
+            pendingTail = NULL;
+        }
+        numPendingStrips--;
+
+        // Injection touches the xref table and object counter, so it stays on this thread
+        pthread_mutex_unlock(&compressionLock);
+        if (task->outBuffer && growOutBuff(task->numCompBytes + sizeof(pOutStr) * 16)) {
+            injectStrip(task->outBuffer, task->outBufferSize, task->numCompBytes,
+                    task->imageHeight, task->compression, task->colorSpace, task->whiteStrip);
+        } else {
+            LOGE("injectCompletedStrips: dropping strip, out of memory");
+            releaseStripBuffer(task->outBuffer, task->outBufferSize);
+        }
+        free(task);
+        pthread_mutex_lock(&compressionLock);
+    }
+    pthread_mutex_unlock(&compressionLock);
+}
+
 PCLmGenerator::PCLmGenerator() {
     strcpy(currMediaName, "LETTER");
     currDuplexDisposition = simplex;
@@ -1364,6 +2013,14 @@ PCLmGenerator::PCLmGenerator() {
     scaleFactor = 1;
     jobOpen = job_closed;
     scratchBuffer = NULL;
+    scratchBufferSize = 0;
+    whiteRow = NULL;
+    mirrorRow = NULL;
+    marginStrip = NULL;
+    gatherBuffer = NULL;
+    stripRowPtrs = NULL;
+    pageBufferRowBytes = 0;
+    pageBufferStripHeight = 0;
     pageCount = 0;
 
     currRenderResolutionInteger = 600;
@@ -1374,6 +2031,8 @@ PCLmGenerator::PCLmGenerator() {
     // XRefTable storage
     xRefIndex = 0;
     xRefStart = 0;
+    startXRef = 0;
+    endXRef = 0;
 
     objCounter = PAGES_OBJ_NUMBER + 1;
     totalBytesWrittenToPCLmFile = 0;
@@ -1387,6 +2046,7 @@ PCLmGenerator::PCLmGenerator() {
 
     // Initialize the leftover scanline logic
     leftoverScanlineBuffer = 0;
+    numLeftoverScanlines = 0;
 
     adobeRGBCS_firstTime = true;
     mirrorBackside = true;
@@ -1394,10 +2054,31 @@ PCLmGenerator::PCLmGenerator() {
     topMarginInPix = 0;
     leftMarginInPix = 0;
     m_pPCLmSSettings = NULL;
+
+    numCompressionThreads = 0;
+    pendingHead = pendingTail = NULL;
+    numPendingStrips = 0;
+    numSpareStripBuffers = 0;
+    pthread_mutex_init(&compressionLock, NULL);
+    pthread_cond_init(&compressionDone, NULL);
+
+    vectorOutput = false;
+    segmentStart = 0;
+    outSegments = NULL;
+    numOutSegments = maxOutSegments = 0;
+    outVector = NULL;
+    maxOutVector = 0;
+    heldPayload = NULL;
+    heldPayloadSize = 0;
+    heldStripBuffers = NULL;
+    heldStripBufferSizes = NULL;
+    numHeldStripBuffers = maxHeldStripBuffers = 0;
 }
 
 PCLmGenerator::~PCLmGenerator() {
     Cleanup();
+    pthread_cond_destroy(&compressionDone);
+    pthread_mutex_destroy(&compressionLock);
 }
 
 int PCLmGenerator::StartJob(void **pOutBuffer, int *iOutBufferSize) {
@@ -1594,287 +2275,189 @@ int PCLmGenerator::StartPage(PCLmPageSetup *PCLmPageContent, void **pOutBuffer,
     writePDFGrammarPage(mediaWidthInPixels, mediaHeightInPixels, numImageStrips, destColorSpace);
     *iOutBufferSize = totalBytesWrittenToCurrBuff;
 
-    if (!scratchBuffer) {
-        // We need to pad the scratchBuffer size to allow for compression expansion (RLE can create
-        // compressed segments that are slightly larger than the source.
-        size_t len = (size_t) currStripHeight * mediaWidthInPixels * srcNumComponents * 2;
-        scratchBuffer = (ubyte *) malloc(len);
-        if (!scratchBuffer) {
-            return errorOutAndCleanUp();
-        }
+    // Pages of the same size reuse the previous page's buffers
+    sint32 rowBytes = MAX(mediaWidthInPixels, currSourceWidth) * srcNumComponents;
+    if (!allocPageBuffers(rowBytes, leftMarginInPix || currSourceWidth < mediaWidthInPixels)) {
+        return errorOutAndCleanUp();
     }
 
     mirrorBackside = PCLmPageContent->mirrorBackside;
     firstStrip = true;
 
+    joinCompressionPool(PCLmPageContent->numCompressionThreads);
+
     return success;
 }
 
 int PCLmGenerator::EndPage(void **pOutBuffer, int *iOutBufferSize) {
+    initOutBuff((char *) allocatedOutputBuffer, outBuffSize);
+
+    // Flush every strip still in the hands of the compression workers
+    injectCompletedStrips(true, 0);
     *pOutBuffer = allocatedOutputBuffer;
-    initOutBuff((char *) *pOutBuffer, outBuffSize);
     *iOutBufferSize = totalBytesWrittenToCurrBuff;
 
-    // Free up the scratchbuffer at endpage, to allow the next page to have a different size
-    if (scratchBuffer) {
-        free(scratchBuffer);
-        scratchBuffer = NULL;
-    }
-
+    // The page buffers stay for the next page; StartPage replaces them if its size differs
     return success;
 }
 
+int PCLmGenerator::EndPageV(const struct iovec **pOutVector, int *iOutVectorCount) {
+    void *pOutBuffer;
+    int iOutBufferSize;
+
+    vectorOutput = true;
+    int result = EndPage(&pOutBuffer, &iOutBufferSize);
+    vectorOutput = false;
+    if (result != success) {
+        return result;
+    }
+    return finishOutVector(pOutVector, iOutVectorCount);
+}
+
 int PCLmGenerator::Encapsulate(void *pInBuffer, int inBufferSize, int thisHeight,
         void **pOutBuffer, int *iOutBufferSize) {
-    int numCompBytes;
-    int scanlineWidth = mediaWidthInPixels * srcNumComponents;
-    int numLinesThisCall = thisHeight;
-    void *savedInBufferPtr = NULL;
-    void *tmpBuffer = NULL;
-    void *localInBuffer;
-    ubyte *newStripPtr = NULL;
+    PCLmStripDescriptor strip;
+    strip.data = (ubyte *) pInBuffer;
+    strip.stride = currSourceWidth * srcNumComponents;
+    strip.numRows = thisHeight;
+    return EncapsulateStrip(&strip, pOutBuffer, iOutBufferSize);
+}
 
-    if (leftoverScanlineBuffer) {
-        ubyte *whereAreWe;
-        sint32 scanlinesThisTime;
-        // The leftover scanlines have already been processed (color-converted and flipped), so
-        // just put them into the output buffer.
+int PCLmGenerator::EncapsulateStrip(const PCLmStripDescriptor *strip, void **pOutBuffer,
+        int *iOutBufferSize) {
+    ubyte *data = strip->data;
+    sint32 stride = strip->stride;
+    sint32 numLinesThisCall = strip->numRows;
+    sint32 srcRowBytes = currSourceWidth * srcNumComponents;
+    sint32 numComponents = srcNumComponents;
+    ubyte *tmpBuffer = NULL;
+
+    if (NULL == allocatedOutputBuffer || NULL == stripRowPtrs) {
+        return (errorOutAndCleanUp());
+    }
 
-        // Allocate a temporary buffer to copy leftover and new data into
-        tmpBuffer = malloc(scanlineWidth * currStripHeight);
+    if (data && (leftoverScanlineBuffer || numLinesThisCall > currStripHeight)) {
+        // Rows beyond a full strip are held back until the next call. This only happens when the
+        // caller's strips are taller than ours, so the extra copies are acceptable here.
+        sint32 numRows = numLeftoverScanlines + numLinesThisCall;
+        tmpBuffer = (ubyte *) malloc(srcRowBytes * numRows);
         if (!tmpBuffer) {
             return (errorOutAndCleanUp());
         }
-
-        // Copy leftover scanlines into tmpBuffer
-        memcpy(tmpBuffer, leftoverScanlineBuffer, scanlineWidth * numLeftoverScanlines);
-
-        whereAreWe = (ubyte *) tmpBuffer + (scanlineWidth * numLeftoverScanlines);
-
-        scanlinesThisTime = currStripHeight - numLeftoverScanlines;
-
-        // Copy enough scanlines from the real inBuffer to fill out the tmpBuffer
-        memcpy(whereAreWe, pInBuffer, scanlinesThisTime * scanlineWidth);
-
-        // Now copy the remaining scanlines from pInBuffer to the leftoverBuffer
-        numLeftoverScanlines = thisHeight - scanlinesThisTime;
-        assert(leftoverScanlineBuffer);
-        whereAreWe = (ubyte *) pInBuffer + (scanlineWidth * numLeftoverScanlines);
-        memcpy(leftoverScanlineBuffer, whereAreWe, scanlineWidth * numLeftoverScanlines);
-        numLinesThisCall = thisHeight = currStripHeight;
-
-        savedInBufferPtr = pInBuffer;
-        localInBuffer = tmpBuffer;
-    } else {
-        localInBuffer = pInBuffer;
-    }
-
-    if (thisHeight > currStripHeight) {
-        // Copy raw raster into leftoverScanlineBuffer
-        ubyte *ptr;
-        numLeftoverScanlines = thisHeight - currStripHeight;
-        leftoverScanlineBuffer = malloc(scanlineWidth * numLeftoverScanlines);
-        if (!leftoverScanlineBuffer) {
-            return (errorOutAndCleanUp());
+        if (leftoverScanlineBuffer) {
+            memcpy(tmpBuffer, leftoverScanlineBuffer, srcRowBytes * numLeftoverScanlines);
+            free(leftoverScanlineBuffer);
+            leftoverScanlineBuffer = NULL;
         }
-        ptr = (ubyte *) localInBuffer + scanlineWidth * numLeftoverScanlines;
-        memcpy(leftoverScanlineBuffer, ptr, scanlineWidth * numLeftoverScanlines);
-        thisHeight = currStripHeight;
-    }
-
-    if (NULL == allocatedOutputBuffer) {
-        if (tmpBuffer) {
-            free(tmpBuffer);
+        for (sint32 i = 0; i < numLinesThisCall; i++) {
+            memcpy(tmpBuffer + (numLeftoverScanlines + i) * srcRowBytes, data + i * stride,
+                    srcRowBytes);
+        }
+        data = tmpBuffer;
+        stride = srcRowBytes;
+        numLinesThisCall = MIN(numRows, currStripHeight);
+        numLeftoverScanlines = numRows - numLinesThisCall;
+
+        if (numLeftoverScanlines) {
+            leftoverScanlineBuffer = malloc(srcRowBytes * numLeftoverScanlines);
+            if (!leftoverScanlineBuffer) {
+                free(tmpBuffer);
+                return (errorOutAndCleanUp());
+            }
+            memcpy(leftoverScanlineBuffer, data + numLinesThisCall * srcRowBytes,
+                    srcRowBytes * numLeftoverScanlines);
         }
-        return (errorOutAndCleanUp());
     }
+    numLinesThisCall = MIN(numLinesThisCall, currStripHeight);
+
     *pOutBuffer = allocatedOutputBuffer;
     initOutBuff((char *) *pOutBuffer, outBuffSize);
 
-    if (currDuplexDisposition == duplex_longEdge && !(pageCount % 2)) {
+    if (data && currDuplexDisposition == duplex_longEdge && !(pageCount % 2)) {
         if (mirrorBackside) {
-            prepImageForBacksideDuplex((ubyte *) localInBuffer, numLinesThisCall, currSourceWidth,
-                    srcNumComponents);
+            prepImageForBacksideDuplex(data, numLinesThisCall, currSourceWidth, srcNumComponents,
+                    stride, mirrorRow);
         }
     }
 
     if (destColorSpace == grayScale &&
             (sourceColorSpace == deviceRGB || sourceColorSpace == adobeRGB)) {
-        colorConvertSource(sourceColorSpace, grayScale, (ubyte *) localInBuffer, currSourceWidth,
-                numLinesThisCall);
+        if (data) {
+            colorConvertSource(sourceColorSpace, grayScale, data, currSourceWidth,
+                    numLinesThisCall, stride);
+        }
         // Adjust the scanline width accordingly
-        scanlineWidth = mediaWidthInPixels * dstNumComponents;
-    }
-
-    if (leftMarginInPix) {
-        newStripPtr = shiftStripByLeftMargin((ubyte *) localInBuffer, currSourceWidth,
-                currStripHeight, numLinesThisCall, mediaWidthInPixels, leftMarginInPix,
-                destColorSpace);
+        numComponents = dstNumComponents;
     }
+    sint32 scanlineWidth = mediaWidthInPixels * numComponents;
 
+    bool allWhite = isWhiteStrip(data, stride, currSourceWidth * numComponents, numLinesThisCall);
     bool whiteStrip = false;
 #ifdef SUPPORT_WHITE_STRIPS
-    if (!firstStrip) {
-        // PCLm does not print a blank page if all the strips are marked as "/Name /WhiteStrip"
-        // so only apply /WhiteStrip to strips after the first
-        whiteStrip = isWhiteStrip(pInBuffer, thisHeight * currSourceWidth * srcNumComponents);
-    }
+    // PCLm does not print a blank page if all the strips are marked as "/Name /WhiteStrip"
+    // so only apply /WhiteStrip to strips after the first
+    whiteStrip = allWhite && !firstStrip;
 #endif
 
-    if (currCompressionDisposition == compressDCT) {
-        if (firstStrip && topMarginInPix) {
-            ubyte whitePt = 0xff;
-
-            ubyte *tmpStrip = (ubyte *) malloc(scanlineWidth * topMarginInPix);
-            memset(tmpStrip, whitePt, scanlineWidth * topMarginInPix);
-
-            for (sint32 stripCntr = 0; stripCntr < numFullInjectedStrips; stripCntr++) {
-                write_JPEG_Buff(scratchBuffer, JPEG_QUALITY, mediaWidthInPixels,
-                        (sint32) numFullScanlinesToInject, tmpStrip, currRenderResolutionInteger,
-                        destColorSpace, &numCompBytes);
-                injectJPEG((char *) scratchBuffer, mediaWidthInPixels,
-                        (sint32) numFullScanlinesToInject, numCompBytes, destColorSpace, true);
-            }
-
-            if (numPartialScanlinesToInject) {
-                // Handle the leftover strip
-                write_JPEG_Buff(scratchBuffer, JPEG_QUALITY, mediaWidthInPixels,
-                        numPartialScanlinesToInject, tmpStrip, currRenderResolutionInteger,
-                        destColorSpace, &numCompBytes);
-                injectJPEG((char *) scratchBuffer, mediaWidthInPixels, numPartialScanlinesToInject,
-                        numCompBytes, destColorSpace, true);
+    bool encoded = true;
+    if (firstStrip && topMarginInPix) {
+        // We need to inject blank image-strips with a total height==topMarginInPix
+        for (sint32 stripCntr = 0; encoded && stripCntr <= numFullInjectedStrips; stripCntr++) {
+            sint32 numLines = (stripCntr < numFullInjectedStrips) ? numFullScanlinesToInject
+                    : numPartialScanlinesToInject;
+            if (numLines) {
+                encoded = encodeWhiteStrip(numLines, scanlineWidth, true);
             }
-
-            free(tmpStrip);
-        }
-        firstStrip = false;
-
-        // We are always going to compress the full strip height, even though the image may be less;
-        // this allows the compressed images to be symmetric
-        if (numLinesThisCall < currStripHeight) {
-            sint32 numLeftoverBytes = (currStripHeight - numLinesThisCall) * currSourceWidth * 3;
-            sint32 numImagedBytes = numLinesThisCall * currSourceWidth * 3;
-
-            // End-of-page: we have to white-out the unused section of the source image
-            memset((ubyte *) localInBuffer + numImagedBytes, 0xff, numLeftoverBytes);
-        }
-
-        if (newStripPtr) {
-            write_JPEG_Buff(scratchBuffer, JPEG_QUALITY, mediaWidthInPixels, currStripHeight,
-                    newStripPtr, currRenderResolutionInteger, destColorSpace, &numCompBytes);
-
-            free(newStripPtr);
-            newStripPtr = NULL;
-        } else {
-            write_JPEG_Buff(scratchBuffer, JPEG_QUALITY, mediaWidthInPixels, currStripHeight,
-                    (JSAMPLE *) localInBuffer, currRenderResolutionInteger, destColorSpace,
-                    &numCompBytes);
-        }
-
-        injectJPEG((char *) scratchBuffer, mediaWidthInPixels, currStripHeight, numCompBytes,
-                destColorSpace, whiteStrip);
-    } else if (currCompressionDisposition == compressFlate) {
-        uint32 len = numLinesThisCall * scanlineWidth;
-        uLongf destSize = len;
-        int result;
-
-        if (firstStrip && topMarginInPix) {
-            ubyte whitePt = 0xff;
-
-            // We need to inject a blank image-strip with a height==topMarginInPix
-            ubyte *tmpStrip = (ubyte *) malloc(scanlineWidth * topMarginInPix);
-            uLongf tmpDestSize = destSize;
-            memset(tmpStrip, whitePt, scanlineWidth * topMarginInPix);
-
-            for (sint32 stripCntr = 0; stripCntr < numFullInjectedStrips; stripCntr++) {
-                result = compress(scratchBuffer, &tmpDestSize, (const Bytef *) tmpStrip,
-                        scanlineWidth * numFullScanlinesToInject);
-                injectLZStrip(scratchBuffer, tmpDestSize, mediaWidthInPixels,
-                        numFullScanlinesToInject, destColorSpace, true);
-            }
-            if (numPartialScanlinesToInject) {
-                result = compress(scratchBuffer, &tmpDestSize, (const Bytef *) tmpStrip,
-                        scanlineWidth * numPartialScanlinesToInject);
-                injectLZStrip(scratchBuffer, tmpDestSize, mediaWidthInPixels,
-                        numPartialScanlinesToInject, destColorSpace, true);
-            }
-            free(tmpStrip);
-        }
-        firstStrip = false;
-
-        if (newStripPtr) {
-            result = compress(scratchBuffer, &destSize, (const Bytef *) newStripPtr,
-                    scanlineWidth * numLinesThisCall);
-            free(newStripPtr);
-            newStripPtr = NULL;
-        } else {
-            // Dump the source data
-            result = compress(scratchBuffer, &destSize, (const Bytef *) localInBuffer,
-                    scanlineWidth * numLinesThisCall);
         }
-        injectLZStrip(scratchBuffer, destSize, mediaWidthInPixels, numLinesThisCall, destColorSpace,
-                whiteStrip);
-    } else if (currCompressionDisposition == compressRLE) {
-        int compSize;
-        if (firstStrip && topMarginInPix) {
-            ubyte whitePt = 0xff;
-
-            // We need to inject a blank image-strip with a height==topMarginInPix
-
-            ubyte *tmpStrip = (ubyte *) malloc(scanlineWidth * topMarginInPix);
-            memset(tmpStrip, whitePt, scanlineWidth * topMarginInPix);
-
-            for (sint32 stripCntr = 0; stripCntr < numFullInjectedStrips; stripCntr++) {
-                compSize = RLEEncodeImage(tmpStrip, scratchBuffer,
-                        scanlineWidth * numFullScanlinesToInject);
-                injectRLEStrip(scratchBuffer, compSize, mediaWidthInPixels,
-                        numFullScanlinesToInject, destColorSpace, true);
-            }
-
-            if (numPartialScanlinesToInject) {
-                compSize = RLEEncodeImage(tmpStrip, scratchBuffer,
-                        scanlineWidth * numPartialScanlinesToInject);
-                injectRLEStrip(scratchBuffer, compSize, mediaWidthInPixels,
-                        numPartialScanlinesToInject, destColorSpace, true);
-            }
+    }
+    firstStrip = false;
 
-            free(tmpStrip);
+    if (encoded) {
+        // We are always going to compress the full JPEG strip height, even though the image may be
+        // less; this allows the compressed images to be symmetric
+        sint32 stripLines = numLinesThisCall;
+        if (currCompressionDisposition == compressDCT) {
+            stripLines = currStripHeight;
         }
-        firstStrip = false;
-
-        if (newStripPtr) {
-            compSize = RLEEncodeImage(newStripPtr, scratchBuffer,
-                    scanlineWidth * numLinesThisCall);
-            free(newStripPtr);
-            newStripPtr = NULL;
+        if (allWhite) {
+            encoded = encodeWhiteStrip(stripLines, scanlineWidth, whiteStrip);
         } else {
-            compSize = RLEEncodeImage((ubyte *) localInBuffer, scratchBuffer,
-                    scanlineWidth * numLinesThisCall);
+            ubyte **rows = stripRows(data, stride, numLinesThisCall, numComponents, stripLines);
+            encoded = encodeStrip(rows, stripLines, scanlineWidth, whiteStrip);
         }
-
-        injectRLEStrip(scratchBuffer, compSize, mediaWidthInPixels, numLinesThisCall,
-                destColorSpace, whiteStrip);
-    } else {
-        assert(0);
     }
 
-    *iOutBufferSize = totalBytesWrittenToCurrBuff;
-
-    if (savedInBufferPtr) {
-        pInBuffer = savedInBufferPtr;
+    if (numCompressionThreads) {
+        // Inject whatever the compression workers have finished
+        injectCompletedStrips(false, numCompressionThreads * 2);
+        *pOutBuffer = allocatedOutputBuffer;
     }
+    *iOutBufferSize = totalBytesWrittenToCurrBuff;
 
     if (tmpBuffer) {
         free(tmpBuffer);
     }
 
-    if (newStripPtr) {
-        free(newStripPtr);
+    if (!encoded) {
+        return errorOutAndCleanUp();
     }
-
     return success;
 }
 
+int PCLmGenerator::EncapsulateStripV(const PCLmStripDescriptor *strip,
+        const struct iovec **pOutVector, int *iOutVectorCount) {
+    void *pOutBuffer;
+    int iOutBufferSize;
+
+    vectorOutput = true;
+    int result = EncapsulateStrip(strip, &pOutBuffer, &iOutBufferSize);
+    vectorOutput = false;
+    if (result != success) {
+        return result;
+    }
+    return finishOutVector(pOutVector, iOutVectorCount);
+}
+
 int PCLmGenerator::GetPclmMediaDimensions(const char *mediaRequested,
         PCLmPageSetup *myPageInfo) {
     int i = 0;
@@ -24,12 +24,11 @@
 #include "lib_wprint.h"
 #include "lib_pclm.h"
 #include "common_defines.h"
+#include "wprint_color.h"
 
 #define _WJOBH_NONE  0
 #define STANDARD_SCALE_FOR_PDF    72.0
 
-#define SP_GRAY(Yr, Cbg, Crb) (((Yr<<6) + (Cbg*160) + (Crb<<5)) >> 8)
-
 #define _START_JOB(JOB_INFO, EXT) \
 { \
     const ifc_wprint_debug_stream_t* debug_ifc = \
@@ -83,7 +82,39 @@
     if (debug_ifc) { \
         debug_ifc->debug_job_data(JOB_INFO->job_handle, (const unsigned char *)BUFF, LEN); \
     } \
+    int64_t send_start = wprint_get_usecs(); \
     JOB_INFO->print_ifc->send_data(JOB_INFO->print_ifc, BUFF, LEN); \
+    JOB_INFO->send_us += wprint_get_usecs() - send_start; \
+    JOB_INFO->bytes_sent += LEN; \
+}
+
+/*
+ * Same as _WRITE for the concatenation of the IOVCNT buffers of IOV, which go to the printer in
+ * one call where the print interface supports it
+ */
+#define _WRITEV(JOB_INFO, IOV, IOVCNT)   \
+{ \
+    const ifc_wprint_debug_stream_t* debug_ifc = \
+        JOB_INFO->wprint_ifc->get_debug_stream_ifc(JOB_INFO->job_handle); \
+    int iov_index; \
+    for (iov_index = 0; iov_index < (IOVCNT); iov_index++) { \
+        if (debug_ifc) { \
+            debug_ifc->debug_job_data(JOB_INFO->job_handle, \
+                    (const unsigned char *) (IOV)[iov_index].iov_base, \
+                    (IOV)[iov_index].iov_len); \
+        } \
+        JOB_INFO->bytes_sent += (IOV)[iov_index].iov_len; \
+    } \
+    int64_t send_start = wprint_get_usecs(); \
+    if (JOB_INFO->print_ifc->send_datav != NULL) { \
+        JOB_INFO->print_ifc->send_datav(JOB_INFO->print_ifc, IOV, IOVCNT); \
+    } else { \
+        for (iov_index = 0; iov_index < (IOVCNT); iov_index++) { \
+            JOB_INFO->print_ifc->send_data(JOB_INFO->print_ifc, \
+                    (const char *) (IOV)[iov_index].iov_base, (IOV)[iov_index].iov_len); \
+        } \
+    } \
+    JOB_INFO->send_us += wprint_get_usecs() - send_start; \
 }
 
 /*
@@ -111,10 +142,19 @@ typedef struct {
     int strip_height;
     int pclm_scan_line_width;
 
+    // from the job parameters, to size the PCLm compression workers
+    int memory_budget;
+    int compression_threads;
+
     void *pclmgen_obj;
+    void *pwg_obj;
     PCLmPageSetup pclm_page_info;
     uint8 *pclm_output_buffer;
     const char *useragent;
+
+    // time spent in print_ifc->send_data, in microseconds, and the bytes passed to it
+    int64_t send_us;
+    int64_t bytes_sent;
 } pcl_job_info_t;
 
 /*
@@ -153,7 +193,7 @@ typedef struct ifc_pcl_st {
     /*
      * Called several times a page to send a rectangular swath of RGB data. The array
      * rgb_pixels[] must have (num_rows * pixel_width) pixels. bytes_per_row can be used for
-     * 32-bit aligned rows. Returns OK or ERROR.
+     * 32-bit aligned rows. rgb_pixels is NULL for a swath known to be white. Returns OK or ERROR.
      */
     status_t (*print_swath)(pcl_job_info_t *job_info, char *rgb_pixels, int start_row, int num_rows,
             int bytes_per_row);
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "lib_pcl.h"
 #include "wprint_image.h"
@@ -31,6 +32,27 @@
 
 #define TAG "lib_pclm"
 
+/* Strip compression workers a job uses unless its parameters ask for a number */
+#define DEFAULT_COMPRESSION_THREADS 2
+
+/*
+ * Returns the number of strip compression workers for strips of strip_bytes: the job's
+ * compression_threads, or else one fewer than the online cores, up to
+ * DEFAULT_COMPRESSION_THREADS. A job keeps up to two strips per worker queued, each a copy of the
+ * rows with room for twice that compressed, so the count is also kept to what fits in the job's
+ * memory budget.
+ */
+static int _get_compression_threads(const pcl_job_info_t *job_info, int strip_bytes) {
+    long budget = (job_info->memory_budget > 0) ? job_info->memory_budget : DEFAULT_MEMORY_BUDGET;
+    long threads = job_info->compression_threads;
+
+    if (threads <= 0) {
+        threads = MIN(sysconf(_SC_NPROCESSORS_ONLN) - 1, DEFAULT_COMPRESSION_THREADS);
+    }
+    threads = MIN(threads, budget / MAX(6L * strip_bytes, 1));
+    return (threads > 1) ? (int) threads : 0;
+}
+
 /*
  * Store a valid media_size name into media_name
  */
@@ -209,6 +231,8 @@ static int _start_page(pcl_job_info_t *job_info, int pixel_width, int pixel_heig
     page_info->SourceHeightPixels = pixel_height;
     job_info->pclm_scan_line_width =
             job_info->pclm_page_info.mediaWidthInPixels * job_info->num_components;
+    page_info->numCompressionThreads = _get_compression_threads(job_info,
+            job_info->pclm_scan_line_width * page_info->stripHeight);
 
     LOGD("PCLmGetMediaDimensions(%d), mediaSizeName=%s, mediaWidth=%f, mediaHeight=%f, "
             "widthPixels=%d, heightPixels=%d", res1, job_info->pclm_page_info.mediaSizeName,
@@ -225,19 +249,14 @@ static int _start_page(pcl_job_info_t *job_info, int pixel_width, int pixel_heig
 
 static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_row, int num_rows,
         int bytes_per_row) {
-    int outBuffSize = 0;
-    _PAGE_DATA(job_info, (const unsigned char *) rgb_pixels, (num_rows * bytes_per_row));
-
-    if (job_info->monochrome) {
-        unsigned char *buff = (unsigned char *) rgb_pixels;
-        int nbytes = (num_rows * bytes_per_row);
-        int readIndex, writeIndex;
-        for (readIndex = writeIndex = 0; readIndex < nbytes; readIndex += BYTES_PER_PIXEL(1)) {
-            unsigned char gray = SP_GRAY(buff[readIndex + 0], buff[readIndex + 1],
-                    buff[readIndex + 2]);
-            buff[writeIndex++] = gray;
-            buff[writeIndex++] = gray;
-            buff[writeIndex++] = gray;
+    const struct iovec *out_vector;
+    int out_vector_count;
+    if (rgb_pixels != NULL) {
+        _PAGE_DATA(job_info, (const unsigned char *) rgb_pixels, (num_rows * bytes_per_row));
+
+        if (job_info->monochrome) {
+            wprint_rgb_to_sp_gray_rgb((uint8 *) rgb_pixels,
+                    (num_rows * bytes_per_row) / BYTES_PER_PIXEL(1));
         }
     }
 
@@ -245,42 +264,39 @@ static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_ro
             job_info->page_number, job_info->strip_height * job_info->scan_line_width, start_row,
             start_row + num_rows - 1, num_rows, bytes_per_row);
 
-    if (job_info->scan_line_width > job_info->pclm_scan_line_width) {
-        int i;
-        char *src_pixels = rgb_pixels + job_info->scan_line_width;
-        char *dest_pixels = rgb_pixels + job_info->pclm_scan_line_width;
-        for (i = 1; i < num_rows; i++, src_pixels += job_info->scan_line_width,
-                dest_pixels += job_info->pclm_scan_line_width) {
-            memmove(dest_pixels, src_pixels, job_info->pclm_scan_line_width);
-        }
-    }
-
-    /* if the inBufferSize is ever used in genPCLm, change the input parameter to pass in
-     * image_info->printable_width*num_components*strip_height
-     * it is currently pixel_width (from _start_page()) * num_components * strip_height
+    /* The generator reads the rows in place at our stride, clipping them to the media width.
+     * A NULL swath is white and is never read.
      */
-    PCLmEncapsulate(job_info->pclmgen_obj, rgb_pixels,
-            job_info->strip_height * MIN(job_info->scan_line_width, job_info->pclm_scan_line_width),
-            num_rows, (void **) &job_info->pclm_output_buffer, &outBuffSize);
-    _WRITE(job_info, (const char *) job_info->pclm_output_buffer, outBuffSize);
+    PCLmStripDescriptor strip = {
+            .data = (ubyte *) rgb_pixels, .stride = bytes_per_row, .numRows = num_rows
+    };
+    // The compressed strips are sent from where they were encoded rather than copied behind
+    // their headers
+    if (PCLmEncapsulateStripV(job_info->pclmgen_obj, &strip, &out_vector, &out_vector_count)
+            == success) {
+        _WRITEV(job_info, out_vector, out_vector_count);
+    }
 
     return OK;
 }
 
 static int _end_page(pcl_job_info_t *job_info, int page_number) {
-    int outBuffSize = 0;
+    const struct iovec *out_vector;
+    int out_vector_count;
 
     if (page_number == -1) {
         LOGI("_end_page(): writing blank page");
         _start_page(job_info, 0, 0);
-        unsigned char blank_data[1] = {0xFF};
-        PCLmEncapsulate(job_info->pclmgen_obj, (void *) blank_data, 1, 1,
-                (void **) &job_info->pclm_output_buffer, &outBuffSize);
-        _WRITE(job_info, (const char *) job_info->pclm_output_buffer, outBuffSize);
+        PCLmStripDescriptor blank_strip = {.data = NULL, .stride = 0, .numRows = 1};
+        if (PCLmEncapsulateStripV(job_info->pclmgen_obj, &blank_strip, &out_vector,
+                &out_vector_count) == success) {
+            _WRITEV(job_info, out_vector, out_vector_count);
+        }
     }
     LOGI("_end_page()");
-    PCLmEndPage(job_info->pclmgen_obj, (void **) &job_info->pclm_output_buffer, &outBuffSize);
-    _WRITE(job_info, (const char *) job_info->pclm_output_buffer, outBuffSize);
+    if (PCLmEndPageV(job_info->pclmgen_obj, &out_vector, &out_vector_count) == success) {
+        _WRITEV(job_info, out_vector, out_vector_count);
+    }
     _END_PAGE(job_info);
 
     return OK;
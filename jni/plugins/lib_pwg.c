@@ -29,8 +29,17 @@
 
 #define TAG "lib_pwg"
 
-cups_raster_t *ras_out = NULL;
-cups_page_header2_t header_pwg;
+/*
+ * Raster output state for one PWG job, so that jobs for different printers can run at once
+ */
+typedef struct {
+    cups_raster_t *ras_out;
+    cups_page_header2_t header_pwg;
+
+    /* One white output row, written repeatedly for swaths known to be white */
+    unsigned char *white_row;
+    int white_row_size;
+} pwg_job_t;
 
 /*
  * Write the PWG header
@@ -162,12 +171,20 @@ static wJob_t _start_job(wJob_t job_handle, pcl_job_info_t *job_info, media_size
     LOGD("_start_job(), media_size %d, media_type %d, dt %d, %s, media_tray %d", media_size,
             media_type, dry_time, (duplex == DUPLEX_MODE_NONE) ? "simplex" : "duplex",
             media_tray);
+
+    pwg_job_t *pwg = (pwg_job_t *) calloc(1, sizeof(pwg_job_t));
+    if (pwg == NULL) {
+        LOGE("_start_job(): out of memory");
+        return _WJOBH_NONE;
+    }
+    cups_page_header2_t *header = &pwg->header_pwg;
+    job_info->pwg_obj = pwg;
     job_info->job_handle = job_handle;
 
     _START_JOB(job_info, "pwg");
 
-    header_pwg.HWResolution[0] = resolution;
-    header_pwg.HWResolution[1] = resolution;
+    header->HWResolution[0] = resolution;
+    header->HWResolution[1] = resolution;
 
     job_info->resolution = resolution;
     job_info->media_size = media_size;
@@ -189,20 +206,20 @@ static wJob_t _start_job(wJob_t job_handle, pcl_job_info_t *job_info, media_size
         job_info->pclm_page_info.mediaHeightOffset = top_margin;
     }
 
-    header_pwg.cupsMediaType = media_size;
+    header->cupsMediaType = media_size;
 
     job_info->pclm_page_info.pageOrigin = top_left;    // REVISIT
     job_info->monochrome = (color_space == COLOR_SPACE_MONO);
     job_info->pclm_page_info.dstColorSpaceSpefication = deviceRGB;
     if (color_space == COLOR_SPACE_MONO) {
-        header_pwg.cupsColorSpace = CUPS_CSPACE_SW;
+        header->cupsColorSpace = CUPS_CSPACE_SW;
         job_info->pclm_page_info.dstColorSpaceSpefication = deviceRGB;
     } else if (color_space == COLOR_SPACE_COLOR) {
         job_info->pclm_page_info.dstColorSpaceSpefication = deviceRGB;
-        header_pwg.cupsColorSpace = CUPS_CSPACE_SRGB;
+        header->cupsColorSpace = CUPS_CSPACE_SRGB;
     } else if (color_space == COLOR_SPACE_ADOBE_RGB) {
         job_info->pclm_page_info.dstColorSpaceSpefication = adobeRGB;
-        header_pwg.cupsColorSpace = CUPS_CSPACE_SRGB;
+        header->cupsColorSpace = CUPS_CSPACE_SRGB;
     }
 
     job_info->pclm_page_info.stripHeight = job_info->strip_height;
@@ -217,27 +234,31 @@ static wJob_t _start_job(wJob_t job_handle, pcl_job_info_t *job_info, media_size
 
     if (duplex == DUPLEX_MODE_BOOK) {
         job_info->pclm_page_info.duplexDisposition = duplex_longEdge;
-        header_pwg.Duplex = CUPS_TRUE;
-        header_pwg.Tumble = CUPS_FALSE;
+        header->Duplex = CUPS_TRUE;
+        header->Tumble = CUPS_FALSE;
     } else if (duplex == DUPLEX_MODE_TABLET) {
         job_info->pclm_page_info.duplexDisposition = duplex_shortEdge;
-        header_pwg.Duplex = CUPS_TRUE;
-        header_pwg.Tumble = CUPS_TRUE;
+        header->Duplex = CUPS_TRUE;
+        header->Tumble = CUPS_TRUE;
     } else {
         job_info->pclm_page_info.duplexDisposition = simplex;
-        header_pwg.Duplex = CUPS_FALSE;
-        header_pwg.Tumble = CUPS_FALSE;
+        header->Duplex = CUPS_FALSE;
+        header->Tumble = CUPS_FALSE;
     }
 
     job_info->pclm_page_info.mirrorBackside = false;
-    header_pwg.OutputFaceUp = CUPS_FALSE;
-    header_pwg.cupsBitsPerColor = BITS_PER_CHANNEL;
-    ras_out = cupsRasterOpenIO(_pwg_io_write, (void *) job_info, CUPS_RASTER_WRITE_PWG);
+    header->OutputFaceUp = CUPS_FALSE;
+    header->cupsBitsPerColor = BITS_PER_CHANNEL;
+    pwg->ras_out = cupsRasterOpenIO(_pwg_io_write, (void *) job_info, CUPS_RASTER_WRITE_PWG);
     return job_info->job_handle;
 }
 
 static int _start_page(pcl_job_info_t *job_info, int pixel_width, int pixel_height) {
+    pwg_job_t *pwg = (pwg_job_t *) job_info->pwg_obj;
     PCLmPageSetup *page_info = &job_info->pclm_page_info;
+    if (pwg == NULL) {
+        return ERROR;
+    }
     _START_PAGE(job_info, pixel_width, pixel_height);
 
     page_info->sourceHeight = (float) pixel_height / job_info->standard_scale;
@@ -263,38 +284,67 @@ static int _start_page(pcl_job_info_t *job_info, int pixel_width, int pixel_heig
     job_info->scan_line_width = BYTES_PER_PIXEL(pixel_width);
 
     // Fill up the pwg header
-    _write_header_pwg(pixel_width, pixel_height, &header_pwg, job_info->monochrome);
-
-    LOGI("cupsWidth = %d", header_pwg.cupsWidth);
-    LOGI("cupsHeight = %d", header_pwg.cupsHeight);
-    LOGI("cupsPageWidth = %f", header_pwg.cupsPageSize[0]);
-    LOGI("cupsPageHeight = %f", header_pwg.cupsPageSize[1]);
-    LOGI("cupsBitsPerColor = %d", header_pwg.cupsBitsPerColor);
-    LOGI("cupsBitsPerPixel = %d", header_pwg.cupsBitsPerPixel);
-    LOGI("cupsBytesPerLine = %d", header_pwg.cupsBytesPerLine);
-    LOGI("cupsColorOrder = %d", header_pwg.cupsColorOrder);
-    LOGI("cupsColorSpace = %d", header_pwg.cupsColorSpace);
-
-    cupsRasterWriteHeader2(ras_out, &header_pwg);
+    _write_header_pwg(pixel_width, pixel_height, &pwg->header_pwg, job_info->monochrome);
+
+    LOGI("cupsWidth = %d", pwg->header_pwg.cupsWidth);
+    LOGI("cupsHeight = %d", pwg->header_pwg.cupsHeight);
+    LOGI("cupsPageWidth = %f", pwg->header_pwg.cupsPageSize[0]);
+    LOGI("cupsPageHeight = %f", pwg->header_pwg.cupsPageSize[1]);
+    LOGI("cupsBitsPerColor = %d", pwg->header_pwg.cupsBitsPerColor);
+    LOGI("cupsBitsPerPixel = %d", pwg->header_pwg.cupsBitsPerPixel);
+    LOGI("cupsBytesPerLine = %d", pwg->header_pwg.cupsBytesPerLine);
+    LOGI("cupsColorOrder = %d", pwg->header_pwg.cupsColorOrder);
+    LOGI("cupsColorSpace = %d", pwg->header_pwg.cupsColorSpace);
+
+    cupsRasterWriteHeader2(pwg->ras_out, &pwg->header_pwg);
     job_info->page_number++;
     return job_info->page_number;
 }
 
+/*
+ * Write num_rows white rows. The raster stream encodes them as repeats of one row, so nothing
+ * the size of the swath is filled or converted.
+ */
+static int _print_white_rows(pcl_job_info_t *job_info, int num_rows, int bytes_per_row) {
+    pwg_job_t *pwg = (pwg_job_t *) job_info->pwg_obj;
+    int row_size = (job_info->monochrome ? (bytes_per_row / BYTES_PER_PIXEL(1)) : bytes_per_row);
+
+    if (row_size > pwg->white_row_size) {
+        unsigned char *row = (unsigned char *) realloc(pwg->white_row, row_size);
+        if (row == NULL) {
+            return ERROR;
+        }
+        pwg->white_row = row;
+        pwg->white_row_size = row_size;
+        memset(pwg->white_row, 0xff, pwg->white_row_size);
+    }
+
+    LOGD("_print_white_rows(): page #%d, %d rows", job_info->page_number, num_rows);
+    if (pwg->ras_out != NULL) {
+        for (; num_rows > 0; num_rows--) {
+            cupsRasterWritePixels(pwg->ras_out, pwg->white_row, row_size);
+        }
+    } else {
+        LOGD("cupsRasterWritePixels raster is null");
+    }
+    return OK;
+}
+
 static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_row, int num_rows,
         int bytes_per_row) {
+    pwg_job_t *pwg = (pwg_job_t *) job_info->pwg_obj;
     int outBuffSize;
+    if (pwg == NULL) {
+        return ERROR;
+    }
+    if (rgb_pixels == NULL) {
+        return _print_white_rows(job_info, num_rows, bytes_per_row);
+    }
     _PAGE_DATA(job_info, (const unsigned char *) rgb_pixels, (num_rows * bytes_per_row));
 
     if (job_info->monochrome) {
-        unsigned char *buff = (unsigned char *) rgb_pixels;
-        int nbytes = (num_rows * bytes_per_row);
-        int readIndex, writeIndex;
-        for (readIndex = writeIndex = 0; readIndex < nbytes; readIndex += BYTES_PER_PIXEL(1)) {
-            unsigned char gray = SP_GRAY(buff[readIndex + 0], buff[readIndex + 1],
-                    buff[readIndex + 2]);
-            buff[writeIndex++] = gray;
-        }
-        outBuffSize = writeIndex;
+        outBuffSize = (num_rows * bytes_per_row) / BYTES_PER_PIXEL(1);
+        wprint_rgb_to_sp_gray((uint8 *) rgb_pixels, (uint8 *) rgb_pixels, outBuffSize);
     } else {
         outBuffSize = num_rows * bytes_per_row;
     }
@@ -306,8 +356,9 @@ static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_ro
      * image_info->printable_width*num_components*strip_height. it is currently pixel_width
      * (from _start_page()) * num_components * strip_height
      */
-    if (ras_out != NULL) {
-        unsigned result = cupsRasterWritePixels(ras_out, (unsigned char *) rgb_pixels, outBuffSize);
+    if (pwg->ras_out != NULL) {
+        unsigned result = cupsRasterWritePixels(pwg->ras_out, (unsigned char *) rgb_pixels,
+                outBuffSize);
         LOGD("cupsRasterWritePixels return %d", result);
     } else {
         LOGD("cupsRasterWritePixels raster is null");
@@ -366,13 +417,18 @@ unsigned char *_generate_blank_data(int pixel_width, int pixel_height, uint8 mon
 }
 
 static int _end_page(pcl_job_info_t *job_info, int page_number) {
+    pwg_job_t *pwg = (pwg_job_t *) job_info->pwg_obj;
+    if (pwg == NULL) {
+        return ERROR;
+    }
     if (page_number == -1) {
         LOGD("lib_pclm: _end_page(): writing blank page");
 
         size_t buffer_size;
         unsigned char *buffer;
-        _start_page(job_info, header_pwg.cupsWidth, header_pwg.cupsHeight);
-        buffer = _generate_blank_data(header_pwg.cupsWidth, header_pwg.cupsHeight, job_info->monochrome, &buffer_size);
+        _start_page(job_info, pwg->header_pwg.cupsWidth, pwg->header_pwg.cupsHeight);
+        buffer = _generate_blank_data(pwg->header_pwg.cupsWidth, pwg->header_pwg.cupsHeight,
+                job_info->monochrome, &buffer_size);
         if (buffer == NULL) {
             return ERROR;
         } else {
@@ -389,7 +445,14 @@ static int _end_page(pcl_job_info_t *job_info, int page_number) {
 static int _end_job(pcl_job_info_t *job_info) {
     LOGI("_end_job()");
     _END_JOB(job_info);
-    cupsRasterClose(ras_out);
+
+    pwg_job_t *pwg = (pwg_job_t *) job_info->pwg_obj;
+    if (pwg != NULL) {
+        cupsRasterClose(pwg->ras_out);
+        free(pwg->white_row);
+        free(pwg);
+        job_info->pwg_obj = NULL;
+    }
     return OK;
 }
 
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * Copyright (C) 2016 Mopria Alliance, Inc.
+ * Copyright (C) 2013 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "media.h"
+
+/*
+ * Known media sizes.
+ *
+ * A note on rounding: In some cases the Android-specified width (in mils) is rounded down.
+ * This causes artifacts in libjpeg-turbo when rendering to the correct width, so in these
+ * cases we override with a rounded-up value.
+ */
+struct MediaSizeTableElement SupportedMediaSizes[SUPPORTED_MEDIA_SIZE_COUNT] = {
+        { US_LETTER, "LETTER", 8500, 11000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_letter_8.5x11in" },
+        { US_LEGAL, "LEGAL", 8500, 14000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_legal_8.5x14in" },
+        { LEDGER, "LEDGER", 11000, 17000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_ledger_11x17in" },
+        { INDEX_CARD_5X7, "5X7", 5000, 7000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_5x7_5x7in" },
+
+        // Android system uses width of 11690
+        { ISO_A3, "A3", 11694, 16540, 297, 420, "iso_a3_297x420mm" },
+
+        // Android system uses width of 8267
+        { ISO_A4, "A4", 8268, 11692, 210, 297, "iso_a4_210x297mm" },
+        { ISO_A5, "A5", 5830, 8270, 148, 210, "iso_a5_148x210mm" },
+
+        // Android system uses width of 10118
+        { JIS_B4, "JIS B4", 10119, 14331, 257, 364, "jis_b4_257x364mm" },
+
+        // Android system uses width of 7165
+        { JIS_B5, "JIS B5", 7167, 10118, 182, 257, "jis_b5_182x257mm" },
+        { US_GOVERNMENT_LETTER, "8x10", 8000, 10000, UNKNOWN_VALUE, UNKNOWN_VALUE,
+        "na_govt-letter_8x10in" },
+        { INDEX_CARD_4X6, "4x6", 4000, 6000, UNKNOWN_VALUE, UNKNOWN_VALUE, "na_index-4x6_4x6in" },
+        { JPN_HAGAKI_PC, "JPOST", 3940, 5830, 100, 148, "jpn_hagaki_100x148mm" },
+        { PHOTO_89X119, "89X119", 3504, 4685, 89, 119, "om_dsc-photo_89x119mm" },
+        { CARD_54X86, "54X86", 2126, 3386, 54, 86, "om_card_54x86mm" },
+        { OE_PHOTO_L, "L", 3500, 5000, UNKNOWN_VALUE, UNKNOWN_VALUE, "oe_photo-l_3.5x5in" }
+};
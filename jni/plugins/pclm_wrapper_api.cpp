@@ -37,16 +37,32 @@ int PCLmStartPage(void *thisClass, PCLmPageSetup *PCLmPageContent, void **pOutBu
             iOutBufferSize);
 }
 
+int PCLmEncapsulateStripV(void *thisClass, const PCLmStripDescriptor *strip,
+        const struct iovec **pOutVector, int *iOutVectorCount) {
+    return static_cast<PCLmGenerator *>(thisClass)->EncapsulateStripV(strip, pOutVector,
+            iOutVectorCount);
+}
+
 int PCLmEndPage(void *thisClass, void **pOutBuffer, int *iOutBufferSize) {
     return static_cast<PCLmGenerator *>(thisClass)->EndPage(pOutBuffer, iOutBufferSize);
 }
 
+int PCLmEndPageV(void *thisClass, const struct iovec **pOutVector, int *iOutVectorCount) {
+    return static_cast<PCLmGenerator *>(thisClass)->EndPageV(pOutVector, iOutVectorCount);
+}
+
 int PCLmEncapsulate(void *thisClass, void *pInBuffer, int inBufferSize, int numLines,
         void **pOutBuffer, int *iOutBufferSize) {
     return static_cast<PCLmGenerator *>(thisClass)->Encapsulate(pInBuffer, inBufferSize, numLines,
             pOutBuffer, iOutBufferSize);
 }
 
+int PCLmEncapsulateStrip(void *thisClass, const PCLmStripDescriptor *strip, void **pOutBuffer,
+        int *iOutBufferSize) {
+    return static_cast<PCLmGenerator *>(thisClass)->EncapsulateStrip(strip, pOutBuffer,
+            iOutBufferSize);
+}
+
 void PCLmFreeBuffer(void *thisClass, void *pBuffer) {
     return static_cast<PCLmGenerator *>(thisClass)->FreeBuffer(pBuffer);
 }
@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 
+#include <sys/uio.h>
 #include "common_defines.h"
 
 #ifndef PCLMWRAPPERAPI_H_
@@ -36,8 +37,13 @@ int PCLmEndJob(void *thisClass, void **pOutBUffer, int *iOutBifferSize);
 int PCLmStartPage(void *thisClass, PCLmPageSetup *PCLmPageContent, void **pOutBuffer,
         int *iOutBufferSize);
 int PCLmEndPage(void *thisClass, void **pOutBuffer, int *iOutBufferSize);
+int PCLmEndPageV(void *thisClass, const struct iovec **pOutVector, int *iOutVectorCount);
 int PCLmEncapsulate(void *thisClass, void *pInBuffer, int inBufferSize, int numLines,
         void **pOutBuffer, int *iOutBufferSize);
+int PCLmEncapsulateStrip(void *thisClass, const PCLmStripDescriptor *strip, void **pOutBuffer,
+        int *iOutBufferSize);
+int PCLmEncapsulateStripV(void *thisClass, const PCLmStripDescriptor *strip,
+        const struct iovec **pOutVector, int *iOutVectorCount);
 void PCLmFreeBuffer(void *thisClass, void *pBuffer);
 void DestroyPCLmGen(void *thisClass);
 int PCLmGetMediaDimensions(void *thisClass, const char *mediaRequested, PCLmPageSetup *myPageInfo);
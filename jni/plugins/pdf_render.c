@@ -73,9 +73,9 @@ static int getPageAttributes(pdf_render_ifc_t *obj, int page, double *width, dou
     return OK;
 }
 
-static int renderPageStripe(pdf_render_ifc_t *obj, int page, int width, int height, float zoom,
-        char *buffer) {
-    LOGD("renderPageStripe %p %d", obj, page);
+static int renderPageStripe(pdf_render_ifc_t *obj, int page, int x, int y, int width,
+        int height, float zoom, char *buffer) {
+    LOGD("renderPageStripe %p %d x=%d y=%d", obj, page, x, y);
     if (!gPdfRenderClass) return ERROR;
 
     pdf_render_st_t *self = (pdf_render_st_t *) obj;
@@ -83,13 +83,12 @@ static int renderPageStripe(pdf_render_ifc_t *obj, int page, int width, int heig
     int bufferSize = width * height * 3;
     jobject byteBuffer = (*self->env)->NewDirectByteBuffer(self->env, buffer, bufferSize);
 
-    if (!(*self->env)->CallBooleanMethod(self->env, self->obj, gPdfRenderRenderPageStripe, page,
-            0, width, height, (double) zoom, byteBuffer)) {
-        return ERROR;
-    }
+    jboolean rendered = (*self->env)->CallBooleanMethod(self->env, self->obj,
+            gPdfRenderRenderPageStripe, page, x, y, width, height, (double) zoom, byteBuffer);
 
+    // Pages are rendered in many stripes, so don't let references pile up on this thread
     (*self->env)->DeleteLocalRef(self->env, byteBuffer);
-    return OK;
+    return rendered ? OK : ERROR;
 }
 
 static void destroy(pdf_render_ifc_t *obj) {
@@ -116,7 +115,7 @@ void pdf_render_init(JNIEnv *env) {
     gPdfRenderGetPageSize = (*env)->GetMethodID(env, gPdfRenderClass, "getPageSize",
             "(I)Lcom/android/bips/jni/SizeD;");
     gPdfRenderRenderPageStripe = (*env)->GetMethodID(env, gPdfRenderClass, "renderPageStripe",
-            "(IIIIDLjava/nio/ByteBuffer;)Z");
+            "(IIIIIDLjava/nio/ByteBuffer;)Z");
 
     gSizeDClass = (*env)->NewGlobalRef(env, (*env)->FindClass(env, "com/android/bips/jni/SizeD"));
     gSizeDGetWidth = (*env)->GetMethodID(env, gSizeDClass, "getWidth", "()D");
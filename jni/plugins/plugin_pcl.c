@@ -22,6 +22,7 @@
 #include "ifc_print_job.h"
 #include "lib_pcl.h"
 #include "wprint_image.h"
+#include "wprint_arena.h"
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -31,9 +32,13 @@
 #endif
 
 #include <pthread.h>
-#include <semaphore.h>
 
-#define MAX_SEND_BUFFS (BUFFERED_ROWS / STRIPE_HEIGHT)
+/*
+ * Messages _send_thread may fall behind by for a job with num_buffs stripe buffers. A stripe buffer
+ * is only refilled once this many of the messages after it have been queued, so keeping this below
+ * num_buffs - 1 means the send thread has finished with it.
+ */
+#define SEND_QUEUE_DEPTH(num_buffs) ((num_buffs) - 2)
 
 #define TAG "plugin_pcl"
 
@@ -62,7 +67,7 @@ typedef struct {
         } send;
         struct {
             int page;
-            char *buffers[MAX_SEND_BUFFS];
+            char *buffers[MAX_STRIPE_BUFFERS];
             int count;
         } end_page;
     } param;
@@ -74,8 +79,25 @@ typedef struct {
     pthread_t send_tid;
     pcl_job_info_t job_info;
     wprint_job_params_t *job_params;
-    sem_t buffs_sem;
     ifc_pcl_t *pcl_ifc;
+
+    // stripe buffers each page may have in flight, chosen for the job's memory budget
+    int num_buffs;
+
+    // page buffers, recycled from one page to the next
+    wprint_arena_t *arena;
+
+    // where the job's time went, in microseconds
+    int pages;
+    int64_t decode_us;
+    int64_t buffer_wait_us;
+    int rows_cached;
+
+    // totals of the send thread, guarded by stats_lock
+    pthread_mutex_t stats_lock;
+    int64_t compress_us;
+    int64_t send_us;
+    int64_t bytes_sent;
 } plugin_data_t;
 
 static const char *_mime_types[] = {
@@ -101,11 +123,48 @@ static void _cleanup_plugin_data(plugin_data_t *priv) {
         if (priv->msgQ != MSG_Q_INVALID_ID) {
             priv->job_info.wprint_ifc->msgQDelete(priv->msgQ);
         }
-        sem_destroy(&priv->buffs_sem);
+        pthread_mutex_destroy(&priv->stats_lock);
+        wprint_arena_destroy(priv->arena);
         free(priv);
     }
 }
 
+/*
+ * Adds the time since start, less the time spent sending since send_us was read, to the job's
+ * compression time, and publishes the send totals
+ */
+static void _add_compress_time(plugin_data_t *priv, int64_t start, int64_t send_us) {
+    int64_t elapsed = wprint_get_usecs() - start;
+
+    pthread_mutex_lock(&priv->stats_lock);
+    priv->compress_us += elapsed - (priv->job_info.send_us - send_us);
+    priv->send_us = priv->job_info.send_us;
+    priv->bytes_sent = priv->job_info.bytes_sent;
+    pthread_mutex_unlock(&priv->stats_lock);
+}
+
+/*
+ * Copies where the job's time went so far into its job_params, where the job's callbacks find it.
+ * Must be called on the thread printing the pages.
+ */
+static void _update_stats(plugin_data_t *priv) {
+    wprint_job_stats_t *stats = &priv->job_params->stats;
+
+    stats->pages = priv->pages;
+    stats->render_ms = wprint_image_get_render_ms(priv->job_params);
+    stats->decode_ms = (long) (priv->decode_us / 1000);
+    stats->buffer_wait_ms = (long) (priv->buffer_wait_us / 1000);
+    stats->strip_height = (int) priv->job_params->strip_height;
+    stats->stripe_buffers = priv->num_buffs;
+    stats->rows_cached = priv->rows_cached;
+
+    pthread_mutex_lock(&priv->stats_lock);
+    stats->compress_ms = (long) (priv->compress_us / 1000);
+    stats->send_ms = (long) (priv->send_us / 1000);
+    stats->bytes_sent = priv->bytes_sent;
+    pthread_mutex_unlock(&priv->stats_lock);
+}
+
 /*
  * Waits to receive message from the msgQ. Handles messages and sends commands to handle jobs
  */
@@ -115,6 +174,8 @@ static void *_send_thread(void *param) {
 
     while (priv->job_info.wprint_ifc->msgQReceive(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t),
             WAIT_FOREVER) == OK) {
+        int64_t start = wprint_get_usecs(), send_us = priv->job_info.send_us;
+
         if (msg.id == MSG_START_JOB) {
             priv->pcl_ifc->start_job(priv->job_handle, &priv->job_info,
                     priv->job_params->media_size, priv->job_params->media_type,
@@ -131,19 +192,18 @@ static void *_send_thread(void *param) {
                         msg.param.send.start_row, msg.param.send.num_rows,
                         msg.param.send.bytes_per_row);
             }
-            sem_post(&priv->buffs_sem);
         } else if (msg.id == MSG_END_PAGE) {
             int i;
             priv->pcl_ifc->end_page(&priv->job_info, msg.param.end_page.page);
             for (i = 0; i < msg.param.end_page.count; i++) {
-                if (msg.param.end_page.buffers[i] != NULL) {
-                    free(msg.param.end_page.buffers[i]);
-                }
+                wprint_arena_free(priv->arena, msg.param.end_page.buffers[i]);
             }
         } else if (msg.id == MSG_END_JOB) {
             priv->pcl_ifc->end_job(&priv->job_info);
+            _add_compress_time(priv, start, send_us);
             break;
         }
+        _add_compress_time(priv, start, send_us);
     }
     return NULL;
 }
@@ -204,11 +264,12 @@ static status_t _stop_thread(plugin_data_t *priv) {
         msg.id = MSG_END_JOB;
 
         priv->job_info.wprint_ifc->msgQSend(
-                priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
+                priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), WAIT_FOREVER, MSG_Q_FIFO);
         pthread_join(priv->send_tid, 0);
         priv->send_tid = pthread_self();
         result = OK;
     }
+    _update_stats(priv);
     _cleanup_plugin_data(priv);
     return result;
 }
@@ -235,10 +296,9 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
         priv->job_info.job_handle = _WJOBH_NONE;
         priv->job_info.print_ifc = (ifc_print_job_t *) print_ifc_p;
         priv->job_info.wprint_ifc = (ifc_wprint_t *) wprint_ifc_p;
-        priv->job_info.strip_height = job_params->strip_height;
         priv->job_info.useragent = job_params->useragent;
 
-        sem_init(&priv->buffs_sem, 0, MAX_SEND_BUFFS);
+        pthread_mutex_init(&priv->stats_lock, NULL);
         switch (job_params->pcl_type) {
             case PCLm:
                 priv->pcl_ifc = pclm_connect();
@@ -255,8 +315,22 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
             continue;
         }
 
+        // PCLm strips go to the printer as they are, so only PWG may change their height
+        wprint_image_plan_stripes(job_params->memory_budget,
+                BYTES_PER_PIXEL(job_params->printable_area_width), (job_params->pcl_type == PCLm),
+                &job_params->strip_height, &priv->num_buffs);
+        priv->job_info.strip_height = job_params->strip_height;
+        priv->job_info.memory_budget = job_params->memory_budget;
+        priv->job_info.compression_threads = job_params->compression_threads;
+        LOGI("_start_job(): %d stripes of %d rows in flight", priv->num_buffs,
+                job_params->strip_height);
+
+        // pages fall back to the heap without one
+        priv->arena = wprint_arena_create();
+
+        // only the job's thread sends and only _send_thread receives
         priv->msgQ = priv->job_info.wprint_ifc->msgQCreate(
-                (MAX_SEND_BUFFS * 2), sizeof(msgQ_msg_t));
+                SEND_QUEUE_DEPTH(priv->num_buffs), sizeof(msgQ_msg_t), MSG_Q_SPSC);
         if (priv->msgQ == MSG_Q_INVALID_ID) continue;
 
         if (_start_thread(priv) == ERROR) continue;
@@ -264,7 +338,7 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
         job_params->plugin_data = (void *) priv;
         msg.id = MSG_START_JOB;
         priv->job_info.wprint_ifc->msgQSend(
-                priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
+                priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), WAIT_FOREVER, MSG_Q_FIFO);
 
         return OK;
     } while (0);
@@ -273,21 +347,41 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
     return ERROR;
 }
 
+/*
+ * Returns the scaler filter for a job's scale quality
+ */
+static scaler_filter_t _get_scaler_filter(scale_quality_t scale_quality) {
+    switch (scale_quality) {
+        case SCALE_QUALITY_BOX:
+            return SCALER_FILTER_BOX;
+        case SCALE_QUALITY_BILINEAR:
+            return SCALER_FILTER_BILINEAR;
+        case SCALE_QUALITY_BICUBIC:
+            return SCALER_FILTER_BICUBIC;
+        case SCALE_QUALITY_LANCZOS3:
+            return SCALER_FILTER_LANCZOS3;
+        case SCALE_QUALITY_DEFAULT:
+        default:
+            return SCALER_FILTER_DEFAULT;
+    }
+}
+
 static status_t _print_page(wprint_job_params_t *job_params, const char *mime_type,
         const char *pathname) {
     wprint_image_info_t *image_info;
     FILE *imgfile;
     status_t result;
     int num_rows, height, image_row;
-    int blank_data;
     char *buff;
     int i, buff_index, buff_size;
-    char *buff_pool[MAX_SEND_BUFFS];
+    char *buff_pool[MAX_STRIPE_BUFFERS];
 
     int nbytes;
     plugin_data_t *priv;
     msgQ_msg_t msg;
     int image_padding = PAD_PRINT;
+    int64_t start;
+    long render_ms;
 
     if (job_params == NULL) return ERROR;
 
@@ -310,15 +404,18 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
         msg.param.end_page.count = 0;
         result = ERROR;
     } else if (strlen(pathname)) {
-        image_info = malloc(sizeof(wprint_image_info_t));
+        wprint_arena_next_page(priv->arena);
+        image_info = wprint_arena_alloc(priv->arena, sizeof(wprint_image_info_t));
         if (image_info == NULL) return ERROR;
 
         imgfile = fopen(pathname, "r");
         if (imgfile) {
             LOGD("_print_page(): fopen succeeded on %s", pathname);
             wprint_image_setup(image_info, mime_type, priv->job_info.wprint_ifc,
-                    job_params->pixel_units, job_params->pdf_render_resolution);
-            wprint_image_init(image_info, pathname, job_params->page_num);
+                    job_params->pixel_units, job_params->pdf_render_resolution,
+                    _get_scaler_filter(job_params->scale_quality), job_params->memory_budget,
+                    priv->arena);
+            wprint_image_init(image_info, pathname, job_params->page_num, job_params);
 
             // get the image_info of the input file of specified MIME type
             if ((result = wprint_image_get_info(imgfile, image_info)) == OK) {
@@ -355,25 +452,23 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                         job_params->printable_area_width, job_params->printable_area_height,
                         job_params->print_top_margin, job_params->print_left_margin,
                         job_params->print_right_margin, job_params->print_bottom_margin,
-                        job_params->render_flags, job_params->strip_height, MAX_SEND_BUFFS,
+                        job_params->render_flags, job_params->strip_height, priv->num_buffs,
                         image_padding);
 
                 // allocate memory for a stripe of data
-                for (i = 0; i < MAX_SEND_BUFFS; i++) {
+                for (i = 0; i < priv->num_buffs; i++) {
                     buff_pool[i] = NULL;
                 }
 
-                blank_data = MAX_SEND_BUFFS;
                 buff_size = wprint_image_get_output_buff_size(image_info);
-                for (i = 0; i < MAX_SEND_BUFFS; i++) {
-                    buff_pool[i] = malloc(buff_size);
+                for (i = 0; i < priv->num_buffs; i++) {
+                    buff_pool[i] = wprint_arena_alloc(priv->arena, buff_size);
                     if (buff_pool[i] == NULL) {
                         break;
                     }
-                    memset(buff_pool[i], 0xff, buff_size);
                 }
 
-                if (i == MAX_SEND_BUFFS) {
+                if (i == priv->num_buffs) {
                     msg.id = MSG_START_PAGE;
                     msg.param.start_page.extra_margin = ((job_params->duplex !=
                             DUPLEX_MODE_NONE) &&
@@ -383,7 +478,7 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                     msg.param.start_page.height = wprint_image_get_height(image_info);
                     priv->job_info.num_components = image_info->num_components;
                     priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg,
-                            sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
+                            sizeof(msgQ_msg_t), WAIT_FOREVER, MSG_Q_FIFO);
 
                     msg.id = MSG_SEND;
                     msg.param.send.bytes_per_row = BYTES_PER_PIXEL(wprint_image_get_width(
@@ -399,23 +494,24 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                         if (priv->pcl_ifc->canCancelMidPage() && job_params->cancelled) {
                             break;
                         }
-                        sem_wait(&priv->buffs_sem);
-
                         buff = buff_pool[buff_index];
-                        buff_index = ((buff_index + 1) % MAX_SEND_BUFFS);
+                        buff_index = ((buff_index + 1) % priv->num_buffs);
 
                         height = MIN(num_rows, job_params->strip_height);
-                        if (!job_params->cancelled) {
+                        if (job_params->cancelled ||
+                                wprint_image_is_blank_stripe(image_info, image_row, height)) {
+                            // Known white, so send no pixels and let the encoder skip them
+                            nbytes = height * msg.param.send.bytes_per_row;
+                            buff = NULL;
+                        } else {
+                            // rendering is counted separately
+                            render_ms = image_info->decoder_data.render_ms;
+                            start = wprint_get_usecs();
                             nbytes = wprint_image_decode_stripe(image_info, image_row, &height,
                                     (unsigned char *) buff);
-
-                            if (blank_data > 0) {
-                                blank_data--;
-                            }
-                        } else if (blank_data < MAX_SEND_BUFFS) {
-                            nbytes = buff_size;
-                            memset(buff, 0xff, buff_size);
-                            blank_data++;
+                            priv->decode_us += wprint_get_usecs() - start -
+                                    (int64_t) (image_info->decoder_data.render_ms - render_ms) *
+                                            1000;
                         }
 
                         if (nbytes > 0) {
@@ -423,16 +519,15 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                             msg.param.send.start_row = image_row;
                             msg.param.send.num_rows = height;
 
+                            // blocks while the send thread is a full queue behind
+                            start = wprint_get_usecs();
                             result = priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg,
-                                    sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
-                            if (result < 0) {
-                                sem_post(&priv->buffs_sem);
-                            }
+                                    sizeof(msgQ_msg_t), WAIT_FOREVER, MSG_Q_FIFO);
+                            priv->buffer_wait_us += wprint_get_usecs() - start;
 
                             image_row += height;
                             num_rows -= height;
                         } else {
-                            sem_post(&priv->buffs_sem);
                             if (nbytes < 0) {
                                 LOGE("_print_page(): ERROR: file appears to be corrupted");
                                 result = CORRUPT;
@@ -444,6 +539,8 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                     if ((result == OK) && job_params->cancelled) {
                         result = CANCELLED;
                     }
+                    priv->pages++;
+                    priv->rows_cached = MAX(priv->rows_cached, image_info->rows_cached);
 
                     LOGI("_print_page(): sends done, result: %d", result);
 
@@ -462,10 +559,10 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                     result = ERROR;
                     LOGE("_print_page(): plugin_pcl cannot allocate memory for image stripe");
                 }
-                for (i = 0; i < MAX_SEND_BUFFS; i++) {
+                for (i = 0; i < priv->num_buffs; i++) {
                     msg.param.end_page.buffers[i] = buff_pool[i];
                 }
-                msg.param.end_page.count = MAX_SEND_BUFFS;
+                msg.param.end_page.count = priv->num_buffs;
             } else {
                 msg.param.end_page.page = -1;
                 msg.param.end_page.count = 0;
@@ -482,7 +579,7 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
             LOGE("_print_page(): could not open %s", pathname);
             result = CORRUPT;
         }
-        free(image_info);
+        wprint_arena_free(priv->arena, image_info);
     } else {
         LOGE("_print_page(): ERROR: filename was empty");
         msg.param.end_page.page = -1;
@@ -491,8 +588,9 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
     }
 
     msg.id = MSG_END_PAGE;
-    priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT,
-            MSG_Q_FIFO);
+    priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t),
+            WAIT_FOREVER, MSG_Q_FIFO);
+    _update_stats(priv);
     return result;
 }
 
@@ -511,14 +609,25 @@ static int _print_blank_page(wJob_t job_handle, wprint_job_params_t *job_params)
     msg.id = MSG_END_PAGE;
     msg.param.end_page.page = -1;
     msg.param.end_page.count = 0;
-    priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT,
-            MSG_Q_FIFO);
+    priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t),
+            WAIT_FOREVER, MSG_Q_FIFO);
     return OK;
 }
 
+/*
+ * Renders an upcoming page while the current one is encoded and sent
+ */
+static status_t _prepare_page(wprint_job_params_t *job_params, const char *mime_type,
+        const char *pathname, int page_num) {
+    if ((job_params == NULL) || (pathname == NULL)) return ERROR;
+    return wprint_image_prefetch(job_params, mime_type, pathname, page_num,
+            job_params->pdf_render_resolution, job_params->render_ahead_bytes);
+}
+
 static int _end_job(wprint_job_params_t *job_params) {
     if (job_params != NULL) {
         _stop_thread((plugin_data_t *) job_params->plugin_data);
+        wprint_image_end_job(job_params);
     }
     return OK;
 }
@@ -527,6 +636,7 @@ wprint_plugin_t *libwprintplugin_pcl_reg(void) {
     static const wprint_plugin_t _pcl_plugin = {.version = WPRINT_PLUGIN_VERSION(0),
             .priority = PRIORITY_LOCAL, .get_mime_types = _get_mime_types,
             .get_print_formats = _get_print_formats, .start_job = _start_job,
-            .print_page = _print_page, .print_blank_page = _print_blank_page, .end_job = _end_job,};
+            .print_page = _print_page, .print_blank_page = _print_blank_page, .end_job = _end_job,
+            .prepare_page = _prepare_page,};
     return ((wprint_plugin_t *) &_pcl_plugin);
 }
\ No newline at end of file
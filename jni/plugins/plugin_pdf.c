@@ -74,6 +74,7 @@ static int _print_page(wprint_job_params_t *job_params, const char *mime_type,
     int result = OK;
     int rbytes, wbytes, nbytes = 0;
     char *buff;
+    int64_t start, send_us = 0;
 
     if (job_params == NULL) return ERROR;
 
@@ -93,7 +94,9 @@ static int _print_page(wprint_job_params_t *job_params, const char *mime_type,
             rbytes = read(fd, buff, BUFF_SIZE);
 
             while ((rbytes > 0) && !job_params->cancelled) {
+                start = wprint_get_usecs();
                 wbytes = priv->print_ifc->send_data(priv->print_ifc, buff, rbytes);
+                send_us += wprint_get_usecs() - start;
                 if (wbytes == rbytes) {
                     nbytes += wbytes;
                     rbytes = read(fd, buff, BUFF_SIZE);
@@ -105,6 +108,10 @@ static int _print_page(wprint_job_params_t *job_params, const char *mime_type,
             }
             LOGI("dumped %d bytes of %s to printer", nbytes, pathname);
             close(fd);
+
+            job_params->stats.pages++;
+            job_params->stats.send_ms += (long) (send_us / 1000);
+            job_params->stats.bytes_sent += nbytes;
         }
 
         free(buff);
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "wprint_arena.h"
+#include "wprint_debug.h"
+
+#define TAG "wprint_arena"
+
+/* Blocks tracked before the table first has to grow */
+#define INITIAL_BLOCKS 32
+
+typedef struct {
+    void *ptr;
+    size_t size;
+    bool in_use;
+
+    // page on which the block was last handed out or given back
+    int page;
+} arena_block_t;
+
+struct wprint_arena_st {
+    pthread_mutex_t lock;
+    arena_block_t *blocks;
+    int num_blocks;
+    int max_blocks;
+    int page;
+
+    // totals logged when the arena is destroyed
+    size_t bytes_held;
+    size_t peak_bytes;
+    long allocs;
+    long reuses;
+};
+
+wprint_arena_t *wprint_arena_create(void) {
+    wprint_arena_t *arena = (wprint_arena_t *) calloc(1, sizeof(wprint_arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->blocks = (arena_block_t *) malloc(INITIAL_BLOCKS * sizeof(arena_block_t));
+    if (arena->blocks == NULL) {
+        free(arena);
+        return NULL;
+    }
+    arena->max_blocks = INITIAL_BLOCKS;
+    pthread_mutex_init(&arena->lock, NULL);
+    return arena;
+}
+
+void wprint_arena_destroy(wprint_arena_t *arena) {
+    int i;
+
+    if (arena == NULL) {
+        return;
+    }
+
+    LOGD("wprint_arena_destroy(): %ld of %ld allocations reused, %zu bytes at most", arena->reuses,
+            arena->allocs, arena->peak_bytes);
+    for (i = 0; i < arena->num_blocks; i++) {
+        free(arena->blocks[i].ptr);
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena->blocks);
+    free(arena);
+}
+
+/*
+ * Returns the index of the smallest idle block of between size and twice size bytes, or -1.
+ * Called with the lock held.
+ */
+static int _find_idle_block(wprint_arena_t *arena, size_t size) {
+    int i, best = -1;
+
+    for (i = 0; i < arena->num_blocks; i++) {
+        arena_block_t *block = &arena->blocks[i];
+        if (!block->in_use && (block->size >= size) && (block->size / 2 <= size) &&
+                ((best < 0) || (block->size < arena->blocks[best].size))) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * Tracks a newly allocated block as in use. Called with the lock held.
+ */
+static bool _add_block(wprint_arena_t *arena, void *ptr, size_t size) {
+    if (arena->num_blocks == arena->max_blocks) {
+        arena_block_t *blocks = (arena_block_t *) realloc(arena->blocks,
+                2 * arena->max_blocks * sizeof(arena_block_t));
+        if (blocks == NULL) {
+            return false;
+        }
+        arena->blocks = blocks;
+        arena->max_blocks *= 2;
+    }
+
+    arena->blocks[arena->num_blocks].ptr = ptr;
+    arena->blocks[arena->num_blocks].size = size;
+    arena->blocks[arena->num_blocks].in_use = true;
+    arena->blocks[arena->num_blocks].page = arena->page;
+    arena->num_blocks++;
+    arena->bytes_held += size;
+    if (arena->bytes_held > arena->peak_bytes) {
+        arena->peak_bytes = arena->bytes_held;
+    }
+    return true;
+}
+
+void *wprint_arena_alloc(wprint_arena_t *arena, size_t size) {
+    void *ptr;
+    int i;
+
+    if (arena == NULL) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        size = 1;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    arena->allocs++;
+    i = _find_idle_block(arena, size);
+    if (i >= 0) {
+        arena->blocks[i].in_use = true;
+        arena->blocks[i].page = arena->page;
+        arena->reuses++;
+        ptr = arena->blocks[i].ptr;
+        pthread_mutex_unlock(&arena->lock);
+        return ptr;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    // Nothing to reuse, so the heap is asked without holding up the other threads
+    ptr = malloc(size);
+    if (ptr == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    if (!_add_block(arena, ptr, size)) {
+        free(ptr);
+        ptr = NULL;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+void wprint_arena_free(wprint_arena_t *arena, void *ptr) {
+    bool found = false;
+    int i;
+
+    if (ptr == NULL) {
+        return;
+    }
+    if (arena == NULL) {
+        free(ptr);
+        return;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    for (i = 0; i < arena->num_blocks; i++) {
+        if (arena->blocks[i].ptr == ptr) {
+            arena->blocks[i].in_use = false;
+            arena->blocks[i].page = arena->page;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    if (!found) {
+        free(ptr);
+    }
+}
+
+void wprint_arena_next_page(wprint_arena_t *arena) {
+    int i;
+
+    if (arena == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    arena->page++;
+    for (i = 0; i < arena->num_blocks;) {
+        arena_block_t *block = &arena->blocks[i];
+        if (!block->in_use && (arena->page - block->page > ARENA_IDLE_PAGES)) {
+            free(block->ptr);
+            arena->bytes_held -= block->size;
+            *block = arena->blocks[--arena->num_blocks];
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
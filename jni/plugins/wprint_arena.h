@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WPRINT_ARENA_H__
+#define __WPRINT_ARENA_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pages an idle block is kept for before it is returned to the heap
+ */
+#define ARENA_IDLE_PAGES 2
+
+/*
+ * Recycles the large buffers of a job from one page to the next. Pages of the same geometry ask
+ * for the same sizes again, so a freed block is held until a later request of about its size
+ * takes it, instead of going back to the heap and being faulted in again. An arena may be used
+ * from several threads at once.
+ */
+typedef struct wprint_arena_st wprint_arena_t;
+
+/*
+ * Returns a new, empty arena or NULL if out of memory
+ */
+wprint_arena_t *wprint_arena_create(void);
+
+/*
+ * Frees every block held by arena, whether or not it was given back
+ */
+void wprint_arena_destroy(wprint_arena_t *arena);
+
+/*
+ * Returns at least size bytes of uninitialized memory, reusing an idle block of between size and
+ * twice size bytes if there is one. With a NULL arena this is malloc().
+ */
+void *wprint_arena_alloc(wprint_arena_t *arena, size_t size);
+
+/*
+ * Gives ptr back to arena for reuse. Memory that did not come from arena is passed to free(), so
+ * a buffer from malloc() may be handed to whoever frees the arena's blocks.
+ */
+void wprint_arena_free(wprint_arena_t *arena, void *ptr);
+
+/*
+ * Marks the start of a page, returning blocks idle for the last ARENA_IDLE_PAGES pages to the
+ * heap so that a change of geometry does not leave the old sizes held for the rest of the job
+ */
+void wprint_arena_next_page(wprint_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __WPRINT_ARENA_H__
@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * Copyright (C) 2016 Mopria Alliance, Inc.
+ * Copyright (C) 2013 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "wprint_color.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+/*
+ * The vector paths below multiply and add in the same order as the scalar formula, so keep the
+ * compiler from fusing the scalar version into FMAs; that would change the truncated result.
+ */
+#pragma STDC FP_CONTRACT OFF
+
+#define PIXELS_PER_VECTOR 16
+
+static inline uint8 _rgb_2_gray(uint8 r, uint8 g, uint8 b) {
+    return (uint8) (0.299 * (double) r + 0.587 * (double) g + 0.114 * (double) b);
+}
+
+#if defined(__ARM_NEON)
+
+/*
+ * SP_GRAY of 16 deinterleaved pixels
+ */
+static inline uint8x16_t _sp_gray_16(uint8x16x3_t rgb) {
+    uint16x8_t lo = vshlq_n_u16(vmovl_u8(vget_low_u8(rgb.val[0])), 6);
+    uint16x8_t hi = vshlq_n_u16(vmovl_u8(vget_high_u8(rgb.val[0])), 6);
+    lo = vmlaq_n_u16(lo, vmovl_u8(vget_low_u8(rgb.val[1])), 160);
+    hi = vmlaq_n_u16(hi, vmovl_u8(vget_high_u8(rgb.val[1])), 160);
+    lo = vaddq_u16(lo, vshlq_n_u16(vmovl_u8(vget_low_u8(rgb.val[2])), 5));
+    hi = vaddq_u16(hi, vshlq_n_u16(vmovl_u8(vget_high_u8(rgb.val[2])), 5));
+    return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+#if defined(__aarch64__)
+
+/*
+ * _rgb_2_gray of two pixels
+ */
+static inline uint32x2_t _gray_2(uint32x2_t r, uint32x2_t g, uint32x2_t b) {
+    float64x2_t y = vmulq_n_f64(vcvtq_f64_u64(vmovl_u32(r)), 0.299);
+    y = vaddq_f64(y, vmulq_n_f64(vcvtq_f64_u64(vmovl_u32(g)), 0.587));
+    y = vaddq_f64(y, vmulq_n_f64(vcvtq_f64_u64(vmovl_u32(b)), 0.114));
+    return vmovn_u64(vcvtq_u64_f64(y));
+}
+
+/*
+ * _rgb_2_gray of eight pixels
+ */
+static inline uint8x8_t _gray_8(uint8x8_t r8, uint8x8_t g8, uint8x8_t b8) {
+    uint16x8_t r = vmovl_u8(r8), g = vmovl_u8(g8), b = vmovl_u8(b8);
+    uint32x4_t rl = vmovl_u16(vget_low_u16(r)), rh = vmovl_u16(vget_high_u16(r));
+    uint32x4_t gl = vmovl_u16(vget_low_u16(g)), gh = vmovl_u16(vget_high_u16(g));
+    uint32x4_t bl = vmovl_u16(vget_low_u16(b)), bh = vmovl_u16(vget_high_u16(b));
+    uint32x4_t lo = vcombine_u32(
+            _gray_2(vget_low_u32(rl), vget_low_u32(gl), vget_low_u32(bl)),
+            _gray_2(vget_high_u32(rl), vget_high_u32(gl), vget_high_u32(bl)));
+    uint32x4_t hi = vcombine_u32(
+            _gray_2(vget_low_u32(rh), vget_low_u32(gh), vget_low_u32(bh)),
+            _gray_2(vget_high_u32(rh), vget_high_u32(gh), vget_high_u32(bh)));
+    return vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+}
+
+#endif // __aarch64__
+
+#elif defined(__SSSE3__)
+
+/*
+ * Splits 16 RGB pixels into one vector per component
+ */
+static inline void _deinterleave_16(const uint8 *src, __m128i *r, __m128i *g, __m128i *b) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *) src);
+    __m128i a1 = _mm_loadu_si128((const __m128i *) (src + 16));
+    __m128i a2 = _mm_loadu_si128((const __m128i *) (src + 32));
+
+    *r = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1)),
+            _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1,
+                    -1, -1, -1))),
+            _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4,
+                    7, 10, 13)));
+    *g = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1)),
+            _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1,
+                    -1, -1, -1))),
+            _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5,
+                    8, 11, 14)));
+    *b = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1)),
+            _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1,
+                    -1, -1, -1))),
+            _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6,
+                    9, 12, 15)));
+}
+
+/*
+ * SP_GRAY of eight pixels held as 16-bit components
+ */
+static inline __m128i _sp_gray_8(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_slli_epi16(r, 6);
+    y = _mm_add_epi16(y, _mm_mullo_epi16(g, _mm_set1_epi16(160)));
+    y = _mm_add_epi16(y, _mm_slli_epi16(b, 5));
+    return _mm_srli_epi16(y, 8);
+}
+
+/*
+ * SP_GRAY of 16 RGB pixels
+ */
+static inline __m128i _sp_gray_16(const uint8 *src) {
+    __m128i r, g, b, zero = _mm_setzero_si128();
+    _deinterleave_16(src, &r, &g, &b);
+    __m128i lo = _sp_gray_8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero),
+            _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _sp_gray_8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero),
+            _mm_unpackhi_epi8(b, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+
+/*
+ * _rgb_2_gray of four pixels held as 32-bit components
+ */
+static inline __m128i _gray_4(__m128i r, __m128i g, __m128i b) {
+    __m128d y0 = _mm_mul_pd(_mm_cvtepi32_pd(r), _mm_set1_pd(0.299));
+    __m128d y1 = _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(r, 8)), _mm_set1_pd(0.299));
+    y0 = _mm_add_pd(y0, _mm_mul_pd(_mm_cvtepi32_pd(g), _mm_set1_pd(0.587)));
+    y1 = _mm_add_pd(y1, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(g, 8)), _mm_set1_pd(0.587)));
+    y0 = _mm_add_pd(y0, _mm_mul_pd(_mm_cvtepi32_pd(b), _mm_set1_pd(0.114)));
+    y1 = _mm_add_pd(y1, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(b, 8)), _mm_set1_pd(0.114)));
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(y0), _mm_cvttpd_epi32(y1));
+}
+
+/*
+ * _rgb_2_gray of eight pixels held as 16-bit components
+ */
+static inline __m128i _gray_8(__m128i r, __m128i g, __m128i b) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _gray_4(_mm_unpacklo_epi16(r, zero), _mm_unpacklo_epi16(g, zero),
+            _mm_unpacklo_epi16(b, zero));
+    __m128i hi = _gray_4(_mm_unpackhi_epi16(r, zero), _mm_unpackhi_epi16(g, zero),
+            _mm_unpackhi_epi16(b, zero));
+    return _mm_packs_epi32(lo, hi);
+}
+
+#endif
+
+void wprint_rgb_to_sp_gray(const uint8 *src, uint8 *dst, int num_pixels) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+        vst1q_u8(dst + i, _sp_gray_16(vld3q_u8(src + i * 3)));
+    }
+#elif defined(__SSSE3__)
+    for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+        _mm_storeu_si128((__m128i *) (dst + i), _sp_gray_16(src + i * 3));
+    }
+#endif
+    for (; i < num_pixels; i++) {
+        dst[i] = (uint8) SP_GRAY(src[i * 3], src[i * 3 + 1], src[i * 3 + 2]);
+    }
+}
+
+void wprint_rgb_to_sp_gray_rgb(uint8 *pixels, int num_pixels) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+        uint8x16x3_t out;
+        out.val[0] = out.val[1] = out.val[2] = _sp_gray_16(vld3q_u8(pixels + i * 3));
+        vst3q_u8(pixels + i * 3, out);
+    }
+#elif defined(__SSSE3__)
+    for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+        uint8 *p = pixels + i * 3;
+        __m128i gray = _sp_gray_16(p);
+        _mm_storeu_si128((__m128i *) p, _mm_shuffle_epi8(gray,
+                _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5)));
+        _mm_storeu_si128((__m128i *) (p + 16), _mm_shuffle_epi8(gray,
+                _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10)));
+        _mm_storeu_si128((__m128i *) (p + 32), _mm_shuffle_epi8(gray,
+                _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15)));
+    }
+#endif
+    for (; i < num_pixels; i++) {
+        uint8 *p = pixels + i * 3;
+        p[0] = p[1] = p[2] = (uint8) SP_GRAY(p[0], p[1], p[2]);
+    }
+}
+
+void wprint_rgb_to_gray(const uint8 *src, uint8 *dst, int num_pixels) {
+    int i = 0;
+#if defined(__aarch64__)
+    for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+        uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+        uint8x8_t lo = _gray_8(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]),
+                vget_low_u8(rgb.val[2]));
+        uint8x8_t hi = _gray_8(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]),
+                vget_high_u8(rgb.val[2]));
+        vst1q_u8(dst + i, vcombine_u8(lo, hi));
+    }
+#elif defined(__SSSE3__)
+    for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+        __m128i r, g, b, zero = _mm_setzero_si128();
+        _deinterleave_16(src + i * 3, &r, &g, &b);
+        __m128i lo = _gray_8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero),
+                _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _gray_8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero),
+                _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < num_pixels; i++) {
+        dst[i] = _rgb_2_gray(src[i * 3], src[i * 3 + 1], src[i * 3 + 2]);
+    }
+}
+
+#if defined(__ARM_NEON)
+
+/*
+ * Reverses the order of the 16 lanes of a vector
+ */
+static inline uint8x16_t _reverse_16(uint8x16_t v) {
+    v = vrev64q_u8(v);
+    return vcombine_u8(vget_high_u8(v), vget_low_u8(v));
+}
+
+#endif // __ARM_NEON
+
+void wprint_reverse_pixels(const uint8 *src, uint8 *dst, int num_pixels, int bytes_per_pixel) {
+    int i = 0, c;
+
+    // src pixel (num_pixels - 1 - i) becomes dst pixel i
+    if (bytes_per_pixel == 1) {
+#if defined(__ARM_NEON)
+        for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+            vst1q_u8(dst + i, _reverse_16(vld1q_u8(src + num_pixels - i - PIXELS_PER_VECTOR)));
+        }
+#elif defined(__SSSE3__)
+        const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+                0);
+        for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+            __m128i v = _mm_loadu_si128(
+                    (const __m128i *) (src + num_pixels - i - PIXELS_PER_VECTOR));
+            _mm_storeu_si128((__m128i *) (dst + i), _mm_shuffle_epi8(v, reverse));
+        }
+#endif
+        for (; i < num_pixels; i++) {
+            dst[i] = src[num_pixels - 1 - i];
+        }
+    } else if (bytes_per_pixel == 3) {
+#if defined(__ARM_NEON)
+        for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+            uint8x16x3_t rgb = vld3q_u8(src + (num_pixels - i - PIXELS_PER_VECTOR) * 3);
+            rgb.val[0] = _reverse_16(rgb.val[0]);
+            rgb.val[1] = _reverse_16(rgb.val[1]);
+            rgb.val[2] = _reverse_16(rgb.val[2]);
+            vst3q_u8(dst + i * 3, rgb);
+        }
+#elif defined(__SSSE3__)
+        for (; i + PIXELS_PER_VECTOR <= num_pixels; i += PIXELS_PER_VECTOR) {
+            const uint8 *s = src + (num_pixels - i - PIXELS_PER_VECTOR) * 3;
+            uint8 *d = dst + i * 3;
+            __m128i a0 = _mm_loadu_si128((const __m128i *) s);
+            __m128i a1 = _mm_loadu_si128((const __m128i *) (s + 16));
+            __m128i a2 = _mm_loadu_si128((const __m128i *) (s + 32));
+
+            _mm_storeu_si128((__m128i *) d, _mm_or_si128(
+                    _mm_shuffle_epi8(a2, _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6,
+                            1, 2, 3, -1)),
+                    _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                            -1, -1, -1, -1, -1, 14))));
+            _mm_storeu_si128((__m128i *) (d + 16), _mm_or_si128(_mm_or_si128(
+                    _mm_shuffle_epi8(a0, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                            -1, -1, -1, -1, 15, -1)),
+                    _mm_shuffle_epi8(a1, _mm_setr_epi8(15, -1, 11, 12, 13, 8, 9, 10, 5, 6, 7, 2,
+                            3, 4, -1, 0))),
+                    _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, 0, -1, -1, -1, -1, -1, -1, -1, -1,
+                            -1, -1, -1, -1, -1, -1))));
+            _mm_storeu_si128((__m128i *) (d + 32), _mm_or_si128(
+                    _mm_shuffle_epi8(a1, _mm_setr_epi8(1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                            -1, -1, -1, -1, -1)),
+                    _mm_shuffle_epi8(a0, _mm_setr_epi8(-1, 12, 13, 14, 9, 10, 11, 6, 7, 8, 3, 4,
+                            5, 0, 1, 2))));
+        }
+#endif
+        for (; i < num_pixels; i++) {
+            const uint8 *s = src + (num_pixels - 1 - i) * 3;
+            dst[i * 3] = s[0];
+            dst[i * 3 + 1] = s[1];
+            dst[i * 3 + 2] = s[2];
+        }
+    } else {
+        for (; i < num_pixels; i++) {
+            for (c = 0; c < bytes_per_pixel; c++) {
+                dst[i * bytes_per_pixel + c] = src[(num_pixels - 1 - i) * bytes_per_pixel + c];
+            }
+        }
+    }
+}
+
+#if defined(__ARM_NEON)
+
+/*
+ * Transposes eight rows of eight bytes in place
+ */
+static inline void _transpose_8x8(uint8x8_t v[8]) {
+    uint8x8x2_t b0 = vtrn_u8(v[0], v[1]), b1 = vtrn_u8(v[2], v[3]);
+    uint8x8x2_t b2 = vtrn_u8(v[4], v[5]), b3 = vtrn_u8(v[6], v[7]);
+    uint16x4x2_t c0 = vtrn_u16(vreinterpret_u16_u8(b0.val[0]), vreinterpret_u16_u8(b1.val[0]));
+    uint16x4x2_t c1 = vtrn_u16(vreinterpret_u16_u8(b0.val[1]), vreinterpret_u16_u8(b1.val[1]));
+    uint16x4x2_t c2 = vtrn_u16(vreinterpret_u16_u8(b2.val[0]), vreinterpret_u16_u8(b3.val[0]));
+    uint16x4x2_t c3 = vtrn_u16(vreinterpret_u16_u8(b2.val[1]), vreinterpret_u16_u8(b3.val[1]));
+    uint32x2x2_t d0 = vtrn_u32(vreinterpret_u32_u16(c0.val[0]), vreinterpret_u32_u16(c2.val[0]));
+    uint32x2x2_t d1 = vtrn_u32(vreinterpret_u32_u16(c1.val[0]), vreinterpret_u32_u16(c3.val[0]));
+    uint32x2x2_t d2 = vtrn_u32(vreinterpret_u32_u16(c0.val[1]), vreinterpret_u32_u16(c2.val[1]));
+    uint32x2x2_t d3 = vtrn_u32(vreinterpret_u32_u16(c1.val[1]), vreinterpret_u32_u16(c3.val[1]));
+
+    v[0] = vreinterpret_u8_u32(d0.val[0]);
+    v[1] = vreinterpret_u8_u32(d1.val[0]);
+    v[2] = vreinterpret_u8_u32(d2.val[0]);
+    v[3] = vreinterpret_u8_u32(d3.val[0]);
+    v[4] = vreinterpret_u8_u32(d0.val[1]);
+    v[5] = vreinterpret_u8_u32(d1.val[1]);
+    v[6] = vreinterpret_u8_u32(d2.val[1]);
+    v[7] = vreinterpret_u8_u32(d3.val[1]);
+}
+
+#define TRANSPOSE_BLOCK 8
+
+#elif defined(__SSSE3__)
+
+/*
+ * Loads four RGB pixels, reading no further
+ */
+static inline __m128i _load_rgb_4(const uint8 *p) {
+    int last;
+    memcpy(&last, p + 8, sizeof(last));
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) p), _mm_cvtsi32_si128(last));
+}
+
+/*
+ * Stores the four RGB pixels in the low 12 bytes of v, writing no further
+ */
+static inline void _store_rgb_4(uint8 *p, __m128i v) {
+    int last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    _mm_storel_epi64((__m128i *) p, v);
+    memcpy(p + 8, &last, sizeof(last));
+}
+
+#define TRANSPOSE_BLOCK 4
+
+#endif
+
+void wprint_transpose_rgb(const uint8 *const *src_rows, int num_rows, uint8 *const *dst_rows,
+        int num_cols, bool reverse) {
+#if defined(TRANSPOSE_BLOCK)
+    int rows = num_rows - (num_rows % TRANSPOSE_BLOCK);
+    int cols = num_cols - (num_cols % TRANSPOSE_BLOCK);
+#else
+    int rows = 0, cols = 0;
+#endif
+    int i, j;
+
+    // Whole blocks of TRANSPOSE_BLOCK rows by TRANSPOSE_BLOCK pixels
+#if defined(__ARM_NEON)
+    for (i = 0; i < rows; i += TRANSPOSE_BLOCK) {
+        int dst_x = reverse ? num_rows - TRANSPOSE_BLOCK - i : i;
+        for (j = 0; j < cols; j += TRANSPOSE_BLOCK) {
+            uint8x8_t r[8], g[8], b[8];
+            int k;
+            for (k = 0; k < 8; k++) {
+                uint8x8x3_t rgb = vld3_u8(src_rows[i + k] + j * 3);
+                r[k] = rgb.val[0];
+                g[k] = rgb.val[1];
+                b[k] = rgb.val[2];
+            }
+            _transpose_8x8(r);
+            _transpose_8x8(g);
+            _transpose_8x8(b);
+            for (k = 0; k < 8; k++) {
+                uint8x8x3_t rgb;
+                rgb.val[0] = reverse ? vrev64_u8(r[k]) : r[k];
+                rgb.val[1] = reverse ? vrev64_u8(g[k]) : g[k];
+                rgb.val[2] = reverse ? vrev64_u8(b[k]) : b[k];
+                vst3_u8(dst_rows[j + k] + dst_x * 3, rgb);
+            }
+        }
+    }
+#elif defined(__SSSE3__)
+    // Pixels go to 32-bit lanes to be transposed as a 4x4 block of words, then are packed back
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i pack = reverse ?
+            _mm_setr_epi8(12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2, -1, -1, -1, -1) :
+            _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (i = 0; i < rows; i += TRANSPOSE_BLOCK) {
+        int dst_x = reverse ? num_rows - TRANSPOSE_BLOCK - i : i;
+        for (j = 0; j < cols; j += TRANSPOSE_BLOCK) {
+            __m128i a0 = _mm_shuffle_epi8(_load_rgb_4(src_rows[i] + j * 3), spread);
+            __m128i a1 = _mm_shuffle_epi8(_load_rgb_4(src_rows[i + 1] + j * 3), spread);
+            __m128i a2 = _mm_shuffle_epi8(_load_rgb_4(src_rows[i + 2] + j * 3), spread);
+            __m128i a3 = _mm_shuffle_epi8(_load_rgb_4(src_rows[i + 3] + j * 3), spread);
+            __m128i t0 = _mm_unpacklo_epi32(a0, a1), t1 = _mm_unpacklo_epi32(a2, a3);
+            __m128i t2 = _mm_unpackhi_epi32(a0, a1), t3 = _mm_unpackhi_epi32(a2, a3);
+
+            _store_rgb_4(dst_rows[j] + dst_x * 3,
+                    _mm_shuffle_epi8(_mm_unpacklo_epi64(t0, t1), pack));
+            _store_rgb_4(dst_rows[j + 1] + dst_x * 3,
+                    _mm_shuffle_epi8(_mm_unpackhi_epi64(t0, t1), pack));
+            _store_rgb_4(dst_rows[j + 2] + dst_x * 3,
+                    _mm_shuffle_epi8(_mm_unpacklo_epi64(t2, t3), pack));
+            _store_rgb_4(dst_rows[j + 3] + dst_x * 3,
+                    _mm_shuffle_epi8(_mm_unpackhi_epi64(t2, t3), pack));
+        }
+    }
+#endif
+
+    // The pixels right of the blocks, then the rows below them
+    for (i = 0; i < num_rows; i++) {
+        int dst_x = reverse ? num_rows - 1 - i : i;
+        for (j = (i < rows) ? cols : 0; j < num_cols; j++) {
+            const uint8 *s = src_rows[i] + j * 3;
+            uint8 *d = dst_rows[j] + dst_x * 3;
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+        }
+    }
+}
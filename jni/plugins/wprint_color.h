@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * Copyright (C) 2016 Mopria Alliance, Inc.
+ * Copyright (C) 2013 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WPRINT_COLOR_H__
+#define __WPRINT_COLOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "wtypes.h"
+
+/*
+ * Fast integer gray approximation used for monochrome jobs
+ */
+#define SP_GRAY(Yr, Cbg, Crb) (((Yr<<6) + (Cbg*160) + (Crb<<5)) >> 8)
+
+/*
+ * Converts num_pixels RGB pixels to one SP_GRAY byte per pixel. dst may be the same buffer as
+ * src.
+ */
+void wprint_rgb_to_sp_gray(const uint8 *src, uint8 *dst, int num_pixels);
+
+/*
+ * Replaces each of num_pixels RGB pixels with its SP_GRAY value in all three components
+ */
+void wprint_rgb_to_sp_gray_rgb(uint8 *pixels, int num_pixels);
+
+/*
+ * Converts num_pixels RGB pixels to one byte per pixel of 0.299R + 0.587G + 0.114B, truncated.
+ * dst may be the same buffer as src.
+ */
+void wprint_rgb_to_gray(const uint8 *src, uint8 *dst, int num_pixels);
+
+/*
+ * Copies num_pixels pixels of bytes_per_pixel bytes each from src to dst in reverse order. src and
+ * dst must not overlap.
+ */
+void wprint_reverse_pixels(const uint8 *src, uint8 *dst, int num_pixels, int bytes_per_pixel);
+
+/*
+ * Transposes num_rows rows of num_cols RGB pixels: pixel j of src_rows[i] becomes pixel i of
+ * dst_rows[j], or pixel num_rows - 1 - i if reverse is set. No row may overlap another.
+ */
+void wprint_transpose_rgb(const uint8 *const *src_rows, int num_rows, uint8 *const *dst_rows,
+        int num_cols, bool reverse);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __WPRINT_COLOR_H__
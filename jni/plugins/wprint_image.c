@@ -18,16 +18,33 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <unistd.h>
 #include "wprint_image.h"
+#include "wprint_color.h"
 #include "lib_wprint.h"
 
 #define TAG "wprint_image"
-#define MIN_DECODE_MEM (1 * 1024 * 1024)
-#define MAX_DECODE_MEM (4 * 1024 * 1024)
+
+/* Stripe buffers get up to 1/STRIPE_MEM_SHARE of a memory budget, leaving the rest for caching
+ * and scaling rows */
+#define STRIPE_MEM_SHARE 2
+
+/* The row cache always gets at least 1/MIN_CACHE_MEM_SHARE of a memory budget */
+#define MIN_CACHE_MEM_SHARE 4
+
+/* Stripes to keep in flight before making them taller */
+#define PREFERRED_STRIPE_BUFFERS 8
+
+/* Narrowest column slice worth handing to another scaling thread */
+#define MIN_SCALE_SLICE_WIDTH 256
+
+/* Edge in pixels of the square tiles in which ROT_90/ROT_270 pages are transposed */
+#define ROTATE_TILE 32
 
 void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
         const ifc_wprint_t *wprint_ifc, unsigned int output_resolution,
-        int pdf_render_resolution) {
+        int pdf_render_resolution, scaler_filter_t scale_filter, int memory_budget,
+        wprint_arena_t *arena) {
     if (image_info != NULL) {
         LOGD("image_setup");
         memset(image_info, 0, sizeof(wprint_image_info_t));
@@ -35,7 +52,186 @@ void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
         image_info->mime_type = mime_type;
         image_info->print_resolution = output_resolution;
         image_info->pdf_render_resolution = pdf_render_resolution;
+        image_info->scale_filter = scale_filter;
+        image_info->memory_budget = (memory_budget > 0) ? memory_budget : DEFAULT_MEMORY_BUDGET;
+        image_info->arena = arena;
+    }
+}
+
+void wprint_image_plan_stripes(int memory_budget, int bytes_per_row, bool fixed_height,
+        unsigned int *strip_height, int *num_buffers) {
+    long stripe_mem = ((memory_budget > 0) ? memory_budget : DEFAULT_MEMORY_BUDGET) /
+            STRIPE_MEM_SHARE;
+    unsigned int height = *strip_height;
+    long buffers;
+
+    bytes_per_row = MAX(bytes_per_row, 1);
+    if (!fixed_height) {
+        // fewer, taller stripes cost less per row to hand over and encode
+        height = STRIPE_HEIGHT;
+        while ((height * 2 <= MAX_STRIPE_HEIGHT) &&
+                ((long) height * 2 * bytes_per_row * PREFERRED_STRIPE_BUFFERS <= stripe_mem)) {
+            height *= 2;
+        }
+    }
+    height = MAX(height, 1);
+
+    buffers = stripe_mem / ((long) height * bytes_per_row);
+    *strip_height = height;
+    *num_buffers = (int) MIN(MAX(buffers, MIN_STRIPE_BUFFERS), MAX_STRIPE_BUFFERS);
+    LOGD("wprint_image_plan_stripes(): %d stripes of %u rows of %d bytes for a budget of %d",
+            *num_buffers, height, bytes_per_row, memory_budget);
+}
+
+/*
+ * Returns the number of threads to scale stripes with besides the decoding thread
+ */
+static int _get_scale_threads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cores > 1) ? (int) MIN(cores - 1, MAX_SCALE_THREADS) : 0;
+}
+
+/*
+ * Scales slices of the current stripe until none are left to claim. Called with the pool locked.
+ */
+static void _scale_slices(wprint_scale_pool_t *pool) {
+    while (pool->next_slice < pool->num_slices) {
+        int slice = pool->next_slice++;
+        int width = pool->scaler_config->iOutWidth;
+        int first_column = (width * slice) / pool->num_slices;
+        int end_column = (width * (slice + 1)) / pool->num_slices;
+        pthread_mutex_unlock(&pool->lock);
+
+        scaler_scale_image_columns(pool->input, pool->scaler_config, pool->output,
+                pool->mixed_memory[slice], first_column, end_column - first_column);
+
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->slices_done == pool->num_slices) {
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+}
+
+static void *_scale_thread(void *param) {
+    wprint_scale_pool_t *pool = (wprint_scale_pool_t *) param;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->exit) {
+        if (pool->next_slice >= pool->num_slices) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        _scale_slices(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * Starts threads to share the scaling of each stripe when the output is wide enough to split.
+ * Stripes are scaled on the decoding thread alone if this fails.
+ */
+static void _start_scale_pool(wprint_image_info_t *image_info) {
+    wprint_scale_pool_t *pool;
+    int i, num_slices;
+
+    num_slices = MIN(_get_scale_threads() + 1,
+            (int) (image_info->scaled_width / MIN_SCALE_SLICE_WIDTH));
+
+    // each slice needs its own temp buffer, which comes out of the row cache's share
+    if (image_info->mixed_memory_needed != 0) {
+        num_slices = MIN(num_slices, (int) (image_info->memory_budget / MIN_CACHE_MEM_SHARE /
+                image_info->mixed_memory_needed));
+    }
+    if (num_slices <= 1) {
+        return;
+    }
+
+    pool = (wprint_scale_pool_t *) calloc(1, sizeof(wprint_scale_pool_t));
+    if (pool == NULL) {
+        return;
+    }
+
+    // the first slice borrows the image's own temp buffer
+    pool->mixed_memory[0] = image_info->mixed_memory;
+    for (i = 1; (i < num_slices) && (image_info->mixed_memory_needed != 0); i++) {
+        pool->mixed_memory[i] = (unsigned char *) wprint_arena_alloc(image_info->arena,
+                image_info->mixed_memory_needed);
+        if (pool->mixed_memory[i] == NULL) {
+            break;
+        }
+    }
+    if (image_info->mixed_memory_needed != 0) {
+        num_slices = i;
+    }
+
+    pool->num_slices = pool->next_slice = pool->slices_done = num_slices;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i < num_slices - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, _scale_thread, pool) != 0) {
+            break;
+        }
+        pool->num_threads++;
+    }
+    image_info->scale_pool = pool;
+    LOGD("scaling stripes in %d slices on %d extra threads", pool->num_slices,
+            pool->num_threads);
+}
+
+static void _stop_scale_pool(wprint_image_info_t *image_info) {
+    wprint_scale_pool_t *pool = image_info->scale_pool;
+    int i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->exit = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    for (i = 1; i < pool->num_slices; i++) {
+        wprint_arena_free(image_info->arena, pool->mixed_memory[i]);
+    }
+    free(pool);
+    image_info->scale_pool = NULL;
+}
+
+/*
+ * Scales the rows in unscaled_rows into rgb_pixels, sharing the columns with the scale pool
+ */
+static void _scale_stripe(wprint_image_info_t *image_info, unsigned char *rgb_pixels) {
+    wprint_scale_pool_t *pool = image_info->scale_pool;
+
+    if (pool == NULL) {
+        scaler_scale_image_data(image_info->unscaled_rows, (void *) &image_info->scaler_config,
+                rgb_pixels, image_info->mixed_memory);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->scaler_config = &image_info->scaler_config;
+    pool->input = image_info->unscaled_rows;
+    pool->output = rgb_pixels;
+    pool->next_slice = 0;
+    pool->slices_done = 0;
+    pthread_cond_broadcast(&pool->work);
+
+    // this thread takes slices too, so the stripe finishes even if no worker wakes up in time
+    _scale_slices(pool);
+    while (pool->slices_done < pool->num_slices) {
+        pthread_cond_wait(&pool->done, &pool->lock);
     }
+    pthread_mutex_unlock(&pool->lock);
 }
 
 status_t wprint_image_get_info(FILE *imgfile, wprint_image_info_t *image_info) {
@@ -129,14 +325,10 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
     image_info->concurrent_stripes = concurrent_stripes;
 
     // free data just in case
-    if (image_info->unscaled_rows != NULL) {
-        free(image_info->unscaled_rows);
-    }
-
-    // free data just in case
-    if (image_info->mixed_memory != NULL) {
-        free(image_info->mixed_memory);
-    }
+    _stop_scale_pool(image_info);
+    scaler_free_tables(&image_info->scaler_config);
+    wprint_arena_free(image_info->arena, image_info->unscaled_rows);
+    wprint_arena_free(image_info->arena, image_info->mixed_memory);
 
     image_info->row_offset = 0;
     image_info->col_offset = 0;
@@ -344,9 +536,14 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
          * setup the fine-scaler
          * we use rotated image_output_width rather than the pre-rotated sampled_width
          */
-        scaler_make_image_scaler_tables(image_output_width, BYTES_PER_PIXEL(image_output_width),
-                image_info->scaled_width, BYTES_PER_PIXEL(image_info->scaled_width),
-                image_output_height, image_info->scaled_height, &image_info->scaler_config);
+        if (scaler_make_image_resampler_tables(image_output_width,
+                BYTES_PER_PIXEL(image_output_width), image_info->scaled_width,
+                BYTES_PER_PIXEL(image_info->scaled_width), image_output_height,
+                image_info->scaled_height, image_info->scale_filter,
+                &image_info->scaler_config) != OK) {
+            LOGE("no memory for filter %d tables, using default scaler",
+                    image_info->scale_filter);
+        }
 
         image_info->unscaled_rows_needed = 0;
         image_info->mixed_memory_needed = 0;
@@ -376,13 +573,18 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
                 (MAX(image_output_width, image_output_height) * image_info->unscaled_rows_needed));
 
         // allocate memory required for scaling
-        image_info->unscaled_rows = malloc(unscaled_size);
+        image_info->unscaled_rows = wprint_arena_alloc(image_info->arena, unscaled_size);
 
         if (image_info->unscaled_rows != NULL) {
             memset(image_info->unscaled_rows, 0xff, unscaled_size);
         }
-        image_info->mixed_memory = (image_info->mixed_memory_needed != 0) ? malloc(
-                image_info->mixed_memory_needed) : NULL;
+        image_info->mixed_memory = (image_info->mixed_memory_needed != 0) ? wprint_arena_alloc(
+                image_info->arena, image_info->mixed_memory_needed) : NULL;
+
+        if ((image_info->unscaled_rows != NULL) &&
+                ((image_info->mixed_memory_needed == 0) || (image_info->mixed_memory != NULL))) {
+            _start_scale_pool(image_info);
+        }
     } else {
         image_info->scaled_height = image_output_height;
         image_info->scaled_width = image_output_width;
@@ -608,9 +810,93 @@ bool wprint_image_is_landscape(wprint_image_info_t *image_info) {
     return (image_info->width > image_info->height);
 }
 
+/*
+ * Fills output_cache with the rows of a ROT_90 or ROT_270 page starting at output_swath_start.
+ * Source rows are taken ROTATE_TILE at a time and transposed into runs of every cache row while
+ * they stay in cache. Source rows come straight from the decoder when it can peek them,
+ * otherwise only the columns this swath needs are decoded, if the decoder can, and copied.
+ */
+static status_t _fill_rotated_cache(wprint_image_info_t *image_info) {
+    const image_decode_ifc_t *decode_ifc = image_info->decode_ifc;
+    const unsigned char *src_rows[ROTATE_TILE];
+    unsigned char **dst_rows;
+    unsigned char *tile_buf = NULL;
+    int width = image_info->sampled_width;
+    int height = image_info->sampled_height;
+    int swath_start = image_info->output_swath_start;
+    int swath_rows = MIN(image_info->rows_cached, width - swath_start);
+    bool rot_90 = (image_info->rotation == ROT_90);
+    int first_col, tile_y, tile_h, x, i;
+    status_t result = OK;
+
+    if (swath_rows <= 0) {
+        return OK;
+    }
+
+    // The swath is source columns first_col onwards; ROT_90 puts the first in cache row 0 and
+    // ROT_270 in the last
+    first_col = rot_90 ? swath_start : width - swath_start - swath_rows;
+
+    dst_rows = (unsigned char **) wprint_arena_alloc(image_info->arena,
+            swath_rows * sizeof(*dst_rows));
+    if (dst_rows == NULL) {
+        return ERROR;
+    }
+
+    for (tile_y = 0; (tile_y < height) && (result == OK); tile_y += ROTATE_TILE) {
+        tile_h = MIN(ROTATE_TILE, height - tile_y);
+        for (i = 0; i < tile_h; i++) {
+            unsigned char *row = NULL;
+            if ((tile_buf == NULL) && (decode_ifc->peek_row != NULL)) {
+                row = decode_ifc->peek_row(image_info, tile_y + i);
+                if (row != NULL) {
+                    row += BYTES_PER_PIXEL(first_col);
+                }
+            }
+            if (row == NULL) {
+                // The decoder cannot peek this page, so decode the rest of it
+                if ((tile_buf == NULL) && ((tile_buf = (unsigned char *) wprint_arena_alloc(
+                        image_info->arena, BYTES_PER_PIXEL(ROTATE_TILE * swath_rows))) == NULL)) {
+                    result = ERROR;
+                    break;
+                }
+                if (decode_ifc->decode_cols != NULL) {
+                    row = decode_ifc->decode_cols(image_info, tile_y + i, first_col, swath_rows);
+                } else if ((row = decode_ifc->decode_row(image_info, tile_y + i)) != NULL) {
+                    row += BYTES_PER_PIXEL(first_col);
+                }
+                if (row != NULL) {
+                    memcpy(tile_buf + BYTES_PER_PIXEL(i * swath_rows), row,
+                            BYTES_PER_PIXEL(swath_rows));
+                    row = tile_buf + BYTES_PER_PIXEL(i * swath_rows);
+                }
+            }
+            if (row == NULL) {
+                result = ERROR;
+                break;
+            }
+            src_rows[i] = row;
+        }
+        if (result != OK) {
+            break;
+        }
+
+        // ROT_90 fills cache rows from the end, ROT_270 from the start
+        for (x = 0; x < swath_rows; x++) {
+            dst_rows[x] = image_info->output_cache[rot_90 ? x : swath_rows - 1 - x] +
+                    BYTES_PER_PIXEL(rot_90 ? height - tile_y - tile_h : tile_y);
+        }
+        wprint_transpose_rgb(src_rows, tile_h, dst_rows, swath_rows, rot_90);
+    }
+
+    wprint_arena_free(image_info->arena, tile_buf);
+    wprint_arena_free(image_info->arena, dst_rows);
+    return result;
+}
+
 int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
         unsigned int padding_options, unsigned char *rgb_pixels) {
-    int image_y, image_x;
+    int image_y;
     unsigned char *image_data;
     int nbytes = -1;
     int rbytes;
@@ -652,23 +938,14 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                             return ERROR;
                         }
                     }
+                    if (image_info->rows_cached <= 0) {
+                        LOGE("_decode_stripe(): no rows to rotate into");
+                        return ERROR;
+                    }
                     image_info->output_swath_start = ((start_row / image_info->rows_cached) *
                             image_info->rows_cached);
-                    for (image_y = 0; image_y < image_info->sampled_height; image_y++) {
-                        image_data = decode_ifc->decode_row(image_info, image_y);
-                        if (image_data == NULL) {
-                            return ERROR;
-                        }
-                        for (image_x = 0; (image_x < image_info->rows_cached &&
-                                ((image_x + image_info->output_swath_start) <
-                                        image_info->sampled_width));
-                                image_x++) {
-                            memcpy(image_info->output_cache[image_x] + BYTES_PER_PIXEL(
-                                            (image_info->sampled_height - image_y - 1)),
-                                    image_data + BYTES_PER_PIXEL(
-                                            (image_info->output_swath_start + image_x)),
-                                    BYTES_PER_PIXEL(1));
-                        }
+                    if (_fill_rotated_cache(image_info) != OK) {
+                        return ERROR;
                     }
                 }
 
@@ -694,12 +971,9 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                 if (image_data == NULL) {
                     return ERROR;
                 }
-                for (image_x = 0; image_x < image_info->output_width; image_x++) {
-                    memcpy(rgb_pixels + padding_left + BYTES_PER_PIXEL(image_x),
-                            image_data + BYTES_PER_PIXEL(image_info->sampled_width -
-                                    image_x - col_offset - 1),
-                            BYTES_PER_PIXEL(1));
-                }
+                wprint_reverse_pixels(image_data + BYTES_PER_PIXEL(image_info->sampled_width -
+                                image_info->output_width - col_offset),
+                        rgb_pixels + padding_left, image_info->output_width, BYTES_PER_PIXEL(1));
                 nbytes += rbytes + padding_left + padding_right;
                 rgb_pixels += rbytes + padding_left + padding_right;
             }
@@ -723,23 +997,14 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                             return ERROR;
                         }
                     }
+                    if (image_info->rows_cached <= 0) {
+                        LOGE("_decode_stripe(): no rows to rotate into");
+                        return ERROR;
+                    }
                     image_info->output_swath_start = ((start_row / image_info->rows_cached) *
                             image_info->rows_cached);
-                    for (image_y = 0; image_y < image_info->sampled_height; image_y++) {
-                        image_data = decode_ifc->decode_row(image_info, image_y);
-                        if (image_data == NULL) {
-                            return ERROR;
-                        }
-                        for (image_x = 0; ((image_x < image_info->rows_cached) &&
-                                ((image_x + image_info->output_swath_start) <
-                                        image_info->sampled_width));
-                                image_x++) {
-                            memcpy(image_info->output_cache[image_x] + BYTES_PER_PIXEL(image_y),
-                                    image_data + BYTES_PER_PIXEL(image_info->sampled_width -
-                                            (image_info->output_swath_start +
-                                                    image_x) - 1),
-                                    BYTES_PER_PIXEL(1));
-                        }
+                    if (_fill_rotated_cache(image_info) != OK) {
+                        return ERROR;
                     }
                 }
                 for (image_y = start_row;
@@ -776,6 +1041,20 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
     return nbytes;
 }
 
+bool wprint_image_is_blank_stripe(wprint_image_info_t *image_info, int start_row, int num_rows) {
+    int padding_top = ((image_info->padding_options & PAD_TOP) ?
+            image_info->output_padding_top : 0);
+
+    if ((start_row < 0) || (num_rows <= 0) ||
+            ((start_row + num_rows) > _get_height(image_info, image_info->padding_options))) {
+        return false;
+    } else if ((start_row + num_rows) <= padding_top) {
+        return true;
+    }
+    return ((image_info->padding_options & PAD_BOTTOM) &&
+            (start_row >= _get_height(image_info, image_info->padding_options & PAD_TOP)));
+}
+
 int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, int *height,
         unsigned char *rgb_pixels) {
     int nbytes = 0;
@@ -897,8 +1176,7 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
             }
 
             // scale the data to it's final size
-            scaler_scale_image_data(image_info->unscaled_rows, (void *) &image_info->scaler_config,
-                    rgb_pixels, image_info->mixed_memory);
+            _scale_stripe(image_info, rgb_pixels);
             // do we have to move the data around??
             if ((row_offset != 0) ||
                     (image_info->scaled_width > image_info->printable_width) ||
@@ -994,9 +1272,10 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
 
 int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info) {
     int i;
+    unsigned char *cache;
     int row_width, max_rows;
     unsigned char output_mem;
-    int available_mem = MAX_DECODE_MEM;
+    int available_mem = image_info->memory_budget;
     int width, height;
 
     width = image_info->sampled_width;
@@ -1022,11 +1301,12 @@ int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info) {
         // remove any memory allocated for scaling from our pool
         available_mem -= BYTES_PER_PIXEL(
                 image_info->unscaled_rows_needed * image_info->output_width);
-        available_mem -= image_info->mixed_memory_needed;
+        available_mem -= image_info->mixed_memory_needed *
+                ((image_info->scale_pool != NULL) ? image_info->scale_pool->num_slices : 1);
     }
 
     // make sure we have a valid amount of memory to work with
-    available_mem = MAX(available_mem, MIN_DECODE_MEM);
+    available_mem = MAX(available_mem, image_info->memory_budget / MIN_CACHE_MEM_SHARE);
 
     LOGD("wprint_image_compute_rows_to_cache(): %d bytes available for row caching", available_mem);
 
@@ -1045,9 +1325,22 @@ int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info) {
             max_rows = MAX(width, height);
         }
 
-        image_info->output_cache = (unsigned char **) malloc(sizeof(unsigned char *) * max_rows);
-        for (i = 0; i < max_rows; i++) {
-            image_info->output_cache[i] = (unsigned char *) malloc(row_width);
+        // The rows share one block, freed through the first row
+        image_info->output_cache = (unsigned char **) wprint_arena_alloc(image_info->arena,
+                sizeof(unsigned char *) * max_rows);
+        cache = (unsigned char *) wprint_arena_alloc(image_info->arena,
+                (size_t) row_width * max_rows);
+        if ((image_info->output_cache == NULL) || (cache == NULL)) {
+            LOGE("wprint_image_compute_rows_to_cache(): cannot allocate %d rows", max_rows);
+            wprint_arena_free(image_info->arena, image_info->output_cache);
+            wprint_arena_free(image_info->arena, cache);
+            image_info->output_cache = NULL;
+            image_info->rows_cached = 0;
+            return ERROR;
+        } else {
+            for (i = 0; i < max_rows; i++) {
+                image_info->output_cache[i] = cache + (size_t) row_width * i;
+            }
         }
     } else {
         max_rows = MIN(max_rows, height);
@@ -1064,30 +1357,28 @@ int wprint_image_input_rows_cached(wprint_image_info_t *image_info) {
 }
 
 void wprint_image_cleanup(wprint_image_info_t *image_info) {
-    int i;
     const image_decode_ifc_t *decode_ifc = image_info->decode_ifc;
 
     if ((decode_ifc != NULL) && (decode_ifc->cleanup != NULL)) {
         decode_ifc->cleanup(image_info);
     }
 
+    _stop_scale_pool(image_info);
+    scaler_free_tables(&image_info->scaler_config);
+
     // free memory allocated for saving unscaled rows
-    if (image_info->unscaled_rows != NULL) {
-        free(image_info->unscaled_rows);
-        image_info->unscaled_rows = NULL;
-    }
+    wprint_arena_free(image_info->arena, image_info->unscaled_rows);
+    image_info->unscaled_rows = NULL;
 
     // free memory allocated needed for mixed scaling
-    if (image_info->mixed_memory != NULL) {
-        free(image_info->mixed_memory);
-        image_info->mixed_memory = NULL;
-    }
+    wprint_arena_free(image_info->arena, image_info->mixed_memory);
+    image_info->mixed_memory = NULL;
 
     if (image_info->output_cache != NULL) {
-        for (i = 0; i < image_info->rows_cached; i++) {
-            free(image_info->output_cache[i]);
+        if (image_info->rows_cached > 0) {
+            wprint_arena_free(image_info->arena, image_info->output_cache[0]);
         }
-        free(image_info->output_cache);
+        wprint_arena_free(image_info->arena, image_info->output_cache);
         image_info->output_cache = NULL;
     }
 }
\ No newline at end of file
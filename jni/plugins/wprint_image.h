@@ -20,10 +20,12 @@
 #define __WPRINT_IMAGE__
 
 #include <stdio.h>
+#include <pthread.h>
 #include "mime_types.h"
 #include "wprint_scaler.h"
 #include "wprint_debug.h"
 #include "ifc_wprint.h"
+#include "wprint_arena.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -33,6 +35,16 @@ extern "C"
 #define BYTES_PER_PIXEL(X)  ((X)*3)
 #define BITS_PER_CHANNEL    8
 
+/* Most threads, besides the decoding thread, that scale slices of one stripe */
+#define MAX_SCALE_THREADS   3
+
+/* Bounds on the stripes of a page that may be in flight at once */
+#define MIN_STRIPE_BUFFERS  4
+#define MAX_STRIPE_BUFFERS  16
+
+/* Tallest stripe chosen to fit a memory budget */
+#define MAX_STRIPE_HEIGHT   256
+
 /*
  * Rotations to apply while decoding
  */
@@ -63,6 +75,29 @@ typedef enum {
 
 #undef __DEFINE_WPRINT_PLATFORM_TYPES__
 
+/*
+ * Workers that scale column slices of each stripe alongside the decoding thread
+ */
+typedef struct {
+    pthread_t threads[MAX_SCALE_THREADS];
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    bool exit;
+
+    // the stripe being scaled
+    const scaler_config_t *scaler_config;
+    unsigned char *input;
+    unsigned char *output;
+    int num_slices;
+    int next_slice;
+    int slices_done;
+
+    // temp buffer for mixed axis scaling of each slice
+    unsigned char *mixed_memory[MAX_SCALE_THREADS + 1];
+} wprint_scale_pool_t;
+
 /*
  * Define an image which can be decoded into a stream
  */
@@ -94,6 +129,8 @@ typedef struct {
     int pdf_render_resolution;
 
     // memory optimization parameters
+    int memory_budget;
+    wprint_arena_t *arena;
     unsigned int stripe_height;
     unsigned int concurrent_stripes;
     unsigned int output_rows;
@@ -109,7 +146,9 @@ typedef struct {
     unsigned int mixed_memory_needed;
     unsigned char *mixed_memory;
     unsigned char scaling_needed;
+    scaler_filter_t scale_filter;
     scaler_config_t scaler_config;
+    wprint_scale_pool_t *scale_pool;
 
     // padding parameters
     unsigned int output_padding_top;
@@ -162,6 +201,21 @@ typedef struct _image_decode_ifc_st {
      * Return resolution in DPI
      */
     int (*native_units)(wprint_image_info_t *image_info);
+
+    /*
+     * Optional. Return image data at the specified row without copying it, or NULL if the
+     * decoder does not hold this page whole, in which case its rows are decoded instead. The data
+     * must stay valid until cleanup.
+     */
+    unsigned char *(*peek_row)(wprint_image_info_t *image_info, int row);
+
+    /*
+     * Optional. Return num_cols columns of image data at the specified row, starting at
+     * first_col, for a decoder that makes part of a row for less than all of it. The data must
+     * stay valid until the next call.
+     */
+    unsigned char *(*decode_cols)(wprint_image_info_t *image_info, int row, int first_col,
+            int num_cols);
 } image_decode_ifc_t;
 
 /*
@@ -170,10 +224,22 @@ typedef struct _image_decode_ifc_st {
 const image_decode_ifc_t *wprint_image_get_decode_ifc(wprint_image_info_t *image_info);
 
 /*
- * Initializes image_info with supplied parameters
+ * Initializes image_info with supplied parameters. memory_budget bounds the stripes, row cache
+ * and scaling buffers of the image, or is 0 for DEFAULT_MEMORY_BUDGET. Those buffers come from
+ * arena, so that the next page can reuse them, or from the heap if arena is NULL.
  */
 void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
-        const ifc_wprint_t *wprint_ifc, unsigned int output_resolution, int pdf_render_resolution);
+        const ifc_wprint_t *wprint_ifc, unsigned int output_resolution, int pdf_render_resolution,
+        scaler_filter_t scale_filter, int memory_budget, wprint_arena_t *arena);
+
+/*
+ * Chooses how pages with rows of bytes_per_row are cut into stripes to fit memory_budget (0 for
+ * DEFAULT_MEMORY_BUDGET). Unless fixed_height, strip_height is set to the tallest height that
+ * still leaves room for several stripes in flight. num_buffers is set to the number of stripes
+ * that fit, from MIN_STRIPE_BUFFERS to MAX_STRIPE_BUFFERS.
+ */
+void wprint_image_plan_stripes(int memory_budget, int bytes_per_row, bool fixed_height,
+        unsigned int *strip_height, int *num_buffers);
 
 /*
  * Open an initialized image from a file
@@ -209,6 +275,12 @@ int wprint_image_get_width(wprint_image_info_t *image_info);
  */
 int wprint_image_get_height(wprint_image_info_t *image_info);
 
+/*
+ * Return true if all num_rows rows from start_row are top or bottom padding, which is always
+ * white. Such a stripe does not need to be decoded.
+ */
+bool wprint_image_is_blank_stripe(wprint_image_info_t *image_info, int start_row, int num_rows);
+
 /*
  * Decode a single stripe of data into rgb_pixels, storing height rendered and returning
  * bytes processed or 0/negative on error.
@@ -218,6 +290,7 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
 
 /*
  * Compute and allocate memory in preparation for decoding row data, returning the number of rows
+ * or ERROR if the rows for a rotated page cannot be allocated
  */
 int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info);
 
@@ -30,11 +30,13 @@ const image_decode_ifc_t *wprint_image_get_decode_ifc(wprint_image_info_t *image
     return NULL;
 }
 
-int wprint_image_init(wprint_image_info_t *image_info, const char *image_url, const int page_num) {
+int wprint_image_init(wprint_image_info_t *image_info, const char *image_url, const int page_num,
+        const void *owner) {
     if (image_info == NULL) return ERROR;
 
     image_info->decoder_data.urlPath = image_url;
     image_info->decoder_data.page = page_num;
+    image_info->decoder_data.owner = owner;
 
     const image_decode_ifc_t *decode_ifc = wprint_image_get_decode_ifc(image_info);
     if ((decode_ifc != NULL) && (decode_ifc->init != NULL)) {
@@ -43,4 +45,20 @@ int wprint_image_init(wprint_image_info_t *image_info, const char *image_url, co
         return OK;
     }
     return ERROR;
-}
\ No newline at end of file
+}
+status_t wprint_image_prefetch(const void *owner, const char *mime_type, const char *image_url,
+        int page_num, int pdf_render_resolution, int max_bytes) {
+    if ((mime_type != NULL) && (strcasecmp(mime_type, MIME_TYPE_PDF) == 0)) {
+        return wprint_mupdf_prefetch(owner, image_url, page_num, pdf_render_resolution,
+                max_bytes);
+    }
+    return ERROR;
+}
+
+long wprint_image_get_render_ms(const void *owner) {
+    return wprint_mupdf_get_render_ms(owner);
+}
+
+void wprint_image_end_job(const void *owner) {
+    wprint_mupdf_end_job(owner);
+}
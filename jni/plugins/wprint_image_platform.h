@@ -39,6 +39,8 @@ extern "C"
 typedef struct {
     const char *urlPath;
     unsigned int page;
+    const void *owner; // job the page belongs to, or NULL
+    long render_ms; // time spent rendering this page on the decoding thread
 
     // PDF data
     struct {
@@ -47,13 +49,44 @@ typedef struct {
         void *fz_doc_ptr;
         void *fz_page_ptr;
         void *fz_pixmap_ptr;
+        void *pdf_render_ptr;
+        void *session_ptr; // job session owning pdf_render_ptr, if any
+        float zoom;
+        int band_start; // first page row held in fz_pixmap_ptr
+        int band_rows; // number of rows fz_pixmap_ptr has room for
+        int band_col; // first page column held in fz_pixmap_ptr
+        int band_cols; // number of columns in each row of fz_pixmap_ptr
+        size_t band_bytes; // size of fz_pixmap_ptr
     } pdf_info;
 } decoder_data_t;
 
 #endif // __DEFINE_WPRINT_PLATFORM_TYPES__
 
 #ifdef __DEFINE_WPRINT_PLATFORM_METHODS__
-int wprint_image_init(wprint_image_info_t *image_info, const char *urlPath, int pageNum);
+/*
+ * Prepares image_info to decode page pageNum of urlPath. Pages with the same non-NULL owner share
+ * decoder resources until wprint_image_end_job(owner).
+ */
+int wprint_image_init(wprint_image_info_t *image_info, const char *urlPath, int pageNum,
+        const void *owner);
+
+/*
+ * Starts rendering page pageNum of urlPath in the background, holding at most max_bytes for owner,
+ * so that a later decode of the same page picks up the rendered rows
+ */
+status_t wprint_image_prefetch(const void *owner, const char *mime_type, const char *urlPath,
+        int pageNum, int pdf_render_resolution, int max_bytes);
+
+/*
+ * Returns the time in milliseconds owner's job has spent rendering pages so far, including pages
+ * rendered ahead
+ */
+long wprint_image_get_render_ms(const void *owner);
+
+/*
+ * Releases decoder resources held for owner, including pages prefetched but never decoded
+ */
+void wprint_image_end_job(const void *owner);
 #endif // __DEFINE_WPRINT_PLATFORM_METHODS__
 
 #ifdef __cplusplus
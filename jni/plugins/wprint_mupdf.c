@@ -16,7 +16,9 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
 #include <time.h>
+#include <sys/stat.h>
 #include "wprint_mupdf.h"
 #include "lib_wprint.h"
 #include "ipphelper.h"
@@ -25,10 +27,133 @@
 #define MUPDF_DEFAULT_RESOLUTION 72
 #define RGB_NUMBER_PIXELS_NUM_COMPONENTS 3
 
-static pdf_render_ifc_t *pdf_render;
+/* Upper bound on the memory used to hold rendered rows of a page rendered in bands */
+#define RENDER_BAND_BYTES (4 * 1024 * 1024)
+
+/*
+ * The renderer holds one open document for the whole process, so jobs take turns opening and
+ * rendering
+ */
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The document the renderer last opened and its file identity, guarded by render_lock */
+static char *render_doc = NULL;
+static struct stat render_doc_stat;
+
+/*
+ * A page rendered from the top ahead of its decoder, waiting to be taken over
+ */
+typedef struct prefetch_st {
+    const void *owner; // NULL once released while still rendering
+    char *path;
+    int page;
+    float zoom;
+    int width;
+    size_t max_bytes; // budget of the owner
+    int rows; // rows rendered from the top of the page
+    bool whole; // rows covers the entire page
+    char *buffer;
+    bool started; // taken up by the job's render-ahead worker
+    bool done;
+    status_t result;
+    struct prefetch_st *next;
+} prefetch_t;
+
+/* Pages being or already prefetched, guarded by prefetch_lock */
+static prefetch_t *prefetch_list = NULL;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+/* Time a job spent opening documents and rendering pages */
+typedef struct {
+    int pages;
+    int opens;
+    long open_ms;
+    long render_ms;
+} render_stats_t;
+
+/*
+ * The renderer interface shared by all pages of a job, created on and used only by the job's
+ * thread until the job ends, and the worker rendering the job's pages ahead with an interface of
+ * its own
+ */
+typedef struct render_session_st {
+    const void *owner;
+    pdf_render_ifc_t *pdf_render;
+    pthread_t worker;
+    bool has_worker;
+    bool ending; // the worker is to stop
+    render_stats_t stats;
+    struct render_session_st *next;
+} render_session_t;
+
+/* Sessions of running jobs, guarded by prefetch_lock */
+static render_session_t *session_list = NULL;
+
+/* Returns the session of owner. Must be called with prefetch_lock held. */
+static render_session_t *_find_session(const void *owner) {
+    render_session_t *session;
+    for (session = session_list; session != NULL; session = session->next) {
+        if (session->owner == owner) break;
+    }
+    return session;
+}
+
+/* Returns the session of owner, starting one if needed. Must be called with prefetch_lock held. */
+static render_session_t *_get_session(const void *owner) {
+    render_session_t *session = _find_session(owner);
+    if (session == NULL) {
+        session = (render_session_t *) calloc(1, sizeof(render_session_t));
+        if (session != NULL) {
+            session->owner = owner;
+            session->next = session_list;
+            session_list = session;
+        }
+    }
+    return session;
+}
+
+/*
+ * Adds stats to the totals of owner's job, if it is still running. Must be called with
+ * prefetch_lock held.
+ */
+static void _add_stats_locked(const void *owner, const render_stats_t *stats) {
+    render_session_t *session;
+
+    if ((owner == NULL) || ((session = _find_session(owner)) == NULL)) return;
+
+    session->stats.pages += stats->pages;
+    session->stats.opens += stats->opens;
+    session->stats.open_ms += stats->open_ms;
+    session->stats.render_ms += stats->render_ms;
+}
+
+static void _add_stats(const void *owner, const render_stats_t *stats) {
+    pthread_mutex_lock(&prefetch_lock);
+    _add_stats_locked(owner, stats);
+    pthread_mutex_unlock(&prefetch_lock);
+}
 
 static void _mupdf_init(wprint_image_info_t *image_info) {
-    pdf_render = create_pdf_render_ifc();
+    const void *owner = image_info->decoder_data.owner;
+    render_session_t *session = NULL;
+
+    if (owner != NULL) {
+        pthread_mutex_lock(&prefetch_lock);
+        session = _get_session(owner);
+        pthread_mutex_unlock(&prefetch_lock);
+    }
+
+    image_info->decoder_data.pdf_info.session_ptr = session;
+    if (session == NULL) {
+        image_info->decoder_data.pdf_info.pdf_render_ptr = create_pdf_render_ifc();
+        return;
+    }
+
+    if (session->pdf_render == NULL) {
+        session->pdf_render = create_pdf_render_ifc();
+    }
+    image_info->decoder_data.pdf_info.pdf_render_ptr = session->pdf_render;
 }
 
 /* Return current clock time in milliseconds */
@@ -38,87 +163,645 @@ static long get_millis() {
     return (long) (((int64_t) now.tv_sec * 1000000000LL + now.tv_nsec) / 1000000);
 }
 
+/*
+ * Opens path in the renderer, recording it as the open document. Returns the page count, or 0 on
+ * failure. Must be called with render_lock held.
+ */
+static int _reopen_document(pdf_render_ifc_t *pdf_render, const char *path,
+        render_stats_t *stats) {
+    struct stat st;
+    long now = get_millis();
+    int pages;
+
+    free(render_doc);
+    render_doc = NULL;
+    if (stat(path, &st) != 0) return 0;
+
+    pages = pdf_render->openDocument(pdf_render, path);
+    if (pages > 0) {
+        render_doc = strdup(path);
+        render_doc_stat = st;
+    }
+    if (stats != NULL) {
+        stats->opens++;
+        stats->open_ms += get_millis() - now;
+    }
+    return MAX(pages, 0);
+}
+
+/*
+ * Opens path in the renderer unless it is already the open document. Pages of one file rendered
+ * by different threads then share the open document. Must be called with render_lock held.
+ */
+static status_t _open_document(pdf_render_ifc_t *pdf_render, const char *path,
+        render_stats_t *stats) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) return ERROR;
+
+    if ((render_doc != NULL) && (strcmp(render_doc, path) == 0) &&
+            (st.st_dev == render_doc_stat.st_dev) && (st.st_ino == render_doc_stat.st_ino) &&
+            (st.st_size == render_doc_stat.st_size) &&
+            (st.st_mtime == render_doc_stat.st_mtime)) {
+        return OK;
+    }
+    return (_reopen_document(pdf_render, path, stats) > 0) ? OK : ERROR;
+}
+
+/* Returns true if the renderer holds a document other than path */
+static bool _other_document_open(const char *path) {
+    bool other;
+    pthread_mutex_lock(&render_lock);
+    other = (render_doc != NULL) && (strcmp(render_doc, path) != 0);
+    pthread_mutex_unlock(&render_lock);
+    return other;
+}
+
+int wprint_mupdf_page_count(const char *fileName) {
+    pdf_render_ifc_t *pdf_render = create_pdf_render_ifc();
+    int pages;
+
+    if (pdf_render == NULL) return 0;
+
+    // Leaves the renderer holding this document, which is usually the next one printed
+    pthread_mutex_lock(&render_lock);
+    pages = _reopen_document(pdf_render, fileName, NULL);
+    pthread_mutex_unlock(&render_lock);
+
+    pdf_render->destroy(pdf_render);
+    return pages;
+}
+
+static void _free_prefetch(prefetch_t *prefetch) {
+    free(prefetch->buffer);
+    free(prefetch->path);
+    free(prefetch);
+}
+
+/* Returns the bytes held by pages prefetched for owner. Must be called with prefetch_lock held. */
+static size_t _prefetch_bytes(const void *owner) {
+    prefetch_t *prefetch;
+    size_t bytes = 0;
+    for (prefetch = prefetch_list; prefetch != NULL; prefetch = prefetch->next) {
+        if (prefetch->owner == owner) {
+            bytes += (size_t) prefetch->rows * prefetch->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+        }
+    }
+    return bytes;
+}
+
+/* Returns true once the owner of prefetch has let it go */
+static bool _prefetch_released(prefetch_t *prefetch) {
+    bool released;
+    pthread_mutex_lock(&prefetch_lock);
+    released = (prefetch->owner == NULL);
+    pthread_mutex_unlock(&prefetch_lock);
+    return released;
+}
+
+/*
+ * Renders the top of a prefetched page, band by band so that decoders of the current page are
+ * never kept from the renderer for long
+ */
+static void _render_prefetch(pdf_render_ifc_t *pdf_render, prefetch_t *prefetch) {
+    double pageWidth, pageHeight;
+    int width = 0, height = 0, rows = 0, row_bytes = 0, band_rows = 1, band_start;
+    size_t used;
+    status_t result = ERROR;
+    render_stats_t stats = {0};
+    long now;
+
+    if (pdf_render != NULL) {
+        pthread_mutex_lock(&render_lock);
+        result = _open_document(pdf_render, prefetch->path, &stats);
+        if (result == OK) {
+            result = pdf_render->getPageAttributes(pdf_render, prefetch->page, &pageWidth,
+                    &pageHeight);
+        }
+        pthread_mutex_unlock(&render_lock);
+
+        if (result == OK) {
+            width = (int) (pageWidth * prefetch->zoom);
+            height = (int) (pageHeight * prefetch->zoom);
+            row_bytes = width * RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+            band_rows = MIN(MAX(RENDER_BAND_BYTES / MAX(row_bytes, 1), 1), MAX(height, 1));
+
+            // Claim what is left of the owner's budget, if that is worth at least one band
+            pthread_mutex_lock(&prefetch_lock);
+            if ((row_bytes > 0) && (prefetch->owner != NULL)) {
+                used = _prefetch_bytes(prefetch->owner);
+                if (used < prefetch->max_bytes) {
+                    rows = (int) MIN((prefetch->max_bytes - used) / row_bytes, (size_t) height);
+                }
+            }
+            if (rows < band_rows) {
+                rows = 0;
+            }
+            prefetch->width = width;
+            prefetch->rows = rows;
+            pthread_mutex_unlock(&prefetch_lock);
+
+            if (rows > 0) {
+                prefetch->buffer = malloc((size_t) rows * row_bytes);
+            }
+            if (prefetch->buffer == NULL) {
+                result = ERROR;
+            }
+        }
+
+        for (band_start = 0; (result == OK) && (band_start < rows); band_start += band_rows) {
+            if (_prefetch_released(prefetch)) {
+                // Nobody is going to take this page
+                result = ERROR;
+                break;
+            }
+            pthread_mutex_lock(&render_lock);
+            result = _open_document(pdf_render, prefetch->path, &stats);
+            if (result == OK) {
+                now = get_millis();
+                result = pdf_render->renderPageStripe(pdf_render, prefetch->page, 0,
+                        band_start, width, MIN(band_rows, rows - band_start), prefetch->zoom,
+                        prefetch->buffer + (size_t) band_start * row_bytes);
+                stats.render_ms += get_millis() - now;
+            }
+            pthread_mutex_unlock(&render_lock);
+        }
+    }
+
+    if (result == OK) {
+        LOGD("Prefetched %d of %d rows of page %d in %ld ms", rows, height, prefetch->page,
+                stats.render_ms);
+    }
+
+    pthread_mutex_lock(&prefetch_lock);
+    _add_stats_locked(prefetch->owner, &stats);
+    prefetch->result = result;
+    prefetch->whole = (result == OK) && (rows == height);
+    prefetch->done = true;
+    if (prefetch->owner == NULL) {
+        _free_prefetch(prefetch);
+    } else {
+        pthread_cond_broadcast(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/*
+ * Returns the page of owner waiting longest to be rendered ahead, or NULL if there is none. Must
+ * be called with prefetch_lock held.
+ */
+static prefetch_t *_next_prefetch(const void *owner) {
+    prefetch_t *prefetch, *next = NULL;
+    // Pages are added at the head of the list
+    for (prefetch = prefetch_list; prefetch != NULL; prefetch = prefetch->next) {
+        if ((prefetch->owner == owner) && !prefetch->started) {
+            next = prefetch;
+        }
+    }
+    return next;
+}
+
+/*
+ * Renders the pages of a job ahead one at a time, in the order they were asked for, until the job
+ * ends. The renderer interface is created once for all of them.
+ */
+static void *_prefetch_worker(void *param) {
+    render_session_t *session = (render_session_t *) param;
+    pdf_render_ifc_t *pdf_render = create_pdf_render_ifc();
+    prefetch_t *prefetch;
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (!session->ending) {
+        prefetch = _next_prefetch(session->owner);
+        if (prefetch == NULL) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+            continue;
+        }
+        prefetch->started = true;
+        pthread_mutex_unlock(&prefetch_lock);
+        _render_prefetch(pdf_render, prefetch);
+        pthread_mutex_lock(&prefetch_lock);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    if (pdf_render != NULL) {
+        pdf_render->destroy(pdf_render);
+    }
+    return NULL;
+}
+
+status_t wprint_mupdf_prefetch(const void *owner, const char *fileName, int page,
+        int resolution, int max_bytes) {
+    prefetch_t *prefetch;
+    render_session_t *session;
+    status_t result = ERROR;
+
+    if ((owner == NULL) || (fileName == NULL) || (max_bytes <= 0)) return ERROR;
+
+    pthread_mutex_lock(&prefetch_lock);
+    for (prefetch = prefetch_list; prefetch != NULL; prefetch = prefetch->next) {
+        if ((prefetch->owner == owner) && (prefetch->page == page) &&
+                (strcmp(prefetch->path, fileName) == 0)) {
+            // Already on its way
+            pthread_mutex_unlock(&prefetch_lock);
+            return OK;
+        }
+    }
+
+    // Time spent prefetching counts towards the job, whose worker renders the page
+    session = _get_session(owner);
+    if ((session != NULL) && !session->has_worker) {
+        session->has_worker = (pthread_create(&session->worker, NULL, _prefetch_worker,
+                session) == 0);
+    }
+    if ((session == NULL) || !session->has_worker) {
+        pthread_mutex_unlock(&prefetch_lock);
+        return ERROR;
+    }
+
+    prefetch = (prefetch_t *) calloc(1, sizeof(prefetch_t));
+    if (prefetch != NULL) {
+        prefetch->owner = owner;
+        prefetch->path = strdup(fileName);
+        prefetch->page = page;
+        prefetch->zoom = resolution / (float) MUPDF_DEFAULT_RESOLUTION;
+        prefetch->max_bytes = (size_t) max_bytes;
+        prefetch->result = ERROR;
+    }
+    if ((prefetch != NULL) && (prefetch->path != NULL)) {
+        prefetch->next = prefetch_list;
+        prefetch_list = prefetch;
+        pthread_cond_broadcast(&prefetch_cond);
+        result = OK;
+    }
+    if ((result != OK) && (prefetch != NULL)) {
+        _free_prefetch(prefetch);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    if (result == OK) {
+        LOGD("Prefetching page %d of %s", page, fileName);
+    }
+    return result;
+}
+
+long wprint_mupdf_get_render_ms(const void *owner) {
+    render_session_t *session;
+    long render_ms = 0;
+
+    pthread_mutex_lock(&prefetch_lock);
+    session = _find_session(owner);
+    if (session != NULL) {
+        render_ms = session->stats.render_ms;
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+    return render_ms;
+}
+
+void wprint_mupdf_end_job(const void *owner) {
+    prefetch_t **link = &prefetch_list, *prefetch;
+    render_session_t **session_link, *session = NULL;
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (*link != NULL) {
+        prefetch = *link;
+        if (prefetch->owner != owner) {
+            link = &prefetch->next;
+            continue;
+        }
+        *link = prefetch->next;
+        if (prefetch->done || !prefetch->started) {
+            _free_prefetch(prefetch);
+        } else {
+            // The worker frees it when it finishes
+            prefetch->owner = NULL;
+        }
+    }
+
+    for (session_link = &session_list; *session_link != NULL;
+            session_link = &(*session_link)->next) {
+        if ((*session_link)->owner == owner) {
+            session = *session_link;
+            *session_link = session->next;
+            session->ending = true;
+            pthread_cond_broadcast(&prefetch_cond);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    // The worker stops between bands of a page nobody is waiting for
+    if ((session != NULL) && session->has_worker) {
+        pthread_join(session->worker, NULL);
+    }
+
+    // The app closes the document once the job is done, so the next page must reopen it
+    pthread_mutex_lock(&render_lock);
+    free(render_doc);
+    render_doc = NULL;
+    pthread_mutex_unlock(&render_lock);
+
+    if (session != NULL) {
+        LOGI("Rendered %d pages: %d document opens took %ld ms, rendering took %ld ms",
+                session->stats.pages, session->stats.opens, session->stats.open_ms,
+                session->stats.render_ms);
+        if (session->pdf_render != NULL) {
+            session->pdf_render->destroy(session->pdf_render);
+        }
+        free(session);
+    }
+}
+
+/*
+ * Removes and returns the prefetched copy of the page image_info decodes, waiting for it to finish
+ * rendering, or NULL if there is none. A page the worker has not started on yet is dropped rather
+ * than waited for.
+ */
+static prefetch_t *_take_prefetch(wprint_image_info_t *image_info) {
+    prefetch_t **link, *prefetch = NULL;
+
+    pthread_mutex_lock(&prefetch_lock);
+    for (link = &prefetch_list; *link != NULL; link = &(*link)->next) {
+        if (((*link)->owner == image_info->decoder_data.owner) &&
+                ((*link)->page == image_info->decoder_data.page) &&
+                ((*link)->zoom == image_info->decoder_data.pdf_info.zoom) &&
+                (strcmp((*link)->path, image_info->decoder_data.urlPath) == 0)) {
+            prefetch = *link;
+            break;
+        }
+    }
+    if ((prefetch != NULL) && !prefetch->started) {
+        *link = prefetch->next;
+        _free_prefetch(prefetch);
+        prefetch = NULL;
+    }
+    if (prefetch != NULL) {
+        while (!prefetch->done) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        }
+        // Other pages of the job may have come and gone while waiting
+        for (link = &prefetch_list; *link != prefetch; link = &(*link)->next);
+        *link = prefetch->next;
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+
+    if ((prefetch != NULL) && ((prefetch->result != OK) ||
+            (prefetch->width != image_info->width))) {
+        _free_prefetch(prefetch);
+        prefetch = NULL;
+    }
+    return prefetch;
+}
+
 static status_t _mupdf_get_hdr(wprint_image_info_t *image_info) {
     double pageWidth, pageHeight;
     float zoom;
-    unsigned int imageWidth;
-    unsigned int imageHeight;
-    int size;
-    char *rawBuffer;
     status_t result;
-    int pages;
+    render_stats_t stats = {0};
+    pdf_render_ifc_t *pdf_render =
+            (pdf_render_ifc_t *) image_info->decoder_data.pdf_info.pdf_render_ptr;
+    if (pdf_render == NULL) return ERROR;
 
-    pages = pdf_render->openDocument(pdf_render, image_info->decoder_data.urlPath);
-    if (pages < 1) return ERROR;
+    pthread_mutex_lock(&render_lock);
+    result = _open_document(pdf_render, image_info->decoder_data.urlPath, &stats);
+    if (result == OK) {
+        result = pdf_render->getPageAttributes(pdf_render, image_info->decoder_data.page,
+                &pageWidth, &pageHeight);
+    }
+    pthread_mutex_unlock(&render_lock);
 
-    result = pdf_render->getPageAttributes(pdf_render, image_info->decoder_data.page, &pageWidth,
-            &pageHeight);
-    if (result != OK) return result;
+    stats.pages = (result == OK) ? 1 : 0;
+    _add_stats(image_info->decoder_data.owner, &stats);
+    if (result != OK) {
+        return result;
+    }
 
     const float POINTS_PER_INCH = MUPDF_DEFAULT_RESOLUTION;
     zoom = (image_info->pdf_render_resolution) / POINTS_PER_INCH;
 
-    imageWidth = (unsigned int) (pageWidth * zoom);
-    imageHeight = (unsigned int) (pageHeight * zoom);
+    image_info->width = (unsigned int) (pageWidth * zoom);
+    image_info->height = (unsigned int) (pageHeight * zoom);
 
-    image_info->width = imageWidth;
-    image_info->height = imageHeight;
+    LOGI("Page=%d w=%.0f h=%.0f res=%d zoom=%0.2f", image_info->decoder_data.page,
+            pageWidth, pageHeight, image_info->pdf_render_resolution, zoom);
 
-    size = imageWidth * imageHeight * 3;
+    // Rendering waits until rows are asked for, when the page rotation is known
+    image_info->decoder_data.pdf_info.zoom = zoom;
+    image_info->decoder_data.pdf_info.band_start = -1;
+    image_info->decoder_data.pdf_info.band_rows = 0;
+    image_info->decoder_data.pdf_info.bitmap_ptr = wprint_arena_alloc(image_info->arena,
+            image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS);
+    image_info->num_components = RGB_NUMBER_PIXELS_NUM_COMPONENTS;
 
-    rawBuffer = (char *) malloc((size_t) size);
-    if (!rawBuffer) return ERROR;
+    return OK;
+}
 
-    LOGI("Render page=%d w=%.0f h=%.0f res=%d zoom=%0.2f size=%d", image_info->decoder_data.page,
-            pageWidth, pageHeight, image_info->pdf_render_resolution, zoom, size);
+/*
+ * Returns true if the page is to be rendered whole. Rotated pages are read a swath of columns at a
+ * time, so they are rendered whole when the page fits the memory budget. Other pages, and rotated
+ * ones too large for the budget, are rendered in bands.
+ */
+static bool _mupdf_render_whole(wprint_image_info_t *image_info) {
+    return ((image_info->rotation == ROT_90) || (image_info->rotation == ROT_270)) &&
+            ((size_t) image_info->width * image_info->height * RGB_NUMBER_PIXELS_NUM_COMPONENTS <=
+                    (size_t) image_info->memory_budget);
+}
 
-    long now = get_millis();
+/*
+ * Renders a band of page rows from row into fz_pixmap_ptr, holding num_cols columns from
+ * first_col. Unless the page is rendered whole, bands are RENDER_BAND_BYTES so that the first
+ * strips can be sent while the rest of the page is still to come. A swath of a rotated page
+ * renders only its own columns, so each band holds more rows. While another job's document is
+ * open, each band would reopen this one, so bands grow to the memory budget instead.
+ */
+static status_t _mupdf_render_band(wprint_image_info_t *image_info, int row, int first_col,
+        int num_cols) {
+    int row_bytes = image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+    int band_start, band_height, band_rows;
+    int last_start = image_info->decoder_data.pdf_info.band_start;
+    // Pages rotated by 180 degrees are read from the bottom up
+    bool upward = (last_start >= 0) && (row < last_start);
+    status_t result = OK;
+    render_stats_t stats = {0};
+    long now;
+    pdf_render_ifc_t *pdf_render =
+            (pdf_render_ifc_t *) image_info->decoder_data.pdf_info.pdf_render_ptr;
+
+    if ((pdf_render == NULL) || (row < 0) || (row >= image_info->height) || (first_col < 0) ||
+            (num_cols <= 0) || (first_col + num_cols > image_info->width)) {
+        return ERROR;
+    }
+
+    if (image_info->decoder_data.pdf_info.fz_pixmap_ptr == NULL) {
+        bool whole = _mupdf_render_whole(image_info);
+        prefetch_t *prefetch = _take_prefetch(image_info);
 
-    result = pdf_render->renderPageStripe(pdf_render, image_info->decoder_data.page, imageWidth,
-            imageHeight, zoom, rawBuffer);
+        if ((prefetch != NULL) && (prefetch->whole || !whole)) {
+            // Adopt the rows rendered ahead as the first band
+            image_info->decoder_data.pdf_info.fz_pixmap_ptr = prefetch->buffer;
+            image_info->decoder_data.pdf_info.band_bytes = (size_t) prefetch->rows * row_bytes;
+            image_info->decoder_data.pdf_info.band_rows = prefetch->rows;
+            image_info->decoder_data.pdf_info.band_col = 0;
+            image_info->decoder_data.pdf_info.band_cols = image_info->width;
+            prefetch->buffer = NULL;
+            _free_prefetch(prefetch);
+            if (row < image_info->decoder_data.pdf_info.band_rows) {
+                image_info->decoder_data.pdf_info.band_start = 0;
+                return OK;
+            }
+        } else if (prefetch != NULL) {
+            _free_prefetch(prefetch);
+        }
+    }
+
+    if (image_info->decoder_data.pdf_info.fz_pixmap_ptr == NULL) {
+        band_rows = image_info->height;
+        if (!_mupdf_render_whole(image_info)) {
+            band_rows = MIN(MAX(RENDER_BAND_BYTES / row_bytes, 1), image_info->height);
+        }
+
+        image_info->decoder_data.pdf_info.band_bytes = (size_t) band_rows * row_bytes;
+        image_info->decoder_data.pdf_info.fz_pixmap_ptr = wprint_arena_alloc(image_info->arena,
+                image_info->decoder_data.pdf_info.band_bytes);
+        if (image_info->decoder_data.pdf_info.fz_pixmap_ptr == NULL) {
+            return ERROR;
+        }
+    }
+
+    if (!_mupdf_render_whole(image_info) &&
+            _other_document_open(image_info->decoder_data.urlPath)) {
+        size_t bytes = MIN((size_t) (upward ? row + 1 : image_info->height - row) * row_bytes,
+                (size_t) image_info->memory_budget);
+        if (bytes > image_info->decoder_data.pdf_info.band_bytes) {
+            wprint_arena_free(image_info->arena, image_info->decoder_data.pdf_info.fz_pixmap_ptr);
+            image_info->decoder_data.pdf_info.band_start = -1;
+            image_info->decoder_data.pdf_info.band_bytes = bytes;
+            image_info->decoder_data.pdf_info.fz_pixmap_ptr = wprint_arena_alloc(image_info->arena,
+                    bytes);
+            if (image_info->decoder_data.pdf_info.fz_pixmap_ptr == NULL) {
+                return ERROR;
+            }
+        }
+    }
+
+    // As many rows of these columns as fit
+    band_rows = (int) MIN(image_info->decoder_data.pdf_info.band_bytes /
+            ((size_t) num_cols * RGB_NUMBER_PIXELS_NUM_COMPONENTS), (size_t) image_info->height);
+    if (last_start < 0) {
+        band_start = (row / band_rows) * band_rows;
+    } else if (upward) {
+        band_start = MAX(row - band_rows + 1, 0);
+    } else {
+        band_start = row;
+    }
+    band_height = MIN(band_rows, image_info->height - band_start);
+
+    pthread_mutex_lock(&render_lock);
+    // Another job may have opened its own document since this one was last rendered
+    result = _open_document(pdf_render, image_info->decoder_data.urlPath, &stats);
+    if (result == OK) {
+        now = get_millis();
+        result = pdf_render->renderPageStripe(pdf_render, image_info->decoder_data.page,
+                first_col, band_start, num_cols, band_height,
+                image_info->decoder_data.pdf_info.zoom,
+                image_info->decoder_data.pdf_info.fz_pixmap_ptr);
+        stats.render_ms = get_millis() - now;
+    }
+    pthread_mutex_unlock(&render_lock);
+    _add_stats(image_info->decoder_data.owner, &stats);
+
+    image_info->decoder_data.pdf_info.band_rows = band_rows;
+    image_info->decoder_data.pdf_info.band_col = first_col;
+    image_info->decoder_data.pdf_info.band_cols = num_cols;
     if (result != OK) {
-        free(rawBuffer);
+        image_info->decoder_data.pdf_info.band_start = -1;
         return result;
     }
 
-    LOGI("Render complete in %ld ms", get_millis() - now);
+    LOGD("Rendered rows %d-%d, columns %d-%d in %ld ms", band_start,
+            band_start + band_height - 1, first_col, first_col + num_cols - 1, stats.render_ms);
+    image_info->decoder_data.pdf_info.band_start = band_start;
+    return OK;
+}
 
-    image_info->decoder_data.pdf_info.fz_pixmap_ptr = rawBuffer;
-    image_info->decoder_data.pdf_info.bitmap_ptr = malloc(
-            image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS);
-    image_info->num_components = RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+/*
+ * Returns a pointer to num_cols columns of row from first_col within the rendered band,
+ * rendering the band first if needed
+ */
+static unsigned char *_mupdf_get_cols(wprint_image_info_t *image_info, int row, int first_col,
+        int num_cols) {
+    int band_start = image_info->decoder_data.pdf_info.band_start;
+    int band_col = image_info->decoder_data.pdf_info.band_col;
 
-    return OK;
+    if ((band_start < 0) || (row < band_start) ||
+            (row >= band_start + image_info->decoder_data.pdf_info.band_rows) ||
+            (first_col < band_col) ||
+            (first_col + num_cols > band_col + image_info->decoder_data.pdf_info.band_cols)) {
+        long now = get_millis();
+        status_t result = _mupdf_render_band(image_info, row, first_col, num_cols);
+
+        // including any wait for the page to finish rendering ahead
+        image_info->decoder_data.render_ms += get_millis() - now;
+        if (result != OK) {
+            return NULL;
+        }
+        band_start = image_info->decoder_data.pdf_info.band_start;
+        band_col = image_info->decoder_data.pdf_info.band_col;
+    }
+
+    return (unsigned char *) image_info->decoder_data.pdf_info.fz_pixmap_ptr +
+            ((size_t) (row - band_start) * image_info->decoder_data.pdf_info.band_cols +
+                    (first_col - band_col)) * RGB_NUMBER_PIXELS_NUM_COMPONENTS;
 }
 
 static unsigned char *_mupdf_decode_row(wprint_image_info_t *image_info, int row) {
     unsigned char *rgbPixels = 0;
+    unsigned char *rendered;
 
-    if (image_info->swath_start == -1) {
-        wprint_image_compute_rows_to_cache(image_info);
+    if ((image_info->swath_start == -1) && (wprint_image_compute_rows_to_cache(image_info) < 0)) {
+        return NULL;
     }
 
     image_info->swath_start = row;
-    if (NULL != image_info->decoder_data.pdf_info.fz_pixmap_ptr) {
+    rendered = _mupdf_get_cols(image_info, row, 0, image_info->width);
+    if ((rendered != NULL) && (image_info->decoder_data.pdf_info.bitmap_ptr != NULL)) {
         rgbPixels = (unsigned char *) image_info->decoder_data.pdf_info.bitmap_ptr;
-        memcpy(rgbPixels, (char *) (image_info->decoder_data.pdf_info.fz_pixmap_ptr) +
-                        row * image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS,
-                image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS);
+        memcpy(rgbPixels, rendered, image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS);
     }
     return rgbPixels;
 }
 
+static unsigned char *_mupdf_peek_row(wprint_image_info_t *image_info, int row) {
+    // Rows of a banded page would not outlive the band, so its columns are decoded instead
+    if (!_mupdf_render_whole(image_info)) {
+        return NULL;
+    }
+    return _mupdf_get_cols(image_info, row, 0, image_info->width);
+}
+
+static unsigned char *_mupdf_decode_cols(wprint_image_info_t *image_info, int row, int first_col,
+        int num_cols) {
+    return _mupdf_get_cols(image_info, row, first_col, num_cols);
+}
+
 static status_t _mupdf_cleanup(wprint_image_info_t *image_info) {
     LOGD("MUPDF: _mupdf_cleanup(): Enter");
-    if (NULL != image_info->decoder_data.pdf_info.fz_pixmap_ptr) {
-        free(image_info->decoder_data.pdf_info.fz_pixmap_ptr);
-        image_info->decoder_data.pdf_info.fz_pixmap_ptr = NULL;
+    // An adopted prefetch buffer is not the arena's, and goes back to the heap
+    wprint_arena_free(image_info->arena, image_info->decoder_data.pdf_info.fz_pixmap_ptr);
+    image_info->decoder_data.pdf_info.fz_pixmap_ptr = NULL;
+    image_info->decoder_data.pdf_info.band_start = -1;
+    image_info->decoder_data.pdf_info.band_rows = 0;
+    image_info->decoder_data.pdf_info.band_bytes = 0;
+    wprint_arena_free(image_info->arena, image_info->decoder_data.pdf_info.bitmap_ptr);
+    image_info->decoder_data.pdf_info.bitmap_ptr = NULL;
+    pdf_render_ifc_t *pdf_render =
+            (pdf_render_ifc_t *) image_info->decoder_data.pdf_info.pdf_render_ptr;
+    // A job's interface stays with its session until the job ends
+    if ((pdf_render != NULL) && (image_info->decoder_data.pdf_info.session_ptr == NULL)) {
+        pdf_render->destroy(pdf_render);
     }
-    if (image_info->decoder_data.pdf_info.bitmap_ptr != NULL) {
-        free(image_info->decoder_data.pdf_info.bitmap_ptr);
-    }
-    pdf_render->destroy(pdf_render);
-    pdf_render = NULL;
+    image_info->decoder_data.pdf_info.pdf_render_ptr = NULL;
+    image_info->decoder_data.pdf_info.session_ptr = NULL;
     return OK;
 }
 
@@ -134,6 +817,8 @@ static int _mupdf_native_units(wprint_image_info_t *image_info) {
 static const image_decode_ifc_t _mupdf_decode_ifc = {&_mupdf_init, &_mupdf_get_hdr,
         &_mupdf_decode_row, &_mupdf_cleanup,
         &_mupdf_supports_subsampling,
-        &_mupdf_native_units,};
+        &_mupdf_native_units,
+        &_mupdf_peek_row,
+        &_mupdf_decode_cols,};
 
 const image_decode_ifc_t *wprint_mupdf_decode_ifc = &_mupdf_decode_ifc;
\ No newline at end of file
@@ -24,6 +24,31 @@
 
 extern const image_decode_ifc_t *wprint_mupdf_decode_ifc;
 
+/*
+ * Renders the top of page (1-based) of fileName on owner's render-ahead worker, using no more than
+ * max_bytes across all pages prefetched for owner. A decoder opening the same page at the same
+ * resolution takes over the rendered rows.
+ */
+status_t wprint_mupdf_prefetch(const void *owner, const char *fileName, int page,
+        int resolution, int max_bytes);
+
+/*
+ * Returns the time in milliseconds owner's job has spent rendering so far, on any thread
+ */
+long wprint_mupdf_get_render_ms(const void *owner);
+
+/*
+ * Ends the rendering session of owner's job: frees pages prefetched that no decoder took over,
+ * stops the render-ahead worker, and releases the renderer interface its pages shared. Must be
+ * called on the thread that decoded the job's pages.
+ */
+void wprint_mupdf_end_job(const void *owner);
+
+/*
+ * Opens fileName in the renderer and returns its page count, or 0 on failure
+ */
+int wprint_mupdf_page_count(const char *fileName);
+
 typedef struct pdf_render_ifc pdf_render_ifc_t;
 
 /*
@@ -37,10 +62,11 @@ struct pdf_render_ifc {
     int (*openDocument)(pdf_render_ifc_t *self, const char *fileName);
 
     /*
-     * Render a page (1-based) at the specified zoom level into the supplied output buffer. The
-     * buffer must be large enough to contain width * height * 3 (RGB). Returns success.
+     * Render height rows of width columns of a page (1-based), starting at column x of row y, at
+     * the specified zoom level into the supplied output buffer. The buffer must be large enough to
+     * contain width * height * 3 (RGB). Returns success.
      */
-    status_t (*renderPageStripe)(pdf_render_ifc_t *self, int page, int width,
+    status_t (*renderPageStripe)(pdf_render_ifc_t *self, int page, int x, int y, int width,
             int height, float zoom, char *buffer);
 
     /*
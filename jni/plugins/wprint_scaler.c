@@ -18,12 +18,25 @@
 
 #include "wprint_scaler.h"
 #include <assert.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define ROUND_4_DOWN(x) ((x) & ~3)
 #define ROUND_4_UP(x)   (ROUND_4_DOWN((x) + 3))
 #define PSCALER_FRACT_BITS_COUNT 24
 
+// Fixed point of polyphase weights, and the bits dropped between the vertical and horizontal pass
+#define RESAMPLE_WEIGHT_BITS 14
+#define RESAMPLE_PASS_BITS 8
+
 typedef enum {
     FRACTION_ROUND_UP,
     FRACTION_TRUNCATE
@@ -32,10 +45,25 @@ typedef enum {
 static uint32
         _scaler_fraction_part(uint32 iNum, uint32 iDen, pscaler_fraction_t mode, bool_t *overflow);
 
-static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t scaleMode);
+static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t scaleMode,
+        uint32 first_column, uint32 num_columns);
+
+static uint32 _input_columns(scaler_mode_t scaleMode, uint64 position_x, uint64 x_factor_inv,
+        int out_width);
 
 static void _calculate_factors(scaler_config_t *pscaler_config, scaler_mode_t scaleMode);
 
+static scaler_taps_t *_make_taps(scaler_filter_t filter, uint16 in_size, uint16 out_size);
+
+static void _resample_calculate_rows(uint16 start_output_row_number,
+        uint16 end_output_row_number, scaler_config_t *pscaler_config,
+        uint16 *start_input_row_number, uint16 *end_input_row_number,
+        uint16 *num_output_rows_generated, uint16 *num_rows_offset_to_start_output_row,
+        uint32 *temp_buffer_size_needed);
+
+static void _resample_columns(const uint8 *input_plane, const scaler_config_t *pscaler_config,
+        uint8 *scaled_output_plane, int16_t *temp, uint32 first_column, uint32 num_columns);
+
 void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 image_input_buf_width,
         uint16 image_output_width, uint16 image_output_buf_width, uint16 image_input_height,
         uint16 image_output_height, scaler_config_t *pscaler_config) {
@@ -74,6 +102,38 @@ void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 image_inpu
     pscaler_config->pSrcBuf = NULL;
     pscaler_config->pOutBuf = NULL;
     pscaler_config->pTmpBuf = NULL;
+    pscaler_config->filter = SCALER_FILTER_DEFAULT;
+    pscaler_config->pXTaps = NULL;
+    pscaler_config->pYTaps = NULL;
+    pscaler_config->usePixelLoops = 0;
+}
+
+status_t scaler_make_image_resampler_tables(uint16 image_input_width,
+        uint16 image_input_buf_width, uint16 image_output_width, uint16 image_output_buf_width,
+        uint16 image_input_height, uint16 image_output_height, scaler_filter_t filter,
+        scaler_config_t *pscaler_config) {
+    scaler_make_image_scaler_tables(image_input_width, image_input_buf_width, image_output_width,
+            image_output_buf_width, image_input_height, image_output_height, pscaler_config);
+    if (filter == SCALER_FILTER_DEFAULT) {
+        return OK;
+    }
+
+    pscaler_config->pXTaps = _make_taps(filter, image_input_width, image_output_width);
+    pscaler_config->pYTaps = _make_taps(filter, image_input_height, image_output_height);
+    if ((pscaler_config->pXTaps == NULL) || (pscaler_config->pYTaps == NULL)) {
+        scaler_free_tables(pscaler_config);
+        return ERROR;
+    }
+    pscaler_config->filter = filter;
+    return OK;
+}
+
+void scaler_free_tables(scaler_config_t *pscaler_config) {
+    free(pscaler_config->pXTaps);
+    free(pscaler_config->pYTaps);
+    pscaler_config->pXTaps = NULL;
+    pscaler_config->pYTaps = NULL;
+    pscaler_config->filter = SCALER_FILTER_DEFAULT;
 }
 
 void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_output_row_number,
@@ -87,6 +147,13 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
     pscaler_config = (scaler_config_t *) tables_ptr;
     assert (start_output_row_number < pscaler_config->iOutHeight);
 
+    if (pscaler_config->filter != SCALER_FILTER_DEFAULT) {
+        _resample_calculate_rows(start_output_row_number, end_output_row_number, pscaler_config,
+                start_input_row_number, end_input_row_number, num_output_rows_generated,
+                num_rows_offset_to_start_output_row, mixed_axis_temp_buffer_size_needed);
+        return;
+    }
+
     // copy the output start and end rows
     // Don't ever attempt to output a single row from the scaler.
     if (end_output_row_number == start_output_row_number) {
@@ -173,14 +240,14 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
     *end_input_row_number = pscaler_config->iSrcEndRow;
     *num_output_rows_generated = (pscaler_config->iOutEndRow - pscaler_config->iOutStartRow + 1);
 
-    // Calculate the 2nd pass buffer size if mixed scaling is done
+    // Calculate the 2nd pass buffer size if mixed scaling is done, in bytes of whole buffer rows
     if (pscaler_config->scaleMode == PSCALER_SCALE_MIXED_XUP) {
         *mixed_axis_temp_buffer_size_needed =
-                ROUND_4_UP(pscaler_config->iOutWidth + 1) *
+                ROUND_4_UP(pscaler_config->iOutBufWidth + 3) *
                         (*end_input_row_number - *start_input_row_number + 1);
     } else if (pscaler_config->scaleMode == PSCALER_SCALE_MIXED_YUP) {
         *mixed_axis_temp_buffer_size_needed =
-                ROUND_4_UP(pscaler_config->iSrcWidth) * (*num_output_rows_generated + 1);
+                ROUND_4_UP(pscaler_config->iSrcBufWidth) * (*num_output_rows_generated + 1);
     } else {
         *mixed_axis_temp_buffer_size_needed = 0;
     }
@@ -190,135 +257,84 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
 
 void scaler_scale_image_data(uint8 *input_plane, void *tables_ptr, uint8 *scaled_output_plane,
         uint8 *temp_buffer_for_mixed_axis_scaling) {
-    uint16 iOrigWidth, iOrigHeight, iOrigOutBufWidth, iOrigSrcBufWidth;
-    uint16 iOrigOutStartRow, iOrigOutEndRow, iOrigSrcStartRow, iOrigSrcEndRow;
-    float64_t fOrigSrcStartRow;
-    uint8 *pOrigBuf;
-    scaler_config_t *pscaler_config;
-
-    pscaler_config = (scaler_config_t *) tables_ptr;
-    pscaler_config->pSrcBuf = input_plane;
-    pscaler_config->pOutBuf = scaled_output_plane;
-
-    if ((PSCALER_SCALE_MIXED_XUP == pscaler_config->scaleMode) ||
-            (PSCALER_SCALE_MIXED_YUP == pscaler_config->scaleMode)) {
-        pscaler_config->pTmpBuf = temp_buffer_for_mixed_axis_scaling;
-
-        // save the output buffer
-        pOrigBuf = pscaler_config->pOutBuf;
-
-        // use the temp buff as the output buff for pass 1
-        pscaler_config->pOutBuf = pscaler_config->pTmpBuf;
-
-        if (PSCALER_SCALE_MIXED_YUP == pscaler_config->scaleMode) {
-            // save the original output widths
-            iOrigWidth = pscaler_config->iOutWidth;
-            iOrigOutBufWidth = pscaler_config->iOutBufWidth;
-
-            // set output widths to input widths (1::1)
-            pscaler_config->iOutWidth = pscaler_config->iSrcWidth;
-            pscaler_config->iOutBufWidth = pscaler_config->iSrcBufWidth;
-
-            // calculate the new scaler factors
-            _calculate_factors(pscaler_config, PSCALER_SCALE_UP);
-
-            // Run the photo scaler hardware
-            _hw_scale_image_plane(pscaler_config, PSCALER_SCALE_UP);
-
-            // reset the output widths
-            pscaler_config->iOutWidth = iOrigWidth;
-            pscaler_config->iOutBufWidth = iOrigOutBufWidth;
-        } else {
-            // save the original output height and row info
-            iOrigHeight = pscaler_config->iOutHeight;
-            iOrigOutStartRow = pscaler_config->iOutStartRow;
-            iOrigOutEndRow = pscaler_config->iOutEndRow;
-            fOrigSrcStartRow.fraction = pscaler_config->fSrcStartRow.fraction;
-
-            // set output height and rows to input height and rows(1::1)
-            pscaler_config->iOutHeight = pscaler_config->iSrcHeight;
-            pscaler_config->iOutStartRow = pscaler_config->iSrcStartRow;
-            pscaler_config->iOutEndRow = pscaler_config->iSrcEndRow;
-            pscaler_config->fSrcStartRow.fraction = 0;
-
-            // calculate the new scaler factors
-            _calculate_factors(pscaler_config, PSCALER_SCALE_UP);
-
-            // Run the photo scaler hardware
-            _hw_scale_image_plane(pscaler_config, PSCALER_SCALE_UP);
-
-            // reset the output height and rows
-            pscaler_config->iOutHeight = iOrigHeight;
-            pscaler_config->iOutStartRow = iOrigOutStartRow;
-            pscaler_config->iOutEndRow = iOrigOutEndRow;
-            pscaler_config->fSrcStartRow.fraction = fOrigSrcStartRow.fraction;
-        }
-        // restore the original output buffer
-        pscaler_config->pOutBuf = pOrigBuf;
-
-        // save the original input buffer
-        pOrigBuf = pscaler_config->pSrcBuf;
-
-        // use the previous output (temp) buffer as the new input buffer
-        pscaler_config->pSrcBuf = pscaler_config->pTmpBuf;
-
-        if (PSCALER_SCALE_MIXED_YUP == pscaler_config->scaleMode) {
-            // save the original input height and rows
-            iOrigHeight = pscaler_config->iSrcHeight;
-            iOrigSrcStartRow = pscaler_config->iSrcStartRow;
-            iOrigSrcEndRow = pscaler_config->iSrcEndRow;
-            fOrigSrcStartRow.decimal = pscaler_config->fSrcStartRow.decimal;
-            fOrigSrcStartRow.fraction = pscaler_config->fSrcStartRow.fraction;
-
-            // set the height and rows to 1::1 for the second pass
-            pscaler_config->iSrcHeight = pscaler_config->iOutHeight;
-            pscaler_config->iSrcStartRow = pscaler_config->iOutStartRow;
-            pscaler_config->iSrcEndRow = pscaler_config->iOutEndRow;
-            pscaler_config->fSrcStartRow.decimal = pscaler_config->iOutStartRow;
-            pscaler_config->fSrcStartRow.fraction = 0;
-
-            // calculate new scale factors
-            _calculate_factors(pscaler_config, PSCALER_SCALE_DOWN);
-
-            // Run the photo scaler hardware
-            _hw_scale_image_plane(pscaler_config, PSCALER_SCALE_DOWN);
-
-            // restore original input height and rows
-            pscaler_config->iSrcHeight = iOrigHeight;
-            pscaler_config->iSrcStartRow = iOrigSrcStartRow;
-            pscaler_config->iSrcEndRow = iOrigSrcEndRow;
-            pscaler_config->fSrcStartRow.decimal = fOrigSrcStartRow.decimal;
-            pscaler_config->fSrcStartRow.fraction = fOrigSrcStartRow.fraction;
-        } else {
-            // save the original input widths
-            iOrigWidth = pscaler_config->iSrcWidth;
-            iOrigSrcBufWidth = pscaler_config->iSrcBufWidth;
+    scaler_config_t *pscaler_config = (scaler_config_t *) tables_ptr;
 
-            // set the widths to 1::1 for the second pass
-            pscaler_config->iSrcWidth = pscaler_config->iOutWidth;
-            pscaler_config->iSrcBufWidth = pscaler_config->iOutBufWidth;
-
-            // calculate new scale factors
-            _calculate_factors(pscaler_config, PSCALER_SCALE_DOWN);
+    scaler_scale_image_columns(input_plane, pscaler_config, scaled_output_plane,
+            temp_buffer_for_mixed_axis_scaling, 0, pscaler_config->iOutWidth);
+}
 
-            // Run the photo scaler hardware
-            _hw_scale_image_plane(pscaler_config, PSCALER_SCALE_DOWN);
+void scaler_scale_image_columns(uint8 *input_plane, const scaler_config_t *pscaler_config,
+        uint8 *scaled_output_plane, uint8 *temp_buffer_for_mixed_axis_scaling,
+        uint16 first_output_column, uint16 num_output_columns) {
+    // Each pass works on its own copy so that slices of one stripe can be scaled concurrently
+    scaler_config_t pass1 = *pscaler_config;
+    scaler_config_t pass2;
+    uint64 position_x, x_factor_inv;
+    uint32 first_column, end_column;
+
+    if (pscaler_config->filter != SCALER_FILTER_DEFAULT) {
+        _resample_columns(input_plane, pscaler_config, scaled_output_plane,
+                (int16_t *) temp_buffer_for_mixed_axis_scaling, first_output_column,
+                num_output_columns);
+        return;
+    }
 
-            // restore original input widths
-            pscaler_config->iSrcWidth = iOrigWidth;
-            pscaler_config->iSrcBufWidth = iOrigSrcBufWidth;
-        }
+    pass1.pSrcBuf = input_plane;
+    pass1.pOutBuf = scaled_output_plane;
 
-        // restore the input buffer
-        pscaler_config->pTmpBuf = pscaler_config->pSrcBuf;
-        pscaler_config->pSrcBuf = pOrigBuf;
+    if ((PSCALER_SCALE_MIXED_XUP != pass1.scaleMode) &&
+            (PSCALER_SCALE_MIXED_YUP != pass1.scaleMode)) {
+        // Run the photo scaler hardware
+        _hw_scale_image_plane(&pass1, pass1.scaleMode, first_output_column, num_output_columns);
+        return;
+    }
 
-        // release the temp buffer
-        pscaler_config->pTmpBuf = NULL;
+    // the first pass writes to the temp buffer, which the second pass reads
+    pass1.pTmpBuf = temp_buffer_for_mixed_axis_scaling;
+    pass1.pOutBuf = pass1.pTmpBuf;
+    pass2 = *pscaler_config;
+    pass2.pSrcBuf = pass1.pTmpBuf;
+    pass2.pOutBuf = scaled_output_plane;
+
+    if (PSCALER_SCALE_MIXED_YUP == pass1.scaleMode) {
+        // set output widths to input widths (1::1)
+        pass1.iOutWidth = pass1.iSrcWidth;
+        pass1.iOutBufWidth = pass1.iSrcBufWidth;
+        _calculate_factors(&pass1, PSCALER_SCALE_UP);
+
+        // set the height and rows to 1::1 for the second pass
+        pass2.iSrcHeight = pass2.iOutHeight;
+        pass2.iSrcStartRow = pass2.iOutStartRow;
+        pass2.iSrcEndRow = pass2.iOutEndRow;
+        pass2.fSrcStartRow.decimal = pass2.iOutStartRow;
+        pass2.fSrcStartRow.fraction = 0;
+        _calculate_factors(&pass2, PSCALER_SCALE_DOWN);
+
+        // the first pass only needs the columns the second pass reads
+        x_factor_inv = ((uint64) pass2.fXfactorInv.decimal << 32) | pass2.fXfactorInv.fraction;
+        position_x = (uint64) first_output_column * x_factor_inv;
+        first_column = position_x >> 32;
+        end_column = MIN(_input_columns(PSCALER_SCALE_DOWN, position_x, x_factor_inv,
+                num_output_columns), pass1.iOutWidth);
+
+        _hw_scale_image_plane(&pass1, PSCALER_SCALE_UP, first_column, end_column - first_column);
     } else {
-        // Run the photo scaler hardware
-        _hw_scale_image_plane(pscaler_config, pscaler_config->scaleMode);
+        // set output height and rows to input height and rows(1::1)
+        pass1.iOutHeight = pass1.iSrcHeight;
+        pass1.iOutStartRow = pass1.iSrcStartRow;
+        pass1.iOutEndRow = pass1.iSrcEndRow;
+        pass1.fSrcStartRow.fraction = 0;
+        _calculate_factors(&pass1, PSCALER_SCALE_UP);
+
+        // set the widths to 1::1 for the second pass
+        pass2.iSrcWidth = pass2.iOutWidth;
+        pass2.iSrcBufWidth = pass2.iOutBufWidth;
+        _calculate_factors(&pass2, PSCALER_SCALE_DOWN);
+
+        _hw_scale_image_plane(&pass1, PSCALER_SCALE_UP, first_output_column, num_output_columns);
     }
+
+    _hw_scale_image_plane(&pass2, PSCALER_SCALE_DOWN, first_output_column, num_output_columns);
 }
 
 static void _calculate_factors(scaler_config_t *pscaler_config, scaler_mode_t scaleMode) {
@@ -485,8 +501,8 @@ static inline void _scale_row_down_9in(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_
         position_x += x_factor_inv;
 
         out[(x * 3) + 0] = ((uint64) acc_r * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
-        out[(x * 3) + 0] = ((uint64) acc_g * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
-        out[(x * 3) + 0] = ((uint64) acc_b * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
+        out[(x * 3) + 1] = ((uint64) acc_g * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
+        out[(x * 3) + 2] = ((uint64) acc_b * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
     }
 }
 
@@ -840,36 +856,45 @@ static inline void _scale_row_down_2in(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_
     }
 }
 
-static inline void _scale_row_down(uint8 *in, uint8 *_RESTRICT_ out, uint32 in_row_ofs,
-        uint64 position_x, uint64 position_y, uint64 x_factor_inv, uint64 y_factor_inv,
-        uint32 weight_reciprocal, int out_width) {
-    int x;
-    uint32 y, in_col, in_rows, top_weight, bot_weight;
-    sint32 total_weight;
-
-    total_weight = y_factor_inv >> 24;
+/*
+ * Returns the number of input rows contributing to an output row at position_y, with the weights
+ * of the first and last. Rows in between weigh 256.
+ */
+static inline uint32 _row_weights(uint64 position_y, uint64 y_factor_inv, uint32 *top_weight,
+        uint32 *bot_weight) {
+    sint32 total_weight = y_factor_inv >> 24;
 
-    top_weight = (uint32) 256 - ((position_y >> 24) & 0xff);
+    *top_weight = (uint32) 256 - ((position_y >> 24) & 0xff);
 
-    if ((sint32) top_weight > total_weight) {
-        top_weight = total_weight;
+    if ((sint32) *top_weight > total_weight) {
+        *top_weight = total_weight;
     }
-    total_weight -= top_weight;
+    total_weight -= *top_weight;
 
     if (total_weight & 0xff) {
-        bot_weight = total_weight & 0xff;
+        *bot_weight = total_weight & 0xff;
     } else if (total_weight > 255) {
-        bot_weight = 256;
+        *bot_weight = 256;
     } else {
-        bot_weight = 0;
+        *bot_weight = 0;
     }
 
-    total_weight -= bot_weight;
+    total_weight -= *bot_weight;
 
     assert(total_weight >= 0);
     assert((total_weight & 0xff) == 0);
 
-    in_rows = 2 + (total_weight >> 8);
+    return 2 + (total_weight >> 8);
+}
+
+static inline void _scale_row_down(uint8 *in, uint8 *_RESTRICT_ out, uint32 in_row_ofs,
+        uint64 position_x, uint64 position_y, uint64 x_factor_inv, uint64 y_factor_inv,
+        uint32 weight_reciprocal, int out_width) {
+    int x;
+    uint32 y, in_col, in_rows, top_weight, bot_weight;
+    sint32 total_weight;
+
+    in_rows = _row_weights(position_y, y_factor_inv, &top_weight, &bot_weight);
 
     if (in_rows == 2) {
         _scale_row_down_2in(in, in + in_row_ofs,
@@ -994,19 +1019,213 @@ static void _scale_row_up(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1, uint8 *_
     }
 }
 
-static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t scaleMode) {
+/*
+ * The vectorized path splits each output row into a vertical pass over whole input rows, which
+ * SIMD handles well, and a per-pixel horizontal pass over the result. Only the order of integer
+ * operations changes, so output matches _scale_row_down and _scale_row_up exactly; those remain
+ * the reference and the fallback. The combined rows are held in 32-bit lanes, as uint32 is as
+ * wide as a long.
+ */
+
+/*
+ * Adds num_values bytes of in, times weight, to sums. If first is set sums is overwritten instead.
+ * weight may be at most 256.
+ */
+static void _add_weighted_row(const uint8 *_RESTRICT_ in, uint32 weight, uint32_t *_RESTRICT_ sums,
+        int num_values, bool_t first) {
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 16 <= num_values; i += 16) {
+        uint8x16_t v = vld1q_u8(in + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        uint32x4_t s0, s1, s2, s3;
+        if (first) {
+            s0 = s1 = s2 = s3 = vdupq_n_u32(0);
+        } else {
+            s0 = vld1q_u32(sums + i);
+            s1 = vld1q_u32(sums + i + 4);
+            s2 = vld1q_u32(sums + i + 8);
+            s3 = vld1q_u32(sums + i + 12);
+        }
+        vst1q_u32(sums + i, vmlal_n_u16(s0, vget_low_u16(lo), (uint16) weight));
+        vst1q_u32(sums + i + 4, vmlal_n_u16(s1, vget_high_u16(lo), (uint16) weight));
+        vst1q_u32(sums + i + 8, vmlal_n_u16(s2, vget_low_u16(hi), (uint16) weight));
+        vst1q_u32(sums + i + 12, vmlal_n_u16(s3, vget_high_u16(hi), (uint16) weight));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16((short) weight);
+    for (; i + 16 <= num_values; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        // 255 * 256 still fits in 16 unsigned bits
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w);
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w);
+        __m128i p0 = _mm_unpacklo_epi16(lo, zero);
+        __m128i p1 = _mm_unpackhi_epi16(lo, zero);
+        __m128i p2 = _mm_unpacklo_epi16(hi, zero);
+        __m128i p3 = _mm_unpackhi_epi16(hi, zero);
+        if (!first) {
+            p0 = _mm_add_epi32(p0, _mm_loadu_si128((const __m128i *) (sums + i)));
+            p1 = _mm_add_epi32(p1, _mm_loadu_si128((const __m128i *) (sums + i + 4)));
+            p2 = _mm_add_epi32(p2, _mm_loadu_si128((const __m128i *) (sums + i + 8)));
+            p3 = _mm_add_epi32(p3, _mm_loadu_si128((const __m128i *) (sums + i + 12)));
+        }
+        _mm_storeu_si128((__m128i *) (sums + i), p0);
+        _mm_storeu_si128((__m128i *) (sums + i + 4), p1);
+        _mm_storeu_si128((__m128i *) (sums + i + 8), p2);
+        _mm_storeu_si128((__m128i *) (sums + i + 12), p3);
+    }
+#endif
+
+    for (; i < num_values; i++) {
+        sums[i] = (first ? 0 : sums[i]) + (uint32_t) in[i] * weight;
+    }
+}
+
+/*
+ * Produces an output row from sums of weighted input rows, weighting input columns as
+ * _scale_row_down does
+ */
+static void _scale_sums_down(const uint32_t *_RESTRICT_ sums, uint8 *_RESTRICT_ out,
+        uint64 position_x, uint64 x_factor_inv, uint32 weight_reciprocal, int out_width) {
+    int x;
+    uint32 in_col;
+    sint32 total_weight;
+
+    for (x = 0; x < out_width; x++) {
+        uint32 acc_r = 0;
+        uint32 acc_g = 0;
+        uint32 acc_b = 0;
+        uint32 curr_weight = 256 - ((position_x >> 24) & 0xff);
+        total_weight = x_factor_inv >> 24;
+
+        in_col = position_x >> 32;
+
+        while (total_weight > 0) {
+            acc_r += sums[(in_col * 3) + 0] * curr_weight;
+            acc_g += sums[(in_col * 3) + 1] * curr_weight;
+            acc_b += sums[(in_col * 3) + 2] * curr_weight;
+
+            in_col++;
+            total_weight -= curr_weight;
+            curr_weight = total_weight > 256 ? 256 : total_weight;
+        }
+
+        position_x += x_factor_inv;
+
+        out[(x * 3) + 0] = ((uint64) acc_r * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
+        out[(x * 3) + 1] = ((uint64) acc_g * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
+        out[(x * 3) + 2] = ((uint64) acc_b * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
+    }
+}
+
+/*
+ * Stores (in0 << 10) + weight_y * (in1 - in0) for num_values bytes of two rows, weight_y being
+ * a 10-bit fraction
+ */
+static void _blend_rows(const uint8 *_RESTRICT_ in0, const uint8 *_RESTRICT_ in1, sint32 weight_y,
+        int32_t *_RESTRICT_ blend, int num_values) {
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    const uint16 w0 = (uint16) (1024 - weight_y), w1 = (uint16) weight_y;
+    for (; i + 8 <= num_values; i += 8) {
+        uint16x8_t a = vmovl_u8(vld1_u8(in0 + i));
+        uint16x8_t b = vmovl_u8(vld1_u8(in1 + i));
+        uint32x4_t lo = vmlal_n_u16(vmull_n_u16(vget_low_u16(a), w0), vget_low_u16(b), w1);
+        uint32x4_t hi = vmlal_n_u16(vmull_n_u16(vget_high_u16(a), w0), vget_high_u16(b), w1);
+        vst1q_s32(blend + i, vreinterpretq_s32_u32(lo));
+        vst1q_s32(blend + i + 4, vreinterpretq_s32_u32(hi));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    // Pairs of (1024 - weight_y, weight_y) so that madd yields in0 * (1024 - w) + in1 * w
+    const __m128i w = _mm_set1_epi32((weight_y << 16) | (1024 - weight_y));
+    for (; i + 8 <= num_values; i += 8) {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (in0 + i)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (in1 + i)), zero);
+        _mm_storeu_si128((__m128i *) (blend + i),
+                _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+        _mm_storeu_si128((__m128i *) (blend + i + 4),
+                _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+    }
+#endif
+
+    for (; i < num_values; i++) {
+        blend[i] = ((int32_t) in0[i] << 10) + weight_y * ((int32_t) in1[i] - in0[i]);
+    }
+}
+
+/*
+ * Produces an output row from two input rows already blended by _blend_rows, interpolating
+ * columns as _scale_row_up does
+ */
+static void _scale_blend_up(const int32_t *_RESTRICT_ blend, uint8 *_RESTRICT_ out,
+        uint64 position_x, uint64 increment_x, int out_width) {
+    int x;
+    for (x = 0; x < out_width; x++) {
+        uint32 pix_x = position_x >> 32;
+        sint32 weight_x = (position_x & 0xffffffff) >> 22;
+        const int32_t *left = blend + (pix_x * 3);
+
+        out[(x * 3) + 0] = ((left[0] << 10) + weight_x * (left[3] - left[0])) >> 20;
+        out[(x * 3) + 1] = ((left[1] << 10) + weight_x * (left[4] - left[1])) >> 20;
+        out[(x * 3) + 2] = ((left[2] << 10) + weight_x * (left[5] - left[2])) >> 20;
+
+        position_x += increment_x;
+    }
+}
+
+/*
+ * Returns the number of input columns, counting from 0, that an output row of out_width pixels
+ * reads from
+ */
+static uint32 _input_columns(scaler_mode_t scaleMode, uint64 position_x, uint64 x_factor_inv,
+        int out_width) {
+    uint64 last_x = position_x + (uint64) (out_width - 1) * x_factor_inv;
+    uint32 in_col = last_x >> 32;
+    uint32 curr_weight;
+    sint32 total_weight;
+
+    if (scaleMode == PSCALER_SCALE_UP) {
+        // Interpolation reads one column past the last position
+        return in_col + 2;
+    }
+
+    curr_weight = 256 - ((last_x >> 24) & 0xff);
+    total_weight = x_factor_inv >> 24;
+    while (total_weight > 0) {
+        in_col++;
+        total_weight -= curr_weight;
+        curr_weight = total_weight > 256 ? 256 : total_weight;
+    }
+    return in_col;
+}
+
+/*
+ * Scales num_columns output columns of the configured rows, starting at first_column
+ */
+static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t scaleMode,
+        uint32 first_column, uint32 num_columns) {
     // These pointers duplicate h/w regs
     uint64 x_factor, y_factor, x_factor_inv, y_factor_inv;
     uint32 x_output_width, y_output_width;
     uint32 input_pixel_ptr_offset, output_pixel_ptr_offset;
-    uint32 first_xi;
     uint64 first_y_src, first_x_src, weight_reciprocal;
 
     // These are internal state
-    uint32 r;
+    uint32 r, row, in_rows, top_weight, bot_weight, num_values, base_column;
+    uint64 base_x_src;
     uint8 *outp;
+    uint32_t *sums;
+
+    if (num_columns == 0) {
+        return;
+    }
 
-    x_output_width = pscaler_config->iOutWidth;
+    x_output_width = num_columns;
     y_output_width = pscaler_config->iOutEndRow -
             pscaler_config->iOutStartRow + 1;
 
@@ -1028,31 +1247,29 @@ static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t
     first_y_src = (uint64) pscaler_config->fSrcStartRow.decimal << 32;
     first_y_src |= pscaler_config->fSrcStartRow.fraction;
 
-    // PC REVISIT - The HW has config registers for these, but they aren't being
-    // used by lib_photo_scaler do I don't want to use them, either. For now
-    // just print them so I can figure out what's going on and then clear the
-    // associated variables. Maybe we're always running the scaler from the
-    // left edge of the source so they're implicitly zero?
-    first_xi = pscaler_config->iOutStartColumn;
-
-    first_x_src = (uint64) pscaler_config->fSrcStartColumn.decimal << 32;
-    first_x_src |= pscaler_config->fSrcStartColumn.fraction;
-
-    first_xi = first_x_src = 0;
+    // The row is scaled from its left edge, so a slice starts where its first column would be
+    first_x_src = (uint64) first_column * x_factor_inv;
 
     weight_reciprocal = ((uint64) 1 << 32);
     weight_reciprocal /= (x_factor_inv >> 24) * (y_factor_inv >> 24);
 
-    outp = (pscaler_config->pOutBuf) + (first_xi * 3);
+    outp = (pscaler_config->pOutBuf) + (first_column * 3);
 
     // PC - Assume pSrcBuf is already aligned to "true" base of input,
     // so ignore whole-number part of first_y_src.
     first_y_src = first_y_src & 0xffffffff;
 
+    // Room for the input columns of this slice combined vertically, as sums or blends
+    base_column = first_x_src >> 32;
+    base_x_src = first_x_src & 0xffffffff;
+    num_values = 3 * _input_columns(scaleMode, base_x_src, x_factor_inv, x_output_width);
+    sums = pscaler_config->usePixelLoops ? NULL :
+            (uint32_t *) malloc(num_values * sizeof(uint32_t));
+
     for (r = 0; r < y_output_width; r++) {
         uint8 *inp = (pscaler_config->pSrcBuf) +
                 (first_y_src >> 32) * input_pixel_ptr_offset;
-        {
+        if (sums == NULL) {
             if (scaleMode == PSCALER_SCALE_UP) {
                 _scale_row_up(inp, inp + input_pixel_ptr_offset, outp,
                         (first_y_src & 0xffffffff) >> 22, first_x_src,
@@ -1062,8 +1279,364 @@ static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t
                         first_x_src, first_y_src, x_factor_inv, y_factor_inv,
                         weight_reciprocal, x_output_width);
             }
+        } else if (scaleMode == PSCALER_SCALE_UP) {
+            inp += base_column * 3;
+            _blend_rows(inp, inp + input_pixel_ptr_offset, (first_y_src & 0xffffffff) >> 22,
+                    (int32_t *) sums, num_values);
+            _scale_blend_up((int32_t *) sums, outp, base_x_src, x_factor_inv, x_output_width);
+        } else {
+            inp += base_column * 3;
+            in_rows = _row_weights(first_y_src, y_factor_inv, &top_weight, &bot_weight);
+            _add_weighted_row(inp, top_weight, sums, num_values, 1);
+            for (row = 1; row < in_rows - 1; row++) {
+                _add_weighted_row(inp + row * input_pixel_ptr_offset, 256, sums, num_values, 0);
+            }
+            _add_weighted_row(inp + row * input_pixel_ptr_offset, bot_weight, sums, num_values,
+                    0);
+            _scale_sums_down(sums, outp, base_x_src, x_factor_inv, weight_reciprocal,
+                    x_output_width);
         }
         first_y_src += y_factor_inv;
         outp += output_pixel_ptr_offset;
     }
-}
\ No newline at end of file
+
+    free(sums);
+}
+/*
+ * Returns how far from its center the filter reaches, in input pixels when not shrinking
+ */
+static double _filter_radius(scaler_filter_t filter) {
+    switch (filter) {
+        case SCALER_FILTER_BOX:
+            return 0.5;
+        case SCALER_FILTER_BILINEAR:
+            return 1.0;
+        case SCALER_FILTER_BICUBIC:
+            return 2.0;
+        case SCALER_FILTER_LANCZOS3:
+        default:
+            return 3.0;
+    }
+}
+
+static double _sinc(double x) {
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+/*
+ * Returns the unnormalized weight of a pixel x pixels away from the filter center
+ */
+static double _filter_weight(scaler_filter_t filter, double x) {
+    x = fabs(x);
+    switch (filter) {
+        case SCALER_FILTER_BOX:
+            return (x <= 0.5) ? 1.0 : 0.0;
+        case SCALER_FILTER_BILINEAR:
+            return (x < 1.0) ? 1.0 - x : 0.0;
+        case SCALER_FILTER_BICUBIC:
+            // Catmull-Rom (a = -0.5), which keeps edges sharp without much ringing
+            if (x < 1.0) {
+                return ((1.5 * x - 2.5) * x) * x + 1.0;
+            } else if (x < 2.0) {
+                return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+            }
+            return 0.0;
+        case SCALER_FILTER_LANCZOS3:
+        default:
+            return (x < 3.0) ? _sinc(x) * _sinc(x / 3.0) : 0.0;
+    }
+}
+
+/*
+ * Builds the coefficients that resample in_size pixels to out_size pixels along one axis. Every
+ * output pixel reads the same number of taps, with taps past the edges folded onto the edge pixel
+ * and taps that weigh nothing for every output pixel left out.
+ */
+static scaler_taps_t *_make_taps(scaler_filter_t filter, uint16 in_size, uint16 out_size) {
+    double scale = (double) in_size / out_size;
+    // widen the filter when shrinking so that it averages every input pixel
+    double stretch = MAX(scale, 1.0);
+    double support = _filter_radius(filter) * stretch;
+    int full_taps = (int) floor(2.0 * support) + 1;
+    int max_taps = MIN(full_taps, (int) in_size);
+    int num_taps = 1;
+    scaler_taps_t *taps;
+    double *weights;
+    sint16 *quantized;
+    int *first, *last, *window;
+    int i, k;
+
+    // first and last are the input pixels with nonzero weights, window the first pixel read
+    weights = (double *) malloc(max_taps * sizeof(double));
+    quantized = (sint16 *) malloc((size_t) out_size * max_taps * sizeof(sint16));
+    first = (int *) malloc(out_size * 3 * sizeof(int));
+    if ((weights == NULL) || (quantized == NULL) || (first == NULL)) {
+        free(weights);
+        free(quantized);
+        free(first);
+        return NULL;
+    }
+    last = first + out_size;
+    window = last + out_size;
+
+    for (i = 0; i < out_size; i++) {
+        double center = (i + 0.5) * scale - 0.5;
+        int left = (int) ceil(center - support);
+        int start = MAX(0, MIN(left, (int) in_size - max_taps));
+        sint16 *q = quantized + i * max_taps;
+        double total = 0.0;
+        int sum = 0, largest = 0;
+
+        for (k = 0; k < max_taps; k++) {
+            weights[k] = 0.0;
+        }
+        for (k = 0; k < full_taps; k++) {
+            int in = MAX(0, MIN(left + k, (int) in_size - 1));
+            double weight = _filter_weight(filter, (left + k - center) / stretch);
+            weights[in - start] += weight;
+            total += weight;
+        }
+        if (total == 0.0) {
+            // only possible for a box narrower than a pixel; use the nearest pixel
+            weights[MAX(0, MIN((int) floor(center + 0.5), (int) in_size - 1)) - start] = 1.0;
+            total = 1.0;
+        }
+
+        // quantize, then give any rounding error to the largest tap so the set sums to one
+        for (k = 0; k < max_taps; k++) {
+            q[k] = (sint16) lround(weights[k] / total * (1 << RESAMPLE_WEIGHT_BITS));
+            sum += q[k];
+            if (abs(q[k]) > abs(q[largest])) {
+                largest = k;
+            }
+        }
+        q[largest] += (1 << RESAMPLE_WEIGHT_BITS) - sum;
+
+        for (first[i] = 0; q[first[i]] == 0; first[i]++) {
+        }
+        for (last[i] = max_taps - 1; q[last[i]] == 0; last[i]--) {
+        }
+        num_taps = MAX(num_taps, last[i] - first[i] + 1);
+        first[i] += start;
+        last[i] += start;
+    }
+
+    /*
+     * Slices and stripes find their input range from the windows of their first and last
+     * output pixels, so windows must never move backwards. Place each as far right as the
+     * windows after it allow, and widen them all if one then misses its last weight.
+     */
+    for (;;) {
+        int limit = (int) in_size - num_taps;
+        for (i = out_size - 1; i >= 0; i--) {
+            limit = MIN(limit, first[i]);
+            if (limit + num_taps <= last[i]) {
+                break;
+            }
+            window[i] = limit;
+        }
+        if (i < 0) {
+            break;
+        }
+        num_taps++;
+    }
+
+    taps = (scaler_taps_t *) malloc(sizeof(scaler_taps_t) + out_size * sizeof(uint16) +
+            (size_t) out_size * num_taps * sizeof(sint16));
+    if (taps != NULL) {
+        taps->num_taps = num_taps;
+        taps->start = (uint16 *) (taps + 1);
+        taps->weights = (sint16 *) (taps->start + out_size);
+
+        for (i = 0; i < out_size; i++) {
+            // quantized holds max_taps weights from the same start as in the first pass
+            double center = (i + 0.5) * scale - 0.5;
+            int start = MAX(0, MIN((int) ceil(center - support), (int) in_size - max_taps));
+            for (k = 0; k < num_taps; k++) {
+                int index = window[i] - start + k;
+                taps->weights[i * num_taps + k] = ((index >= 0) && (index < max_taps)) ?
+                        quantized[i * max_taps + index] : 0;
+            }
+            taps->start[i] = window[i];
+        }
+    }
+
+    free(weights);
+    free(quantized);
+    free(first);
+    return taps;
+}
+
+static void _resample_calculate_rows(uint16 start_output_row_number,
+        uint16 end_output_row_number, scaler_config_t *pscaler_config,
+        uint16 *start_input_row_number, uint16 *end_input_row_number,
+        uint16 *num_output_rows_generated, uint16 *num_rows_offset_to_start_output_row,
+        uint32 *temp_buffer_size_needed) {
+    const scaler_taps_t *y_taps = pscaler_config->pYTaps;
+
+    if (end_output_row_number >= pscaler_config->iOutHeight) { // last stripe
+        end_output_row_number = pscaler_config->iOutHeight - 1;
+    }
+
+    pscaler_config->iOutStartRow = start_output_row_number;
+    pscaler_config->iOutEndRow = end_output_row_number;
+    pscaler_config->iSrcStartRow = y_taps->start[start_output_row_number];
+    pscaler_config->iSrcEndRow = y_taps->start[end_output_row_number] + y_taps->num_taps - 1;
+
+    *start_input_row_number = pscaler_config->iSrcStartRow;
+    *end_input_row_number = pscaler_config->iSrcEndRow;
+    *num_output_rows_generated = end_output_row_number - start_output_row_number + 1;
+    *num_rows_offset_to_start_output_row = 0;
+
+    // one row of the vertical pass, plus the value past its end that _resample_row may load
+    *temp_buffer_size_needed = (ROUND_4_UP(pscaler_config->iSrcBufWidth) + 4) * sizeof(int16_t);
+}
+
+/*
+ * Combines num_taps rows of n values, stride bytes apart, into out with RESAMPLE_PASS_BITS of the
+ * weight precision dropped
+ */
+static void _resample_rows(const uint8 *_RESTRICT_ in, uint32 stride,
+        const sint16 *_RESTRICT_ weights, uint32 num_taps, int16_t *_RESTRICT_ out, uint32 n) {
+    uint32 i = 0, k;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = vdupq_n_s32(1 << (RESAMPLE_PASS_BITS - 1));
+        int32x4_t hi = lo;
+        for (k = 0; k < num_taps; k++) {
+            int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(in + k * stride + i)));
+            lo = vmlal_n_s16(lo, vget_low_s16(pixels), weights[k]);
+            hi = vmlal_n_s16(hi, vget_high_s16(pixels), weights[k]);
+        }
+        vst1q_s16(out + i, vcombine_s16(vshrn_n_s32(lo, RESAMPLE_PASS_BITS),
+                vshrn_n_s32(hi, RESAMPLE_PASS_BITS)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_set1_epi32(1 << (RESAMPLE_PASS_BITS - 1));
+        __m128i hi = lo;
+        // interleave two rows so one madd applies both of their weights
+        for (k = 0; k < num_taps; k += 2) {
+            __m128i row0 = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64((const __m128i *) (in + k * stride + i)), zero);
+            __m128i row1 = zero;
+            int32_t pair = (uint16_t) weights[k];
+            if (k + 1 < num_taps) {
+                row1 = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64((const __m128i *) (in + (k + 1) * stride + i)), zero);
+                pair |= (int32_t) ((uint32_t) (uint16_t) weights[k + 1] << 16);
+            }
+            __m128i w = _mm_set1_epi32(pair);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(row0, row1), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(row0, row1), w));
+        }
+        _mm_storeu_si128((__m128i *) (out + i),
+                _mm_packs_epi32(_mm_srai_epi32(lo, RESAMPLE_PASS_BITS),
+                        _mm_srai_epi32(hi, RESAMPLE_PASS_BITS)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        int32_t sum = 1 << (RESAMPLE_PASS_BITS - 1);
+        for (k = 0; k < num_taps; k++) {
+            sum += in[k * stride + i] * weights[k];
+        }
+        out[i] = (int16_t) (sum >> RESAMPLE_PASS_BITS);
+    }
+}
+
+static inline uint8 _clamp_pixel(int32_t value) {
+    return (value < 0) ? 0 : ((value > 255) ? 255 : (uint8) value);
+}
+
+/*
+ * Resamples num_columns RGB pixels starting at first_column from a row produced by
+ * _resample_rows, whose first pixel is input column first_input. The SIMD paths load one value
+ * past the last tap of each pixel, so the row must be readable one value past its end.
+ */
+static void _resample_row(const int16_t *_RESTRICT_ in, const scaler_taps_t *x_taps,
+        uint32 first_column, uint32 num_columns, uint32 first_input, uint8 *_RESTRICT_ out) {
+#define RESAMPLE_ROW_BITS (RESAMPLE_WEIGHT_BITS * 2 - RESAMPLE_PASS_BITS)
+    uint32 x, k, num_taps = x_taps->num_taps;
+
+    for (x = first_column; x < first_column + num_columns; x++, out += 3) {
+        const int16_t *p = in + (x_taps->start[x] - first_input) * 3;
+        const sint16 *w = x_taps->weights + x * num_taps;
+#if defined(__ARM_NEON)
+        // each load holds R, G and B of one tap plus a value that is never used
+        int32x4_t sum = vdupq_n_s32(1 << (RESAMPLE_ROW_BITS - 1));
+        uint8x8_t pixel;
+        for (k = 0; k < num_taps; k++, p += 3) {
+            sum = vmlal_n_s16(sum, vld1_s16(p), w[k]);
+        }
+        pixel = vqmovun_s16(vcombine_s16(vqshrn_n_s32(sum, RESAMPLE_ROW_BITS), vdup_n_s16(0)));
+        out[0] = vget_lane_u8(pixel, 0);
+        out[1] = vget_lane_u8(pixel, 1);
+        out[2] = vget_lane_u8(pixel, 2);
+#elif defined(__SSE2__)
+        // interleave two taps so one madd applies both of their weights to R, G and B
+        __m128i sum = _mm_set1_epi32(1 << (RESAMPLE_ROW_BITS - 1));
+        uint32_t pixel;
+        for (k = 0; k + 1 < num_taps; k += 2, p += 6) {
+            __m128i taps = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) p),
+                    _mm_loadl_epi64((const __m128i *) (p + 3)));
+            __m128i pair = _mm_set1_epi32((int32_t) ((uint16_t) w[k] |
+                    ((uint32_t) (uint16_t) w[k + 1] << 16)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(taps, pair));
+        }
+        if (k < num_taps) {
+            __m128i taps = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) p),
+                    _mm_setzero_si128());
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(taps, _mm_set1_epi32((uint16_t) w[k])));
+        }
+        sum = _mm_packs_epi32(_mm_srai_epi32(sum, RESAMPLE_ROW_BITS), _mm_setzero_si128());
+        pixel = (uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+        out[0] = (uint8) pixel;
+        out[1] = (uint8) (pixel >> 8);
+        out[2] = (uint8) (pixel >> 16);
+#else
+        int32_t r = 1 << (RESAMPLE_ROW_BITS - 1), g = r, b = r;
+        for (k = 0; k < num_taps; k++, p += 3) {
+            r += p[0] * w[k];
+            g += p[1] * w[k];
+            b += p[2] * w[k];
+        }
+        out[0] = _clamp_pixel(r >> RESAMPLE_ROW_BITS);
+        out[1] = _clamp_pixel(g >> RESAMPLE_ROW_BITS);
+        out[2] = _clamp_pixel(b >> RESAMPLE_ROW_BITS);
+#endif
+    }
+#undef RESAMPLE_ROW_BITS
+}
+
+static void _resample_columns(const uint8 *input_plane, const scaler_config_t *pscaler_config,
+        uint8 *scaled_output_plane, int16_t *temp, uint32 first_column, uint32 num_columns) {
+    const scaler_taps_t *x_taps = pscaler_config->pXTaps;
+    const scaler_taps_t *y_taps = pscaler_config->pYTaps;
+    uint32 r, first_input, num_values;
+    uint8 *outp = scaled_output_plane + first_column * 3;
+
+    if (num_columns == 0) {
+        return;
+    }
+
+    // only the input columns this slice reads are combined vertically
+    first_input = x_taps->start[first_column];
+    num_values = 3 * (x_taps->start[first_column + num_columns - 1] + x_taps->num_taps -
+            first_input);
+
+    for (r = pscaler_config->iOutStartRow; r <= pscaler_config->iOutEndRow; r++) {
+        const uint8 *inp = input_plane + first_input * 3 +
+                (y_taps->start[r] - pscaler_config->iSrcStartRow) * pscaler_config->iSrcBufWidth;
+        _resample_rows(inp, pscaler_config->iSrcBufWidth, y_taps->weights + r * y_taps->num_taps,
+                y_taps->num_taps, temp, num_values);
+        _resample_row(temp, x_taps, first_column, num_columns, first_input, outp);
+        outp += pscaler_config->iOutBufWidth;
+    }
+}
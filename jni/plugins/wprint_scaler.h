@@ -47,6 +47,27 @@ typedef enum scaler_modes_e {
     PSCALER_SCALE_MODE_INVALID
 } scaler_mode_t;
 
+/*
+ * Resampling filter. SCALER_FILTER_DEFAULT is the fixed-point scaler; the others resample through
+ * precomputed polyphase coefficient tables.
+ */
+typedef enum scaler_filter_e {
+    SCALER_FILTER_DEFAULT = 0,
+    SCALER_FILTER_BOX,
+    SCALER_FILTER_BILINEAR,
+    SCALER_FILTER_BICUBIC,
+    SCALER_FILTER_LANCZOS3,
+} scaler_filter_t;
+
+/*
+ * Polyphase coefficients along one axis
+ */
+typedef struct scaler_taps_s {
+    uint16 num_taps;            // coefficients per output pixel
+    uint16 *start;              // first input pixel read by each output pixel
+    sint16 *weights;            // num_taps weights per output pixel, each set summing to 1 << 14
+} scaler_taps_t;
+
 /*
  * Context structure for a scaling operation
  */
@@ -81,6 +102,12 @@ typedef struct scaler_config_s {
     float64_t fYfactorInv;      // y_factor_inv_int & y_factor_inv_fract
 
     scaler_mode_t scaleMode;    // scale mode for the current image
+
+    scaler_filter_t filter;     // resampling filter for the current image
+    scaler_taps_t *pXTaps;      // coefficients of each output column, unless filter is default
+    scaler_taps_t *pYTaps;      // coefficients of each output row, unless filter is default
+
+    bool_t usePixelLoops;       // default scaler uses its per-pixel fallback, not the row passes
 } scaler_config_t;
 
 /*
@@ -90,6 +117,21 @@ extern void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 ima
         uint16 image_output_width, uint16 image_output_buf_width, uint16 image_input_height,
         uint16 image_output_height, scaler_config_t *pscaler_config);
 
+/*
+ * Like scaler_make_image_scaler_tables, but resamples with the given filter. If the coefficient
+ * tables cannot be allocated, returns ERROR and leaves pscaler_config set up for the default
+ * scaler. Tables must be released with scaler_free_tables.
+ */
+extern status_t scaler_make_image_resampler_tables(uint16 image_input_width,
+        uint16 image_input_buf_width, uint16 image_output_width, uint16 image_output_buf_width,
+        uint16 image_input_height, uint16 image_output_height, scaler_filter_t filter,
+        scaler_config_t *pscaler_config);
+
+/*
+ * Releases coefficient tables allocated by scaler_make_image_resampler_tables
+ */
+extern void scaler_free_tables(scaler_config_t *pscaler_config);
+
 /*
  * Called once to configure a single image stripe/slice. Must be called after
  * scaler_make_image_scaler_tables.
@@ -106,6 +148,15 @@ extern void scaler_calculate_scaling_rows(uint16 start_output_row_number,
 extern void scaler_scale_image_data(uint8 *input_plane, void *tables_ptr,
         uint8 *scaled_output_plane, uint8 *temp_buffer_for_mixed_axis_scaling);
 
+/*
+ * Like scaler_scale_image_data, but produces only num_output_columns columns of the stripe
+ * starting at first_output_column. The configuration is only read, so disjoint column ranges of a
+ * stripe may be scaled on different threads as long as each has its own temp buffer.
+ */
+extern void scaler_scale_image_columns(uint8 *input_plane, const scaler_config_t *pscaler_config,
+        uint8 *scaled_output_plane, uint8 *temp_buffer_for_mixed_axis_scaling,
+        uint16 first_output_column, uint16 num_output_columns);
+
 #ifdef __cplusplus
 }
 #endif
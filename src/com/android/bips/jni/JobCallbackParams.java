@@ -25,4 +25,18 @@ public final class JobCallbackParams {
     public String jobDoneResult;
     public String[] blockedReasons;
     public byte[] certificate;
+
+    // Where the job's time went, set when the job is done. Times are in milliseconds.
+    public int pages;
+    public long renderMs;
+    public long decodeMs;
+    public long compressMs;
+    public long bufferWaitMs;
+    public long sendMs;
+    public long bytesSent;
+
+    // How the job's stripes were sized for its memory budget, set when the job is done
+    public int stripHeight;
+    public int stripeBuffers;
+    public int rowsCached;
 }
@@ -140,6 +140,7 @@ public class PdfRender {
     /**
      * Renders the content of the page. (Called by native code.)
      * @param page 0-based page
+     * @param x x-offset onto page
      * @param y y-offset onto page
      * @param width width of area to render
      * @param height height of area to render
@@ -147,10 +148,10 @@ public class PdfRender {
      * @param target target byte buffer to fill with results
      * @return true if rendering was successful
      */
-    public boolean renderPageStripe(int page, int y, int width, int height,
+    public boolean renderPageStripe(int page, int x, int y, int width, int height,
             double zoomFactor, ByteBuffer target) {
         if (DEBUG) {
-            Log.d(TAG, "renderPageStripe() page=" + page + " y=" + y + " w=" + width
+            Log.d(TAG, "renderPageStripe() page=" + page + " x=" + x + " y=" + y + " w=" + width
                     + " h=" + height + " zoom=" + zoomFactor);
         }
         if (mService == null) {
@@ -159,7 +160,7 @@ public class PdfRender {
 
         try {
             long start = System.currentTimeMillis();
-            ParcelFileDescriptor input = mService.renderPageStripe(page - 1, y, width, height,
+            ParcelFileDescriptor input = mService.renderPageStripe(page - 1, x, y, width, height,
                     zoomFactor);
 
             // Copy received data into the ByteBuffer
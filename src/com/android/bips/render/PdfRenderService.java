@@ -78,8 +78,8 @@ public class PdfRenderService extends Service {
         }
 
         @Override
-        public ParcelFileDescriptor renderPageStripe(int page, int y, int width, int height,
-                double zoomFactor)
+        public ParcelFileDescriptor renderPageStripe(int page, int x, int y, int width,
+                int height, double zoomFactor)
                 throws RemoteException {
             if (!openPage(page)) {
                 return null;
@@ -94,7 +94,7 @@ public class PdfRenderService extends Service {
             }
 
             // Use a thread to spool out the bitmap data
-            new RenderThread(mPage, y, width, height, zoomFactor, pipes[1]).start();
+            new RenderThread(mPage, x, y, width, height, zoomFactor, pipes[1]).start();
 
             // Return the corresponding input stream.
             return pipes[0];
@@ -172,6 +172,7 @@ public class PdfRenderService extends Service {
     private class RenderThread extends Thread {
         private final PdfRenderer.Page mPage;
         private final int mWidth;
+        private final int mXOffset;
         private final int mYOffset;
         private final int mHeight;
         private final double mZoomFactor;
@@ -179,10 +180,11 @@ public class PdfRenderService extends Service {
         private final ParcelFileDescriptor mOutput;
         private final ByteBuffer mBuffer;
 
-        RenderThread(PdfRenderer.Page page, int y, int width, int height, double zoom,
+        RenderThread(PdfRenderer.Page page, int x, int y, int width, int height, double zoom,
                 ParcelFileDescriptor output) {
             mPage = page;
             mWidth = width;
+            mXOffset = x;
             mYOffset = y;
             mHeight = height;
             mZoomFactor = zoom;
@@ -232,7 +234,7 @@ public class PdfRenderService extends Service {
             // The scaling matrix increases DPI (default is 72dpi) to page output
             matrix.setScale((float) mZoomFactor, (float) mZoomFactor);
             // The translate specifies adjusts which part of the page we are rendering
-            matrix.postTranslate(0, 0 - startRow);
+            matrix.postTranslate(0 - mXOffset, 0 - startRow);
             bitmap.eraseColor(0xFFFFFFFF);
 
             mPage.render(bitmap, null, matrix, PdfRenderer.Page.RENDER_MODE_FOR_PRINT);